@@ -108,6 +108,25 @@ void us_janus_client_send(us_janus_client_s *client, const us_rtp_s *rtp) {
 	}
 }
 
+void us_janus_client_send_rtcp(us_janus_client_s *client, bool video, const u8 *data, uz size) {
+	if (
+		atomic_load(&client->transmit)
+		&& (video || atomic_load(&client->transmit_acap))
+	) {
+		u8 buf[size]; // Janus may rewrite SSRC in place
+		memcpy(buf, data, size);
+		janus_plugin_rtcp packet = {
+			.video = video,
+			.buffer = (char*)buf,
+			.length = size,
+#			if JANUS_PLUGIN_API_VERSION >= 100
+			.mindex = (video ? 0 : 1),
+#			endif
+		};
+		client->gw->relay_rtcp(client->session, &packet);
+	}
+}
+
 void us_janus_client_recv(us_janus_client_s *client, janus_plugin_rtp *packet) {
 	if (
 		packet->video
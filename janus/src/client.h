@@ -62,4 +62,5 @@ us_janus_client_s *us_janus_client_init(janus_callbacks *gw, janus_plugin_sessio
 void us_janus_client_destroy(us_janus_client_s *client);
 
 void us_janus_client_send(us_janus_client_s *client, const us_rtp_s *rtp);
+void us_janus_client_send_rtcp(us_janus_client_s *client, bool video, const u8 *data, uz size);
 void us_janus_client_recv(us_janus_client_s *client, janus_plugin_rtp *packet);
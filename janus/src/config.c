@@ -60,11 +60,7 @@ us_config_s *us_config_init(const char *config_dir_path) {
 		US_JLOG_ERROR("config", "Missing config value: video.sink");
 		goto error;
 	}
-	if ((config->acap_dev_name = _get_value(jcfg, "acap", "device")) != NULL) {
-		if ((config->tc358743_dev_path = _get_value(jcfg, "acap", "tc358743")) == NULL) {
-			US_JLOG_INFO("config", "Missing config value: acap.tc358743");
-			goto error;
-		}
+	if ((config->acap_sink_name = _get_value(jcfg, "acap", "sink")) != NULL) {
 		if ((config->aplay_dev_name = _get_value(jcfg, "aplay", "device")) != NULL) {
 			char *path = _get_value(jcfg, "aplay", "check");
 			if (path != NULL) {
@@ -90,8 +86,7 @@ ok:
 
 void us_config_destroy(us_config_s *config) {
 	US_DELETE(config->video_sink_name, free);
-	US_DELETE(config->acap_dev_name, free);
-	US_DELETE(config->tc358743_dev_path, free);
+	US_DELETE(config->acap_sink_name, free);
 	US_DELETE(config->aplay_dev_name, free);
 	free(config);
 }
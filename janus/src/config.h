@@ -26,8 +26,7 @@
 typedef struct {
 	char	*video_sink_name;
 
-	char	*acap_dev_name;
-	char	*tc358743_dev_path;
+	char	*acap_sink_name;
 
 	char	*aplay_dev_name;
 } us_config_s;
@@ -46,13 +46,13 @@
 #include "uslibs/list.h"
 #include "uslibs/ring.h"
 #include "uslibs/memsinksh.h"
-#include "uslibs/tc358743.h"
+#include "uslibs/ausinksh.h"
+#include "uslibs/mclock.h"
 
 #include "const.h"
 #include "logging.h"
 #include "client.h"
 #include "au.h"
-#include "acap.h"
 #include "rtp.h"
 #include "rtpv.h"
 #include "rtpa.h"
@@ -64,12 +64,16 @@ static const char *const	default_ice_url = "stun:stun.l.google.com:19302";
 
 static us_config_s		*_g_config = NULL;
 static const useconds_t	_g_watchers_polling = 100000;
+static const ldf		_g_sr_interval = 1;
 
 static us_janus_client_s	*_g_clients = NULL;
 static janus_callbacks		*_g_gw = NULL;
 static us_ring_s			*_g_video_ring = NULL;
 static us_rtpv_s			*_g_rtpv = NULL;
 static us_rtpa_s			*_g_rtpa = NULL; // Also indicates "audio capture is available"
+static us_mclock_s			*_g_mclock = NULL;
+static us_mclock_stream_s	_g_video_mclock;
+static us_mclock_stream_s	_g_acap_mclock;
 
 static pthread_t		_g_video_rtp_tid;
 static atomic_bool		_g_video_rtp_tid_created = false;
@@ -115,18 +119,41 @@ static atomic_bool		_g_key_required = false;
 janus_plugin *create(void);
 
 
+static void _relay_rtcp_sr(const us_mclock_stream_s *stream, const us_rtp_s *rtp, ldf *next_sr_ts) {
+	// Sender Reports tie RTP timestamps of both streams to the common NTP timeline,
+	// so the receiver can synchronize audio with video regardless of the clock drift.
+	const ldf now_ts = us_get_now_monotonic();
+	if (now_ts < *next_sr_ts) {
+		return;
+	}
+	u8 sr[US_MCLOCK_SR_SIZE];
+	const uz size = us_mclock_make_sr(stream, rtp->ssrc, sr);
+	if (size > 0) {
+		US_LIST_ITERATE(_g_clients, client, {
+			us_janus_client_send_rtcp(client, rtp->video, sr, size);
+		});
+		*next_sr_ts = now_ts + _g_sr_interval;
+	}
+}
+
+
 static void *_video_rtp_thread(void *arg) {
 	(void)arg;
 	US_THREAD_SETTLE("us_p_rtpv");
 	atomic_store(&_g_video_rtp_tid_created, true);
 
+	ldf next_sr_ts = 0;
+
 	while (!_STOP) {
 		const int ri = us_ring_consumer_acquire(_g_video_ring, 0.1);
 		if (ri >= 0) {
 			const us_frame_s *const frame = _g_video_ring->items[ri];
 			_LOCK_VIDEO;
 			const bool zero_playout_delay = (frame->gop == 0);
-			us_rtpv_wrap(_g_rtpv, frame, zero_playout_delay);
+			const ldf grab_ts = (frame->grab_ts > 0 ? frame->grab_ts : us_get_now_monotonic());
+			const u32 pts = us_mclock_ts_to_rtp(&_g_video_mclock, grab_ts);
+			us_rtpv_wrap(_g_rtpv, frame, pts, zero_playout_delay);
+			_relay_rtcp_sr(&_g_video_mclock, _g_rtpv->rtp, &next_sr_ts);
 			_UNLOCK_VIDEO;
 			us_ring_consumer_release(_g_video_ring, ri);
 		}
@@ -214,31 +241,17 @@ static void *_video_sink_thread(void *arg) {
 	return NULL;
 }
 
-static int _check_tc358743_acap(uint *hz) {
-	int fd;
-	if ((fd = open(_g_config->tc358743_dev_path, O_RDWR)) < 0) {
-		US_JLOG_PERROR("acap", "Can't open TC358743 V4L2 device");
-		return -1;
-	}
-	const int checked = us_tc358743_xioctl_get_audio_hz(fd, hz);
-	if (checked < 0) {
-		US_JLOG_PERROR("acap", "Can't check TC358743 audio state (%d)", checked);
-		close(fd);
-		return -1;
-	}
-	close(fd);
-	return 0;
-}
-
 static void *_acap_thread(void *arg) {
 	(void)arg;
 	US_THREAD_SETTLE("us_p_ac");
 	atomic_store(&_g_acap_tid_created, true);
 
-	assert(_g_config->acap_dev_name != NULL);
-	assert(_g_config->tc358743_dev_path != NULL);
+	assert(_g_config->acap_sink_name != NULL);
 	assert(_g_rtpa != NULL);
 
+	us_ausink_packet_s *packet;
+	US_CALLOC(packet, 1);
+	ldf next_sr_ts = 0;
 	int once = 0;
 
 	while (!_STOP) {
@@ -247,44 +260,55 @@ static void *_acap_thread(void *arg) {
 			continue;
 		}
 
-		uint hz = 0;
-		us_acap_s *acap = NULL;
+		int fd = -1;
+		us_ausink_shared_s *mem = NULL;
 
-		if (_check_tc358743_acap(&hz) < 0) {
-			goto close_acap;
-		}
-		if (hz == 0) {
-			US_ONCE({ US_JLOG_INFO("acap", "No audio presented from the host"); });
-			goto close_acap;
+		if ((fd = shm_open(_g_config->acap_sink_name, O_RDWR, 0)) < 0) {
+			US_ONCE({ US_JLOG_PERROR("acap", "Can't open audio sink"); });
+			goto close_ausink;
 		}
-		US_ONCE({ US_JLOG_INFO("acap", "Detected host audio"); });
-		if ((acap = us_acap_init(_g_config->acap_dev_name, hz)) == NULL) {
-			goto close_acap;
+
+		if ((mem = us_ausink_shared_map(fd)) == NULL) {
+			US_ONCE({ US_JLOG_PERROR("acap", "Can't map audio sink"); });
+			goto close_ausink;
 		}
 
 		once = 0;
 
+		US_JLOG_INFO("acap", "Audio sink opened; reading packets ...");
+		u32 next = atomic_load(&mem->head); // Start from the freshest packet
 		while (!_STOP && _HAS_WATCHERS && _HAS_LISTENERS) {
-			if (_check_tc358743_acap(&hz) < 0 || acap->pcm_hz != hz) {
-				goto close_acap;
-			}
-			uz size = US_RTP_DATAGRAM_SIZE - US_RTP_HEADER_SIZE;
-			u8 data[size];
-			u64 pts;
-			const int result = us_acap_get_encoded(acap, data, &size, &pts);
+			const int result = us_ausink_shared_get(mem, &next, packet, NULL);
 			if (result == 0) {
+				if (packet->format != US_AUSINK_FORMAT_OPUS || packet->hz != US_RTP_OPUS_HZ) {
+					US_ONCE({ US_JLOG_ERROR("acap", "Got non-OPUS packet from the audio sink"); });
+					continue;
+				}
 				_LOCK_ACAP;
-				us_rtpa_wrap(_g_rtpa, data, size, pts);
+				const u32 pts = us_mclock_pts_to_rtp(&_g_acap_mclock, packet->pts, packet->grab_ts);
+				us_rtpa_wrap(_g_rtpa, packet->data, packet->used, pts);
+				_relay_rtcp_sr(&_g_acap_mclock, _g_rtpa->rtp, &next_sr_ts);
 				_UNLOCK_ACAP;
-			} else if (result == -1) {
-				goto close_acap;
+			} else if (result == US_ERROR_NO_DATA) {
+				usleep((US_AU_FRAME_MS / 4) * 1000);
+			} else {
+				US_JLOG_ERROR("acap", "Audio sink protocol version mismatch: sink=%u, required=%u",
+					mem->version, US_AUSINK_VERSION);
+				goto close_ausink;
 			}
 		}
 
-	close_acap:
-		US_DELETE(acap, us_acap_destroy);
+	close_ausink:
+		if (mem != NULL) {
+			us_ausink_shared_unmap(mem);
+			mem = NULL;
+		}
+		US_CLOSE_FD(fd);
+		US_JLOG_INFO("acap", "Audio sink closed");
 		sleep(1); // error_delay
 	}
+
+	free(packet);
 	return NULL;
 }
 
@@ -394,6 +418,7 @@ static void *_aplay_thread(void *arg) {
 }
 
 static void _relay_rtp_clients(const us_rtp_s *rtp) {
+	us_mclock_count_sent((rtp->video ? &_g_video_mclock : &_g_acap_mclock), rtp->used - US_RTP_HEADER_SIZE);
 	US_LIST_ITERATE(_g_clients, client, {
 		us_janus_client_send(client, rtp);
 	});
@@ -423,8 +448,11 @@ static int _plugin_init(janus_callbacks *gw, const char *config_dir_path) {
 	snd_lib_error_set_handler(_alsa_quiet);
 
 	US_RING_INIT_WITH_ITEMS(_g_video_ring, 64, us_frame_init);
+	_g_mclock = us_mclock_init();
+	us_mclock_stream_init(&_g_video_mclock, _g_mclock, 90000); // H264 RTP clock
+	us_mclock_stream_init(&_g_acap_mclock, _g_mclock, US_RTP_OPUS_HZ);
 	_g_rtpv = us_rtpv_init(_relay_rtp_clients);
-	if (_g_config->acap_dev_name != NULL && us_acap_probe(_g_config->acap_dev_name)) {
+	if (_g_config->acap_sink_name != NULL) {
 		_g_rtpa = us_rtpa_init(_relay_rtp_clients);
 		US_THREAD_CREATE(_g_acap_tid, _acap_thread, NULL);
 		if (_g_config->aplay_dev_name != NULL) {
@@ -458,6 +486,7 @@ static void _plugin_destroy(void) {
 
 	US_DELETE(_g_rtpa, us_rtpa_destroy);
 	US_DELETE(_g_rtpv, us_rtpv_destroy);
+	US_DELETE(_g_mclock, us_mclock_destroy);
 	US_DELETE(_g_config, us_config_destroy);
 }
 
@@ -682,6 +711,21 @@ static struct janus_plugin_result *_plugin_handle_message(
 		PUSH_STATUS("features", features, NULL);
 		json_decref(features);
 
+	} else if (!strcmp(request_str, "sync")) {
+		_LOCK_ALL;
+		json_t *const sync = json_pack(
+			"{s:{s:f}, s:{s:b, s:f, s:f}}",
+			"video",
+				"last_ts", (double)_g_video_mclock.last_ts,
+			"audio",
+				"online", _g_acap_mclock.based,
+				"last_ts", (double)_g_acap_mclock.last_ts,
+				"drift", (double)_g_acap_mclock.drift
+		);
+		_UNLOCK_ALL;
+		PUSH_STATUS("sync", sync, NULL);
+		json_decref(sync);
+
 	} else if (!strcmp(request_str, "key_required")) {
 		// US_JLOG_INFO("main", "Got key_required message");
 		atomic_store(&_g_key_required, true);
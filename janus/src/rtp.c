@@ -26,6 +26,7 @@
 #include "rtp.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "uslibs/types.h"
 #include "uslibs/tools.h"
@@ -56,8 +57,10 @@ void us_rtp_write_header(us_rtp_s *rtp, u32 pts, bool marked) {
 	word0 |= rtp->seq;
 	++rtp->seq;
 
-#	define WRITE_BE_U32(x_offset, x_value) \
-		*((u32*)(rtp->datagram + x_offset)) = __builtin_bswap32(x_value)
+#	define WRITE_BE_U32(x_offset, x_value) { \
+			const u32 m_be = __builtin_bswap32(x_value); \
+			memcpy(rtp->datagram + x_offset, &m_be, sizeof(m_be)); /* datagram is unaligned */ \
+		}
 	WRITE_BE_U32(0, word0);
 	WRITE_BE_U32(4, pts);
 	WRITE_BE_U32(8, rtp->ssrc);
@@ -82,7 +82,7 @@ char *us_rtpv_make_sdp(us_rtpv_s *rtpv) {
 
 #define _PRE 3 // Annex B prefix length
 
-void us_rtpv_wrap(us_rtpv_s *rtpv, const us_frame_s *frame, bool zero_playout_delay) {
+void us_rtpv_wrap(us_rtpv_s *rtpv, const us_frame_s *frame, u32 pts, bool zero_playout_delay) {
 	// There is a complicated logic here but everything works as it should:
 	//   - https://github.com/pikvm/ustreamer/issues/115#issuecomment-893071775
 
@@ -90,7 +90,6 @@ void us_rtpv_wrap(us_rtpv_s *rtpv, const us_frame_s *frame, bool zero_playout_de
 
 	rtpv->rtp->zero_playout_delay = zero_playout_delay;
 
-	const u32 pts = us_get_now_monotonic_u64() * 9 / 100; // PTS units are in 90 kHz
 	sz last_offset = -_PRE;
 
 	while (true) { // Find and iterate by nalus
@@ -104,7 +103,7 @@ void us_rtpv_wrap(us_rtpv_s *rtpv, const us_frame_s *frame, bool zero_playout_de
 		if (last_offset >= 0) {
 			const u8 *const data = frame->data + last_offset + _PRE;
 			uz size = offset - last_offset - _PRE;
-			if (data[size - 1] == 0) { // Check for extra 00
+			if (size > 0 && data[size - 1] == 0) { // Check for extra 00
 				--size;
 			}
 			_rtpv_process_nalu(rtpv, data, size, pts, false);
@@ -121,6 +120,10 @@ void us_rtpv_wrap(us_rtpv_s *rtpv, const us_frame_s *frame, bool zero_playout_de
 }
 
 void _rtpv_process_nalu(us_rtpv_s *rtpv, const u8 *data, uz size, u32 pts, bool marked) {
+	if (size == 0) {
+		return; // Adjacent start codes or a start code at the very end
+	}
+
 	const uint ref_idc = (data[0] >> 5) & 3;
 	const uint type = data[0] & 0x1F;
 	u8 *dg = rtpv->rtp->datagram;
@@ -182,3 +185,64 @@ static sz _find_annexb(const u8 *data, uz size) {
 }
 
 #undef _PRE
+
+
+#ifdef FUZZ_RTPV
+// Нарезка H.264 Annex B на RTP (single NALU и FU-A) для WebRTC. RTCP и разбор
+// входящих RTP-пакетов делает сама Janus (janus_rtcp_*, janus_rtp_payload()),
+// без ее заголовков их здесь не собрать.
+//   clang -g -O1 -std=c17 -D_GNU_SOURCE -fsanitize=fuzzer,address,undefined -DUS_FUZZ_LIBFUZZER -DFUZZ_RTPV -o fuzz-rtpv rtpv.c rtp.c uslibs/frame.c uslibs/pixel.c -lm -pthread
+//   gcc -g -O1 -std=c17 -D_GNU_SOURCE -fsanitize=address,undefined -DFUZZ_RTPV -o fuzz-rtpv rtpv.c rtp.c uslibs/frame.c uslibs/pixel.c -lm -pthread
+
+#include "uslibs/fuzz.h"
+
+
+const us_fuzz_seed_s us_fuzz_seeds[] = {
+	US_FUZZ_SEED("\x00\x00\x00\x01\x67\x42\xE0\x1F\x00\x00\x00\x01\x68\xCE\x3C\x80\x00\x00\x01\x65\x88\x84\x00"),
+	US_FUZZ_SEED("\x00\x00\x01\x00\x00\x01\x00\x00\x01"),
+	US_FUZZ_SEED("\x00\x00\x01\x41"),
+	US_FUZZ_SEED("\x00\x00\x01"),
+	US_FUZZ_SEED("\x01"),
+};
+const uz us_fuzz_seeds_count = US_ARRAY_LEN(us_fuzz_seeds);
+
+static uz _fuzz_sent;
+
+static void _fuzz_callback(const us_rtp_s *rtp) {
+	assert(rtp->used > US_RTP_HEADER_SIZE);
+	assert(rtp->used <= US_RTP_DATAGRAM_SIZE);
+	_fuzz_sent += rtp->used - US_RTP_HEADER_SIZE;
+}
+
+void us_fuzz_one(const u8 *data, uz size) {
+	static us_rtpv_s *rtpv = NULL;
+	static u8 *big = NULL;
+	if (rtpv == NULL) {
+		rtpv = us_rtpv_init(_fuzz_callback);
+		US_CALLOC(big, 64 * 1024);
+	}
+
+	// Короткий вход растягиваем повтором, чтобы доходило до FU-A
+	uz used = size;
+	const u8 *frame_data = data;
+	if (size > 0 && size < US_RTP_DATAGRAM_SIZE && (data[0] & 0x80)) {
+		used = size * (1 + (US_RTP_DATAGRAM_SIZE * 2) / size);
+		used = US_MIN(used, (uz)64 * 1024);
+		for (uz offset = 0; offset < used; offset += size) {
+			memcpy(big + offset, data, US_MIN(size, used - offset));
+		}
+		frame_data = big;
+	}
+
+	const us_frame_s frame = {
+		.data = (u8*)frame_data,
+		.used = used,
+		.format = V4L2_PIX_FMT_H264,
+		.dma_fd = -1,
+	};
+	_fuzz_sent = 0;
+	us_rtpv_wrap(rtpv, &frame, 0, false);
+	assert(_fuzz_sent <= used);
+}
+
+#endif
@@ -0,0 +1 @@
+../../../src/libs/ausinksh.c
\ No newline at end of file
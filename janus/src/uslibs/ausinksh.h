@@ -0,0 +1 @@
+../../../src/libs/ausinksh.h
\ No newline at end of file
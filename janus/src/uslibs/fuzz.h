@@ -0,0 +1 @@
+../../../src/libs/fuzz.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../src/libs/mclock.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../../src/libs/mclock.h
\ No newline at end of file
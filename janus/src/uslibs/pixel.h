@@ -0,0 +1 @@
+../../../src/libs/pixel.h
\ No newline at end of file
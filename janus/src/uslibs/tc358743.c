@@ -1 +0,0 @@
-../../../src/libs/tc358743.c
\ No newline at end of file
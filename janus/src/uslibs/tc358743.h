@@ -1 +0,0 @@
-../../../src/libs/tc358743.h
\ No newline at end of file
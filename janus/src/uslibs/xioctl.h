@@ -1 +0,0 @@
-../../../src/libs/xioctl.h
\ No newline at end of file
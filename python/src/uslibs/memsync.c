@@ -0,0 +1 @@
+../../../src/libs/memsync.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../../src/libs/memsync.h
\ No newline at end of file
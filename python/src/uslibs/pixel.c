@@ -0,0 +1 @@
+../../../src/libs/pixel.c
\ No newline at end of file
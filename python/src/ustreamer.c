@@ -19,6 +19,7 @@
 #include "uslibs/tools.h"
 #include "uslibs/frame.h"
 #include "uslibs/memsinksh.h"
+#include "uslibs/memsync.h"
 
 
 typedef struct {
@@ -119,6 +120,46 @@ static PyObject *_MemsinkObject_exit(_MemsinkObject *self, PyObject *Py_UNUSED(i
 	return PyObject_CallMethod((PyObject*)self, "close", "");
 }
 
+static PyObject *_make_frame_dict(const us_frame_s *frame) {
+	PyObject *dict_frame = PyDict_New();
+	if (dict_frame  == NULL) {
+		return NULL;
+	}
+
+#	define SET_VALUE(x_key, x_maker) { \
+			PyObject *m_tmp = x_maker; \
+			if (m_tmp == NULL) { \
+				Py_DECREF(dict_frame); \
+				return NULL; \
+			} \
+			if (PyDict_SetItemString(dict_frame, x_key, m_tmp) < 0) { \
+				Py_DECREF(m_tmp); \
+				Py_DECREF(dict_frame); \
+				return NULL; \
+			} \
+			Py_DECREF(m_tmp); \
+		}
+#	define SET_NUMBER(x_key, x_from, x_to) \
+		SET_VALUE(#x_key, Py##x_to##_From##x_from(frame->x_key))
+
+	SET_NUMBER(width, Long, Long);
+	SET_NUMBER(height, Long, Long);
+	SET_NUMBER(format, Long, Long);
+	SET_NUMBER(stride, Long, Long);
+	SET_NUMBER(online, Long, Bool);
+	SET_NUMBER(key, Long, Bool);
+	SET_NUMBER(gop, Long, Long);
+	SET_NUMBER(grab_ts, Double, Float);
+	SET_NUMBER(encode_begin_ts, Double, Float);
+	SET_NUMBER(encode_end_ts, Double, Float);
+	SET_VALUE("data", PyBytes_FromStringAndSize((const char*)frame->data, frame->used));
+
+#	undef SET_NUMBER
+#	undef SET_VALUE
+
+	return dict_frame;
+}
+
 static int _wait_frame(_MemsinkObject *self) {
 	const ldf deadline_ts = us_get_now_monotonic() + self->wait_timeout;
 
@@ -215,41 +256,7 @@ static PyObject *_MemsinkObject_wait_frame(_MemsinkObject *self, PyObject *args,
 		return PyErr_SetFromErrno(PyExc_OSError);
 	}
 
-	PyObject *dict_frame = PyDict_New();
-	if (dict_frame  == NULL) {
-		return NULL;
-	}
-
-#	define SET_VALUE(x_key, x_maker) { \
-			PyObject *m_tmp = x_maker; \
-			if (m_tmp == NULL) { \
-				return NULL; \
-			} \
-			if (PyDict_SetItemString(dict_frame, x_key, m_tmp) < 0) { \
-				Py_DECREF(m_tmp); \
-				return NULL; \
-			} \
-			Py_DECREF(m_tmp); \
-		}
-#	define SET_NUMBER(x_key, x_from, x_to) \
-		SET_VALUE(#x_key, Py##x_to##_From##x_from(self->frame->x_key))
-
-	SET_NUMBER(width, Long, Long);
-	SET_NUMBER(height, Long, Long);
-	SET_NUMBER(format, Long, Long);
-	SET_NUMBER(stride, Long, Long);
-	SET_NUMBER(online, Long, Bool);
-	SET_NUMBER(key, Long, Bool);
-	SET_NUMBER(gop, Long, Long);
-	SET_NUMBER(grab_ts, Double, Float);
-	SET_NUMBER(encode_begin_ts, Double, Float);
-	SET_NUMBER(encode_end_ts, Double, Float);
-	SET_VALUE("data", PyBytes_FromStringAndSize((const char*)self->frame->data, self->frame->used));
-
-#	undef SET_NUMBER
-#	undef SET_VALUE
-
-	return dict_frame;
+	return _make_frame_dict(self->frame);
 }
 
 static PyObject *_MemsinkObject_is_opened(_MemsinkObject *self, PyObject *Py_UNUSED(ignored)) {
@@ -302,6 +309,276 @@ static PyTypeObject _MemsinkType = {
 	.tp_getset		= _MemsinkObject_getsets,
 };
 
+typedef struct {
+	PyObject_HEAD
+
+	PyObject	*objs; // Tuple of str, the memsync refers to their buffers
+	double		tolerance;
+	int			policy;
+	uint		depth;
+	double		wait_timeout;
+
+	us_memsync_s	*sync;
+	us_frame_s		*frames[US_MEMSYNC_MAX_SINKS];
+} _MemsinkSyncObject;
+
+
+static void _MemsinkSyncObject_destroy_internals(_MemsinkSyncObject *self) {
+	US_DELETE(self->sync, us_memsync_destroy);
+	for (uint index = 0; index < US_MEMSYNC_MAX_SINKS; ++index) {
+		US_DELETE(self->frames[index], us_frame_destroy);
+	}
+}
+
+static int _MemsinkSyncObject_init(_MemsinkSyncObject *self, PyObject *args, PyObject *kwargs) {
+	self->tolerance = 0.005;
+	self->depth = 4;
+	self->wait_timeout = 1;
+
+	PyObject *objs = NULL;
+	const char *policy = "nearest";
+	PyObject *offsets = Py_None;
+	static char *kws[] = {"objs", "tolerance", "policy", "depth", "offsets", "wait_timeout", NULL};
+	if (!PyArg_ParseTupleAndKeywords(
+		args, kwargs, "O|dsIOd", kws,
+		&objs, &self->tolerance, &policy, &self->depth, &offsets, &self->wait_timeout)) {
+		return -1;
+	}
+
+	if (!(self->tolerance >= 0)) {
+		PyErr_SetString(PyExc_ValueError, "tolerance must be >= 0");
+		return -1;
+	}
+	if (!(self->wait_timeout > 0)) {
+		PyErr_SetString(PyExc_ValueError, "wait_timeout must be > 0");
+		return -1;
+	}
+	if (self->depth == 0 || self->depth > US_MEMSYNC_MAX_DEPTH) {
+		PyErr_Format(PyExc_ValueError, "depth must be in 1..%d", US_MEMSYNC_MAX_DEPTH);
+		return -1;
+	}
+	if ((self->policy = us_memsync_parse_policy(policy)) < 0) {
+		PyErr_SetString(PyExc_ValueError, "policy must be 'nearest' or 'latest'");
+		return -1;
+	}
+
+	Py_XDECREF(self->objs);
+	if ((self->objs = PySequence_Tuple(objs)) == NULL) {
+		return -1;
+	}
+	const Py_ssize_t n_sinks = PyTuple_GET_SIZE(self->objs);
+	if (n_sinks < 1 || n_sinks > US_MEMSYNC_MAX_SINKS) {
+		PyErr_Format(PyExc_ValueError, "objs must contain 1..%d sinks", US_MEMSYNC_MAX_SINKS);
+		return -1;
+	}
+
+	const char *c_objs[US_MEMSYNC_MAX_SINKS];
+	ldf c_offsets[US_MEMSYNC_MAX_SINKS] = {0};
+	for (Py_ssize_t index = 0; index < n_sinks; ++index) {
+		if ((c_objs[index] = PyUnicode_AsUTF8(PyTuple_GET_ITEM(self->objs, index))) == NULL) {
+			return -1;
+		}
+	}
+	if (offsets != Py_None) {
+		if (PySequence_Size(offsets) != n_sinks) {
+			PyErr_SetString(PyExc_ValueError, "offsets must have the same length as objs");
+			return -1;
+		}
+		for (Py_ssize_t index = 0; index < n_sinks; ++index) {
+			PyObject *const item = PySequence_GetItem(offsets, index);
+			if (item == NULL) {
+				return -1;
+			}
+			c_offsets[index] = PyFloat_AsDouble(item);
+			Py_DECREF(item);
+			if (PyErr_Occurred()) {
+				return -1;
+			}
+		}
+	}
+
+	_MemsinkSyncObject_destroy_internals(self);
+	if ((self->sync = us_memsync_init(n_sinks, c_objs, c_offsets, self->tolerance, self->policy, self->depth)) == NULL) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		return -1;
+	}
+	for (Py_ssize_t index = 0; index < n_sinks; ++index) {
+		self->frames[index] = us_frame_init();
+	}
+	return 0;
+}
+
+static PyObject *_MemsinkSyncObject_repr(_MemsinkSyncObject *self) {
+	return PyUnicode_FromFormat("<MemsinkSync(%R)>", (self->objs != NULL ? self->objs : Py_None));
+}
+
+static void _MemsinkSyncObject_dealloc(_MemsinkSyncObject *self) {
+	_MemsinkSyncObject_destroy_internals(self);
+	Py_XDECREF(self->objs);
+	PyObject_Del(self);
+}
+
+static PyObject *_MemsinkSyncObject_close(_MemsinkSyncObject *self, PyObject *Py_UNUSED(ignored)) {
+	_MemsinkSyncObject_destroy_internals(self);
+	Py_RETURN_NONE;
+}
+
+static PyObject *_MemsinkSyncObject_enter(_MemsinkSyncObject *self, PyObject *Py_UNUSED(ignored)) {
+	Py_INCREF(self);
+	return (PyObject*)self;
+}
+
+static PyObject *_MemsinkSyncObject_exit(_MemsinkSyncObject *self, PyObject *Py_UNUSED(ignored)) {
+	return PyObject_CallMethod((PyObject*)self, "close", "");
+}
+
+static PyObject *_MemsinkSyncObject_wait_frames(_MemsinkSyncObject *self, PyObject *Py_UNUSED(ignored)) {
+	if (self->sync == NULL) {
+		PyErr_SetString(PyExc_RuntimeError, "Closed");
+		return NULL;
+	}
+
+	const ldf deadline_ts = us_get_now_monotonic() + self->wait_timeout;
+	int retval;
+	while (true) {
+		// Short slices to handle the signals
+		const ldf timeout = US_MIN(deadline_ts - us_get_now_monotonic(), 0.1);
+		Py_BEGIN_ALLOW_THREADS
+		retval = us_memsync_get(self->sync, self->frames, US_MAX(timeout, 0));
+		Py_END_ALLOW_THREADS
+		if (retval != US_ERROR_NO_DATA || us_get_now_monotonic() >= deadline_ts) {
+			break;
+		}
+		if (PyErr_CheckSignals() < 0) {
+			return NULL;
+		}
+	}
+	switch (retval) {
+		case 0: break;
+		case US_ERROR_NO_DATA: Py_RETURN_NONE;
+		default: return PyErr_SetFromErrno(PyExc_OSError);
+	}
+
+	PyObject *tuple_frames = PyTuple_New(self->sync->n_sinks);
+	if (tuple_frames == NULL) {
+		return NULL;
+	}
+	for (uint index = 0; index < self->sync->n_sinks; ++index) {
+		PyObject *const dict_frame = _make_frame_dict(self->frames[index]);
+		if (dict_frame == NULL) {
+			Py_DECREF(tuple_frames);
+			return NULL;
+		}
+		PyTuple_SET_ITEM(tuple_frames, index, dict_frame);
+	}
+	return tuple_frames;
+}
+
+static PyObject *_MemsinkSyncObject_reset_stats(_MemsinkSyncObject *self, PyObject *Py_UNUSED(ignored)) {
+	if (self->sync != NULL) {
+		us_memsync_reset_stats(self->sync);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *_MemsinkSyncObject_is_opened(_MemsinkSyncObject *self, PyObject *Py_UNUSED(ignored)) {
+	return PyBool_FromLong(self->sync != NULL);
+}
+
+static PyObject *_MemsinkSyncObject_getter_stats(_MemsinkSyncObject *self, void *Py_UNUSED(closure)) {
+	if (self->sync == NULL) {
+		PyErr_SetString(PyExc_RuntimeError, "Closed");
+		return NULL;
+	}
+	const us_memsync_stats_s *const stats = &self->sync->stats;
+
+	PyObject *list_sinks = PyList_New(self->sync->n_sinks);
+	if (list_sinks == NULL) {
+		return NULL;
+	}
+	for (uint index = 0; index < self->sync->n_sinks; ++index) {
+		PyObject *const dict_sink = Py_BuildValue(
+			"{s:K,s:K,s:K,s:d}",
+			"received", (ull)stats->sinks[index].received,
+			"dropped", (ull)stats->sinks[index].dropped,
+			"resyncs", (ull)stats->sinks[index].resyncs,
+			"offset_avg", (double)stats->sinks[index].offset_avg);
+		if (dict_sink == NULL) {
+			Py_DECREF(list_sinks);
+			return NULL;
+		}
+		PyList_SET_ITEM(list_sinks, index, dict_sink);
+	}
+	return Py_BuildValue(
+		"{s:K,s:K,s:d,s:d,s:d,s:d,s:d,s:N}",
+		"matched", (ull)stats->matched,
+		"dropped", (ull)stats->dropped,
+		"skew_last", (double)stats->skew_last,
+		"skew_min", (double)US_MAX(stats->skew_min, 0),
+		"skew_max", (double)stats->skew_max,
+		"skew_avg", (double)stats->skew_avg,
+		"latency_avg", (double)stats->latency_avg,
+		"sinks", list_sinks);
+}
+
+#define FIELD_GETTER(x_field, x_from, x_to) \
+	static PyObject *_MemsinkSyncObject_getter_##x_field(_MemsinkSyncObject *self, void *Py_UNUSED(closure)) { \
+		return Py##x_to##_From##x_from(self->x_field); \
+	}
+FIELD_GETTER(tolerance, Double, Float)
+FIELD_GETTER(depth, Long, Long)
+FIELD_GETTER(wait_timeout, Double, Float)
+#undef FIELD_GETTER
+
+static PyObject *_MemsinkSyncObject_getter_policy(_MemsinkSyncObject *self, void *Py_UNUSED(closure)) {
+	return PyUnicode_FromString(us_memsync_policy_to_string(self->policy));
+}
+
+static PyObject *_MemsinkSyncObject_getter_objs(_MemsinkSyncObject *self, void *Py_UNUSED(closure)) {
+	PyObject *const objs = (self->objs != NULL ? self->objs : Py_None);
+	Py_INCREF(objs);
+	return objs;
+}
+
+static PyMethodDef _MemsinkSyncObject_methods[] = {
+#	define ADD_METHOD(x_name, x_method, x_flags) \
+		{.ml_name = x_name, .ml_meth = (PyCFunction)_MemsinkSyncObject_##x_method, .ml_flags = (x_flags)}
+	ADD_METHOD("close", close, METH_NOARGS),
+	ADD_METHOD("__enter__", enter, METH_NOARGS),
+	ADD_METHOD("__exit__", exit, METH_VARARGS),
+	ADD_METHOD("wait_frames", wait_frames, METH_NOARGS),
+	ADD_METHOD("reset_stats", reset_stats, METH_NOARGS),
+	ADD_METHOD("is_opened", is_opened, METH_NOARGS),
+	{},
+#	undef ADD_METHOD
+};
+
+static PyGetSetDef _MemsinkSyncObject_getsets[] = {
+#	define ADD_GETTER(x_field) \
+		{.name = #x_field, .get = (getter)_MemsinkSyncObject_getter_##x_field}
+	ADD_GETTER(objs),
+	ADD_GETTER(tolerance),
+	ADD_GETTER(policy),
+	ADD_GETTER(depth),
+	ADD_GETTER(wait_timeout),
+	ADD_GETTER(stats),
+	{},
+#	undef ADD_GETTER
+};
+
+static PyTypeObject _MemsinkSyncType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name		= "ustreamer.MemsinkSync",
+	.tp_basicsize	= sizeof(_MemsinkSyncObject),
+	.tp_flags		= Py_TPFLAGS_DEFAULT,
+	.tp_new			= PyType_GenericNew,
+	.tp_init		= (initproc)_MemsinkSyncObject_init,
+	.tp_dealloc		= (destructor)_MemsinkSyncObject_dealloc,
+	.tp_repr		= (reprfunc)_MemsinkSyncObject_repr,
+	.tp_methods		= _MemsinkSyncObject_methods,
+	.tp_getset		= _MemsinkSyncObject_getsets,
+};
+
 static PyModuleDef _Module = {
 	PyModuleDef_HEAD_INIT,
 	.m_name = "ustreamer",
@@ -314,6 +591,9 @@ PyMODINIT_FUNC PyInit_ustreamer(void) {
 	if (PyType_Ready(&_MemsinkType) < 0) {
 		goto error;
 	}
+	if (PyType_Ready(&_MemsinkSyncType) < 0) {
+		goto error;
+	}
 
 	if ((module = PyModule_Create(&_Module)) == NULL) {
 		goto error;
@@ -327,6 +607,7 @@ PyMODINIT_FUNC PyInit_ustreamer(void) {
 	ADD(IntConstant, "VERSION_MINOR", US_VERSION_MINOR);
 	ADD(StringConstant, "FEATURES", US_FEATURES); // Defined in setup.py
 	ADD(ObjectRef, "Memsink", (PyObject*)&_MemsinkType);
+	ADD(ObjectRef, "MemsinkSync", (PyObject*)&_MemsinkSyncType);
 #	undef ADD
 	return module;
 
@@ -0,0 +1,81 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+#include <speex/speex_resampler.h>
+#include <opus/opus.h>
+
+#include "../libs/types.h"
+#include "../libs/ring.h"
+#include "../libs/ausink.h"
+
+
+// The output clock of the producer, same as OPUS and RTP
+#define US_ACAP_HZ				48000
+#define US_ACAP_CH				2
+
+// A number of frames per 1 channel:
+//   - https://github.com/xiph/opus/blob/7b05f44/src/opus_demo.c#L368
+#define US_ACAP_FRAME_MS		20
+#define US_ACAP_HZ_TO_FRAMES(x_hz)	((x_hz) / 50) // 20ms
+#define US_ACAP_HZ_TO_BUF16(x_hz)	(US_ACAP_HZ_TO_FRAMES(x_hz) * US_ACAP_CH) // ... * 2: One stereo frame = (16bit L) + (16bit R)
+#define US_ACAP_HZ_TO_BUF8(x_hz)	(US_ACAP_HZ_TO_BUF16(x_hz) * sizeof(s16))
+
+#define US_ACAP_MIN_PCM_HZ		8000
+#define US_ACAP_MAX_PCM_HZ		192000
+#define US_ACAP_MAX_BUF16		US_ACAP_HZ_TO_BUF16(US_ACAP_MAX_PCM_HZ)
+#define US_ACAP_MAX_BUF8		US_ACAP_HZ_TO_BUF8(US_ACAP_MAX_PCM_HZ)
+
+// Fits into a single RTP datagram (see janus/src/rtp.h)
+#define US_ACAP_OPUS_MAX_SIZE	1188
+
+
+typedef struct {
+	snd_pcm_t			*dev;
+	uint				pcm_hz;
+	uint				pcm_frames;
+	uz					pcm_size;
+	snd_pcm_hw_params_t	*dev_params;
+	SpeexResamplerState	*res;
+	OpusEncoder			*enc;
+
+	us_ausink_s		*pcm_sink;
+	us_ausink_s		*opus_sink;
+
+	us_ring_s		*pcm_ring;
+
+	pthread_t		pcm_tid;
+	pthread_t		enc_tid;
+	bool			tids_created;
+	atomic_bool		stop;
+} us_acap_s;
+
+
+bool us_acap_probe(const char *name);
+
+us_acap_s *us_acap_init(const char *name, uint pcm_hz, us_ausink_s *pcm_sink, us_ausink_s *opus_sink);
+void us_acap_destroy(us_acap_s *acap);
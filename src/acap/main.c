@@ -0,0 +1,298 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <getopt.h>
+#include <errno.h>
+
+#include "../libs/types.h"
+#include "../libs/const.h"
+#include "../libs/tools.h"
+#include "../libs/logging.h"
+#include "../libs/ausink.h"
+#include "../libs/tc358743.h"
+#include "../libs/signal.h"
+#include "../libs/options.h"
+
+#include "acap.h"
+
+
+enum _OPT_VALUES {
+	_O_DEVICE = 'd',
+	_O_RATE = 'r',
+	_O_TC358743 = 't',
+
+	_O_HELP = 'h',
+	_O_VERSION = 'v',
+
+	_O_PCM_SINK = 10000,
+	_O_OPUS_SINK,
+	_O_SINK_MODE,
+	_O_SINK_RM,
+	_O_SINK_CLIENT_TTL,
+
+	_O_LOG_LEVEL,
+	_O_PERF,
+	_O_VERBOSE,
+	_O_DEBUG,
+	_O_FORCE_LOG_COLORS,
+	_O_NO_LOG_COLORS,
+};
+
+static const struct option _LONG_OPTS[] = {
+	{"device",				required_argument,	NULL,	_O_DEVICE},
+	{"rate",				required_argument,	NULL,	_O_RATE},
+	{"tc358743",			required_argument,	NULL,	_O_TC358743},
+
+	{"pcm-sink",			required_argument,	NULL,	_O_PCM_SINK},
+	{"opus-sink",			required_argument,	NULL,	_O_OPUS_SINK},
+	{"sink-mode",			required_argument,	NULL,	_O_SINK_MODE},
+	{"sink-rm",				no_argument,		NULL,	_O_SINK_RM},
+	{"sink-client-ttl",		required_argument,	NULL,	_O_SINK_CLIENT_TTL},
+
+	{"log-level",			required_argument,	NULL,	_O_LOG_LEVEL},
+	{"perf",				no_argument,		NULL,	_O_PERF},
+	{"verbose",				no_argument,		NULL,	_O_VERBOSE},
+	{"debug",				no_argument,		NULL,	_O_DEBUG},
+	{"force-log-colors",	no_argument,		NULL,	_O_FORCE_LOG_COLORS},
+	{"no-log-colors",		no_argument,		NULL,	_O_NO_LOG_COLORS},
+
+	{"help",				no_argument,		NULL,	_O_HELP},
+	{"version",				no_argument,		NULL,	_O_VERSION},
+
+	{NULL, 0, NULL, 0},
+};
+
+
+volatile atomic_bool _g_stop = false;
+
+
+static void _signal_handler(int signum);
+
+static void _main_loop(const char *dev_name, uint rate, const char *tc358743_path, us_ausink_s *pcm_sink, us_ausink_s *opus_sink);
+static int _check_tc358743_audio(const char *path, uint *hz);
+
+static void _help(FILE *fp);
+
+
+int main(int argc, char *argv[]) {
+	US_LOGGING_INIT;
+	US_THREAD_RENAME("main");
+
+	const char *dev_name = "default";
+	uint rate = US_ACAP_HZ;
+	const char *tc358743_path = NULL;
+	const char *pcm_sink_name = NULL;
+	const char *opus_sink_name = NULL;
+	uint sink_mode = 0660;
+	bool sink_rm = false;
+	uint sink_client_ttl = 10;
+
+#	define OPT_SET(_dest, _value) { \
+			_dest = _value; \
+			break; \
+		}
+
+#	define OPT_NUMBER(_name, _dest, _min, _max, _base) { \
+			errno = 0; char *_end = NULL; long long _tmp = strtoll(optarg, &_end, _base); \
+			if (errno || *_end || _tmp < _min || _tmp > _max) { \
+				printf("Invalid value for '%s=%s': min=%lld, max=%lld\n", _name, optarg, (long long)_min, (long long)_max); \
+				return 1; \
+			} \
+			_dest = _tmp; \
+			break; \
+		}
+
+	char short_opts[128];
+	us_build_short_options(_LONG_OPTS, short_opts, 128);
+
+	for (int ch; (ch = getopt_long(argc, argv, short_opts, _LONG_OPTS, NULL)) >= 0;) {
+		switch (ch) {
+			case _O_DEVICE:				OPT_SET(dev_name, optarg);
+			case _O_RATE:				OPT_NUMBER("--rate", rate, US_ACAP_MIN_PCM_HZ, US_ACAP_MAX_PCM_HZ, 0);
+			case _O_TC358743:			OPT_SET(tc358743_path, optarg);
+
+			case _O_PCM_SINK:			OPT_SET(pcm_sink_name, optarg);
+			case _O_OPUS_SINK:			OPT_SET(opus_sink_name, optarg);
+			case _O_SINK_MODE:			OPT_NUMBER("--sink-mode", sink_mode, INT_MIN, INT_MAX, 8);
+			case _O_SINK_RM:			OPT_SET(sink_rm, true);
+			case _O_SINK_CLIENT_TTL:	OPT_NUMBER("--sink-client-ttl", sink_client_ttl, 1, 60, 0);
+
+			case _O_LOG_LEVEL:			OPT_NUMBER("--log-level", us_g_log_level, US_LOG_LEVEL_INFO, US_LOG_LEVEL_DEBUG, 0);
+			case _O_PERF:				OPT_SET(us_g_log_level, US_LOG_LEVEL_PERF);
+			case _O_VERBOSE:			OPT_SET(us_g_log_level, US_LOG_LEVEL_VERBOSE);
+			case _O_DEBUG:				OPT_SET(us_g_log_level, US_LOG_LEVEL_DEBUG);
+			case _O_FORCE_LOG_COLORS:	OPT_SET(us_g_log_colored, true);
+			case _O_NO_LOG_COLORS:		OPT_SET(us_g_log_colored, false);
+
+			case _O_HELP:		_help(stdout); return 0;
+			case _O_VERSION:	puts(US_VERSION); return 0;
+
+			case 0:		break;
+			default:	return 1;
+		}
+	}
+
+#	undef OPT_NUMBER
+#	undef OPT_SET
+
+	if ((pcm_sink_name == NULL || pcm_sink_name[0] == '\0') && (opus_sink_name == NULL || opus_sink_name[0] == '\0')) {
+		puts("Missing option --pcm-sink and/or --opus-sink. See --help for details.");
+		return 1;
+	}
+
+	int retval = 1;
+	us_ausink_s *pcm_sink = NULL;
+	us_ausink_s *opus_sink = NULL;
+
+#	define ADD_SINK(x_label, x_name, x_dest) { \
+			if (x_name != NULL && x_name[0] != '\0') { \
+				if ((x_dest = us_ausink_init_opened(x_label, x_name, true, sink_mode, sink_rm, sink_client_ttl, 0)) == NULL) { \
+					goto error; \
+				} \
+			} \
+		}
+	ADD_SINK("PCM", pcm_sink_name, pcm_sink);
+	ADD_SINK("OPUS", opus_sink_name, opus_sink);
+#	undef ADD_SINK
+
+	us_install_signals_handler(_signal_handler, false);
+	_main_loop(dev_name, rate, tc358743_path, pcm_sink, opus_sink);
+	retval = 0;
+
+error:
+	US_DELETE(opus_sink, us_ausink_destroy);
+	US_DELETE(pcm_sink, us_ausink_destroy);
+	US_LOG_INFO("Bye-bye");
+	return retval;
+}
+
+
+static void _signal_handler(int signum) {
+	char *const name = us_signum_to_string(signum);
+	US_LOG_INFO_NOLOCK("===== Stopping by %s =====", name);
+	free(name);
+	atomic_store(&_g_stop, true);
+}
+
+static void _main_loop(const char *dev_name, uint rate, const char *tc358743_path, us_ausink_s *pcm_sink, us_ausink_s *opus_sink) {
+	int once = 0;
+
+	while (!atomic_load(&_g_stop)) {
+		uint hz = rate;
+		us_acap_s *acap = NULL;
+
+		if (tc358743_path != NULL) {
+			if (_check_tc358743_audio(tc358743_path, &hz) < 0) {
+				goto close_acap;
+			}
+			if (hz == 0) {
+				US_ONCE({ US_LOG_INFO("No audio presented from the host"); });
+				goto close_acap;
+			}
+			US_ONCE({ US_LOG_INFO("Detected host audio"); });
+		}
+		if ((acap = us_acap_init(dev_name, hz, pcm_sink, opus_sink)) == NULL) {
+			goto close_acap;
+		}
+
+		once = 0;
+
+		while (!atomic_load(&_g_stop) && !atomic_load(&acap->stop)) {
+			if (tc358743_path != NULL) {
+				if (_check_tc358743_audio(tc358743_path, &hz) < 0 || acap->pcm_hz != hz) {
+					goto close_acap;
+				}
+			}
+			usleep(100000);
+		}
+
+	close_acap:
+		US_DELETE(acap, us_acap_destroy);
+		if (!atomic_load(&_g_stop)) {
+			sleep(1); // error_delay
+		}
+	}
+}
+
+static int _check_tc358743_audio(const char *path, uint *hz) {
+	int fd;
+	if ((fd = open(path, O_RDWR)) < 0) {
+		US_LOG_PERROR("Can't open TC358743 V4L2 device");
+		return -1;
+	}
+	const int checked = us_tc358743_xioctl_get_audio_hz(fd, hz);
+	if (checked < 0) {
+		US_LOG_PERROR("Can't check TC358743 audio state (%d)", checked);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+static void _help(FILE *fp) {
+#	define SAY(_msg, ...) fprintf(fp, _msg "\n", ##__VA_ARGS__)
+	SAY("\nuStreamer-acap - Capture ALSA audio to the shared memory sinks");
+	SAY("═══════════════════════════════════════════════════════════════");
+	SAY("Version: %s; license: GPLv3", US_VERSION);
+	SAY("Copyright (C) 2018-2024 Maxim Devaev <mdevaev@gmail.com>\n");
+	SAY("Example:");
+	SAY("════════");
+	SAY("    ustreamer-acap --device hw:0 --tc358743 /dev/video0 --opus-sink kvmd::ustreamer::opus\n");
+	SAY("Capturing options:");
+	SAY("══════════════════");
+	SAY("    -d|--device <name>  ─── ALSA capture device. Use 'null' to test the sinks with silence.");
+	SAY("                            Default: %s.\n", "default");
+	SAY("    -r|--rate <hz>  ─────── PCM sampling rate. The audio will be resampled to %uHz stereo.", US_ACAP_HZ);
+	SAY("                            Default: %u.\n", US_ACAP_HZ);
+	SAY("    -t|--tc358743 <path>  ─ Take the sampling rate from the TC358743 V4L2 device and wait");
+	SAY("                            for the host audio. Overrides --rate. Default: disabled.\n");
+	SAY("Sink options:");
+	SAY("═════════════");
+	SAY("    --pcm-sink <name>  ────────── Use the shared memory to sink 20ms chunks of S16LE PCM. Default: disabled.\n");
+	SAY("    --opus-sink <name>  ───────── Use the shared memory to sink 20ms OPUS packets. Default: disabled.\n");
+	SAY("    --sink-mode <mode>  ───────── Set sinks permissions (like 777). Default: 660.\n");
+	SAY("    --sink-rm  ────────────────── Remove shared memory on stop. Default: disabled.\n");
+	SAY("    --sink-client-ttl <sec>  ──── Client TTL. Default: 10.\n");
+	SAY("Logging options:");
+	SAY("════════════════");
+	SAY("    --log-level <N>  ──── Verbosity level of messages from 0 (info) to 3 (debug).");
+	SAY("                          Enabling debugging messages can slow down the program.");
+	SAY("                          Available levels: 0 (info), 1 (performance), 2 (verbose), 3 (debug).");
+	SAY("                          Default: %d.\n", us_g_log_level);
+	SAY("    --perf  ───────────── Enable performance messages (same as --log-level=1). Default: disabled.\n");
+	SAY("    --verbose  ────────── Enable verbose messages and lower (same as --log-level=2). Default: disabled.\n");
+	SAY("    --debug  ──────────── Enable debug messages and lower (same as --log-level=3). Default: disabled.\n");
+	SAY("    --force-log-colors  ─ Force color logging. Default: colored if stderr is a TTY.\n");
+	SAY("    --no-log-colors  ──── Disable color logging. Default: ditto.\n");
+	SAY("Help options:");
+	SAY("═════════════");
+	SAY("    -h|--help  ─────── Print this text and exit.\n");
+	SAY("    -v|--version  ──── Print version and exit.\n");
+#	undef SAY
+}
@@ -0,0 +1,267 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "cfr.h"
+
+#include <math.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/logging.h"
+#include "../libs/frame.h"
+
+
+// When the input rate is about the same as the output one, the slot boundaries
+// follow the phase of the input, so the capture jitter doesn't produce pairs
+// of the duplicates and drops on them. Only the phase is locked: the shift is
+// bounded by about a half of the period and wraps around, so the output rate
+// stays exactly fps, and the drift of the camera clock slips by a single
+// duplicate or drop per period of the drift.
+#define _PLL_GAIN	((ldf)0.05)
+#define _PLL_RANGE	((ldf)0.1) // Of the period
+#define _PLL_SLIP	((ldf)0.1) // Of the period, over the half
+
+// The input which is slower than the output never needs a drop, so a frame
+// which the jitter has moved into the slot of the previous one takes the next
+// slot instead. The same for the faster input and the duplicates. The margin
+// keeps the noise of the average interval away, the PLL handles the rest.
+#define _RATE_MARGIN	((ldf)0.01) // Of the period
+
+
+static void _swap(us_frame_s **a, us_frame_s **b);
+
+
+us_cfr_s *us_cfr_init(uint fps, ldf latency) {
+	us_cfr_s *cfr;
+	US_CALLOC(cfr, 1);
+	cfr->fps = fps;
+	cfr->period = (ldf)1 / fps;
+	cfr->latency = latency;
+	cfr->pending = us_frame_init();
+	cfr->ahead = us_frame_init();
+	cfr->last = us_frame_init();
+	return cfr;
+}
+
+void us_cfr_destroy(us_cfr_s *cfr) {
+	us_frame_destroy(cfr->last);
+	us_frame_destroy(cfr->ahead);
+	us_frame_destroy(cfr->pending);
+	free(cfr);
+}
+
+void us_cfr_put(us_cfr_s *cfr, us_frame_s **frame) {
+	const ldf grab_ts = (*frame)->grab_ts;
+
+	if (cfr->received == 0) {
+		cfr->base_ts = grab_ts;
+		cfr->phase = 0;
+	} else {
+		const ldf interval = grab_ts - cfr->prev_grab_ts;
+		// The mean of the first intervals, then the slow average
+		const ldf weight = US_MAX((ldf)1 / cfr->received, (ldf)0.01);
+		cfr->interval_avg += (interval - cfr->interval_avg) * weight;
+	}
+	cfr->prev_grab_ts = grab_ts;
+	++cfr->received;
+
+	const ldf pos = (grab_ts - cfr->base_ts - cfr->phase) / cfr->period;
+	sll slot = llroundl(pos);
+
+	if (llabs(slot - (sll)cfr->next_slot) > (sll)cfr->fps) {
+		// The source has been restarted or the stall was longer than the latency.
+		// Keep the PTS continuous and take the new phase.
+		US_LOG_INFO("CFR: Resync by %.3Lf seconds", (pos - cfr->next_slot) * cfr->period);
+		cfr->base_ts = grab_ts - cfr->next_slot * cfr->period;
+		cfr->phase = 0;
+		slot = cfr->next_slot;
+		++cfr->resyncs;
+	} else if (fabsl(cfr->interval_avg - cfr->period) < cfr->period * _PLL_RANGE) {
+		cfr->phase += (pos - slot) * cfr->period * _PLL_GAIN;
+		// The drift has reached the next slot: wrap the phase and slip by a frame.
+		// The hysteresis prevents the pairs of the slips by the jitter on the edge.
+		const ldf limit = cfr->period * ((ldf)0.5 + _PLL_SLIP);
+		if (cfr->phase > limit) {
+			cfr->phase -= cfr->period;
+		} else if (cfr->phase < -limit) {
+			cfr->phase += cfr->period;
+		}
+	}
+
+	if (cfr->received > 1) {
+		if (slot <= cfr->prev_slot && cfr->interval_avg > cfr->period * (1 + _RATE_MARGIN)) {
+			slot = cfr->prev_slot + 1;
+		} else if (slot == cfr->prev_slot + 2 && cfr->interval_avg < cfr->period * (1 - _RATE_MARGIN)) {
+			slot = cfr->prev_slot + 1;
+		}
+	}
+	cfr->prev_slot = slot;
+
+	if (slot <= (sll)cfr->next_slot) {
+		if (slot < (sll)cfr->next_slot) {
+			++cfr->late; // Its slot has been emitted by the deadline, so it goes to the next one
+		}
+		if (cfr->has_pending) {
+			++cfr->drops;
+		}
+		_swap(&cfr->pending, frame);
+		cfr->has_pending = true;
+	} else {
+		if (cfr->has_ahead) {
+			++cfr->drops;
+		}
+		_swap(&cfr->ahead, frame);
+		cfr->has_ahead = true;
+		cfr->ahead_slot = slot;
+	}
+}
+
+const us_frame_s *us_cfr_get(us_cfr_s *cfr, ldf now_ts) {
+	if (!cfr->has_pending && !cfr->has_last) {
+		if (!cfr->has_ahead) {
+			return NULL;
+		}
+		cfr->next_slot = cfr->ahead_slot;
+		_swap(&cfr->pending, &cfr->ahead);
+		cfr->has_pending = true;
+		cfr->has_ahead = false;
+	}
+
+	// A frame for a later slot means that the next slot is complete,
+	// otherwise wait for a late frame until the deadline.
+	if (!cfr->has_ahead) {
+		const ldf deadline_ts = cfr->base_ts + cfr->phase + (cfr->next_slot + (ldf)0.5) * cfr->period + cfr->latency;
+		if (now_ts < deadline_ts) {
+			return NULL;
+		}
+	}
+
+	if (cfr->has_pending) {
+		_swap(&cfr->last, &cfr->pending);
+		cfr->has_pending = false;
+		cfr->has_last = true;
+	} else {
+		++cfr->dups;
+	}
+	cfr->last->grab_ts = cfr->base_ts + cfr->next_slot * cfr->period;
+	++cfr->next_slot;
+	++cfr->emitted;
+
+	if (cfr->has_ahead && cfr->ahead_slot <= cfr->next_slot) {
+		_swap(&cfr->pending, &cfr->ahead);
+		cfr->has_pending = true;
+		cfr->has_ahead = false;
+	}
+	return cfr->last;
+}
+
+static void _swap(us_frame_s **a, us_frame_s **b) {
+	us_frame_s *const tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+
+#ifdef TEST_CFR
+// Feeds the jittered input of the different rates and checks that the output
+// rate is exactly fps, and the PTS goes by the period. The input of about
+// the same rate should slip only by the clock drift.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_CFR -o cfr-test dump/cfr.c libs/frame.c libs/pixel.c libs/logging.c -pthread -lm
+
+#include <stdio.h>
+
+#include "../libs/array.h"
+
+
+int main(void) {
+	US_LOGGING_INIT;
+
+	const ldf rates[] = {30, 29.97, 30.03, 29, 25, 15, 35};
+	const uint frames = 30000;
+	int retval = 0;
+
+	for (uint index = 0; index < US_ARRAY_LEN(rates); ++index) {
+		us_cfr_s *const cfr = us_cfr_init(30, 0.1);
+		us_frame_s *frame = us_frame_init();
+		srand(1);
+
+		ldf first_ts = 0;
+		ldf prev_ts = 0;
+		uint bad_steps = 0;
+		ldf grab_ts = 0;
+		for (uint number = 0; number < frames; ++number) {
+			grab_ts = 1000 + number / rates[index] + (ldf)((rand() % 1600) - 800) / 100000; // +/- 8ms
+			frame->grab_ts = grab_ts;
+			frame->used = 1;
+			us_cfr_put(cfr, &frame);
+
+			const us_frame_s *out;
+			while ((out = us_cfr_get(cfr, grab_ts + 0.02)) != NULL) {
+				if (cfr->emitted == 1) {
+					first_ts = out->grab_ts;
+				} else if (fabsl(out->grab_ts - prev_ts - cfr->period) > 1e-9) {
+					++bad_steps;
+				}
+				prev_ts = out->grab_ts;
+			}
+		}
+
+		// Nothing is emitted before the first frame and after the last one + latency
+		const ldf out_rate = (cfr->emitted - 1) / (prev_ts - first_ts);
+		const ldf in_duration = (frames - 1) / rates[index];
+		bool ok = (
+			fabsl(out_rate - 30) < 1e-6
+			&& fabsl(cfr->emitted - in_duration * 30) < 30 * 0.2
+			&& bad_steps == 0
+			&& cfr->resyncs == 0
+		);
+		if (rates[index] == 30) {
+			ok = (ok && cfr->dups == 0 && cfr->drops == 0);
+		} else if (rates[index] == (ldf)29.97 || rates[index] == (ldf)30.03) {
+			// 0.03 frames per second should be slipped in one direction
+			const ldf expected = in_duration * (ldf)0.03;
+			const ull slips = (rates[index] < 30 ? cfr->dups : cfr->drops);
+			const ull wrong = (rates[index] < 30 ? cfr->drops : cfr->dups);
+			ok = (ok && slips <= expected + 2 && wrong <= 2);
+		} else if (rates[index] < 30) {
+			// Every input frame goes out, and the rest are the duplicates
+			const ldf expected = in_duration * 30 - frames;
+			ok = (ok && cfr->drops == 0 && fabsl(cfr->dups - expected) <= 3);
+		} else {
+			ok = (ok && cfr->dups == 0);
+		}
+		printf("rate=%.2Lf: in=%llu out=%llu dups=%llu drops=%llu late=%llu resyncs=%llu, out_rate=%.6Lf, bad_steps=%u - %s\n",
+			rates[index], (ull)cfr->received, (ull)cfr->emitted, (ull)cfr->dups, (ull)cfr->drops,
+			(ull)cfr->late, (ull)cfr->resyncs, out_rate, bad_steps, (ok ? "ok" : "FAILED"));
+		if (!ok) {
+			retval = 1;
+		}
+
+		us_frame_destroy(frame);
+		us_cfr_destroy(cfr);
+	}
+
+	puts(retval == 0 ? "OK" : "FAILED");
+	return retval;
+}
+#endif
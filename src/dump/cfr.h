@@ -0,0 +1,72 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "../libs/types.h"
+#include "../libs/frame.h"
+
+
+typedef struct {
+	uint	fps;
+	ldf		period;
+	ldf		latency; // How long to wait for a late frame before the duplicate
+
+	ldf		base_ts; // grab_ts of the slot 0, the origin of the output PTS
+	ldf		phase; // Shift of the slot boundaries to the input, about +/- period/2
+	ldf		interval_avg; // Of the input frames
+	ldf		prev_grab_ts;
+	u64		next_slot; // Also the PTS of the next output frame in the units of period
+	sll		prev_slot; // Of the previous input frame
+
+	us_frame_s	*pending; // The freshest frame for the next slot
+	us_frame_s	*ahead; // A frame for one of the later slots
+	us_frame_s	*last; // The last emitted one for the duplicates
+	u64			ahead_slot;
+	bool		has_pending;
+	bool		has_ahead;
+	bool		has_last;
+
+	u64		received;
+	u64		emitted;
+	u64		dups;
+	u64		drops;
+	u64		late;
+	u64		resyncs;
+} us_cfr_s;
+
+
+us_cfr_s *us_cfr_init(uint fps, ldf latency);
+void us_cfr_destroy(us_cfr_s *cfr);
+
+// Takes the frame by swapping it with the internal one, which is returned
+// to the caller for the reuse. The frames must be passed in the grab_ts order.
+void us_cfr_put(us_cfr_s *cfr, us_frame_s **frame);
+
+// Returns the frame for the next slot if it's due or NULL. It should be called
+// until NULL after each put() and periodically to emit the duplicates on stalls.
+// The grab_ts of the returned frame is replaced by the slot time, the frame
+// is valid until the next put() or get().
+const us_frame_s *us_cfr_get(us_cfr_s *cfr, ldf now_ts);
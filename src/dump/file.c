@@ -20,12 +20,34 @@
 *****************************************************************************/
 
 
+
 #include "file.h"
 
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#	include <sys/inotify.h>
+#endif
+
+
+static int _write_frame(int fd, const us_frame_s *frame);
+#ifdef __linux__
+static int _splice_frame(us_output_file_s *output, const us_frame_s *frame);
+static int _wait_pipe_drained(us_output_file_s *output);
+#endif
+
 
-us_output_file_s *us_output_file_init(const char *path, bool json) {
+us_output_file_s *us_output_file_init(const char *path, bool json, bool splice) {
 	us_output_file_s *output;
 	US_CALLOC(output, 1);
+	output->notify_fd = -1;
 
 	if (!strcmp(path, "-")) {
 		US_LOG_INFO("Using output: <stdout>");
@@ -37,8 +59,49 @@ us_output_file_s *us_output_file_init(const char *path, bool json) {
 			goto error;
 		}
 	}
+	output->fd = fileno(output->fp);
+
+	if (splice && json) {
+		US_LOG_INFO("Splicing is not available for JSON output, using write()");
+		splice = false;
+	} else if (splice) {
+#		ifdef __linux__
+		struct stat st;
+		if (fstat(output->fd, &st) < 0) {
+			US_LOG_PERROR("Can't stat output file");
+			goto error;
+		}
+		if (S_ISFIFO(st.st_mode)) {
+			// Each read() or splice() from the pipe generates IN_ACCESS,
+			// so the writer can sleep until the reader takes the frame.
+			char proc_path[64];
+			US_SNPRINTF(proc_path, sizeof(proc_path), "/proc/self/fd/%d", output->fd);
+			if (
+				(output->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0
+				|| inotify_add_watch(output->notify_fd, proc_path, IN_ACCESS) < 0
+			) {
+				US_LOG_PERROR("Can't watch the output pipe, using write()");
+				splice = false;
+			} else {
+				US_LOG_INFO("Using vmsplice() to the output pipe");
+				// The bigger pipe means the fewer wakeups of the both sides.
+				// It's limited by /proc/sys/fs/pipe-max-size, so it's only a wish.
+				if (fcntl(output->fd, F_SETPIPE_SZ, 1024 * 1024) < 0) {
+					US_LOG_VERBOSE("Can't increase the output pipe size: %s", strerror(errno));
+				}
+			}
+		} else {
+			US_LOG_INFO("The output is not a pipe, using write()");
+			splice = false;
+		}
+#		else
+		US_LOG_INFO("Splicing is not supported on this platform, using write()");
+		splice = false;
+#		endif
+	}
 
 	output->json = json;
+	output->splice = splice;
 	return output;
 
 	error:
@@ -59,15 +122,28 @@ void us_output_file_write(void *v_output, const us_frame_s *frame) {
 			frame->format, frame->stride, frame->online, frame->key, frame->gop,
 			frame->grab_ts, frame->encode_begin_ts, frame->encode_end_ts,
 			output->base64_data);
+		fflush(output->fp);
+#	ifdef __linux__
+	} else if (output->splice) {
+		if (_splice_frame(output, frame) < 0) {
+			US_LOG_PERROR("Can't splice the frame to the output");
+		}
+#	endif
 	} else {
-		fwrite(frame->data, 1, frame->used, output->fp);
+		// The raw frames bypass stdio: there is nothing to buffer between
+		// the frame boundaries, and the whole frame goes by the single write().
+		if (_write_frame(output->fd, frame) < 0) {
+			US_LOG_PERROR("Can't write the frame to the output");
+		}
 	}
-	fflush(output->fp);
 }
 
 void us_output_file_destroy(void *v_output) {
 	us_output_file_s *output = v_output;
 	US_DELETE(output->base64_data, free);
+	if (output->notify_fd >= 0) {
+		close(output->notify_fd);
+	}
 	if (output->fp && output->fp != stdout) {
 		if (fclose(output->fp) < 0) {
 			US_LOG_PERROR("Can't close output file");
@@ -75,3 +151,219 @@ void us_output_file_destroy(void *v_output) {
 	}
 	free(output);
 }
+
+static int _write_frame(int fd, const us_frame_s *frame) {
+	const u8 *data = frame->data;
+	uz left = frame->used;
+	while (left > 0) {
+		const sz written = write(fd, data, left);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += written;
+		left -= written;
+	}
+	return 0;
+}
+
+#ifdef __linux__
+static int _splice_frame(us_output_file_s *output, const us_frame_s *frame) {
+	struct iovec iov = {.iov_base = frame->data, .iov_len = frame->used};
+	while (iov.iov_len > 0) {
+		const sz spliced = vmsplice(output->fd, &iov, 1, 0);
+		if (spliced < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		iov.iov_base = (u8*)iov.iov_base + spliced;
+		iov.iov_len -= spliced;
+	}
+	// vmsplice() puts the pages of the frame to the pipe without copying,
+	// so the frame buffer can't be reused until the reader has consumed them.
+	// If the reader moves them further by splice() or tee(), they are still
+	// referenced after the pipe is empty. See --output-splice in the man.
+	return _wait_pipe_drained(output);
+}
+
+static int _wait_pipe_drained(us_output_file_s *output) {
+	while (true) {
+		int unread = 0;
+		if (ioctl(output->fd, FIONREAD, &unread) < 0) {
+			return -1;
+		}
+		if (unread == 0) {
+			return 0;
+		}
+		// The events of the reads before FIONREAD are still in the queue,
+		// so there is no lost wakeup here, just a spare check.
+		struct pollfd fds[2] = {
+			{.fd = output->fd, .events = 0}, // POLLERR if the reader has closed the pipe
+			{.fd = output->notify_fd, .events = POLLIN},
+		};
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (fds[0].revents & POLLERR) {
+			errno = EPIPE;
+			return -1;
+		}
+		if (fds[1].revents & POLLIN) {
+			char events[sizeof(struct inotify_event) * 16];
+			while (read(output->notify_fd, events, sizeof(events)) > 0);
+		}
+	}
+}
+#endif
+
+
+#ifdef TEST_OUTPUT_FILE
+// Pushes 1 MiB frames through a pipe to a reader which drains it by 64 KiB,
+// like the ffmpeg's pipe: protocol. Each frame is copied from the "sink" first
+// as _dump_sink() does. Compares the old stdio path with write() and vmsplice().
+// Every frame is stamped by its number, and the reader checks each byte
+// and the total length. The stamping time is not counted for the writer.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_OUTPUT_FILE -o file-test dump/file.c libs/frame.c libs/pixel.c libs/base64.c libs/logging.c -pthread -lm
+
+#include <assert.h>
+
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+
+#define _FRAME_SIZE	(1024 * 1024)
+#define _FRAMES		3000
+#define _CHUNK_SIZE	(64 * 1024)
+
+
+static ldf _get_cpu(int who) {
+	struct rusage usage;
+	assert(!getrusage(who, &usage));
+	return (
+		usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+		+ (ldf)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000
+	);
+}
+
+static u32 _get_word(u64 offset) {
+	// The frame number and the index of the word in the frame
+	const u64 index = offset / sizeof(u32);
+	return ((index / (_FRAME_SIZE / sizeof(u32))) << 18) | (index % (_FRAME_SIZE / sizeof(u32)));
+}
+
+static void _stamp(u8 *data, uint number) {
+	u32 *const words = (u32*)data;
+	for (uz index = 0; index < _FRAME_SIZE / sizeof(u32); ++index) {
+		words[index] = _get_word((u64)number * _FRAME_SIZE + index * sizeof(u32));
+	}
+}
+
+static bool _read_all(int fd) {
+	u32 *const buf = malloc(_CHUNK_SIZE);
+	assert(buf != NULL);
+	u64 total = 0;
+	bool ok = true;
+	while (true) {
+		// Fill the whole chunk to keep the words aligned
+		uz filled = 0;
+		sz len;
+		while (filled < _CHUNK_SIZE && (len = read(fd, (u8*)buf + filled, _CHUNK_SIZE - filled)) > 0) {
+			filled += len;
+		}
+		if (filled % sizeof(u32) != 0) {
+			ok = false;
+		}
+		for (uz index = 0; index < filled / sizeof(u32); ++index) {
+			if (buf[index] != _get_word(total + index * sizeof(u32))) {
+				ok = false;
+			}
+		}
+		total += filled;
+		if (filled < _CHUNK_SIZE) {
+			break;
+		}
+	}
+	free(buf);
+	return (ok && total == (u64)_FRAMES * _FRAME_SIZE);
+}
+
+static bool _bench(const char *mode) {
+	int fds[2];
+	assert(!pipe(fds));
+	const pid_t pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		close(fds[1]);
+		_exit(_read_all(fds[0]) ? 0 : 1);
+	}
+	close(fds[0]);
+
+	const int stdout_fd = dup(STDOUT_FILENO);
+	assert(dup2(fds[1], STDOUT_FILENO) >= 0);
+	close(fds[1]);
+
+	us_frame_s *const sink = us_frame_init();
+	us_frame_realloc_data(sink, _FRAME_SIZE);
+	sink->used = _FRAME_SIZE;
+	us_frame_s *const frame = us_frame_init();
+
+	us_output_file_s *output = NULL;
+	if (strcmp(mode, "stdio")) {
+		assert((output = us_output_file_init("-", false, !strcmp(mode, "vmsplice"))) != NULL);
+	}
+
+	ldf stamp = 0;
+	const ldf cpu_ts = _get_cpu(RUSAGE_SELF);
+	const ldf begin_ts = us_get_now_monotonic();
+	for (uint number = 0; number < _FRAMES; ++number) {
+		const ldf stamp_ts = us_get_now_monotonic();
+		_stamp(sink->data, number);
+		stamp += us_get_now_monotonic() - stamp_ts;
+
+		us_frame_copy(sink, frame);
+		if (output == NULL) {
+			fwrite(frame->data, 1, frame->used, stdout);
+			fflush(stdout);
+		} else {
+			us_output_file_write(output, frame);
+		}
+	}
+	const ldf wall = us_get_now_monotonic() - begin_ts - stamp;
+	const ldf cpu = _get_cpu(RUSAGE_SELF) - cpu_ts - stamp;
+
+	const ldf child_cpu_ts = _get_cpu(RUSAGE_CHILDREN);
+	assert(dup2(stdout_fd, STDOUT_FILENO) >= 0); // Closes the pipe
+	close(stdout_fd);
+	int status;
+	assert(waitpid(pid, &status, 0) == pid);
+	const ldf child_cpu = _get_cpu(RUSAGE_CHILDREN) - child_cpu_ts;
+	const bool ok = (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	fprintf(stderr, "%-8s  %7.1Lf MiB/s  writer_cpu=%4.0Lf us/frame  reader_cpu=%4.0Lf us/frame - %s\n",
+		mode, (ldf)_FRAMES * _FRAME_SIZE / 1024 / 1024 / wall,
+		cpu * 1000000 / _FRAMES, child_cpu * 1000000 / _FRAMES,
+		(ok ? "ok" : "CORRUPTED"));
+
+	US_DELETE(output, us_output_file_destroy);
+	us_frame_destroy(frame);
+	us_frame_destroy(sink);
+	return ok;
+}
+
+int main(void) {
+	US_LOGGING_INIT;
+	bool ok = true;
+	ok = (_bench("stdio") && ok);
+	ok = (_bench("write") && ok);
+	ok = (_bench("vmsplice") && ok);
+	fputs(ok ? "OK\n" : "FAILED\n", stderr);
+	return !ok;
+}
+#endif
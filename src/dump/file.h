@@ -37,13 +37,16 @@
 typedef struct {
 	const char *path;
 	bool		json;
+	bool		splice;
 
 	FILE		*fp;
+	int			fd;
+	int			notify_fd;
 	char		*base64_data;
 	size_t		base64_allocated;
 } us_output_file_s;
 
 
-us_output_file_s *us_output_file_init(const char *path, bool json);
+us_output_file_s *us_output_file_init(const char *path, bool json, bool splice);
 void us_output_file_write(void *v_output, const us_frame_s *frame);
 void us_output_file_destroy(void *v_output);
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <limits.h>
 #include <float.h>
@@ -30,6 +31,12 @@
 #include <errno.h>
 #include <assert.h>
 
+#ifdef __APPLE__
+#include "../libs/macos_v4l2_stub.h"
+#else
+#include <linux/videodev2.h>
+#endif
+
 #include "../libs/const.h"
 #include "../libs/errors.h"
 #include "../libs/tools.h"
@@ -41,6 +48,8 @@
 #include "../libs/options.h"
 
 #include "file.h"
+#include "store.h"
+#include "cfr.h"
 
 
 enum _OPT_VALUES {
@@ -51,11 +60,24 @@ enum _OPT_VALUES {
 	_O_COUNT = 'c',
 	_O_INTERVAL = 'i',
 	_O_KEY_REQUIRED = 'k',
+	_O_STORE = 'S',
 
 	_O_HELP = 'h',
 	_O_VERSION = 'v',
 
-	_O_LOG_LEVEL = 10000,
+	_O_OUTPUT_SPLICE = 10000,
+	_O_CFR,
+	_O_CFR_LATENCY,
+	_O_STORE_SIZE,
+	_O_STORE_BATCH,
+	_O_STORE_SYNC,
+	_O_STORE_DIRECT,
+	_O_STORE_LIST,
+	_O_STORE_EXPORT,
+	_O_FROM,
+	_O_TO,
+
+	_O_LOG_LEVEL,
 	_O_PERF,
 	_O_VERBOSE,
 	_O_DEBUG,
@@ -68,9 +90,22 @@ static const struct option _LONG_OPTS[] = {
 	{"sink-timeout",		required_argument,	NULL,	_O_SINK_TIMEOUT},
 	{"output",				required_argument,	NULL,	_O_OUTPUT},
 	{"output-json",			no_argument,		NULL,	_O_OUTPUT_JSON},
+	{"output-splice",		no_argument,		NULL,	_O_OUTPUT_SPLICE},
 	{"count",				required_argument,	NULL,	_O_COUNT},
 	{"interval",			required_argument,	NULL,	_O_INTERVAL},
 	{"key-required",		no_argument,		NULL,	_O_KEY_REQUIRED},
+	{"cfr",					required_argument,	NULL,	_O_CFR},
+	{"cfr-latency",			required_argument,	NULL,	_O_CFR_LATENCY},
+
+	{"store",				required_argument,	NULL,	_O_STORE},
+	{"store-size",			required_argument,	NULL,	_O_STORE_SIZE},
+	{"store-batch",			required_argument,	NULL,	_O_STORE_BATCH},
+	{"store-sync",			required_argument,	NULL,	_O_STORE_SYNC},
+	{"store-direct",		no_argument,		NULL,	_O_STORE_DIRECT},
+	{"store-list",			no_argument,		NULL,	_O_STORE_LIST},
+	{"store-export",		no_argument,		NULL,	_O_STORE_EXPORT},
+	{"from",				required_argument,	NULL,	_O_FROM},
+	{"to",					required_argument,	NULL,	_O_TO},
 
 	{"log-level",			required_argument,	NULL,	_O_LOG_LEVEL},
 	{"perf",				no_argument,		NULL,	_O_PERF},
@@ -93,6 +128,7 @@ typedef struct {
 	void *v_output;
 	void (*write)(void *v_output, const us_frame_s *frame);
 	void (*destroy)(void *v_output);
+	bool has_key; // For the store export
 } _output_context_s;
 
 
@@ -102,7 +138,15 @@ static int _dump_sink(
 	const char *sink_name, unsigned sink_timeout,
 	long long count, long double interval,
 	bool key_required,
+	unsigned cfr_fps, long double cfr_latency,
 	_output_context_s *ctx);
+static bool _count_frame(long long *count);
+
+static int _read_store(
+	const char *store_path, long double from_ts, long double to_ts,
+	bool list, _output_context_s *ctx);
+static void _store_list_callback(void *v_ctx, const us_store_record_s *rec, const us_frame_s *frame);
+static void _store_export_callback(void *v_ctx, const us_store_record_s *rec, const us_frame_s *frame);
 
 static void _help(FILE *fp);
 
@@ -115,9 +159,22 @@ int main(int argc, char *argv[]) {
 	unsigned sink_timeout = 1;
 	const char *output_path = NULL;
 	bool output_json = false;
+	bool output_splice = false;
 	long long count = 0;
 	long double interval = 0;
 	bool key_required = false;
+	unsigned cfr_fps = 0;
+	long double cfr_latency = 0.1;
+
+	const char *store_path = NULL;
+	long long store_size = 1024; // MiB
+	long long store_batch = 1024; // KiB
+	long double store_sync = 1;
+	bool store_direct = false;
+	bool store_list = false;
+	bool store_export = false;
+	long double from_ts = 0;
+	long double to_ts = 0;
 
 #	define OPT_SET(_dest, _value) { \
 			_dest = _value; \
@@ -153,9 +210,22 @@ int main(int argc, char *argv[]) {
 			case _O_SINK_TIMEOUT:	OPT_NUMBER("--sink-timeout", sink_timeout, 1, 60, 0);
 			case _O_OUTPUT:			OPT_SET(output_path, optarg);
 			case _O_OUTPUT_JSON:	OPT_SET(output_json, true);
+			case _O_OUTPUT_SPLICE:	OPT_SET(output_splice, true);
 			case _O_COUNT:			OPT_NUMBER("--count", count, 0, LLONG_MAX, 0);
 			case _O_INTERVAL:		OPT_LDOUBLE("--interval", interval, 0, 60);
 			case _O_KEY_REQUIRED:	OPT_SET(key_required, true);
+			case _O_CFR:			OPT_NUMBER("--cfr", cfr_fps, 0, 120, 0);
+			case _O_CFR_LATENCY:	OPT_LDOUBLE("--cfr-latency", cfr_latency, 0, 10);
+
+			case _O_STORE:			OPT_SET(store_path, optarg);
+			case _O_STORE_SIZE:		OPT_NUMBER("--store-size", store_size, 16, 1LL << 30, 0);
+			case _O_STORE_BATCH:	OPT_NUMBER("--store-batch", store_batch, 4, 1024 * 1024, 0);
+			case _O_STORE_SYNC:		OPT_LDOUBLE("--store-sync", store_sync, 0, 3600);
+			case _O_STORE_DIRECT:	OPT_SET(store_direct, true);
+			case _O_STORE_LIST:		OPT_SET(store_list, true);
+			case _O_STORE_EXPORT:	OPT_SET(store_export, true);
+			case _O_FROM:			OPT_LDOUBLE("--from", from_ts, -1e10, 1e10);
+			case _O_TO:				OPT_LDOUBLE("--to", to_ts, -1e10, 1e10);
 
 			case _O_LOG_LEVEL:			OPT_NUMBER("--log-level", us_g_log_level, US_LOG_LEVEL_INFO, US_LOG_LEVEL_DEBUG, 0);
 			case _O_PERF:				OPT_SET(us_g_log_level, US_LOG_LEVEL_PERF);
@@ -176,15 +246,53 @@ int main(int argc, char *argv[]) {
 #	undef OPT_NUMBER
 #	undef OPT_SET
 
+	_output_context_s ctx = {0};
+
+	if (store_list || store_export) {
+		if (store_path == NULL || store_path[0] == '\0') {
+			puts("Missing option --store. See --help for details.");
+			return 1;
+		}
+		if (store_export && (output_path == NULL || output_path[0] == '\0')) {
+			puts("Missing option --output for --store-export. See --help for details.");
+			return 1;
+		}
+		if (store_export && (ctx.v_output = (void*)us_output_file_init(output_path, output_json, output_splice)) == NULL) {
+			return 1;
+		}
+		// Negative values are relative to now, zero means no limit
+		const long double now_ts = us_get_now_real();
+		from_ts = (from_ts < 0 ? now_ts + from_ts : from_ts);
+		to_ts = (to_ts < 0 ? now_ts + to_ts : (to_ts == 0 ? LDBL_MAX : to_ts));
+		const int retval = abs(_read_store(store_path, from_ts, to_ts, store_list, &ctx));
+		US_DELETE(ctx.v_output, us_output_file_destroy);
+		return retval;
+	}
+
 	if (sink_name == NULL || sink_name[0] == '\0') {
 		puts("Missing option --sink. See --help for details.");
 		return 1;
 	}
+	if (cfr_fps > 0 && interval > 0) {
+		puts("Options --cfr and --interval can't be used together. See --help for details.");
+		return 1;
+	}
 
-	_output_context_s ctx = {0};
+	if (store_path && store_path[0] != '\0') {
+		if (output_path && output_path[0] != '\0') {
+			puts("Options --output and --store can't be used together. See --help for details.");
+			return 1;
+		}
+		if ((ctx.v_output = (void*)us_output_store_init(
+			store_path, (u64)store_size * 1024 * 1024, store_batch * 1024, store_sync, store_direct)) == NULL
+		) {
+			return 1;
+		}
+		ctx.write = us_output_store_write;
+		ctx.destroy = us_output_store_destroy;
 
-	if (output_path && output_path[0] != '\0') {
-		if ((ctx.v_output = (void*)us_output_file_init(output_path, output_json)) == NULL) {
+	} else if (output_path && output_path[0] != '\0') {
+		if ((ctx.v_output = (void*)us_output_file_init(output_path, output_json, output_splice)) == NULL) {
 			return 1;
 		}
 		ctx.write = us_output_file_write;
@@ -192,7 +300,7 @@ int main(int argc, char *argv[]) {
 	}
 
 	us_install_signals_handler(_signal_handler, false);
-	const int retval = abs(_dump_sink(sink_name, sink_timeout, count, interval, key_required, &ctx));
+	const int retval = abs(_dump_sink(sink_name, sink_timeout, count, interval, key_required, cfr_fps, cfr_latency, &ctx));
 	if (ctx.v_output && ctx.destroy) {
 		ctx.destroy(ctx.v_output);
 	}
@@ -211,6 +319,7 @@ static int _dump_sink(
 	const char *sink_name, unsigned sink_timeout,
 	long long count, long double interval,
 	bool key_required,
+	unsigned cfr_fps, long double cfr_latency,
 	_output_context_s *ctx) {
 
 	int retval = -1;
@@ -224,6 +333,12 @@ static int _dump_sink(
 	us_frame_s *frame = us_frame_init();
 	us_fpsi_s *fpsi = us_fpsi_init("SINK", false);
 	us_memsink_s *sink = NULL;
+	us_cfr_s *cfr = NULL;
+
+	if (cfr_fps > 0) {
+		US_LOG_INFO("Using CFR: fps=%u, latency=%.3Lf", cfr_fps, cfr_latency);
+		cfr = us_cfr_init(cfr_fps, cfr_latency);
+	}
 
 	if ((sink = us_memsink_init_opened("input", sink_name, false, 0, false, 0, sink_timeout)) == NULL) {
 		goto error;
@@ -253,30 +368,61 @@ static int _dump_sink(
 
 			us_fpsi_update(fpsi, true, NULL);
 
-			if (ctx->v_output != NULL) {
-				ctx->write(ctx->v_output, frame);
-			}
-
-			if (count >= 0) {
-				--count;
-				if (count <= 0) {
+			if (cfr != NULL) {
+				if (frame->format == V4L2_PIX_FMT_H264) {
+					US_LOG_ERROR("CFR: H.264 frames can't be duplicated or dropped without re-encoding");
+					goto error;
+				}
+				if (cfr->received == 0 && frame->grab_ts + 1 < now) {
+					// The sink keeps the last frame, it's not a part of the stream
+					US_LOG_VERBOSE("CFR: Skipping the stale frame");
+				} else {
+					us_cfr_put(cfr, &frame);
+				}
+			} else {
+				if (ctx->v_output != NULL) {
+					ctx->write(ctx->v_output, frame);
+				}
+				if (_count_frame(&count)) {
 					break;
 				}
-			}
-
-			if (interval_us > 0) {
-				usleep(interval_us);
+				if (interval_us > 0) {
+					usleep(interval_us);
+				}
 			}
 		} else if (got == US_ERROR_NO_DATA) {
 			usleep(1000);
 		} else {
 			goto error;
 		}
+
+		if (cfr != NULL) {
+			// The duplicates are emitted by the deadline even if the sink is stalled
+			bool done = false;
+			const us_frame_s *cfr_frame;
+			while (!done && (cfr_frame = us_cfr_get(cfr, us_get_now_monotonic())) != NULL) {
+				US_LOG_DEBUG("CFR: Emitting pts=%" PRIu64 ", dups=%" PRIu64 ", drops=%" PRIu64,
+					cfr->emitted, cfr->dups, cfr->drops);
+				if (ctx->v_output != NULL) {
+					ctx->write(ctx->v_output, cfr_frame);
+				}
+				done = _count_frame(&count);
+			}
+			if (done) {
+				break;
+			}
+		}
 	}
 
 	retval = 0;
 
 error:
+	if (cfr != NULL) {
+		US_LOG_INFO("CFR: received=%" PRIu64 ", emitted=%" PRIu64 ", dups=%" PRIu64
+			", drops=%" PRIu64 ", late=%" PRIu64 ", resyncs=%" PRIu64,
+			cfr->received, cfr->emitted, cfr->dups, cfr->drops, cfr->late, cfr->resyncs);
+		us_cfr_destroy(cfr);
+	}
 	US_DELETE(sink, us_memsink_destroy);
 	us_fpsi_destroy(fpsi);
 	us_frame_destroy(frame);
@@ -284,6 +430,48 @@ error:
 	return retval;
 }
 
+static bool _count_frame(long long *count) {
+	if (*count >= 0) {
+		--(*count);
+		return (*count <= 0);
+	}
+	return false;
+}
+
+static int _read_store(
+	const char *store_path, long double from_ts, long double to_ts,
+	bool list, _output_context_s *ctx) {
+
+	if (list) {
+		return us_store_read(store_path, from_ts, to_ts, false, _store_list_callback, NULL);
+	}
+	ctx->has_key = false;
+	return us_store_read(store_path, from_ts, to_ts, true, _store_export_callback, ctx);
+}
+
+static void _store_list_callback(void *v_ctx, const us_store_record_s *rec, const us_frame_s *frame) {
+	(void)v_ctx;
+	char fourcc_str[8];
+	printf("{\"seq\": %llu, \"ts\": %.3f, \"size\": %u, \"format\": \"%s\", \"width\": %u, \"height\": %u,"
+		" \"online\": %s, \"key\": %s}\n",
+		(unsigned long long)rec->seq, rec->ts, rec->size,
+		us_fourcc_to_string(frame->format, fourcc_str, 8),
+		rec->width, rec->height,
+		us_bool_to_string(rec->online), us_bool_to_string(rec->key));
+}
+
+static void _store_export_callback(void *v_ctx, const us_store_record_s *rec, const us_frame_s *frame) {
+	_output_context_s *const ctx = v_ctx;
+	(void)rec;
+	if (frame->format == V4L2_PIX_FMT_H264 && !ctx->has_key) {
+		if (!frame->key) {
+			return; // The decoder can't start from the middle of GOP
+		}
+		ctx->has_key = true;
+	}
+	us_output_file_write(ctx->v_output, frame);
+}
+
 static void _help(FILE *fp) {
 #	define SAY(_msg, ...) fprintf(fp, _msg "\n", ##__VA_ARGS__)
 	SAY("\nuStreamer-dump - Dump uStreamer's memory sink to file");
@@ -300,9 +488,34 @@ static void _help(FILE *fp) {
 	SAY("    -t|--sink-timeout <sec>  ─ Timeout for the upcoming frame. Default: 1.\n");
 	SAY("    -o|--output <filename> ─── Filename to dump output to. Use '-' for stdout. Default: just consume the sink.\n");
 	SAY("    -j|--output-json  ──────── Format output as JSON. Required option --output. Default: disabled.\n");
+	SAY("    --output-splice  ───────── Pass the raw frames to the output pipe by vmsplice() without copying.");
+	SAY("                               The next frame waits until the reader consumes the previous one.");
+	SAY("                               The reader must use read(), not splice() or tee(): the moved pages");
+	SAY("                               still refer to the frame buffer, and the next frame overwrites them.");
+	SAY("                               Linux only, required option --output. Default: disabled.\n");
 	SAY("    -c|--count  <N>  ───────── Limit the number of frames. Default: 0 (infinite).\n");
 	SAY("    -i|--interval <sec>  ───── Delay between reading frames (float). Default: 0.\n");
 	SAY("    -k|--key-required  ─────── Request keyframe from the sink. Default: disabled.\n");
+	SAY("    --cfr <fps>  ───────────── Emit the frames with the constant rate, duplicate or drop them");
+	SAY("                               by grab_ts. The grab_ts of the output frames is the slot time.");
+	SAY("                               The --count limits the output frames. Not for H.264. Default: disabled.\n");
+	SAY("    --cfr-latency <sec>  ───── How long to wait for a late frame before the duplicate (float).");
+	SAY("                               Default: 0.1.\n");
+	SAY("Circular store options:");
+	SAY("═══════════════════════");
+	SAY("    -S|--store <path>  ────── Record the sink to a preallocated circular store instead of --output.");
+	SAY("                              The oldest frames are overwritten, the index survives a power loss.\n");
+	SAY("    --store-size <MiB>  ───── Size of a new store. An existing one keeps its size. Default: 1024.\n");
+	SAY("    --store-batch <KiB>  ──── Write the frames by aligned batches of this size. The bigger batches");
+	SAY("                              reduce the write amplification. Default: 1024.\n");
+	SAY("    --store-sync <sec>  ───── Flush and fdatasync() the batch at least with this period (float).");
+	SAY("                              It's the maximum of the lost recording on a power loss. Default: 1.\n");
+	SAY("    --store-direct  ───────── Use O_DIRECT to bypass the page cache. Default: disabled.\n");
+	SAY("    --store-list  ─────────── Print the index of the --store as JSON lines and exit.\n");
+	SAY("    --store-export  ───────── Export the frames of the --store to the --output and exit.\n");
+	SAY("    --from <ts>  ──────────── The beginning of the time range for --store-list and --store-export.");
+	SAY("                              UNIX time or negative seconds relative to now. Default: 0 (no limit).\n");
+	SAY("    --to <ts>  ────────────── The end of the time range, the same format. Default: 0 (no limit).\n");
 	SAY("Logging options:");
 	SAY("════════════════");
 	SAY("    --log-level <N>  ──── Verbosity level of messages from 0 (info) to 3 (debug).");
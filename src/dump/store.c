@@ -0,0 +1,617 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+#include "store.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/logging.h"
+#include "../libs/frame.h"
+
+
+// The layout: a header block, the index ring and the data ring.
+// The data is written before or together with its index records
+// and is checked by the CRC, so a power loss in the middle of a batch
+// can only lose the tail, the older frames stay readable.
+
+#define _MAGIC				"uSTORE01"
+#define _BLOCK				((uz)4096)
+#define _RECORDS_PER_BLOCK	(_BLOCK / sizeof(us_store_record_s))
+#define _BYTES_PER_RECORD	(16 * 1024) // For the index size, less than 2 Mbps at 30 fps
+#define _MIN_RECORDS		(4096)
+
+#define _ALIGN_UP(x_value)	(((x_value) + _BLOCK - 1) / _BLOCK * _BLOCK)
+
+
+typedef struct {
+	char	magic[8];
+	u32		block_size;
+	u32		record_size;
+	u64		index_offset;
+	u64		index_capacity;
+	u64		data_offset;
+	u64		data_size;
+	u32		reserved;
+	u32		crc;
+} _header_s;
+
+_Static_assert(sizeof(us_store_record_s) == 64, "Invalid store record size");
+
+
+static u32 _crc32(const u8 *data, uz size);
+static void *_alloc_aligned(uz size);
+static int _pwrite_all(int fd, const void *data, uz size, u64 offset);
+static int _pread_all(int fd, void *data, uz size, u64 offset);
+static int _read_header(int fd, const char *path, _header_s *header);
+static us_store_record_s *_read_index(int fd, const _header_s *header);
+static bool _is_record_valid(const us_store_record_s *rec);
+static const us_store_record_s *_find_last(const us_store_record_s *index, u64 capacity);
+static int _ring_pwrite(us_output_store_s *output, const u8 *data, uz size, u64 offset);
+static int _flush(us_output_store_s *output, bool sync);
+static int _cmp_records(const void *a_ptr, const void *b_ptr);
+
+
+us_output_store_s *us_output_store_init(const char *path, u64 size, uz batch, ldf sync_interval, bool direct) {
+	us_output_store_s *output;
+	US_CALLOC(output, 1);
+	output->path = us_strdup(path);
+	output->fd = -1;
+	output->direct = direct;
+	output->sync_interval = sync_interval;
+
+	int flags = O_RDWR | O_CREAT | O_CLOEXEC;
+	if (direct) {
+#		ifdef O_DIRECT
+		flags |= O_DIRECT;
+#		else
+		US_LOG_ERROR("Store: O_DIRECT is not supported on this platform, ignored");
+#		endif
+	}
+	if ((output->fd = open(path, flags, 0644)) < 0) {
+		US_LOG_PERROR("Store: Can't open %s", path);
+		goto error;
+	}
+
+	struct stat st;
+	if (fstat(output->fd, &st) < 0) {
+		US_LOG_PERROR("Store: Can't stat %s", path);
+		goto error;
+	}
+
+	_header_s *header = _alloc_aligned(_BLOCK);
+	if (st.st_size == 0) {
+		size = size / _BLOCK * _BLOCK;
+		const u64 capacity = US_MAX((u64)_MIN_RECORDS, size / _BYTES_PER_RECORD);
+		memcpy(header->magic, _MAGIC, 8);
+		header->block_size = _BLOCK;
+		header->record_size = sizeof(us_store_record_s);
+		header->index_offset = _BLOCK;
+		header->index_capacity = (capacity + _RECORDS_PER_BLOCK - 1) / _RECORDS_PER_BLOCK * _RECORDS_PER_BLOCK;
+		header->data_offset = header->index_offset + header->index_capacity * sizeof(us_store_record_s);
+		if (size < header->data_offset + 64 * _BLOCK) {
+			US_LOG_ERROR("Store: The size is too small for %s", path);
+			free(header);
+			goto error;
+		}
+		header->data_size = size - header->data_offset;
+		header->crc = _crc32((const u8*)header, offsetof(_header_s, crc));
+
+		US_LOG_INFO("Store: Preallocating %s: %.1f MiB ...", path, (double)size / 1024 / 1024);
+#		ifdef __linux__
+		// The unwritten extents are read as zeros, so the index is empty
+		if (fallocate(output->fd, 0, 0, size) < 0 && (errno != EOPNOTSUPP || posix_fallocate(output->fd, 0, size) != 0)) {
+#		else
+		if (ftruncate(output->fd, size) < 0) {
+#		endif
+			US_LOG_PERROR("Store: Can't preallocate %s", path);
+			free(header);
+			goto error;
+		}
+		if (_pwrite_all(output->fd, header, _BLOCK, 0) < 0 || fsync(output->fd) < 0) {
+			US_LOG_PERROR("Store: Can't write the header of %s", path);
+			free(header);
+			goto error;
+		}
+	} else {
+		if (_read_header(output->fd, path, header) < 0) {
+			free(header);
+			goto error;
+		}
+		if (size / _BLOCK * _BLOCK != header->data_offset + header->data_size) {
+			US_LOG_INFO("Store: Using the existing size of %s: %.1f MiB",
+				path, (double)(header->data_offset + header->data_size) / 1024 / 1024);
+		}
+	}
+	output->index_offset = header->index_offset;
+	output->index_capacity = header->index_capacity;
+	output->data_offset = header->data_offset;
+	output->data_size = header->data_size;
+	free(header);
+
+	{
+		_header_s geometry = {
+			.index_offset = output->index_offset,
+			.index_capacity = output->index_capacity,
+		};
+		if ((output->index = _read_index(output->fd, &geometry)) == NULL) {
+			US_LOG_PERROR("Store: Can't read the index of %s", path);
+			goto error;
+		}
+	}
+
+	const us_store_record_s *const last = _find_last(output->index, output->index_capacity);
+	if (last != NULL) {
+		output->next_seq = last->seq + 1;
+		output->buf_offset = _ALIGN_UP(last->offset + last->size);
+	} else {
+		output->next_seq = 1;
+	}
+	output->dirty_seq = output->next_seq;
+
+	output->batch = US_MIN(_ALIGN_UP(batch), output->data_size / 4 / _BLOCK * _BLOCK);
+	output->buf_allocated = output->batch;
+	output->buf = _alloc_aligned(output->buf_allocated);
+	output->last_sync_ts = us_get_now_monotonic();
+
+	US_LOG_INFO("Store: Recording to %s: data=%.1f MiB, index=%llu records, last_seq=%llu, batch=%zu KiB, sync=%.2Lf sec%s",
+		path, (double)output->data_size / 1024 / 1024, (ull)output->index_capacity,
+		(ull)(output->next_seq - 1), output->batch / 1024, sync_interval,
+		(direct ? ", O_DIRECT" : ""));
+	return output;
+
+error:
+	us_output_store_destroy(output);
+	return NULL;
+}
+
+void us_output_store_write(void *v_output, const us_frame_s *frame) {
+	us_output_store_s *const output = v_output;
+	if (output->fd < 0) {
+		return; // Disabled by an error
+	}
+	if (frame->used == 0 || frame->used > output->data_size / 4) {
+		US_LOG_ERROR("Store: Can't record a frame of %zu bytes, it's too big for the store", frame->used);
+		return;
+	}
+
+	if (output->buf_used + frame->used > output->buf_allocated) {
+		if (_flush(output, false) < 0) {
+			return;
+		}
+		if (frame->used > output->buf_allocated) {
+			free(output->buf);
+			output->buf_allocated = _ALIGN_UP(frame->used);
+			output->buf = _alloc_aligned(output->buf_allocated);
+		}
+	}
+
+	const u64 offset = output->buf_offset + output->buf_used;
+	memcpy(output->buf + output->buf_used, frame->data, frame->used);
+	output->buf_used += frame->used;
+
+	us_store_record_s *const rec = &output->index[output->next_seq % output->index_capacity];
+	memset(rec, 0, sizeof(us_store_record_s));
+	rec->seq = output->next_seq;
+	rec->offset = offset;
+	// The grab timestamp is CLOCK_MONOTONIC of the same host
+	rec->ts = us_get_now_real() - (frame->grab_ts > 0 ? us_get_now_monotonic() - frame->grab_ts : 0);
+	rec->size = frame->used;
+	rec->format = frame->format;
+	rec->width = frame->width;
+	rec->height = frame->height;
+	rec->stride = frame->stride;
+	rec->gop = frame->gop;
+	rec->key = frame->key;
+	rec->online = frame->online;
+	rec->data_crc = _crc32(frame->data, frame->used);
+	rec->crc = _crc32((const u8*)rec, offsetof(us_store_record_s, crc));
+	++output->next_seq;
+	output->payload_bytes += frame->used;
+
+	if (us_get_now_monotonic() - output->last_sync_ts >= output->sync_interval) {
+		_flush(output, true);
+	}
+}
+
+void us_output_store_destroy(void *v_output) {
+	us_output_store_s *const output = v_output;
+	if (output->fd >= 0) {
+		if (output->index != NULL && _flush(output, true) == 0 && output->payload_bytes > 0) {
+			US_LOG_INFO("Store: Recorded %.1f MiB, written %.1f MiB (amplification %.3f), %u syncs",
+				(double)output->payload_bytes / 1024 / 1024,
+				(double)output->written_bytes / 1024 / 1024,
+				(double)output->written_bytes / output->payload_bytes,
+				output->n_syncs);
+		}
+		US_CLOSE_FD(output->fd);
+	}
+	US_DELETE(output->buf, free);
+	US_DELETE(output->index, free);
+	free(output->path);
+	free(output);
+}
+
+int us_store_read(const char *path, ldf from_ts, ldf to_ts, bool with_data, us_store_read_f callback, void *arg) {
+	int retval = -1;
+	_header_s header;
+	us_store_record_s *index = NULL;
+	const us_store_record_s **recs = NULL;
+	us_frame_s *frame = NULL;
+
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		US_LOG_PERROR("Store: Can't open %s", path);
+		goto error;
+	}
+	if (_read_header(fd, path, &header) < 0) {
+		goto error;
+	}
+	if ((index = _read_index(fd, &header)) == NULL) {
+		US_LOG_PERROR("Store: Can't read the index of %s", path);
+		goto error;
+	}
+
+	uz n_recs = 0;
+	US_CALLOC(recs, header.index_capacity);
+	for (u64 slot = 0; slot < header.index_capacity; ++slot) {
+		if (_is_record_valid(&index[slot])) {
+			recs[n_recs] = &index[slot];
+			++n_recs;
+		}
+	}
+	qsort(recs, n_recs, sizeof(us_store_record_s*), _cmp_records);
+
+	// The data before the last written block has been overwritten by the ring
+	const u64 head = (n_recs > 0 ? _ALIGN_UP(recs[n_recs - 1]->offset + recs[n_recs - 1]->size) : 0);
+
+	frame = us_frame_init();
+	for (uz index_n = 0; index_n < n_recs; ++index_n) {
+		const us_store_record_s *const rec = recs[index_n];
+		if (rec->offset + header.data_size < head || rec->ts < from_ts || rec->ts > to_ts) {
+			continue;
+		}
+
+		frame->width = rec->width;
+		frame->height = rec->height;
+		frame->format = rec->format;
+		frame->stride = rec->stride;
+		frame->online = rec->online;
+		frame->key = rec->key;
+		frame->gop = rec->gop;
+		frame->grab_ts = rec->ts;
+		frame->encode_begin_ts = 0;
+		frame->encode_end_ts = 0;
+
+		if (with_data) {
+			us_frame_realloc_data(frame, rec->size);
+			const u64 pos = rec->offset % header.data_size;
+			const uz first = US_MIN((u64)rec->size, header.data_size - pos);
+			if (
+				_pread_all(fd, frame->data, first, header.data_offset + pos) < 0
+				|| _pread_all(fd, frame->data + first, rec->size - first, header.data_offset) < 0
+			) {
+				US_LOG_PERROR("Store: Can't read the frame seq=%llu", (ull)rec->seq);
+				goto error;
+			}
+			frame->used = rec->size;
+			if (_crc32(frame->data, frame->used) != rec->data_crc) {
+				US_LOG_ERROR("Store: Broken frame seq=%llu, skipped", (ull)rec->seq);
+				continue;
+			}
+		} else {
+			frame->used = 0;
+		}
+		callback(arg, rec, frame);
+	}
+	retval = 0;
+
+error:
+	US_DELETE(frame, us_frame_destroy);
+	US_DELETE(recs, free);
+	US_DELETE(index, free);
+	if (fd >= 0) {
+		close(fd);
+	}
+	return retval;
+}
+
+static u32 _crc32(const u8 *data, uz size) {
+	static u32 table[256] = {0};
+	if (table[1] == 0) { // The race is harmless, the values are the same
+		for (u32 index = 0; index < 256; ++index) {
+			u32 crc = index;
+			for (uint bit = 0; bit < 8; ++bit) {
+				crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+			}
+			table[index] = crc;
+		}
+	}
+	u32 crc = 0xFFFFFFFF;
+	for (uz index = 0; index < size; ++index) {
+		crc = (crc >> 8) ^ table[(crc ^ data[index]) & 0xFF];
+	}
+	return ~crc;
+}
+
+static void *_alloc_aligned(uz size) {
+	// For O_DIRECT both the buffer and the size should be aligned to the block
+	void *ptr;
+	assert(!posix_memalign(&ptr, _BLOCK, size));
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+static int _pwrite_all(int fd, const void *data, uz size, u64 offset) {
+	const u8 *ptr = data;
+	while (size > 0) {
+		const sz written = pwrite(fd, ptr, size, offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		ptr += written;
+		size -= written;
+		offset += written;
+	}
+	return 0;
+}
+
+static int _pread_all(int fd, void *data, uz size, u64 offset) {
+	u8 *ptr = data;
+	while (size > 0) {
+		const sz readed = pread(fd, ptr, size, offset);
+		if (readed < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		} else if (readed == 0) {
+			errno = EIO;
+			return -1;
+		}
+		ptr += readed;
+		size -= readed;
+		offset += readed;
+	}
+	return 0;
+}
+
+static int _read_header(int fd, const char *path, _header_s *header) {
+	u8 *const block = _alloc_aligned(_BLOCK);
+	const int retval = _pread_all(fd, block, _BLOCK, 0);
+	memcpy(header, block, sizeof(_header_s));
+	free(block);
+	if (retval < 0) {
+		US_LOG_PERROR("Store: Can't read the header of %s", path);
+		return -1;
+	}
+	if (
+		memcmp(header->magic, _MAGIC, 8)
+		|| header->crc != _crc32((const u8*)header, offsetof(_header_s, crc))
+		|| header->block_size != _BLOCK
+		|| header->record_size != sizeof(us_store_record_s)
+		|| header->index_capacity % _RECORDS_PER_BLOCK != 0
+	) {
+		US_LOG_ERROR("Store: %s is not a store or it's incompatible", path);
+		return -1;
+	}
+	return 0;
+}
+
+static us_store_record_s *_read_index(int fd, const _header_s *header) {
+	const uz size = header->index_capacity * sizeof(us_store_record_s);
+	us_store_record_s *const index = _alloc_aligned(size);
+	if (_pread_all(fd, index, size, header->index_offset) < 0) {
+		free(index);
+		return NULL;
+	}
+	return index;
+}
+
+static bool _is_record_valid(const us_store_record_s *rec) {
+	return (rec->seq > 0 && rec->crc == _crc32((const u8*)rec, offsetof(us_store_record_s, crc)));
+}
+
+static const us_store_record_s *_find_last(const us_store_record_s *index, u64 capacity) {
+	const us_store_record_s *last = NULL;
+	for (u64 slot = 0; slot < capacity; ++slot) {
+		if (_is_record_valid(&index[slot]) && (last == NULL || index[slot].seq > last->seq)) {
+			last = &index[slot];
+		}
+	}
+	return last;
+}
+
+static int _ring_pwrite(us_output_store_s *output, const u8 *data, uz size, u64 offset) {
+	const u64 pos = offset % output->data_size;
+	const uz first = US_MIN((u64)size, output->data_size - pos);
+	if (_pwrite_all(output->fd, data, first, output->data_offset + pos) < 0) {
+		return -1;
+	}
+	return _pwrite_all(output->fd, data + first, size - first, output->data_offset);
+}
+
+static int _flush(us_output_store_s *output, bool sync) {
+	// Все записи выровнены по блоку: данные добиваются нулями до границы,
+	// а индекс пишется целыми блоками, так что годится и O_DIRECT.
+	if (output->buf_used > 0) {
+		const uz padded = _ALIGN_UP(output->buf_used);
+		memset(output->buf + output->buf_used, 0, padded - output->buf_used);
+		if (_ring_pwrite(output, output->buf, padded, output->buf_offset) < 0) {
+			US_LOG_PERROR("Store: Can't write the data");
+			goto error;
+		}
+		output->written_bytes += padded;
+		output->buf_offset += padded;
+		output->buf_used = 0;
+	}
+
+	for (u64 seq = output->dirty_seq; seq < output->next_seq;) {
+		const u64 slot = seq % output->index_capacity;
+		const u64 block = slot / _RECORDS_PER_BLOCK;
+		if (_pwrite_all(
+			output->fd, output->index + block * _RECORDS_PER_BLOCK, _BLOCK,
+			output->index_offset + block * _BLOCK
+		) < 0) {
+			US_LOG_PERROR("Store: Can't write the index");
+			goto error;
+		}
+		output->written_bytes += _BLOCK;
+		seq += _RECORDS_PER_BLOCK - slot % _RECORDS_PER_BLOCK;
+	}
+	output->dirty_seq = output->next_seq;
+
+	if (sync) {
+		if (fdatasync(output->fd) < 0) {
+			US_LOG_PERROR("Store: Can't sync");
+			goto error;
+		}
+		++output->n_syncs;
+		output->last_sync_ts = us_get_now_monotonic();
+	}
+	return 0;
+
+error:
+	US_LOG_ERROR("Store: Recording is stopped");
+	US_CLOSE_FD(output->fd);
+	return -1;
+}
+
+static int _cmp_records(const void *a_ptr, const void *b_ptr) {
+	const us_store_record_s *const a = *(const us_store_record_s *const *)a_ptr;
+	const us_store_record_s *const b = *(const us_store_record_s *const *)b_ptr;
+	return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+
+#ifdef TEST_STORE
+// Wraps a small store a few times, reopens it and checks the frames,
+// then damages the data of the last frame like a torn write.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_STORE -o store-test dump/store.c libs/frame.c libs/logging.c libs/pixel.c -pthread -lm
+
+#include <stdio.h>
+
+
+typedef struct {
+	u64		first_seq;
+	u64		last_seq;
+	uint	count;
+	uint	errors;
+} _test_ctx_s;
+
+static void _fill_frame(us_frame_s *frame, u64 seq) {
+	frame->used = 1000 + (seq * 7919) % 30000;
+	us_frame_realloc_data(frame, frame->used);
+	for (uz index = 0; index < frame->used; ++index) {
+		frame->data[index] = (seq + index) & 0xFF;
+	}
+	frame->width = 640;
+	frame->height = 480;
+	frame->format = 1;
+	frame->key = true;
+	frame->online = true;
+	frame->grab_ts = us_get_now_monotonic();
+}
+
+static void _check_callback(void *v_ctx, const us_store_record_s *rec, const us_frame_s *frame) {
+	_test_ctx_s *const ctx = v_ctx;
+	us_frame_s *const expected = us_frame_init();
+	_fill_frame(expected, rec->seq);
+	if (frame->used != expected->used || memcmp(frame->data, expected->data, frame->used)) {
+		++ctx->errors;
+	}
+	if (ctx->count > 0 && rec->seq != ctx->last_seq + 1) {
+		++ctx->errors; // A gap in the middle
+	}
+	if (ctx->count == 0) {
+		ctx->first_seq = rec->seq;
+	}
+	ctx->last_seq = rec->seq;
+	++ctx->count;
+	us_frame_destroy(expected);
+}
+
+int main(void) {
+	US_LOGGING_INIT;
+	const char *const path = "/tmp/.ustreamer-store-test";
+	unlink(path);
+
+	int retval = 0;
+	us_frame_s *const frame = us_frame_init();
+	us_output_store_s *output = us_output_store_init(path, 16 * 1024 * 1024, 64 * 1024, 0.1, false);
+	assert(output != NULL);
+	for (u64 seq = 1; seq <= 5000; ++seq) {
+		_fill_frame(frame, seq);
+		us_output_store_write(output, frame);
+	}
+	us_output_store_destroy(output);
+
+	_test_ctx_s ctx = {0};
+	assert(!us_store_read(path, 0, 1e10, true, _check_callback, &ctx));
+	printf("After wrapping: frames %llu..%llu (%u), errors=%u\n",
+		(ull)ctx.first_seq, (ull)ctx.last_seq, ctx.count, ctx.errors);
+	if (ctx.last_seq != 5000 || ctx.count < 500 || ctx.errors > 0) {
+		retval = 1;
+	}
+
+	// Continue after the reopening and break the last frame
+	output = us_output_store_init(path, 0, 64 * 1024, 0.1, false);
+	assert(output != NULL);
+	for (u64 seq = 5001; seq <= 5100; ++seq) {
+		_fill_frame(frame, seq);
+		us_output_store_write(output, frame);
+	}
+	const us_store_record_s *const last = &output->index[5100 % output->index_capacity];
+	const u64 pos = output->data_offset + last->offset % output->data_size;
+	us_output_store_destroy(output);
+
+	const int fd = open(path, O_WRONLY);
+	assert(fd >= 0);
+	assert(pwrite(fd, "BROKEN", 6, pos) == 6);
+	close(fd);
+
+	US_MEMSET_ZERO(ctx);
+	assert(!us_store_read(path, 0, 1e10, true, _check_callback, &ctx));
+	printf("After the torn write: frames %llu..%llu (%u), errors=%u\n",
+		(ull)ctx.first_seq, (ull)ctx.last_seq, ctx.count, ctx.errors);
+	if (ctx.last_seq != 5099 || ctx.errors > 0) {
+		retval = 1;
+	}
+
+	us_frame_destroy(frame);
+	unlink(path);
+	puts(retval == 0 ? "OK" : "FAILED");
+	return retval;
+}
+#endif
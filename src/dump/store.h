@@ -0,0 +1,84 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+
+#include <sys/types.h>
+
+#include "../libs/types.h"
+#include "../libs/frame.h"
+
+
+typedef struct {
+	// 64 bytes, the 4K index block holds exactly 64 records
+	u64		seq; // Starts from 1, 0 is an empty slot
+	u64		offset; // Logical offset in the data ring, it only grows
+	double	ts; // Wall clock of the capture
+	u32		size;
+	u32		format;
+	u32		width;
+	u32		height;
+	u32		stride;
+	u32		gop;
+	u8		key;
+	u8		online;
+	u8		reserved[6];
+	u32		data_crc;
+	u32		crc; // Of the record before this field
+} us_store_record_s;
+
+typedef struct {
+	char	*path;
+	int		fd;
+	bool	direct;
+	uz		batch;
+	ldf		sync_interval;
+
+	u64		index_offset;
+	u64		index_capacity;
+	u64		data_offset;
+	u64		data_size;
+
+	us_store_record_s	*index; // The whole index region, aligned
+	u64					next_seq;
+	u64					dirty_seq; // The first record which is not written yet
+
+	u8		*buf; // The pending data, starts from the block boundary
+	uz		buf_allocated;
+	uz		buf_used;
+	u64		buf_offset; // Logical
+
+	ldf		last_sync_ts;
+	u64		payload_bytes;
+	u64		written_bytes;
+	uint	n_syncs;
+} us_output_store_s;
+
+typedef void (*us_store_read_f)(void *arg, const us_store_record_s *rec, const us_frame_s *frame);
+
+
+us_output_store_s *us_output_store_init(const char *path, u64 size, uz batch, ldf sync_interval, bool direct);
+void us_output_store_write(void *v_output, const us_frame_s *frame);
+void us_output_store_destroy(void *v_output);
+
+int us_store_read(const char *path, ldf from_ts, ldf to_ts, bool with_data, us_store_read_f callback, void *arg);
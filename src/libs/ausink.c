@@ -0,0 +1,137 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "ausink.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "types.h"
+#include "errors.h"
+#include "tools.h"
+#include "logging.h"
+#include "ausinksh.h"
+
+
+us_ausink_s *us_ausink_init_opened(
+	const char *name, const char *obj, bool server,
+	mode_t mode, bool rm, uint client_ttl, uint timeout) {
+
+	us_ausink_s *sink;
+	US_CALLOC(sink, 1);
+	sink->name = name;
+	sink->obj = obj;
+	sink->server = server;
+	sink->rm = rm;
+	sink->client_ttl = client_ttl;
+	sink->timeout = timeout;
+	sink->fd = -1;
+	atomic_init(&sink->has_clients, false);
+
+	US_LOG_INFO("Using %s-sink: %s", name, obj);
+
+	const mode_t mask = umask(0);
+	sink->fd = shm_open(sink->obj, (server ? O_RDWR | O_CREAT : O_RDWR), mode);
+	umask(mask);
+	if (sink->fd == -1) {
+		US_LOG_PERROR("%s-sink: Can't open shared memory", name);
+		goto error;
+	}
+
+	if (sink->server && ftruncate(sink->fd, sizeof(us_ausink_shared_s)) < 0) {
+		US_LOG_PERROR("%s-sink: Can't truncate shared memory", name);
+		goto error;
+	}
+
+	if ((sink->mem = us_ausink_shared_map(sink->fd)) == NULL) {
+		US_LOG_PERROR("%s-sink: Can't mmap shared memory", name);
+		goto error;
+	}
+
+	if (!sink->server) {
+		// Start from the freshest packet, the backlog is useless for a new client
+		sink->next = atomic_load(&sink->mem->head);
+	}
+	return sink;
+
+error:
+	us_ausink_destroy(sink);
+	return NULL;
+}
+
+void us_ausink_destroy(us_ausink_s *sink) {
+	if (sink->mem != NULL) {
+		if (us_ausink_shared_unmap(sink->mem) < 0) {
+			US_LOG_PERROR("%s-sink: Can't unmap shared memory", sink->name);
+		}
+	}
+	if (sink->fd >= 0) {
+		if (close(sink->fd) < 0) {
+			US_LOG_PERROR("%s-sink: Can't close shared memory fd", sink->name);
+		}
+		if (sink->rm && shm_unlink(sink->obj) < 0) {
+			if (errno != ENOENT) {
+				US_LOG_PERROR("%s-sink: Can't remove shared memory", sink->name);
+			}
+		}
+	}
+	free(sink);
+}
+
+void us_ausink_server_put(us_ausink_s *sink, const us_ausink_packet_s *packet) {
+	assert(sink->server);
+
+	// The audio stream must be continuous for all the clients,
+	// so the packets are written regardless of whether anyone is reading them.
+	us_ausink_shared_put(sink->mem, packet);
+
+	atomic_store(&sink->has_clients, (sink->mem->last_client_ts + sink->client_ttl > us_get_now_monotonic()));
+}
+
+int us_ausink_client_get(us_ausink_s *sink, us_ausink_packet_s *packet) {
+	assert(!sink->server); // Client only
+
+	const ldf deadline_ts = us_get_now_monotonic() + sink->timeout;
+	do {
+		const uint lost = sink->lost;
+		const int result = us_ausink_shared_get(sink->mem, &sink->next, packet, &sink->lost);
+		if (sink->lost != lost) {
+			US_LOG_VERBOSE("%s-sink: Lost %u packets", sink->name, sink->lost - lost);
+		}
+		if (result == 0) {
+			return 0;
+		} else if (result != US_ERROR_NO_DATA) {
+			US_LOG_ERROR("%s-sink: Protocol version mismatch: sink=%u, required=%u",
+				sink->name, sink->mem->version, US_AUSINK_VERSION);
+			return -1;
+		}
+		usleep(1000); // Polling
+	} while (us_get_now_monotonic() < deadline_ts);
+	return US_ERROR_NO_DATA;
+}
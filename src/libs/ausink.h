@@ -24,38 +24,36 @@
 
 #include <stdatomic.h>
 
-#include <pthread.h>
-#include <alsa/asoundlib.h>
-#include <speex/speex_resampler.h>
-#include <opus/opus.h>
+#include <sys/stat.h>
 
-#include "uslibs/types.h"
-#include "uslibs/ring.h"
+#include "types.h"
+#include "ausinksh.h"
 
 
 typedef struct {
-	snd_pcm_t			*dev;
-	uint				pcm_hz;
-	uint				pcm_frames;
-	uz					pcm_size;
-	snd_pcm_hw_params_t	*dev_params;
-	SpeexResamplerState	*res;
-	OpusEncoder			*enc;
+	const char	*name;
+	const char	*obj;
+	bool		server;
+	bool		rm;
+	uint		client_ttl; // Only for server
+	uint		timeout; // Only for client
 
-	us_ring_s		*pcm_ring;
-	us_ring_s		*enc_ring;
-	u32				pts;
+	int					fd;
+	us_ausink_shared_s	*mem;
 
-	pthread_t		pcm_tid;
-	pthread_t		enc_tid;
-	bool			tids_created;
-	atomic_bool		stop;
-} us_acap_s;
+	u32			next; // Only for client
+	uint		lost; // Only for client
 
+	atomic_bool	has_clients; // Only for server
+} us_ausink_s;
 
-bool us_acap_probe(const char *name);
 
-us_acap_s *us_acap_init(const char *name, uint pcm_hz);
-void us_acap_destroy(us_acap_s *acap);
+us_ausink_s *us_ausink_init_opened(
+	const char *name, const char *obj, bool server,
+	mode_t mode, bool rm, uint client_ttl, uint timeout);
 
-int us_acap_get_encoded(us_acap_s *acap, u8 *data, uz *size, u64 *pts);
+void us_ausink_destroy(us_ausink_s *sink);
+
+void us_ausink_server_put(us_ausink_s *sink, const us_ausink_packet_s *packet);
+
+int us_ausink_client_get(us_ausink_s *sink, us_ausink_packet_s *packet);
@@ -0,0 +1,137 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "ausinksh.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include <assert.h>
+
+#include <sys/mman.h>
+
+#include "types.h"
+#include "errors.h"
+#include "tools.h"
+
+
+us_ausink_shared_s *us_ausink_shared_map(int fd) {
+	us_ausink_shared_s *mem = mmap(
+		NULL,
+		sizeof(us_ausink_shared_s),
+		PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+	if (mem == MAP_FAILED) {
+		return NULL;
+	}
+	assert(mem != NULL);
+	return mem;
+}
+
+int us_ausink_shared_unmap(us_ausink_shared_s *mem) {
+	assert(mem != NULL);
+	return munmap(mem, sizeof(us_ausink_shared_s));
+}
+
+void us_ausink_shared_put(us_ausink_shared_s *mem, const us_ausink_packet_s *packet) {
+	// Single producer. Readers never take a lock, they check the slot sequence
+	// before and after copying (seqlock) and just skip torn packets.
+
+	assert(packet->used <= US_AUSINK_DATA_SIZE);
+
+	const u32 head = atomic_load_explicit(&mem->head, memory_order_relaxed);
+	us_ausink_packet_s *const dest = &mem->packets[head % US_AUSINK_PACKETS];
+
+	const uint seq = atomic_load_explicit(&dest->seq, memory_order_relaxed);
+	atomic_store_explicit(&dest->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	dest->number = head;
+	dest->format = packet->format;
+	dest->hz = packet->hz;
+	dest->channels = packet->channels;
+	dest->frames = packet->frames;
+	dest->pts = packet->pts;
+	dest->grab_ts = packet->grab_ts;
+	dest->used = packet->used;
+	memcpy(dest->data, packet->data, packet->used);
+
+	atomic_store_explicit(&dest->seq, seq + 2, memory_order_release);
+	atomic_store_explicit(&mem->head, head + 1, memory_order_release);
+
+	mem->magic = US_AUSINK_MAGIC;
+	mem->version = US_AUSINK_VERSION;
+}
+
+int us_ausink_shared_get(us_ausink_shared_s *mem, u32 *next, us_ausink_packet_s *packet, uint *lost) {
+	if (mem->magic != US_AUSINK_MAGIC) {
+		return US_ERROR_NO_DATA; // Not initialized yet
+	}
+	if (mem->version != US_AUSINK_VERSION) {
+		return -1;
+	}
+
+	// Let the producer know that the client is alive
+	mem->last_client_ts = us_get_now_monotonic();
+
+	const u32 head = atomic_load_explicit(&mem->head, memory_order_acquire);
+	if (head == 0 || *next == head) {
+		return US_ERROR_NO_DATA;
+	}
+	if (head - *next >= US_AUSINK_PACKETS) {
+		// The client is too slow, or the producer was restarted and the counter was reset.
+		// Audio is realtime, so there is no sense to play the backlog: jump to the last packet.
+		if (lost != NULL) {
+			*lost += head - *next - 1;
+		}
+		*next = head - 1;
+	}
+
+	const us_ausink_packet_s *const src = &mem->packets[*next % US_AUSINK_PACKETS];
+
+	const uint seq = atomic_load_explicit(&src->seq, memory_order_acquire);
+	if (seq & 1) {
+		return US_ERROR_NO_DATA; // Being written right now
+	}
+
+	packet->number = src->number;
+	packet->format = src->format;
+	packet->hz = src->hz;
+	packet->channels = src->channels;
+	packet->frames = src->frames;
+	packet->pts = src->pts;
+	packet->grab_ts = src->grab_ts;
+	packet->used = US_MIN(src->used, (uz)US_AUSINK_DATA_SIZE);
+	memcpy(packet->data, src->data, packet->used);
+
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&src->seq, memory_order_relaxed) != seq || packet->number != *next) {
+		// Overwritten while copying
+		if (lost != NULL) {
+			++*lost;
+		}
+		++*next;
+		return US_ERROR_NO_DATA;
+	}
+
+	++*next;
+	return 0;
+}
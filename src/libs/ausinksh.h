@@ -0,0 +1,71 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include "types.h"
+
+
+#define US_AUSINK_MAGIC		((u64)0xCAFEBABEA0D1CAFE)
+#define US_AUSINK_VERSION	((u32)1)
+
+// 64 packets of 20ms = 1.28 sec of backlog for slow readers
+#define US_AUSINK_PACKETS	64
+// Enough for 20ms of S16LE stereo PCM on 48kHz (3840 bytes) and for any OPUS packet
+#define US_AUSINK_DATA_SIZE	4096
+
+#define US_AUSINK_FORMAT_PCM_S16LE	((uint)1)
+#define US_AUSINK_FORMAT_OPUS		((uint)2)
+
+
+typedef struct {
+	atomic_uint	seq; // Odd while the producer is writing the packet
+	u32			number;
+
+	uint		format;
+	uint		hz;
+	uint		channels;
+	uint		frames; // Per channel
+	u64			pts; // In samples from the beginning of the capture, (hz) clock
+	ldf			grab_ts;
+
+	uz			used;
+	u8			data[US_AUSINK_DATA_SIZE];
+} us_ausink_packet_s;
+
+typedef struct {
+	u64			magic;
+	u32			version;
+	atomic_uint	head; // The number of the next packet to write
+	ldf			last_client_ts;
+
+	us_ausink_packet_s	packets[US_AUSINK_PACKETS];
+} us_ausink_shared_s;
+
+
+us_ausink_shared_s *us_ausink_shared_map(int fd);
+int us_ausink_shared_unmap(us_ausink_shared_s *mem);
+
+void us_ausink_shared_put(us_ausink_shared_s *mem, const us_ausink_packet_s *packet);
+int us_ausink_shared_get(us_ausink_shared_s *mem, u32 *next, us_ausink_packet_s *packet, uint *lost);
@@ -53,6 +53,7 @@
 #include "frame.h"
 #include "xioctl.h"
 #include "tc358743.h"
+#include "mosaic.h"
 
 #ifdef __APPLE__
 #include "macos_camera.h"
@@ -94,6 +95,10 @@ static const struct {
 	{"USERPTR",	V4L2_MEMORY_USERPTR},
 };
 
+static int _capture_open_mosaic(us_capture_s *cap);
+static void _capture_close_mosaic(us_capture_s *cap);
+static int _capture_grab_mosaic(us_capture_s *cap, us_capture_hwbuf_s **hw);
+
 static int _capture_wait_buffer(us_capture_s *cap);
 static int _capture_consume_event(const us_capture_s *cap);
 static void _v4l2_buffer_copy(const struct v4l2_buffer *src, struct v4l2_buffer *dest);
@@ -104,10 +109,13 @@ static int _capture_open_format(us_capture_s *cap, bool first);
 static void _capture_open_hw_fps(us_capture_s *cap);
 static void _capture_open_jpeg_quality(us_capture_s *cap);
 static int _capture_open_io_method(us_capture_s *cap);
+static void _capture_alloc_buffers(us_capture_s *cap, uint n_bufs);
 static int _capture_open_io_method_mmap(us_capture_s *cap);
 static int _capture_open_io_method_userptr(us_capture_s *cap);
 static int _capture_open_queue_buffers(us_capture_s *cap);
 static int _capture_open_export_to_dma(us_capture_s *cap);
+static void _capture_subscribe_source_change(us_capture_s *cap);
+static void _capture_unmap_buffers(us_capture_s *cap);
 static int _capture_apply_resolution(us_capture_s *cap, uint width, uint height, float hz);
 
 static void _capture_apply_controls(const us_capture_s *cap);
@@ -238,6 +246,10 @@ int us_capture_open(us_capture_s *cap) {
 	}
 #endif
 
+	if (cap->mosaic != NULL) {
+		return _capture_open_mosaic(cap);
+	}
+
 	if (access(cap->path, R_OK | W_OK) < 0) {
 		US_ONCE_FOR(run->open_error_once, -errno, {
 			US_LOG_PERROR("No access to capture device");
@@ -282,6 +294,9 @@ int us_capture_open(us_capture_s *cap) {
 	if (_capture_open_format(cap, true) < 0) {
 		goto error;
 	}
+	if (!cap->dv_timings) {
+		_capture_subscribe_source_change(cap);
+	}
 	if (cap->dv_timings && cap->persistent) {
 		struct v4l2_control ctl = {.id = TC358743_CID_LANES_ENOUGH};
 		if (!us_xioctl(run->fd, VIDIOC_G_CTRL, &ctl)) {
@@ -309,10 +324,12 @@ int us_capture_open(us_capture_s *cap) {
 	_capture_apply_controls(cap);
 
 	enum v4l2_buf_type type = run->capture_type;
+	run->streamon_begin_ts = us_get_now_monotonic();
 	if (us_xioctl(run->fd, VIDIOC_STREAMON, &type) < 0) {
 		_LOG_PERROR("Can't start capturing");
 		goto error;
 	}
+	run->streamon_end_ts = us_get_now_monotonic();
 	run->streamon = true;
 
 	run->open_error_once = 0;
@@ -362,6 +379,11 @@ void us_capture_close(us_capture_s *cap) {
 	}
 #endif
 
+	if (cap->mosaic != NULL) {
+		_capture_close_mosaic(cap);
+		return;
+	}
+
 	if (run->streamon) {
 		say = true;
 		_LOG_DEBUG("Calling VIDIOC_STREAMOFF ...");
@@ -375,21 +397,12 @@ void us_capture_close(us_capture_s *cap) {
 	if (run->bufs != NULL) {
 		say = true;
 		_LOG_DEBUG("Releasing HW buffers ...");
+		_capture_unmap_buffers(cap);
 		for (uint index = 0; index < run->n_bufs; ++index) {
 			us_capture_hwbuf_s *hw = &run->bufs[index];
-
-			US_CLOSE_FD(hw->dma_fd);
-
-			if (cap->io_method == V4L2_MEMORY_MMAP) {
-				if (hw->raw.allocated > 0 && hw->raw.data != NULL) {
-					if (munmap(hw->raw.data, hw->raw.allocated) < 0) {
-						_LOG_PERROR("Can't unmap HW buffer=%u", index);
-					}
-				}
-			} else { // V4L2_MEMORY_USERPTR
+			if (cap->io_method == V4L2_MEMORY_USERPTR) {
 				US_DELETE(hw->raw.data, free);
 			}
-
 			if (run->capture_mplane) {
 				free(hw->buf.m.planes);
 			}
@@ -405,6 +418,94 @@ void us_capture_close(us_capture_s *cap) {
 	}
 }
 
+int us_capture_renegotiate(us_capture_s *cap) {
+	// Применяет новое разрешение источника после V4L2_EVENT_SOURCE_CHANGE без закрытия
+	// устройства, так что синки, энкодер и HTTP-клиенты остаются подключенными.
+	// Все буферы должны быть освобождены. Если формат или количество буферов
+	// изменились, то нужен полный перезапуск, и тогда возвращается ошибка.
+
+	us_capture_runtime_s *const run = cap->run;
+
+	const ldf begin_ts = us_get_now_monotonic();
+	const uint prev_width = run->width;
+	const uint prev_height = run->height;
+	const uint prev_format = run->format;
+
+	_LOG_INFO("Renegotiating the format in place ...");
+	for (uint index = 0; index < run->n_bufs; ++index) {
+		assert(!run->bufs[index].grabbed);
+	}
+
+	if (run->streamon) {
+		enum v4l2_buf_type type = run->capture_type;
+		_LOG_DEBUG("Calling VIDIOC_STREAMOFF ...");
+		if (us_xioctl(run->fd, VIDIOC_STREAMOFF, &type) < 0) {
+			_LOG_PERROR("Can't stop capturing");
+			return -1;
+		}
+		run->streamon = false;
+	}
+
+	_capture_unmap_buffers(cap);
+	{
+		struct v4l2_requestbuffers req = {
+			.count = 0,
+			.type = run->capture_type,
+			.memory = cap->io_method,
+		};
+		_LOG_DEBUG("Freeing device buffers ...");
+		if (us_xioctl(run->fd, VIDIOC_REQBUFS, &req) < 0) {
+			_LOG_PERROR("Can't free device buffers");
+			return -1;
+		}
+	}
+
+	if (cap->dv_timings) {
+		const int dv_result = _capture_open_dv_timings(cap, true);
+		if (dv_result < 0) {
+			return dv_result; // No signal, etc.
+		}
+	} else {
+		// Without DV-timings the driver reports the new source resolution as the current format
+		struct v4l2_format fmt = {.type = run->capture_type};
+		if (us_xioctl(run->fd, VIDIOC_G_FMT, &fmt) == 0) {
+			const uint width = (run->capture_mplane ? fmt.fmt.pix_mp.width : fmt.fmt.pix.width);
+			const uint height = (run->capture_mplane ? fmt.fmt.pix_mp.height : fmt.fmt.pix.height);
+			if (_capture_apply_resolution(cap, width, height, run->hz) < 0) {
+				return -1;
+			}
+		}
+	}
+	if (_capture_open_format(cap, true) < 0) {
+		return -1;
+	}
+	if (run->format != prev_format) {
+		_LOG_ERROR("The capture format has changed, restart required");
+		return -1;
+	}
+	if (_capture_open_io_method(cap) < 0) {
+		return -1; // Including the changed number of buffers
+	}
+	if (_capture_open_queue_buffers(cap) < 0) {
+		return -1;
+	}
+	if (run->dma && _capture_open_export_to_dma(cap) < 0) {
+		return -1;
+	}
+
+	enum v4l2_buf_type type = run->capture_type;
+	if (us_xioctl(run->fd, VIDIOC_STREAMON, &type) < 0) {
+		_LOG_PERROR("Can't start capturing");
+		return -1;
+	}
+	run->streamon = true;
+
+	_LOG_INFO("Capturing renegotiated: %ux%u -> %ux%u, time=%.3Lf",
+		prev_width, prev_height, run->width, run->height,
+		us_get_now_monotonic() - begin_ts);
+	return 0;
+}
+
 int us_capture_hwbuf_grab(us_capture_s *cap, us_capture_hwbuf_s **hw) {
 	// Это сложная функция, которая делает сразу много всего, чтобы получить новый фрейм.
 	//   - Вызывается _capture_wait_buffer() с select() внутри, чтобы подождать новый фрейм
@@ -412,6 +513,8 @@ int us_capture_hwbuf_grab(us_capture_s *cap, us_capture_hwbuf_s **hw) {
 	//   - Если есть новые фреймы, то пропустить их все, пока не закончатся и вернуть
 	//     самый-самый свежий, содержащий при этом валидные данные.
 	//   - Если таковых не нашлось, вернуть US_ERROR_NO_DATA.
+	//   - При смене разрешения источника вернуть US_ERROR_SOURCE_CHANGED,
+	//     чтобы вызывающий освободил буферы и сделал us_capture_renegotiate().
 	//   - Ошибка -1 возвращается при любых сбоях.
 
 #if defined(__APPLE__) && defined(WITH_MACOS_CAMERA)
@@ -463,8 +566,13 @@ int us_capture_hwbuf_grab(us_capture_s *cap, us_capture_hwbuf_s **hw) {
 	}
 #endif
 
-	if (_capture_wait_buffer(cap) < 0) {
-		return -1;
+	if (cap->mosaic != NULL) {
+		return _capture_grab_mosaic(cap, hw);
+	}
+
+	const int waited = _capture_wait_buffer(cap);
+	if (waited < 0) {
+		return waited;
 	}
 
 	us_capture_runtime_s *const run = cap->run;
@@ -585,6 +693,11 @@ int us_capture_hwbuf_release(const us_capture_s *cap, us_capture_hwbuf_s *hw) {
 		return 0;
 	}
 #endif
+
+	if (cap->mosaic != NULL) {
+		hw->grabbed = false;
+		return 0;
+	}
 	
 	if (us_xioctl(cap->run->fd, VIDIOC_QBUF, &hw->buf) < 0) {
 		_LOG_PERROR("Can't release HW buffer=%u", index);
@@ -603,6 +716,98 @@ void us_capture_hwbuf_decref(us_capture_hwbuf_s *hw) {
 	atomic_fetch_sub(&hw->refs, 1);
 }
 
+static int _capture_open_mosaic(us_capture_s *cap) {
+	// Вместо устройства кадры собираются из нескольких синков в одну сетку,
+	// так что клиенту нужен только один стрим вместо десятка.
+	us_capture_runtime_s *const run = cap->run;
+
+	us_mosaic_open(cap->mosaic, cap->width, cap->height);
+
+	run->width = cap->width;
+	run->height = cap->height;
+	run->format = V4L2_PIX_FMT_RGB24;
+	run->stride = cap->width * 3;
+	run->hz = (cap->desired_fps > 0 ? cap->desired_fps : 10);
+	run->jpeg_quality = cap->jpeg_quality;
+	run->raw_size = (uz)run->stride * run->height;
+	run->mosaic_next_ts = 0;
+
+	run->n_bufs = cap->n_bufs;
+	US_CALLOC(run->bufs, run->n_bufs);
+	for (uint index = 0; index < run->n_bufs; ++index) {
+		us_capture_hwbuf_s *const hw = &run->bufs[index];
+		hw->dma_fd = -1;
+		hw->raw.dma_fd = -1;
+		hw->buf.index = index;
+		us_frame_realloc_data(&hw->raw, run->raw_size);
+		atomic_init(&hw->refs, 0);
+	}
+
+	_LOG_INFO("Using the mosaic of %u sinks: %ux%u, %.2f fps",
+		cap->mosaic->n_tiles, run->width, run->height, run->hz);
+	return 0;
+}
+
+static void _capture_close_mosaic(us_capture_s *cap) {
+	us_capture_runtime_s *const run = cap->run;
+	if (run->bufs != NULL) {
+		for (uint index = 0; index < run->n_bufs; ++index) {
+			US_DELETE(run->bufs[index].raw.data, free);
+		}
+		US_DELETE(run->bufs, free);
+		run->n_bufs = 0;
+		_LOG_INFO("Capturing stopped");
+	}
+	us_mosaic_close(cap->mosaic);
+}
+
+static int _capture_grab_mosaic(us_capture_s *cap, us_capture_hwbuf_s **hw) {
+	us_capture_runtime_s *const run = cap->run;
+	*hw = NULL;
+
+	const ldf now_ts = us_get_now_monotonic();
+	if (now_ts < run->mosaic_next_ts) {
+		usleep((run->mosaic_next_ts - now_ts) * 1000000);
+	}
+	run->mosaic_next_ts = US_MAX(run->mosaic_next_ts, now_ts) + 1 / (ldf)run->hz;
+
+	if (!us_mosaic_update(cap->mosaic)) {
+		return US_ERROR_NO_DATA; // All tiles are unchanged
+	}
+
+	// Без V4L2 очереди флаг grabbed - единственная защита буфера,
+	// а релизеры сбрасывают его под тем же мьютексом.
+	us_capture_hwbuf_s *free_buf = NULL;
+	if (cap->release_mutex != NULL) {
+		US_MUTEX_LOCK(*cap->release_mutex);
+	}
+	for (uint index = 0; index < run->n_bufs; ++index) {
+		if (!run->bufs[index].grabbed) {
+			free_buf = &run->bufs[index];
+			free_buf->grabbed = true;
+			break;
+		}
+	}
+	if (cap->release_mutex != NULL) {
+		US_MUTEX_UNLOCK(*cap->release_mutex);
+	}
+
+	if (free_buf == NULL) {
+		// Все буферы заняты энкодерами, кадр будет собран на следующем тике
+		cap->mosaic->dirty = true;
+		return US_ERROR_NO_DATA;
+	}
+
+	const us_frame_s *const canvas = cap->mosaic->canvas;
+	memcpy(free_buf->raw.data, canvas->data, canvas->used);
+	US_FRAME_COPY_META(canvas, &free_buf->raw);
+	free_buf->raw.used = canvas->used;
+	free_buf->raw.grab_ts = us_get_now_monotonic();
+	atomic_store(&free_buf->refs, 0);
+	*hw = free_buf;
+	return free_buf - run->bufs;
+}
+
 int _capture_wait_buffer(us_capture_s *cap) {
 	us_capture_runtime_s *const run = cap->run;
 
@@ -639,10 +844,8 @@ int _capture_wait_buffer(us_capture_s *cap) {
 	} else if (selected == 0) {
 		_LOG_ERROR("Device select() timeout");
 		return -1;
-	} else {
-		if (has_error && _capture_consume_event(cap) < 0) {
-			return -1; // Restart required
-		}
+	} else if (has_error) {
+		return _capture_consume_event(cap); // Restart or renegotiation can be required
 	}
 	return 0;
 }
@@ -656,7 +859,7 @@ static int _capture_consume_event(const us_capture_s *cap) {
 	switch (event.type) {
 		case V4L2_EVENT_SOURCE_CHANGE:
 			_LOG_INFO("Got V4L2_EVENT_SOURCE_CHANGE: Source changed");
-			return -1;
+			return US_ERROR_SOURCE_CHANGED;
 		case V4L2_EVENT_EOS:
 			_LOG_INFO("Got V4L2_EVENT_EOS: End of stream");
 			return -1;
@@ -674,7 +877,7 @@ static void _v4l2_buffer_copy(const struct v4l2_buffer *src, struct v4l2_buffer
 	}
 }
 
-bool _capture_is_buffer_valid(const us_capture_s *cap, const struct v4l2_buffer *buf, const u8 *data) {
+static bool _capture_is_buffer_valid(const us_capture_s *cap, const struct v4l2_buffer *buf, const u8 *data) {
 	// Workaround for broken, corrupted frames:
 	// Under low light conditions corrupted frames may get captured.
 	// The good thing is such frames are quite small compared to the regular frames.
@@ -837,7 +1040,7 @@ querystd:
 subscribe:
 	; // Empty statement for the goto label above
 	struct v4l2_event_subscription sub = {.type = V4L2_EVENT_SOURCE_CHANGE};
-	_LOG_DEBUG("Subscribing to V4L2_EVENT_SOURCE_CHANGE ...")
+	_LOG_DEBUG("Subscribing to V4L2_EVENT_SOURCE_CHANGE ...");
 	if (us_xioctl(cap->run->fd, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0) {
 		_LOG_PERROR("Can't subscribe to V4L2_EVENT_SOURCE_CHANGE");
 		return -1;
@@ -1026,6 +1229,21 @@ static int _capture_open_io_method(us_capture_s *cap) {
 	return -1;
 }
 
+static void _capture_alloc_buffers(us_capture_s *cap, uint n_bufs) {
+	us_capture_runtime_s *const run = cap->run;
+
+	_LOG_DEBUG("Allocating device buffers ...");
+	US_CALLOC(run->bufs, n_bufs);
+	for (uint index = 0; index < n_bufs; ++index) {
+		us_capture_hwbuf_s *hw = &run->bufs[index];
+		hw->dma_fd = -1;
+		if (run->capture_mplane) {
+			US_CALLOC(hw->buf.m.planes, VIDEO_MAX_PLANES);
+		}
+	}
+	run->n_bufs = n_bufs;
+}
+
 static int _capture_open_io_method_mmap(us_capture_s *cap) {
 	us_capture_runtime_s *const run = cap->run;
 
@@ -1047,49 +1265,49 @@ static int _capture_open_io_method_mmap(us_capture_s *cap) {
 		_LOG_INFO("Requested %u device buffers, got %u", cap->n_bufs, req.count);
 	}
 
-	_LOG_DEBUG("Allocating device buffers ...");
-
-	US_CALLOC(run->bufs, req.count);
+	if (run->bufs != NULL && req.count != run->n_bufs) {
+		// Renegotiation, the caller will restart the capture
+		_LOG_ERROR("The number of device buffers has changed: %u -> %u", run->n_bufs, req.count);
+		return -1;
+	}
+	if (run->bufs == NULL) {
+		_capture_alloc_buffers(cap, req.count);
+	}
 
-	for (run->n_bufs = 0; run->n_bufs < req.count; ++run->n_bufs) {
+	for (uint index = 0; index < run->n_bufs; ++index) {
 		struct v4l2_buffer buf = {0};
 		struct v4l2_plane planes[VIDEO_MAX_PLANES] = {0};
 		buf.type = run->capture_type;
 		buf.memory = V4L2_MEMORY_MMAP;
-		buf.index = run->n_bufs;
+		buf.index = index;
 		if (run->capture_mplane) {
 			buf.m.planes = planes;
 			buf.length = VIDEO_MAX_PLANES;
 		}
 
-		_LOG_DEBUG("Calling us_xioctl(VIDIOC_QUERYBUF) for device buffer=%u ...", run->n_bufs);
+		_LOG_DEBUG("Calling us_xioctl(VIDIOC_QUERYBUF) for device buffer=%u ...", index);
 		if (us_xioctl(run->fd, VIDIOC_QUERYBUF, &buf) < 0) {
 			_LOG_PERROR("Can't VIDIOC_QUERYBUF");
 			return -1;
 		}
 
-		us_capture_hwbuf_s *hw = &run->bufs[run->n_bufs];
+		us_capture_hwbuf_s *hw = &run->bufs[index];
 		atomic_init(&hw->refs, 0);
 		const uz buf_size = (run->capture_mplane ? buf.m.planes[0].length : buf.length);
 		const off_t buf_offset = (run->capture_mplane ? buf.m.planes[0].m.mem_offset : buf.m.offset);
 
-		_LOG_DEBUG("Mapping device buffer=%u ...", run->n_bufs);
+		_LOG_DEBUG("Mapping device buffer=%u ...", index);
 		if ((hw->raw.data = mmap(
 			NULL, buf_size,
 			PROT_READ | PROT_WRITE, MAP_SHARED,
 			run->fd, buf_offset
 		)) == MAP_FAILED) {
-			_LOG_PERROR("Can't map device buffer=%u", run->n_bufs);
+			_LOG_PERROR("Can't map device buffer=%u", index);
+			hw->raw.data = NULL;
 			return -1;
 		}
 		assert(hw->raw.data != NULL);
 		hw->raw.allocated = buf_size;
-
-		if (run->capture_mplane) {
-			US_CALLOC(hw->buf.m.planes, VIDEO_MAX_PLANES);
-		}
-
-		hw->dma_fd = -1;
 	}
 	return 0;
 }
@@ -1115,20 +1333,26 @@ static int _capture_open_io_method_userptr(us_capture_s *cap) {
 		_LOG_INFO("Requested %u device buffers, got %u", cap->n_bufs, req.count);
 	}
 
-	_LOG_DEBUG("Allocating device buffers ...");
-
-	US_CALLOC(run->bufs, req.count);
+	if (run->bufs != NULL && req.count != run->n_bufs) {
+		// Renegotiation, the caller will restart the capture
+		_LOG_ERROR("The number of device buffers has changed: %u -> %u", run->n_bufs, req.count);
+		return -1;
+	}
+	if (run->bufs == NULL) {
+		_capture_alloc_buffers(cap, req.count);
+	}
 
 	const uint page_size = getpagesize();
 	const uint buf_size = us_align_size(run->raw_size, page_size);
 
-	for (run->n_bufs = 0; run->n_bufs < req.count; ++run->n_bufs) {
-		us_capture_hwbuf_s *hw = &run->bufs[run->n_bufs];
-		assert((hw->raw.data = aligned_alloc(page_size, buf_size)) != NULL);
-		memset(hw->raw.data, 0, buf_size);
-		hw->raw.allocated = buf_size;
-		if (run->capture_mplane) {
-			US_CALLOC(hw->buf.m.planes, VIDEO_MAX_PLANES);
+	for (uint index = 0; index < run->n_bufs; ++index) {
+		us_capture_hwbuf_s *hw = &run->bufs[index];
+		if (hw->raw.allocated < buf_size) {
+			// On renegotiation reuse the buffers which are large enough
+			US_DELETE(hw->raw.data, free);
+			assert((hw->raw.data = aligned_alloc(page_size, buf_size)) != NULL);
+			memset(hw->raw.data, 0, buf_size);
+			hw->raw.allocated = buf_size;
 		}
 	}
 	return 0;
@@ -1188,6 +1412,36 @@ error:
 	return -1;
 }
 
+static void _capture_subscribe_source_change(us_capture_s *cap) {
+	// Для DV-timings подписка обязательна и делается в _capture_open_dv_timings(),
+	// а тут она нужна только для устройств, которые сами сообщают о смене разрешения.
+	struct v4l2_event_subscription sub = {.type = V4L2_EVENT_SOURCE_CHANGE};
+	_LOG_DEBUG("Subscribing to V4L2_EVENT_SOURCE_CHANGE (optional) ...");
+	if (us_xioctl(cap->run->fd, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0) {
+		_LOG_DEBUG("The device doesn't support V4L2_EVENT_SOURCE_CHANGE");
+	}
+}
+
+static void _capture_unmap_buffers(us_capture_s *cap) {
+	us_capture_runtime_s *const run = cap->run;
+
+	for (uint index = 0; index < run->n_bufs; ++index) {
+		us_capture_hwbuf_s *hw = &run->bufs[index];
+
+		US_CLOSE_FD(hw->dma_fd);
+
+		if (cap->io_method == V4L2_MEMORY_MMAP) {
+			if (hw->raw.allocated > 0 && hw->raw.data != NULL) {
+				if (munmap(hw->raw.data, hw->raw.allocated) < 0) {
+					_LOG_PERROR("Can't unmap HW buffer=%u", index);
+				}
+			}
+			hw->raw.data = NULL;
+			hw->raw.allocated = 0;
+		}
+	}
+}
+
 static int _capture_apply_resolution(us_capture_s *cap, uint width, uint height, float hz) {
 	// Тут VIDEO_MIN_* не используются из-за странностей минимального разрешения при отсутствии сигнала
 	// у некоторых устройств, например TC358743
@@ -1334,3 +1588,61 @@ static const char *_io_method_to_string_supported(enum v4l2_memory io_method) {
 	});
 	return "unsupported";
 }
+
+
+#ifdef FUZZ_CAPTURE_JPEG
+// Проверка целостности MJPEG-буферов с камеры. Первый байт входа задает
+// настройки захвата (формат, --min-frame-size, --allow-truncated-frames),
+// остальное - содержимое буфера с bytesused точно по его размеру.
+//   clang -g -O1 -std=c17 -D_GNU_SOURCE -fsanitize=fuzzer,address,undefined -DUS_FUZZ_LIBFUZZER -DFUZZ_CAPTURE_JPEG -o fuzz-capture-jpeg libs/capture.c libs/frame.c libs/pixel.c libs/logging.c libs/tc358743.c libs/mosaic.c libs/memsink.c libs/memsinksh.c libs/unjpeg.c -ljpeg -lm -pthread
+//   gcc -g -O1 -std=c17 -D_GNU_SOURCE -fsanitize=address,undefined -DFUZZ_CAPTURE_JPEG -o fuzz-capture-jpeg libs/capture.c libs/frame.c libs/pixel.c libs/logging.c libs/tc358743.c libs/mosaic.c libs/memsink.c libs/memsinksh.c libs/unjpeg.c -ljpeg -lm -pthread
+
+#include "fuzz.h"
+
+
+#define _JPEG_HEAD \
+	"\xFF\xD8\xFF\xE0\x00\x10JFIF\x00\x01\x01\x00\x00\x01\x00\x01\x00\x00" \
+	"\xFF\xDB\x00\x43\x00" \
+	"\x08\x06\x06\x07\x06\x05\x08\x07\x07\x07\x09\x09\x08\x0A\x0C\x14\x0D\x0C\x0B\x0B\x0C\x19\x12\x13\x0F" \
+	"\x14\x1D\x1A\x1F\x1E\x1D\x1A\x1C\x1C\x20\x24\x2E\x27\x20\x22\x2C\x23\x1C\x1C\x28\x37\x29\x2C\x30\x31" \
+	"\x34\x34\x34\x1F\x27\x39\x3D\x38\x32\x3C\x2E\x33\x34\x32" \
+	"\xFF\xC0\x00\x0B\x08\x00\x08\x00\x08\x01\x01\x11\x00" \
+	"\xFF\xDA\x00\x08\x01\x01\x00\x00\x3F\x00\xD2\xCF\x20"
+
+const us_fuzz_seed_s us_fuzz_seeds[] = {
+	US_FUZZ_SEED("\x00" _JPEG_HEAD "\xFF\xD9"),
+	US_FUZZ_SEED("\x00" _JPEG_HEAD "\xD9\x00"),
+	US_FUZZ_SEED("\x00" _JPEG_HEAD "\x00\x00\x00\x00"),
+	US_FUZZ_SEED("\x01" _JPEG_HEAD "\x12\x34"),
+	US_FUZZ_SEED("\x80" _JPEG_HEAD "\xFF\xD9"),
+	US_FUZZ_SEED("\x00\xFF\xD8\xFF\xD9"),
+	US_FUZZ_SEED("\x02"),
+};
+const uz us_fuzz_seeds_count = US_ARRAY_LEN(us_fuzz_seeds);
+
+void us_fuzz_one(const u8 *data, uz size) {
+	if (size < 1 || size - 1 > UINT32_MAX) {
+		return;
+	}
+
+	static us_capture_s *cap = NULL;
+	if (cap == NULL) {
+		cap = us_capture_init();
+	}
+	cap->allow_truncated_frames = (data[0] & 0x01);
+	cap->run->format = ((data[0] & 0x02) ? V4L2_PIX_FMT_YUYV : V4L2_PIX_FMT_MJPEG);
+	cap->min_frame_size = (data[0] >> 2) * 4; // 0...252, default is 128
+
+	const struct v4l2_buffer buf = {.bytesused = size - 1};
+	const bool valid = _capture_is_buffer_valid(cap, &buf, data + 1);
+	if (valid) {
+		assert(buf.bytesused >= cap->min_frame_size);
+		if (us_is_jpeg(cap->run->format)) {
+			assert(buf.bytesused >= 125);
+		}
+	}
+}
+
+#undef _JPEG_HEAD
+
+#endif
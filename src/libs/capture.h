@@ -24,6 +24,8 @@
 
 #include <stdatomic.h>
 
+#include <pthread.h>
+
 #ifdef __APPLE__
 #include "macos_v4l2_stub.h"
 #else
@@ -32,6 +34,7 @@
 
 #include "types.h"
 #include "frame.h"
+#include "mosaic.h"
 
 #if defined(__APPLE__) && defined(WITH_MACOS_CAMERA)
 #include "macos_camera.h"
@@ -75,7 +78,10 @@ typedef struct {
 	enum v4l2_buf_type	capture_type;
 	bool				capture_mplane;
 	bool				streamon;
+	ldf					streamon_begin_ts;
+	ldf					streamon_end_ts;
 	int					open_error_once;
+	ldf					mosaic_next_ts;
 } us_capture_runtime_s;
 
 typedef enum {
@@ -127,6 +133,8 @@ typedef struct {
 	bool				persistent;
 	uint				timeout;
 	us_controls_s 		ctl;
+	us_mosaic_s			*mosaic; // Replaces the device if set
+	pthread_mutex_t		*release_mutex; // Guards the grabbed flags of the mosaic against the releasers
 	us_capture_runtime_s *run;
 
 #if defined(__APPLE__) && defined(WITH_MACOS_CAMERA)
@@ -144,6 +152,7 @@ int us_capture_parse_io_method(const char *str);
 
 int us_capture_open(us_capture_s *cap);
 void us_capture_close(us_capture_s *cap);
+int us_capture_renegotiate(us_capture_s *cap);
 
 int us_capture_hwbuf_grab(us_capture_s *cap, us_capture_hwbuf_s **hw);
 int us_capture_hwbuf_release(const us_capture_s *cap, us_capture_hwbuf_s *hw);
@@ -79,7 +79,7 @@ bool us_frame_compare(const us_frame_s *a, const us_frame_s *b) {
 	return (
 		a->allocated && b->allocated
 		&& US_FRAME_COMPARE_GEOMETRY(a, b)
-		&& !memcmp(a->data, b->data, b->used)
+		&& !memcmp(a->data, b->data, b->used) // It's vectorized and dispatched by the libc
 	);
 }
 
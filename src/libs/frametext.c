@@ -167,31 +167,30 @@ void _frametext_draw_line(
 	us_frame_s *const frame = ft->frame;
 
 	const size_t len = strlen(line);
+	if (start_x >= frame->width) {
+		return;
+	}
+	const uint line_width = US_MIN(8 * len * scale_x, frame->width - start_x);
 
-	for (uint ch_y = 0; ch_y < 8 * scale_y; ++ch_y) {
-		const uint canvas_y = start_y + ch_y;
-		for (uint ch_x = 0; ch_x < 8 * len * scale_x; ++ch_x) {
-			if ((start_x + ch_x) >= frame->width) {
-				break;
-			}
-			const uint canvas_x = (start_x + ch_x) * 3;
-			const uint offset = canvas_y * frame->stride + canvas_x;
-			if (offset >= frame->used) {
-				break;
-			}
+	for (uint ch_byte = 0; ch_byte < 8; ++ch_byte) {
+		// Each row of the glyphs is drawn once and then replicated scale_y times
+		const uint first_y = start_y + ch_byte * scale_y;
+		if (first_y >= frame->height) {
+			break;
+		}
+		u8 *const first = frame->data + (uz)first_y * frame->stride + start_x * 3;
 
+		for (uint ch_x = 0; ch_x < line_width; ch_x += scale_x) {
 			const u8 ch = US_MIN((u8)line[ch_x / 8 / scale_x], sizeof(US_FRAMETEXT_FONT) / 8 - 1);
-			const uint ch_byte = (ch_y / scale_y) % 8;
 			const uint ch_bit = (ch_x / scale_x) % 8;
-			const bool pix_on = !!(US_FRAMETEXT_FONT[ch][ch_byte] & (1 << ch_bit));
-
-			u8 *const r = &frame->data[offset];
-			u8 *const g = r + 1;
-			u8 *const b = r + 2;
+			if (US_FRAMETEXT_FONT[ch][ch_byte] & (1 << ch_bit)) {
+				// The canvas is cleared, so only the lit pixels are drawn
+				memset(first + ch_x * 3, 0x65, US_MIN(scale_x, line_width - ch_x) * 3); // RGB/BGR-friendly
+			}
+		}
 
-			*r = pix_on * 0x65; // RGB/BGR-friendly
-			*g = pix_on * 0x65;
-			*b = pix_on * 0x65;
+		for (uint ch_y = 1; ch_y < scale_y && first_y + ch_y < frame->height; ++ch_y) {
+			memcpy(first + (uz)ch_y * frame->stride, first, line_width * 3);
 		}
 	}
 }
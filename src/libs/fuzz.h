@@ -0,0 +1,276 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+// Общий драйвер для встроенных фаззинг-харнессов (блоки #ifdef FUZZ_*).
+// Харнесс определяет us_fuzz_one() и набор затравок us_fuzz_seeds[],
+// затем подключает этот файл. Только для сборок с -DFUZZ_*, в основную
+// сборку он не попадает никогда.
+//
+// С -DUS_FUZZ_LIBFUZZER получается только LLVMFuzzerTestOneInput()
+// для clang -fsanitize=fuzzer. Без него добавляется свой main(), который
+// годится для AFL (режим файлов) и для простого прогона под ASan/UBSan:
+//   harness [--seconds N] [--seed N]   - мутации затравок, пишет exec/s и MB/s
+//   harness FILE|DIR ...               - однократный прогон входов (afl-fuzz ... @@)
+//   harness --dump-seeds DIR           - выгрузить затравки как начальный корпус
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "tools.h"
+#include "array.h"
+
+
+typedef struct {
+	const u8	*data;
+	uz			size;
+} us_fuzz_seed_s;
+
+#define US_FUZZ_SEED(x_str) {(const u8*)(x_str), sizeof(x_str) - 1}
+
+
+void us_fuzz_one(const u8 *data, uz size);
+
+extern const us_fuzz_seed_s us_fuzz_seeds[];
+extern const uz us_fuzz_seeds_count;
+
+
+// Для харнессов кода, который логирует каждый плохой вход: логи уходят
+// в /dev/null. Санитайзеры и libFuzzer пишут в fd 2 мимо stdio,
+// так что их отчеты остаются. Подменить stderr можно только в glibc.
+static inline void us_fuzz_silence_logging(void) {
+#	ifdef __GLIBC__
+	FILE *const fp = fopen("/dev/null", "w");
+	assert(fp != NULL);
+	stderr = fp;
+#	endif
+}
+
+
+int LLVMFuzzerTestOneInput(const u8 *data, uz size);
+int LLVMFuzzerTestOneInput(const u8 *data, uz size) {
+	us_fuzz_one(data, size);
+	return 0;
+}
+
+
+#ifndef US_FUZZ_LIBFUZZER
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+
+#define _US_FUZZ_MAX_SIZE	(64 * 1024)
+
+
+static void _us_fuzz_run_copy(const u8 *data, uz size) {
+	// Точный размер буфера, чтобы ASan видел любое чтение за его концом
+	u8 *const copy = malloc(size > 0 ? size : 1);
+	assert(copy != NULL);
+	if (size > 0) {
+		memcpy(copy, data, size);
+	}
+	us_fuzz_one(copy, size);
+	free(copy);
+}
+
+static int _us_fuzz_run_file(const char *path, uz *count) {
+	struct stat st;
+	if (stat(path, &st) < 0) {
+		perror(path);
+		return -1;
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		DIR *const dir = opendir(path);
+		if (dir == NULL) {
+			perror(path);
+			return -1;
+		}
+		int retval = 0;
+		struct dirent *ent;
+		while ((ent = readdir(dir)) != NULL) {
+			if (ent->d_name[0] != '.') {
+				char *sub;
+				US_ASPRINTF(sub, "%s/%s", path, ent->d_name);
+				retval |= _us_fuzz_run_file(sub, count);
+				free(sub);
+			}
+		}
+		closedir(dir);
+		return retval;
+	}
+
+	FILE *const fp = fopen(path, "rb");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+	u8 *data;
+	US_CALLOC(data, _US_FUZZ_MAX_SIZE);
+	const uz size = fread(data, 1, _US_FUZZ_MAX_SIZE, fp);
+	fclose(fp);
+	_us_fuzz_run_copy(data, size);
+	free(data);
+	++*count;
+	return 0;
+}
+
+static int _us_fuzz_dump_seeds(const char *path) {
+	for (uz index = 0; index < us_fuzz_seeds_count; ++index) {
+		char *name;
+		US_ASPRINTF(name, "%s/seed-%03zu", path, index);
+		FILE *const fp = fopen(name, "wb");
+		if (fp == NULL) {
+			perror(name);
+			free(name);
+			return -1;
+		}
+		fwrite(us_fuzz_seeds[index].data, 1, us_fuzz_seeds[index].size, fp);
+		fclose(fp);
+		free(name);
+	}
+	printf("%zu seeds written to %s\n", us_fuzz_seeds_count, path);
+	return 0;
+}
+
+static u64 _us_fuzz_rand(u64 *state) {
+	// xorshift64*
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static uz _us_fuzz_mutate(u8 *buf, uz size, u64 *rs) {
+	static const u8 interesting[] = {0x00, 0x01, 0x7F, 0x80, 0xFF, 0xC0, 0xC4, 0xD9, 0xDA, '/', '.', '%', '&', '=', '+'};
+
+	const uint rounds = 1 + _us_fuzz_rand(rs) % 8;
+	for (uint round = 0; round < rounds; ++round) {
+		const uz pos = (size > 0 ? _us_fuzz_rand(rs) % size : 0);
+		switch (_us_fuzz_rand(rs) % 8) {
+			case 0: if (size > 0) { buf[pos] ^= 1 << (_us_fuzz_rand(rs) % 8); } break;
+			case 1: if (size > 0) { buf[pos] = _us_fuzz_rand(rs); } break;
+			case 2: if (size > 0) { buf[pos] = interesting[_us_fuzz_rand(rs) % US_ARRAY_LEN(interesting)]; } break;
+			case 3: // Insert
+				if (size < _US_FUZZ_MAX_SIZE) {
+					memmove(buf + pos + 1, buf + pos, size - pos);
+					buf[pos] = _us_fuzz_rand(rs);
+					++size;
+				}
+				break;
+			case 4: // Delete
+				if (size > 0) {
+					memmove(buf + pos, buf + pos + 1, size - pos - 1);
+					--size;
+				}
+				break;
+			case 5: size = pos; break; // Truncate
+			case 6: // Overwrite a block with another part of the input
+				if (size > 1) {
+					const uz from = _us_fuzz_rand(rs) % size;
+					const uz len = 1 + _us_fuzz_rand(rs) % US_MIN(size - US_MAX(from, pos), (uz)32);
+					memmove(buf + pos, buf + from, len);
+				}
+				break;
+			case 7: { // Splice with another seed
+				const us_fuzz_seed_s *const seed = &us_fuzz_seeds[_us_fuzz_rand(rs) % us_fuzz_seeds_count];
+				const uz len = US_MIN(seed->size, (uz)_US_FUZZ_MAX_SIZE - pos);
+				memcpy(buf + pos, seed->data, len);
+				size = US_MAX(size, pos + len);
+				break;
+			}
+		}
+	}
+	return size;
+}
+
+static void _us_fuzz_mutate_loop(uint seconds, u64 rs) {
+	u8 *buf;
+	US_CALLOC(buf, _US_FUZZ_MAX_SIZE);
+
+	u64 execs = 0;
+	u64 bytes = 0;
+	const ldf begin_ts = us_get_now_monotonic();
+	ldf now_ts = begin_ts;
+
+	// Сначала все затравки как есть, потом мутации
+	for (uz index = 0; index < us_fuzz_seeds_count; ++index) {
+		_us_fuzz_run_copy(us_fuzz_seeds[index].data, us_fuzz_seeds[index].size);
+		bytes += us_fuzz_seeds[index].size;
+		++execs;
+	}
+
+	while (now_ts - begin_ts < seconds) {
+		for (uint batch = 0; batch < 256; ++batch) {
+			const us_fuzz_seed_s *const seed = &us_fuzz_seeds[_us_fuzz_rand(&rs) % us_fuzz_seeds_count];
+			memcpy(buf, seed->data, seed->size);
+			const uz size = _us_fuzz_mutate(buf, seed->size, &rs);
+			_us_fuzz_run_copy(buf, size);
+			bytes += size;
+			++execs;
+		}
+		now_ts = us_get_now_monotonic();
+	}
+	free(buf);
+
+	const ldf took = US_MAX(now_ts - begin_ts, (ldf)0.001);
+	printf("%llu execs in %.2Lf s: %.0Lf exec/s, %.2Lf MB/s\n",
+		(ull)execs, took, execs / took, bytes / took / (1024 * 1024));
+}
+
+int main(int argc, char **argv) {
+	uint seconds = 10;
+	u64 rs = us_get_now_monotonic_u64() | 1;
+	bool inputs = false;
+	uz count = 0;
+	int retval = 0;
+
+	for (int index = 1; index < argc; ++index) {
+		if (!strcmp(argv[index], "--seconds") && index + 1 < argc) {
+			seconds = strtoul(argv[++index], NULL, 10);
+		} else if (!strcmp(argv[index], "--seed") && index + 1 < argc) {
+			rs = strtoull(argv[++index], NULL, 0) | 1;
+		} else if (!strcmp(argv[index], "--dump-seeds") && index + 1 < argc) {
+			return -_us_fuzz_dump_seeds(argv[++index]);
+		} else {
+			retval |= _us_fuzz_run_file(argv[index], &count);
+			inputs = true;
+		}
+	}
+
+	if (inputs) {
+		printf("%zu inputs passed\n", count);
+		return -retval;
+	}
+	printf("Mutating %zu seeds for %u s, seed=0x%llx ...\n", us_fuzz_seeds_count, seconds, (ull)rs);
+	_us_fuzz_mutate_loop(seconds, rs);
+	return 0;
+}
+
+#undef _US_FUZZ_MAX_SIZE
+
+#endif // US_FUZZ_LIBFUZZER
@@ -0,0 +1,482 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+#include "health.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include <pthread.h>
+
+#ifdef __APPLE__
+#include "macos_v4l2_stub.h"
+#else
+#include <linux/videodev2.h>
+#endif
+
+#include "types.h"
+#include "tools.h"
+#include "threading.h"
+#include "frame.h"
+#include "unjpeg.h"
+
+
+#define _GRID_SIZE		160 // Samples on the longest side
+#define _MAX_GRADIENT	510
+#define _EDGES_PERCENT	10 // The strongest gradients are not used for the noise
+// The noise is averaged out at 1/8 scale, but it still costs bits: a JPEG frame
+// which looks blurry there while being so big may be just as well noisy.
+#define _JPEG_NOISY_BPP	2
+
+
+static uint _get_bytes_per_pixel(uint format);
+static void _rebuild_grid(us_health_runtime_s *run, const us_frame_s *frame);
+static void _measure(us_health_s *health, const us_frame_s *frame, us_health_stats_s *stats);
+static us_health_state_e _evaluate(const us_health_s *health, us_health_stats_s *stats, bool has_prev);
+
+
+us_health_s *us_health_init(void) {
+	us_health_runtime_s *run;
+	US_CALLOC(run, 1);
+	run->decoded = us_frame_init();
+	run->stats.state = US_HEALTH_UNKNOWN;
+	US_MUTEX_INIT(run->mutex);
+
+	us_health_s *health;
+	US_CALLOC(health, 1);
+	health->black_level = 24;
+	health->frozen_diff = 0.1;
+	health->frozen_sec = 3;
+	health->noise_level = 12;
+	health->blur_level = 10;
+	health->run = run;
+	return health;
+}
+
+void us_health_destroy(us_health_s *health) {
+	US_MUTEX_DESTROY(health->run->mutex);
+	US_DELETE(health->run->grid, free);
+	US_DELETE(health->run->gradients, free);
+	US_DELETE(health->run->noises, free);
+	us_frame_destroy(health->run->decoded);
+	free(health->run);
+	free(health);
+}
+
+const char *us_health_state_to_string(us_health_state_e state) {
+	switch (state) {
+		case US_HEALTH_OK: return "ok";
+		case US_HEALTH_UNKNOWN: return "unknown";
+		case US_HEALTH_BLACK: return "black";
+		case US_HEALTH_FROZEN: return "frozen";
+		case US_HEALTH_NOISY: return "noisy";
+		case US_HEALTH_BLURRY: return "blurry";
+	}
+	return "???";
+}
+
+us_health_state_e us_health_process(us_health_s *health, const us_frame_s *frame) {
+	// Вызывается на каждый кадр, а считает только каждый N-й.
+	// Между проверками возвращается последнее состояние.
+	us_health_runtime_s *const run = health->run;
+
+	if (health->interval == 0) {
+		return US_HEALTH_OK;
+	}
+	if (run->count > 0) {
+		run->count = (run->count + 1) % health->interval;
+		return run->stats.state;
+	}
+	run->count = 1 % health->interval;
+
+	us_health_stats_s stats = run->stats;
+	const us_frame_s *const jpeg = (us_is_jpeg(frame->format) ? frame : NULL);
+	if (jpeg != NULL) {
+		// The IDCT at 1/8 gives the DC of each block, it's enough for the grid
+		// and costs a small part of the full decoding.
+		if (us_unjpeg_scaled(frame, run->decoded, 8) < 0) {
+			stats.state = US_HEALTH_UNKNOWN;
+			goto done;
+		}
+		frame = run->decoded;
+	}
+	const uint bpp = _get_bytes_per_pixel(frame->format);
+	if (
+		bpp == 0 || frame->width < 3 || frame->height < 3
+		|| frame->stride < frame->width * bpp
+		|| frame->used < (uz)frame->stride * frame->height
+	) {
+		stats.state = US_HEALTH_UNKNOWN;
+	} else {
+		bool has_prev = (run->grid != NULL);
+		if (
+			run->width != frame->width
+			|| run->height != frame->height
+			|| run->format != frame->format
+			|| run->stride != frame->stride
+		) {
+			_rebuild_grid(run, frame);
+			has_prev = false;
+		}
+		_measure(health, frame, &stats);
+		stats.state = _evaluate(health, &stats, has_prev);
+		if (
+			jpeg != NULL && stats.state == US_HEALTH_BLURRY
+			&& jpeg->used * 8 > (uz)jpeg->width * jpeg->height * _JPEG_NOISY_BPP
+		) {
+			stats.state = US_HEALTH_UNKNOWN;
+		}
+	}
+
+done:
+	US_MUTEX_LOCK(run->mutex);
+	run->stats = stats;
+	US_MUTEX_UNLOCK(run->mutex);
+	return stats.state;
+}
+
+void us_health_get_stats(us_health_s *health, us_health_stats_s *stats) {
+	US_MUTEX_LOCK(health->run->mutex);
+	*stats = health->run->stats;
+	US_MUTEX_UNLOCK(health->run->mutex);
+}
+
+static uint _get_bytes_per_pixel(uint format) {
+	switch (format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_RGB565: return 2;
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24: return 3;
+		case V4L2_PIX_FMT_GREY:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420: return 1;
+		default: break;
+	}
+	return 0;
+}
+
+static void _rebuild_grid(us_health_runtime_s *run, const us_frame_s *frame) {
+	run->width = frame->width;
+	run->height = frame->height;
+	run->format = frame->format;
+	run->stride = frame->stride;
+
+	// Отступ в один пиксель по краям для окрестности 3x3
+	run->step = US_MAX((uint)2, US_MAX(frame->width, frame->height) / _GRID_SIZE);
+	run->grid_w = (frame->width - 3) / run->step + 1;
+	run->grid_h = (frame->height - 3) / run->step + 1;
+	US_DELETE(run->grid, free);
+	US_DELETE(run->gradients, free);
+	US_DELETE(run->noises, free);
+	US_CALLOC(run->grid, run->grid_w * run->grid_h);
+	US_CALLOC(run->gradients, run->grid_w * run->grid_h);
+	US_CALLOC(run->noises, run->grid_w * run->grid_h);
+}
+
+static inline int _get_luma(const u8 *row, uint x, uint format) {
+	switch (format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU: return row[x * 2];
+		case V4L2_PIX_FMT_UYVY: return row[x * 2 + 1];
+		case V4L2_PIX_FMT_RGB24: {
+			const u8 *const px = row + x * 3;
+			return (77 * px[0] + 150 * px[1] + 29 * px[2]) >> 8;
+		}
+		case V4L2_PIX_FMT_BGR24: {
+			const u8 *const px = row + x * 3;
+			return (77 * px[2] + 150 * px[1] + 29 * px[0]) >> 8;
+		}
+		case V4L2_PIX_FMT_RGB565: {
+			const uint px = row[x * 2] | (row[x * 2 + 1] << 8);
+			const uint r = ((px >> 11) & 0x1F) << 3;
+			const uint g = ((px >> 5) & 0x3F) << 2;
+			const uint b = (px & 0x1F) << 3;
+			return (77 * r + 150 * g + 29 * b) >> 8;
+		}
+		default: return row[x]; // Grey and the luma plane of YUV420
+	}
+}
+
+static void _measure(us_health_s *health, const us_frame_s *frame, us_health_stats_s *stats) {
+	us_health_runtime_s *const run = health->run;
+	const uint format = frame->format;
+	const uint stride = frame->stride;
+
+	u64 sum = 0;
+	u64 sum_sq = 0;
+	s64 lap_sum = 0;
+	u64 lap_sum_sq = 0;
+	u64 diff_sum = 0;
+	uint hist[US_HEALTH_HIST_BINS] = {0};
+	uint gradients_hist[_MAX_GRADIENT + 1] = {0};
+
+	for (uint gy = 0; gy < run->grid_h; ++gy) {
+		const uint y = 1 + gy * run->step;
+		const u8 *const r0 = frame->data + (uz)(y - 1) * stride;
+		const u8 *const r1 = r0 + stride;
+		const u8 *const r2 = r1 + stride;
+		u8 *const grid_row = run->grid + (uz)gy * run->grid_w;
+
+		for (uint gx = 0; gx < run->grid_w; ++gx) {
+			const uint x = 1 + gx * run->step;
+			// a b c
+			// d e f
+			// g h i
+			const int a = _get_luma(r0, x - 1, format);
+			const int b = _get_luma(r0, x, format);
+			const int c = _get_luma(r0, x + 1, format);
+			const int d = _get_luma(r1, x - 1, format);
+			const int e = _get_luma(r1, x, format);
+			const int f = _get_luma(r1, x + 1, format);
+			const int g = _get_luma(r2, x - 1, format);
+			const int h = _get_luma(r2, x, format);
+			const int i = _get_luma(r2, x + 1, format);
+
+			sum += e;
+			sum_sq += e * e;
+			++hist[e * US_HEALTH_HIST_BINS / 256];
+
+			const int lap = 4 * e - b - d - f - h;
+			lap_sum += lap;
+			lap_sum_sq += lap * lap;
+
+			// Immerkaer: the difference of two Laplacians is blind to the image
+			// structure, except for the edges, which are skipped below.
+			const uint gradient = abs(f - d) + abs(h - b);
+			const uz si = (uz)gy * run->grid_w + gx;
+			run->gradients[si] = gradient;
+			run->noises[si] = abs(4 * e - 2 * (b + d + f + h) + (a + c + g + i));
+			++gradients_hist[gradient];
+
+			diff_sum += abs(e - grid_row[gx]);
+			grid_row[gx] = e;
+		}
+	}
+
+	const uint n = run->grid_w * run->grid_h;
+
+	uint edge = 0;
+	for (uint flat = 0; edge < _MAX_GRADIENT; ++edge) {
+		flat += gradients_hist[edge];
+		if (flat >= (u64)n * (100 - _EDGES_PERCENT) / 100) {
+			break;
+		}
+	}
+	u64 noise_sum = 0;
+	uint noise_samples = 0;
+	for (uint si = 0; si < n; ++si) {
+		if (run->gradients[si] <= edge) {
+			noise_sum += run->noises[si];
+			++noise_samples;
+		}
+	}
+
+	stats->width = frame->width;
+	stats->height = frame->height;
+	stats->samples = n;
+	stats->mean = (float)sum / n;
+	stats->stddev = sqrtf(US_MAX(0.0f, (float)sum_sq / n - stats->mean * stats->mean));
+	stats->diff = (float)diff_sum / n;
+	stats->noise = sqrtf(M_PI / 2) / 6 * noise_sum / US_MAX(noise_samples, (uint)1);
+	// The noise adds 20*sigma^2 to the Laplacian variance (the sum of the squared weights)
+	const float lap_mean = (float)lap_sum / n;
+	stats->sharpness = US_MAX(0.0f, (float)lap_sum_sq / n - lap_mean * lap_mean - 20 * stats->noise * stats->noise);
+	for (uint index = 0; index < US_HEALTH_HIST_BINS; ++index) {
+		stats->hist[index] = (float)hist[index] / n;
+	}
+	stats->ts = us_get_now_monotonic();
+}
+
+static us_health_state_e _evaluate(const us_health_s *health, us_health_stats_s *stats, bool has_prev) {
+	if (has_prev && stats->diff < health->frozen_diff) {
+		if (stats->frozen_since_ts == 0) {
+			stats->frozen_since_ts = stats->ts;
+		}
+	} else {
+		stats->frozen_since_ts = 0;
+	}
+
+	if (stats->mean < health->black_level && stats->stddev < health->black_level) {
+		return US_HEALTH_BLACK; // A lens cap is black and frozen, it's more specific
+	}
+	if (stats->frozen_since_ts > 0 && stats->ts - stats->frozen_since_ts >= health->frozen_sec) {
+		return US_HEALTH_FROZEN;
+	}
+	if (stats->noise > health->noise_level) {
+		return US_HEALTH_NOISY;
+	}
+	if (stats->sharpness < health->blur_level) {
+		return US_HEALTH_BLURRY;
+	}
+	return US_HEALTH_OK;
+}
+
+
+#ifdef TEST_HEALTH
+// The states of the synthetic frames and the cost of a check at 1080p,
+// both raw and compressed to JPEG.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_HEALTH -o health-test libs/health.c libs/unjpeg.c libs/frame.c libs/pixel.c libs/logging.c -ljpeg -pthread -lm
+
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+#include "logging.h"
+
+
+static u32 _rand_state = 1;
+
+static int _rand_byte(void) {
+	_rand_state = _rand_state * 1103515245 + 12345;
+	return (_rand_state >> 16) & 0xFF;
+}
+
+static void _fill(us_frame_s *frame, int kind) {
+	for (uint y = 0; y < frame->height; ++y) {
+		u8 *const row = frame->data + (uz)y * frame->stride;
+		for (uint x = 0; x < frame->width; ++x) {
+			int luma;
+			switch (kind) {
+				case 0: luma = 16; break; // Black
+				case 1: luma = (((x / 5) + (y / 5)) % 2 ? 200 : 40) + _rand_byte() / 64; break; // Sharp
+				case 2: luma = 128 + 60 * sinf(x / 300.0f) * cosf(y / 200.0f) + _rand_byte() / 64; break; // Blurry
+				default: luma = 128 + 60 * sinf(x / 300.0f) + (_rand_byte() - 128) / 2; break; // Noisy
+			}
+			row[x * 2] = US_MIN(US_MAX(luma, 0), 255);
+			row[x * 2 + 1] = 128;
+		}
+	}
+}
+
+static void _compress(const us_frame_s *src, us_frame_s *dest) {
+	// Only the luma, it's what is checked
+	struct jpeg_compress_struct jpeg;
+	struct jpeg_error_mgr jpeg_error;
+	jpeg.err = jpeg_std_error(&jpeg_error);
+	jpeg_create_compress(&jpeg);
+	u8 *data = NULL;
+	unsigned long size = 0;
+	jpeg_mem_dest(&jpeg, &data, &size);
+	jpeg.image_width = src->width;
+	jpeg.image_height = src->height;
+	jpeg.input_components = 1;
+	jpeg.in_color_space = JCS_GRAYSCALE;
+	jpeg_set_defaults(&jpeg);
+	jpeg_set_quality(&jpeg, 90, TRUE);
+	jpeg_start_compress(&jpeg, TRUE);
+	u8 *const line = malloc(src->width);
+	while (jpeg.next_scanline < src->height) {
+		const u8 *const row = src->data + (uz)jpeg.next_scanline * src->stride;
+		for (uint x = 0; x < src->width; ++x) {
+			line[x] = row[x * 2];
+		}
+		JSAMPROW rows[1] = {line};
+		jpeg_write_scanlines(&jpeg, rows, 1);
+	}
+	jpeg_finish_compress(&jpeg);
+	jpeg_destroy_compress(&jpeg);
+	free(line);
+
+	us_frame_set_data(dest, data, size);
+	free(data);
+	dest->width = src->width;
+	dest->height = src->height;
+	dest->stride = 0;
+	dest->format = V4L2_PIX_FMT_JPEG;
+}
+
+int main(void) {
+	US_LOGGING_INIT;
+
+	us_frame_s frame = {
+		.width = 1920, .height = 1080, .stride = 1920 * 2,
+		.format = V4L2_PIX_FMT_YUYV, .used = 1920 * 1080 * 2,
+	};
+	frame.data = malloc(frame.used);
+	us_frame_s *const jpeg = us_frame_init();
+
+	const char *const names[] = {"black", "sharp", "blurry", "noisy"};
+	const us_health_state_e expected[2][4] = {
+		{US_HEALTH_BLACK, US_HEALTH_OK, US_HEALTH_BLURRY, US_HEALTH_NOISY},
+		// The 1/8 scale averages out the noise, it can't be told from the blur
+		{US_HEALTH_BLACK, US_HEALTH_OK, US_HEALTH_BLURRY, US_HEALTH_UNKNOWN},
+	};
+	int retval = 0;
+
+	for (int compressed = 0; compressed < 2; ++compressed) {
+		us_health_s *const health = us_health_init();
+		health->interval = 1;
+		health->frozen_sec = 0;
+
+		const char *const fmt = (compressed ? "JPEG" : "YUYV");
+		const us_frame_s *const checked = (compressed ? jpeg : &frame);
+		for (int kind = 0; kind < 4; ++kind) {
+			_fill(&frame, kind);
+			if (compressed) {
+				_compress(&frame, jpeg);
+			}
+			us_health_process(health, checked);
+			const us_health_state_e state = us_health_process(health, checked); // The same frame again
+			_fill(&frame, kind);
+			if (compressed) {
+				_compress(&frame, jpeg);
+			}
+			const us_health_state_e fresh = us_health_process(health, checked);
+			us_health_stats_s stats;
+			us_health_get_stats(health, &stats);
+			printf("%s %-6s: %-7s (size=%zu KiB mean=%.1f stddev=%.1f diff=%.2f sharpness=%.1f noise=%.1f), repeated: %s\n",
+				fmt, names[kind], us_health_state_to_string(fresh), checked->used / 1024,
+				stats.mean, stats.stddev, stats.diff, stats.sharpness, stats.noise,
+				us_health_state_to_string(state));
+			const us_health_state_e repeated = (kind == 0 ? US_HEALTH_BLACK : US_HEALTH_FROZEN);
+			if (fresh != expected[compressed][kind] || state != repeated) {
+				printf("  FAILED\n");
+				retval = 1;
+			}
+		}
+
+		// The decoding time depends on the size: the smooth picture is like a real 1080p MJPEG frame,
+		// while the synthetic checker and noise give over 1 MiB.
+		_fill(&frame, 2);
+		if (compressed) {
+			_compress(&frame, jpeg);
+		}
+		const uint n_checks = (compressed ? 200 : 1000);
+		const ldf begin_ts = us_get_now_monotonic();
+		for (uint index = 0; index < n_checks; ++index) {
+			us_health_process(health, checked);
+		}
+		const ldf per_check = (us_get_now_monotonic() - begin_ts) / n_checks;
+		printf("1080p %s (%zu KiB): %.3Lf ms per check, %.2Lf%% of a core at 30 fps with --health-interval 10\n",
+			fmt, checked->used / 1024, per_check * 1000, per_check * 3 * 100);
+
+		us_health_destroy(health);
+	}
+
+	us_frame_destroy(jpeg);
+	free(frame.data);
+	return retval;
+}
+#endif
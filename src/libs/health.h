@@ -0,0 +1,98 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+#pragma once
+
+#include <pthread.h>
+
+#include "types.h"
+#include "frame.h"
+
+
+#define US_HEALTH_HIST_BINS 16
+
+
+typedef enum {
+	US_HEALTH_OK = 0,
+	US_HEALTH_UNKNOWN, // Not measured yet or unsupported format
+	US_HEALTH_BLACK,
+	US_HEALTH_FROZEN,
+	US_HEALTH_NOISY,
+	US_HEALTH_BLURRY,
+} us_health_state_e;
+
+typedef struct {
+	us_health_state_e	state;
+	uint				width;
+	uint				height;
+	uint				samples;
+
+	float	mean; // Luma, 0..255
+	float	stddev;
+	float	diff; // Mean absolute difference with the previous checked frame
+	float	sharpness; // Variance of the Laplacian
+	float	noise; // Immerkaer's sigma estimation
+	float	hist[US_HEALTH_HIST_BINS]; // Fractions of the samples
+
+	ldf		frozen_since_ts;
+	ldf		ts;
+} us_health_stats_s;
+
+typedef struct {
+	uint				count; // Frames since the last check
+	uint				width;
+	uint				height;
+	uint				format;
+	uint				stride;
+
+	us_frame_s			*decoded; // MJPEG/JPEG at 1/8 scale
+
+	u8					*grid; // The sampled luma of the last checked frame
+	u16					*gradients;
+	u16					*noises;
+	uint				grid_w;
+	uint				grid_h;
+	uint				step;
+
+	us_health_stats_s	stats;
+	pthread_mutex_t		mutex; // For the stats
+} us_health_runtime_s;
+
+typedef struct {
+	uint	interval; // Check every Nth frame, 0 means disabled
+
+	float	black_level;
+	float	frozen_diff;
+	uint	frozen_sec;
+	float	noise_level;
+	float	blur_level;
+
+	us_health_runtime_s *run;
+} us_health_s;
+
+
+us_health_s *us_health_init(void);
+void us_health_destroy(us_health_s *health);
+
+const char *us_health_state_to_string(us_health_state_e state);
+
+us_health_state_e us_health_process(us_health_s *health, const us_frame_s *frame);
+void us_health_get_stats(us_health_s *health, us_health_stats_s *stats);
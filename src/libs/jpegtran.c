@@ -0,0 +1,650 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "jpegtran.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <assert.h>
+
+#include <jpeglib.h>
+
+#include "types.h"
+#include "tools.h"
+#include "logging.h"
+#include "frame.h"
+#include "capture.h"
+
+
+// Lossless transformations in the DCT domain, like jpegtran does.
+// The entropy-coded data is decoded to the quantized coefficients only,
+// so there is no IDCT, no color conversion and no requantization.
+// Transposition of an 8x8 block is a transposition of its coefficients,
+// and mirroring is a sign inversion of the odd horizontal or vertical frequencies.
+
+
+typedef struct {
+	struct jpeg_error_mgr	mgr; // Default manager
+	jmp_buf					jmp;
+} _jpeg_error_manager_s;
+
+typedef struct {
+	struct jpeg_destination_mgr mgr; // Default manager
+	JOCTET		*buf; // Start of buffer
+	us_frame_s	*frame;
+} _jpeg_dest_manager_s;
+
+typedef struct {
+	bool	transpose;
+	bool	flip_x; // After the transposition
+	bool	flip_y;
+
+	// Source region in pixels, the offset is iMCU-aligned
+	uint	x;
+	uint	y;
+	uint	width;
+	uint	height;
+
+	// Sign inversion of the transposed coefficients: (coef ^ mask) - mask
+	JCOEF	mask[DCTSIZE2];
+} _geometry_s;
+
+
+#define _DIV_ROUND_UP(x_a, x_b) (((x_a) + (x_b) - 1) / (x_b))
+#define _ROUND_UP(x_a, x_b) (_DIV_ROUND_UP(x_a, x_b) * (x_b))
+
+
+static int _make_geometry(const us_jpegtran_s *tran, const struct jpeg_decompress_struct *jpeg, _geometry_s *geo);
+static jvirt_barray_ptr _request_dest_coefs(j_decompress_ptr jpeg, uint ci, const _geometry_s *geo);
+static void _transform_component(
+	j_decompress_ptr jpeg, uint ci, const _geometry_s *geo,
+	jvirt_barray_ptr src_coefs, jvirt_barray_ptr dest_coefs);
+static void _transform_block(const JCOEF *src, JCOEF *dest, const _geometry_s *geo);
+static void _transpose_critical_parameters(j_compress_ptr jpeg);
+
+static void _jpeg_set_dest_frame(j_compress_ptr jpeg, us_frame_s *frame);
+static void _jpeg_init_destination(j_compress_ptr jpeg);
+static boolean _jpeg_empty_output_buffer(j_compress_ptr jpeg);
+static void _jpeg_term_destination(j_compress_ptr jpeg);
+
+static void _jpeg_error_handler(j_common_ptr jpeg);
+
+
+bool us_jpegtran_is_enabled(const us_jpegtran_s *tran) {
+	return (
+		tran->rotate != 0
+		|| tran->flip_vertical
+		|| tran->flip_horizontal
+		|| tran->crop_width > 0
+	);
+}
+
+int us_jpegtran_parse_rotate(const char *str) {
+	char *end = NULL;
+	const long rotate = strtol(str, &end, 10);
+	if (end == str || *end != '\0') {
+		return -1;
+	}
+	switch (rotate) {
+		case 0: case 90: case 180: case 270: return rotate;
+	}
+	return -1;
+}
+
+int us_jpegtran_parse_crop(us_jpegtran_s *tran, const char *str) {
+	// WxH or WxH+X+Y, like in jpegtran
+	if (strchr(str, '-') != NULL) {
+		return -1;
+	}
+	uint width;
+	uint height;
+	uint left = 0;
+	uint top = 0;
+	int pos = 0;
+	if (sscanf(str, "%ux%u%n", &width, &height, &pos) != 2) {
+		return -1;
+	}
+	if (str[pos] != '\0') {
+		int tail = 0;
+		if (sscanf(str + pos, "+%u+%u%n", &left, &top, &tail) != 2 || str[pos + tail] != '\0') {
+			return -1;
+		}
+	}
+	if (
+		width == 0 || width > US_VIDEO_MAX_WIDTH || left >= US_VIDEO_MAX_WIDTH
+		|| height == 0 || height > US_VIDEO_MAX_HEIGHT || top >= US_VIDEO_MAX_HEIGHT
+	) {
+		return -1;
+	}
+	tran->crop_width = width;
+	tran->crop_height = height;
+	tran->crop_left = left;
+	tran->crop_top = top;
+	return 0;
+}
+
+int us_jpegtran(const us_jpegtran_s *tran, const us_frame_s *src, us_frame_s *dest) {
+	assert(us_is_jpeg(src->format));
+	assert(src != dest);
+
+	volatile int retval = 0;
+
+	struct jpeg_decompress_struct src_jpeg;
+	struct jpeg_compress_struct dest_jpeg;
+
+	// https://stackoverflow.com/questions/19857766/error-handling-in-libjpeg
+	_jpeg_error_manager_s jpeg_error;
+	src_jpeg.err = jpeg_std_error((struct jpeg_error_mgr*)&jpeg_error);
+	dest_jpeg.err = src_jpeg.err;
+	jpeg_error.mgr.error_exit = _jpeg_error_handler;
+	jpeg_create_decompress(&src_jpeg);
+	jpeg_create_compress(&dest_jpeg);
+	if (setjmp(jpeg_error.jmp) < 0) {
+		retval = -1;
+		goto done;
+	}
+
+	jpeg_mem_src(&src_jpeg, src->data, src->used);
+	jpeg_read_header(&src_jpeg, TRUE);
+
+	_geometry_s geo;
+	if (_make_geometry(tran, &src_jpeg, &geo) < 0) {
+		retval = -1;
+		goto done;
+	}
+
+	// The destination arrays must be requested before jpeg_read_coefficients()
+	// which realizes all the virtual arrays of the source memory pool.
+	jvirt_barray_ptr dest_coefs[MAX_COMPONENTS];
+	for (int ci = 0; ci < src_jpeg.num_components; ++ci) {
+		dest_coefs[ci] = _request_dest_coefs(&src_jpeg, ci, &geo);
+	}
+
+	jvirt_barray_ptr *const src_coefs = jpeg_read_coefficients(&src_jpeg);
+
+	jpeg_copy_critical_parameters(&src_jpeg, &dest_jpeg);
+	dest_jpeg.image_width = (geo.transpose ? geo.height : geo.width);
+	dest_jpeg.image_height = (geo.transpose ? geo.width : geo.height);
+	if (geo.transpose) {
+		_transpose_critical_parameters(&dest_jpeg);
+	}
+
+	for (int ci = 0; ci < src_jpeg.num_components; ++ci) {
+		_transform_component(&src_jpeg, ci, &geo, src_coefs[ci], dest_coefs[ci]);
+	}
+
+	US_FRAME_COPY_META(src, dest);
+	dest->width = dest_jpeg.image_width;
+	dest->height = dest_jpeg.image_height;
+	dest->stride = 0;
+
+	_jpeg_set_dest_frame(&dest_jpeg, dest);
+	jpeg_write_coefficients(&dest_jpeg, dest_coefs);
+	jpeg_finish_compress(&dest_jpeg);
+	jpeg_finish_decompress(&src_jpeg);
+
+	dest->encode_end_ts = us_get_now_monotonic();
+
+done:
+	jpeg_destroy_compress(&dest_jpeg);
+	jpeg_destroy_decompress(&src_jpeg);
+	return retval;
+}
+
+static int _make_geometry(const us_jpegtran_s *tran, const struct jpeg_decompress_struct *jpeg, _geometry_s *geo) {
+	// The flips are applied to the source image before the rotation.
+	// Everything is reduced to an optional transposition followed by the flips.
+	const bool fh = tran->flip_horizontal;
+	const bool fv = tran->flip_vertical;
+	switch (tran->rotate) {
+		case 90:	geo->transpose = true;	geo->flip_x = !fv;	geo->flip_y = fh;	break;
+		case 180:	geo->transpose = false;	geo->flip_x = !fh;	geo->flip_y = !fv;	break;
+		case 270:	geo->transpose = true;	geo->flip_x = fv;	geo->flip_y = !fh;	break;
+		default:	geo->transpose = false;	geo->flip_x = fh;	geo->flip_y = fv;	break;
+	}
+
+	for (uint i = 0; i < DCTSIZE; ++i) { // Vertical frequency
+		for (uint j = 0; j < DCTSIZE; ++j) { // Horizontal frequency
+			geo->mask[i * DCTSIZE + j] = ((geo->flip_x && (j & 1)) != (geo->flip_y && (i & 1)) ? -1 : 0);
+		}
+	}
+
+	const uint imcu_width = jpeg->max_h_samp_factor * DCTSIZE;
+	const uint imcu_height = jpeg->max_v_samp_factor * DCTSIZE;
+
+	// A partial iMCU on the right or bottom edge can't be moved to the opposite edge,
+	// so it's dropped in the source directions which are going to be flipped.
+	const bool trim_x = (geo->transpose ? geo->flip_y : geo->flip_x);
+	const bool trim_y = (geo->transpose ? geo->flip_x : geo->flip_y);
+	const uint width = (trim_x ? jpeg->image_width / imcu_width * imcu_width : jpeg->image_width);
+	const uint height = (trim_y ? jpeg->image_height / imcu_height * imcu_height : jpeg->image_height);
+	if (width == 0 || height == 0) {
+		US_LOG_ERROR("Can't transform JPEG: The image %ux%u is too small",
+			jpeg->image_width, jpeg->image_height);
+		return -1;
+	}
+
+	uint x = 0;
+	uint y = 0;
+	uint crop_width = width;
+	uint crop_height = height;
+	if (tran->crop_width > 0) {
+		const uint out_width = (geo->transpose ? height : width);
+		const uint out_height = (geo->transpose ? width : height);
+		if (tran->crop_left >= out_width || tran->crop_top >= out_height) {
+			US_LOG_ERROR("Can't transform JPEG: The crop %ux%u+%u+%u is out of the image %ux%u",
+				tran->crop_width, tran->crop_height, tran->crop_left, tran->crop_top,
+				out_width, out_height);
+			return -1;
+		}
+		const uint out_crop_width = US_MIN(tran->crop_width, out_width - tran->crop_left);
+		const uint out_crop_height = US_MIN(tran->crop_height, out_height - tran->crop_top);
+
+		// Unflip the rectangle and then move it to the source space
+		const uint out_x = (geo->flip_x ? out_width - tran->crop_left - out_crop_width : tran->crop_left);
+		const uint out_y = (geo->flip_y ? out_height - tran->crop_top - out_crop_height : tran->crop_top);
+		x = (geo->transpose ? out_y : out_x);
+		y = (geo->transpose ? out_x : out_y);
+		crop_width = (geo->transpose ? out_crop_height : out_crop_width);
+		crop_height = (geo->transpose ? out_crop_width : out_crop_height);
+	}
+
+	geo->x = x / imcu_width * imcu_width;
+	geo->y = y / imcu_height * imcu_height;
+	geo->width = crop_width + (x - geo->x);
+	geo->height = crop_height + (y - geo->y);
+	if (trim_x) {
+		geo->width = US_MIN(_ROUND_UP(geo->width, imcu_width), width - geo->x);
+	}
+	if (trim_y) {
+		geo->height = US_MIN(_ROUND_UP(geo->height, imcu_height), height - geo->y);
+	}
+	return 0;
+}
+
+static jvirt_barray_ptr _request_dest_coefs(j_decompress_ptr jpeg, uint ci, const _geometry_s *geo) {
+	const jpeg_component_info *const comp = &jpeg->comp_info[ci];
+	const uint width = _DIV_ROUND_UP(geo->width * comp->h_samp_factor, jpeg->max_h_samp_factor * DCTSIZE);
+	const uint height = _DIV_ROUND_UP(geo->height * comp->v_samp_factor, jpeg->max_v_samp_factor * DCTSIZE);
+	const uint h_samp = (geo->transpose ? comp->v_samp_factor : comp->h_samp_factor);
+	const uint v_samp = (geo->transpose ? comp->h_samp_factor : comp->v_samp_factor);
+	return (*jpeg->mem->request_virt_barray)(
+		(j_common_ptr)jpeg, JPOOL_IMAGE, FALSE,
+		_ROUND_UP(geo->transpose ? height : width, h_samp),
+		_ROUND_UP(geo->transpose ? width : height, v_samp),
+		v_samp);
+}
+
+static void _transform_component(
+	j_decompress_ptr jpeg, uint ci, const _geometry_s *geo,
+	jvirt_barray_ptr src_coefs, jvirt_barray_ptr dest_coefs) {
+
+	const jpeg_component_info *const comp = &jpeg->comp_info[ci];
+	const uint imcu_width = jpeg->max_h_samp_factor * DCTSIZE;
+	const uint imcu_height = jpeg->max_v_samp_factor * DCTSIZE;
+
+	// The source region in blocks
+	const uint x = geo->x / imcu_width * comp->h_samp_factor;
+	const uint y = geo->y / imcu_height * comp->v_samp_factor;
+	const uint width = _DIV_ROUND_UP(geo->width * comp->h_samp_factor, imcu_width);
+	const uint height = _DIV_ROUND_UP(geo->height * comp->v_samp_factor, imcu_height);
+
+	const int dest_width = (geo->transpose ? height : width);
+	const int dest_height = (geo->transpose ? width : height);
+	const uint padded_width = _ROUND_UP((uint)dest_width, (geo->transpose ? comp->v_samp_factor : comp->h_samp_factor));
+	const uint padded_height = _ROUND_UP((uint)dest_height, (geo->transpose ? comp->h_samp_factor : comp->v_samp_factor));
+	const bool copy = (!geo->transpose && !geo->flip_x && !geo->flip_y);
+
+	for (uint dy = 0; dy < padded_height; ++dy) {
+		const JBLOCKROW dest = (*jpeg->mem->access_virt_barray)((j_common_ptr)jpeg, dest_coefs, dy, 1, TRUE)[0];
+		int ty = (geo->flip_y ? dest_height - 1 - (int)dy : (int)dy);
+		ty = US_MAX(0, US_MIN(ty, dest_height - 1)); // The padding blocks just repeat the edge
+
+		JBLOCKROW src = NULL;
+		if (!geo->transpose) {
+			src = (*jpeg->mem->access_virt_barray)((j_common_ptr)jpeg, src_coefs, y + ty, 1, FALSE)[0] + x;
+		}
+
+		for (uint dx = 0; dx < padded_width; ++dx) {
+			int tx = (geo->flip_x ? dest_width - 1 - (int)dx : (int)dx);
+			tx = US_MAX(0, US_MIN(tx, dest_width - 1));
+
+			if (geo->transpose) {
+				// The virtual array gives access only to a few rows at a time,
+				// so the source column is walked row by row.
+				src = (*jpeg->mem->access_virt_barray)((j_common_ptr)jpeg, src_coefs, y + tx, 1, FALSE)[0] + x;
+				_transform_block(src[ty], dest[dx], geo);
+			} else if (copy) {
+				memcpy(dest[dx], src[tx], sizeof(JBLOCK));
+			} else {
+				_transform_block(src[tx], dest[dx], geo);
+			}
+		}
+	}
+}
+
+static void _transform_block(const JCOEF *src, JCOEF *dest, const _geometry_s *geo) {
+	// Constant indexes and the branchless negation are vectorized by the compiler
+	if (geo->transpose) {
+		for (uint i = 0; i < DCTSIZE; ++i) {
+			for (uint j = 0; j < DCTSIZE; ++j) {
+				dest[i * DCTSIZE + j] = src[j * DCTSIZE + i];
+			}
+		}
+		src = dest;
+	}
+	for (uint k = 0; k < DCTSIZE2; ++k) {
+		dest[k] = (src[k] ^ geo->mask[k]) - geo->mask[k];
+	}
+}
+
+static void _transpose_critical_parameters(j_compress_ptr jpeg) {
+	for (int ci = 0; ci < jpeg->num_components; ++ci) {
+		jpeg_component_info *const comp = &jpeg->comp_info[ci];
+		const int h_samp = comp->h_samp_factor;
+		comp->h_samp_factor = comp->v_samp_factor;
+		comp->v_samp_factor = h_samp;
+	}
+	for (uint index = 0; index < NUM_QUANT_TBLS; ++index) {
+		JQUANT_TBL *const table = jpeg->quant_tbl_ptrs[index];
+		if (table != NULL) {
+			for (uint i = 0; i < DCTSIZE; ++i) {
+				for (uint j = 0; j < i; ++j) {
+					const UINT16 value = table->quantval[i * DCTSIZE + j];
+					table->quantval[i * DCTSIZE + j] = table->quantval[j * DCTSIZE + i];
+					table->quantval[j * DCTSIZE + i] = value;
+				}
+			}
+		}
+	}
+}
+
+static void _jpeg_set_dest_frame(j_compress_ptr jpeg, us_frame_s *frame) {
+	if (jpeg->dest == NULL) {
+		assert((jpeg->dest = (struct jpeg_destination_mgr*)(*jpeg->mem->alloc_small)(
+			(j_common_ptr) jpeg, JPOOL_PERMANENT, sizeof(_jpeg_dest_manager_s)
+		)) != NULL);
+	}
+
+	_jpeg_dest_manager_s *const dest = (_jpeg_dest_manager_s*)jpeg->dest;
+	dest->mgr.init_destination = _jpeg_init_destination;
+	dest->mgr.empty_output_buffer = _jpeg_empty_output_buffer;
+	dest->mgr.term_destination = _jpeg_term_destination;
+	dest->frame = frame;
+
+	frame->used = 0;
+}
+
+#define JPEG_OUTPUT_BUFFER_SIZE ((size_t)16384)
+
+static void _jpeg_init_destination(j_compress_ptr jpeg) {
+	_jpeg_dest_manager_s *const dest = (_jpeg_dest_manager_s*)jpeg->dest;
+
+	assert((dest->buf = (JOCTET*)(*jpeg->mem->alloc_small)(
+		(j_common_ptr) jpeg, JPOOL_IMAGE, JPEG_OUTPUT_BUFFER_SIZE * sizeof(JOCTET)
+	)) != NULL);
+
+	dest->mgr.next_output_byte = dest->buf;
+	dest->mgr.free_in_buffer = JPEG_OUTPUT_BUFFER_SIZE;
+}
+
+static boolean _jpeg_empty_output_buffer(j_compress_ptr jpeg) {
+	_jpeg_dest_manager_s *const dest = (_jpeg_dest_manager_s*)jpeg->dest;
+
+	us_frame_append_data(dest->frame, dest->buf, JPEG_OUTPUT_BUFFER_SIZE);
+
+	dest->mgr.next_output_byte = dest->buf;
+	dest->mgr.free_in_buffer = JPEG_OUTPUT_BUFFER_SIZE;
+	return TRUE;
+}
+
+static void _jpeg_term_destination(j_compress_ptr jpeg) {
+	_jpeg_dest_manager_s *const dest = (_jpeg_dest_manager_s*)jpeg->dest;
+	const size_t final = JPEG_OUTPUT_BUFFER_SIZE - dest->mgr.free_in_buffer;
+	us_frame_append_data(dest->frame, dest->buf, final);
+}
+
+#undef JPEG_OUTPUT_BUFFER_SIZE
+
+static void _jpeg_error_handler(j_common_ptr jpeg) {
+	_jpeg_error_manager_s *jpeg_error = (_jpeg_error_manager_s*)jpeg->err;
+	char msg[JMSG_LENGTH_MAX];
+
+	(*jpeg_error->mgr.format_message)(jpeg, msg);
+	US_LOG_ERROR("Can't transform JPEG: %s", msg);
+	longjmp(jpeg_error->jmp, -1);
+}
+
+
+#ifdef TEST_JPEGTRAN
+// Encodes an asymmetric YCbCr picture with 4:2:0 and 4:2:2 sampling, runs all
+// the rotations and flips with and without a crop which is not aligned
+// to the iMCU, decodes the result and compares it with the same transform
+// of the decoded source made on the pixels. The DCT domain is lossless,
+// only the IDCT rounding differs.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_JPEGTRAN -o jpegtran-test libs/jpegtran.c libs/frame.c libs/pixel.c libs/logging.c -ljpeg -pthread -lm
+
+#include <math.h>
+
+
+#define _WIDTH	96
+#define _HEIGHT	64
+
+
+static void _encode(us_frame_s *frame, uint h_samp, uint v_samp) {
+	struct jpeg_compress_struct jpeg;
+	struct jpeg_error_mgr jpeg_error;
+	jpeg.err = jpeg_std_error(&jpeg_error);
+	jpeg_create_compress(&jpeg);
+	jpeg.image_width = _WIDTH;
+	jpeg.image_height = _HEIGHT;
+	jpeg.input_components = 3;
+	jpeg.in_color_space = JCS_YCbCr;
+	jpeg_set_defaults(&jpeg);
+	jpeg_set_quality(&jpeg, 95, TRUE);
+	jpeg.comp_info[0].h_samp_factor = h_samp;
+	jpeg.comp_info[0].v_samp_factor = v_samp;
+	_jpeg_set_dest_frame(&jpeg, frame);
+	jpeg_start_compress(&jpeg, TRUE);
+
+	u8 line[_WIDTH * 3];
+	while (jpeg.next_scanline < _HEIGHT) {
+		const uint y = jpeg.next_scanline;
+		for (uint x = 0; x < _WIDTH; ++x) {
+			// A gradient in both directions, a bar in the top left part and a wave
+			line[x * 3] = 30 + x * 150 / _WIDTH + y * 40 / _HEIGHT + (y > _HEIGHT / 3 && x < _WIDTH / 4 ? 0 : 30);
+			line[x * 3 + 1] = 78 + y * 100 / _HEIGHT;
+			line[x * 3 + 2] = 128 + 40 * sinf(x / 9.0f);
+		}
+		JSAMPROW rows[1] = {line};
+		jpeg_write_scanlines(&jpeg, rows, 1);
+	}
+	jpeg_finish_compress(&jpeg);
+	jpeg_destroy_compress(&jpeg);
+
+	frame->width = _WIDTH;
+	frame->height = _HEIGHT;
+	frame->format = V4L2_PIX_FMT_JPEG;
+}
+
+static u8 *_decode(const us_frame_s *frame, uint *width, uint *height) {
+	struct jpeg_decompress_struct jpeg;
+	struct jpeg_error_mgr jpeg_error;
+	jpeg.err = jpeg_std_error(&jpeg_error);
+	jpeg_create_decompress(&jpeg);
+	jpeg_mem_src(&jpeg, frame->data, frame->used);
+	jpeg_read_header(&jpeg, TRUE);
+	// No color conversion and no interpolation between the neighbour blocks
+	jpeg.out_color_space = JCS_YCbCr;
+	jpeg.do_fancy_upsampling = FALSE;
+	jpeg.dct_method = JDCT_ISLOW;
+	jpeg_start_decompress(&jpeg);
+
+	*width = jpeg.output_width;
+	*height = jpeg.output_height;
+	u8 *pixels;
+	US_CALLOC(pixels, (uz)*width * *height * 3);
+	while (jpeg.output_scanline < *height) {
+		JSAMPROW rows[1] = {pixels + (uz)jpeg.output_scanline * *width * 3};
+		jpeg_read_scanlines(&jpeg, rows, 1);
+	}
+	jpeg_finish_decompress(&jpeg);
+	jpeg_destroy_decompress(&jpeg);
+	return pixels;
+}
+
+static void _map(const us_jpegtran_s *tran, uint x, uint y, uint *sx, uint *sy) {
+	// The output pixel to the source one: the flips go first, then the clockwise rotation
+	uint fx;
+	uint fy;
+	switch (tran->rotate) {
+		case 90: fx = y; fy = _HEIGHT - 1 - x; break;
+		case 180: fx = _WIDTH - 1 - x; fy = _HEIGHT - 1 - y; break;
+		case 270: fx = _WIDTH - 1 - y; fy = x; break;
+		default: fx = x; fy = y; break;
+	}
+	*sx = (tran->flip_horizontal ? _WIDTH - 1 - fx : fx);
+	*sy = (tran->flip_vertical ? _HEIGHT - 1 - fy : fy);
+}
+
+static ldf _compare(
+	const us_jpegtran_s *tran, const u8 *src, const u8 *out,
+	uint out_width, uint out_height, uint left, uint top, uint *max_diff) {
+
+	uz sum = 0;
+	*max_diff = 0;
+	for (uint y = 0; y < out_height; ++y) {
+		for (uint x = 0; x < out_width; ++x) {
+			uint sx;
+			uint sy;
+			_map(tran, left + x, top + y, &sx, &sy);
+			for (uint ch = 0; ch < 3; ++ch) {
+				const uint diff = abs(
+					(int)src[((uz)sy * _WIDTH + sx) * 3 + ch]
+					- (int)out[((uz)y * out_width + x) * 3 + ch]);
+				sum += diff;
+				*max_diff = US_MAX(*max_diff, diff);
+			}
+		}
+	}
+	return (ldf)sum / (out_width * out_height * 3);
+}
+
+static bool _test(const us_frame_s *src_frame, const u8 *src, const us_jpegtran_s *tran, us_frame_s *dest) {
+	if (us_jpegtran(tran, src_frame, dest) < 0) {
+		return false;
+	}
+	uint out_width;
+	uint out_height;
+	u8 *const out = _decode(dest, &out_width, &out_height);
+
+	const uint full_width = (tran->rotate % 180 ? _HEIGHT : _WIDTH);
+	const uint full_height = (tran->rotate % 180 ? _WIDTH : _HEIGHT);
+	uint want_left = 0;
+	uint want_top = 0;
+	uint want_width = full_width;
+	uint want_height = full_height;
+	if (tran->crop_width > 0) {
+		want_left = tran->crop_left;
+		want_top = tran->crop_top;
+		want_width = US_MIN(tran->crop_width, full_width - want_left);
+		want_height = US_MIN(tran->crop_height, full_height - want_top);
+	}
+
+	// The crop offset is aligned to the iMCU in the source space,
+	// so the picture can start up to 16 pixels before the requested one.
+	bool ok = false;
+	ldf best = 1000;
+	uint best_max = 0;
+	for (uint dy = 0; dy <= US_MIN(want_top, 15u) && !ok; ++dy) {
+		for (uint dx = 0; dx <= US_MIN(want_left, 15u) && !ok; ++dx) {
+			const uint left = want_left - dx;
+			const uint top = want_top - dy;
+			if (
+				left + out_width > full_width || top + out_height > full_height
+				|| out_width < want_width + dx || out_height < want_height + dy
+			) {
+				continue;
+			}
+			uint max_diff;
+			const ldf avg = _compare(tran, src, out, out_width, out_height, left, top, &max_diff);
+			if (avg < best) {
+				best = avg;
+				best_max = max_diff;
+			}
+			ok = (avg < 0.5 && max_diff <= 4);
+		}
+	}
+	printf("  rotate=%3u flip_h=%d flip_v=%d crop=%ux%u+%u+%u: %ux%u, avg_diff=%.3Lf max_diff=%u - %s\n",
+		tran->rotate, tran->flip_horizontal, tran->flip_vertical,
+		tran->crop_width, tran->crop_height, tran->crop_left, tran->crop_top,
+		out_width, out_height, best, best_max, (ok ? "ok" : "FAILED"));
+	free(out);
+	return ok;
+}
+
+int main(void) {
+	US_LOGGING_INIT;
+
+	const uint samps[][2] = {{2, 2}, {2, 1}};
+	us_frame_s *const src_frame = us_frame_init();
+	us_frame_s *const dest = us_frame_init();
+	int retval = 0;
+
+	for (uint si = 0; si < 2; ++si) {
+		printf("%ux%u, sampling %ux%u:\n", _WIDTH, _HEIGHT, samps[si][0], samps[si][1]);
+		_encode(src_frame, samps[si][0], samps[si][1]);
+		uint width;
+		uint height;
+		u8 *const src = _decode(src_frame, &width, &height);
+		assert(width == _WIDTH && height == _HEIGHT);
+
+		for (uint rotate = 0; rotate < 360; rotate += 90) {
+			for (uint flips = 0; flips < 4; ++flips) {
+				for (uint crop = 0; crop < 2; ++crop) {
+					const us_jpegtran_s tran = {
+						.rotate = rotate,
+						.flip_horizontal = (flips & 1),
+						.flip_vertical = (flips & 2),
+						.crop_width = (crop ? 37 : 0),
+						.crop_height = (crop ? 21 : 0),
+						.crop_left = (crop ? 5 : 0),
+						.crop_top = (crop ? 19 : 0),
+					};
+					if (!_test(src_frame, src, &tran, dest)) {
+						retval = 1;
+					}
+				}
+			}
+		}
+		free(src);
+	}
+
+	us_frame_destroy(dest);
+	us_frame_destroy(src_frame);
+	puts(retval == 0 ? "OK" : "FAILED");
+	return retval;
+}
+#endif
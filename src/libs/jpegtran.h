@@ -0,0 +1,49 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include "types.h"
+#include "frame.h"
+
+
+typedef struct {
+	uint	rotate; // 0, 90, 180 or 270
+	bool	flip_vertical;
+	bool	flip_horizontal;
+
+	// The crop rectangle is given in the output (rotated and flipped) coordinates.
+	// The offset is aligned down to the iMCU boundary, so the result can be
+	// a bit larger than requested. Zero width means no cropping.
+	uint	crop_width;
+	uint	crop_height;
+	uint	crop_left;
+	uint	crop_top;
+} us_jpegtran_s;
+
+
+bool us_jpegtran_is_enabled(const us_jpegtran_s *tran);
+int us_jpegtran_parse_rotate(const char *str);
+int us_jpegtran_parse_crop(us_jpegtran_s *tran, const char *str);
+
+int us_jpegtran(const us_jpegtran_s *tran, const us_frame_s *src, us_frame_s *dest);
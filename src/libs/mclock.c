@@ -0,0 +1,204 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "mclock.h"
+
+#ifdef TEST_MCLOCK
+#	include <stdio.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "types.h"
+#include "tools.h"
+
+
+// Seconds between 1900 (NTP epoch) and 1970 (Unix epoch)
+#define _NTP_UNIX_DIFF	2208988800ULL
+
+// Gaps in the sample counter larger than this are producer restarts, not a drift
+#define _MAX_DRIFT		((ldf)0.5)
+
+
+us_mclock_s *us_mclock_init(void) {
+	us_mclock_s *clock;
+	US_CALLOC(clock, 1);
+	clock->epoch_ts = us_get_now_monotonic();
+	clock->epoch_real_ts = us_get_now_real();
+	return clock;
+}
+
+void us_mclock_destroy(us_mclock_s *clock) {
+	free(clock);
+}
+
+void us_mclock_stream_init(us_mclock_stream_s *stream, const us_mclock_s *clock, uint hz) {
+	US_MEMSET_ZERO(*stream);
+	stream->clock = clock;
+	stream->hz = hz;
+	// https://datatracker.ietf.org/doc/html/rfc3550#section-5.1
+	stream->rtp_offset = us_triple_u32(us_get_now_monotonic_u64() + hz);
+}
+
+u32 us_mclock_ts_to_rtp(us_mclock_stream_s *stream, ldf ts) {
+	// The stream is driven by the capture timestamps (video), so it shares the clock with NTP
+	const u32 rtp = stream->rtp_offset + (u32)llroundl((ts - stream->clock->epoch_ts) * stream->hz);
+	stream->last_ts = ts;
+	stream->last_rtp = rtp;
+	return rtp;
+}
+
+u32 us_mclock_pts_to_rtp(us_mclock_stream_s *stream, u64 pts, ldf ts) {
+	// The stream is driven by the sample counter (audio), so RTP timestamps advance
+	// exactly by the number of samples, while the capture time tells the real timeline.
+	// The difference between them is the drift of the device clock.
+
+	if (stream->based) {
+		const ldf sample_ts = stream->base_ts + (ldf)(pts - stream->base_pts) / stream->hz;
+		const ldf drift = ts - sample_ts;
+		if (pts <= stream->last_pts || fabsl(drift) > _MAX_DRIFT) {
+			stream->based = false;
+		} else {
+			// The capture timestamps are noisy because of scheduling, so smooth them
+			stream->drift += (drift - stream->drift) / 64;
+		}
+	}
+	if (!stream->based) {
+		stream->based = true;
+		stream->base_pts = pts;
+		stream->base_ts = ts;
+		stream->drift = 0;
+	}
+	stream->last_pts = pts;
+
+	const u32 rtp = stream->rtp_offset
+		+ (u32)llroundl((stream->base_ts - stream->clock->epoch_ts) * stream->hz)
+		+ (u32)(pts - stream->base_pts);
+	stream->last_ts = ts;
+	stream->last_rtp = rtp;
+	return rtp;
+}
+
+void us_mclock_count_sent(us_mclock_stream_s *stream, uz octets) {
+	++stream->sent_packets;
+	stream->sent_octets += octets;
+}
+
+uz us_mclock_make_sr(const us_mclock_stream_s *stream, u32 ssrc, u8 *data) {
+	// https://datatracker.ietf.org/doc/html/rfc3550#section-6.4.1
+	// The NTP timestamp corresponds to the capture time of the last sent packet.
+
+	if (stream->last_ts == 0) {
+		return 0;
+	}
+
+	const ldf real_ts = stream->clock->epoch_real_ts + (stream->last_ts - stream->clock->epoch_ts);
+	const u64 ntp_sec = (u64)real_ts + _NTP_UNIX_DIFF;
+	const u32 ntp_frac = (u32)((real_ts - floorl(real_ts)) * 4294967296.0L);
+
+#	define WRITE_BE_U32(x_offset, x_value) { \
+			const u32 m_be = __builtin_bswap32(x_value); \
+			memcpy(data + x_offset, &m_be, sizeof(m_be)); /* data is unaligned */ \
+		}
+	WRITE_BE_U32(0, (2u << 30) | (200 << 16) | (US_MCLOCK_SR_SIZE / 4 - 1)); // V=2, PT=SR, length
+	WRITE_BE_U32(4, ssrc);
+	WRITE_BE_U32(8, ntp_sec);
+	WRITE_BE_U32(12, ntp_frac);
+	WRITE_BE_U32(16, stream->last_rtp);
+	WRITE_BE_U32(20, stream->sent_packets);
+	WRITE_BE_U32(24, stream->sent_octets);
+#	undef WRITE_BE_U32
+	return US_MCLOCK_SR_SIZE;
+}
+
+#ifdef TEST_MCLOCK
+// Maps the audio and video PTS to the common RTP timelines and checks the Sender Reports.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_MCLOCK -o mclock-test libs/mclock.c -lm
+
+int main(void) {
+	int retval = 0;
+
+	us_mclock_s *clock = us_mclock_init();
+	clock->epoch_ts = 1000;
+	clock->epoch_real_ts = 1700000000;
+
+	us_mclock_stream_s video;
+	us_mclock_stream_s audio;
+	us_mclock_stream_init(&video, clock, 90000);
+	us_mclock_stream_init(&audio, clock, 48000);
+
+	// 10 minutes of 30fps video and 20ms audio captured simultaneously,
+	// the audio device is 100ppm slower than the monotonic clock.
+	const ldf ppm = 0.0001;
+	u64 pts = 0;
+	for (uint index = 0; index < 30000; ++index) {
+		const ldf audio_ts = 1000 + (ldf)pts / 48000 * (1 + ppm) + (index % 3) * 0.002; // With jitter
+		us_mclock_pts_to_rtp(&audio, pts, audio_ts);
+		pts += 960;
+		if (index % 5 == 0) {
+			us_mclock_ts_to_rtp(&video, 1000 + (ldf)index / 50);
+		}
+	}
+
+	const ldf expected = (ldf)(pts - 960) / 48000 * ppm;
+	printf("Testing audio drift: %.6Lf, expected ~%.6Lf ... ", audio.drift, expected);
+	if (fabsl(audio.drift - expected) < 0.005) {
+		printf("ok\n");
+	} else {
+		printf("FAILED\n");
+		retval = -1;
+	}
+
+	// The same capture moment must be at the same place of the timeline for both streams,
+	// the audio RTP timestamps lag behind by the accumulated drift.
+	const ldf ts = 1000 + (ldf)pts / 48000 * (1 + ppm);
+	const u32 video_rtp = us_mclock_ts_to_rtp(&video, ts);
+	const u32 audio_rtp = us_mclock_pts_to_rtp(&audio, pts, ts);
+	const ldf video_sec = (ldf)(u32)(video_rtp - video.rtp_offset) / 90000;
+	const ldf audio_sec = (ldf)(u32)(audio_rtp - audio.rtp_offset) / 48000;
+	printf("Testing A/V timeline: video=%.3Lf, audio=%.3Lf, drift=%.3Lf ... ", video_sec, audio_sec, audio.drift);
+	if (fabsl(video_sec - (ts - 1000)) < 0.001 && fabsl(audio_sec + audio.drift - video_sec) < 0.005) {
+		printf("ok\n");
+	} else {
+		printf("FAILED\n");
+		retval = -1;
+	}
+
+	u8 sr[US_MCLOCK_SR_SIZE];
+	printf("Testing SR ... ");
+	if (us_mclock_make_sr(&video, 0x12345678, sr) == US_MCLOCK_SR_SIZE && sr[1] == 200 && sr[4] == 0x12 && sr[7] == 0x78) {
+		printf("ok\n");
+	} else {
+		printf("FAILED\n");
+		retval = -1;
+	}
+
+	us_mclock_destroy(clock);
+
+	if (retval < 0) {
+		printf("===== TEST FAILED =====\n");
+	}
+	return retval;
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "types.h"
+
+
+#define US_MCLOCK_SR_SIZE	28
+
+
+typedef struct {
+	ldf		epoch_ts; // Monotonic, same for all processes
+	ldf		epoch_real_ts;
+} us_mclock_s;
+
+typedef struct {
+	const us_mclock_s	*clock;
+	uint				hz;
+	u32					rtp_offset;
+
+	// For sample-counted streams (audio)
+	bool				based;
+	u64					base_pts;
+	ldf					base_ts;
+	u64					last_pts;
+	ldf					drift; // Capture time minus sample time, smoothed, in seconds
+
+	// The last NTP<->RTP pair
+	ldf					last_ts;
+	u32					last_rtp;
+
+	u32					sent_packets;
+	u32					sent_octets;
+} us_mclock_stream_s;
+
+
+us_mclock_s *us_mclock_init(void);
+void us_mclock_destroy(us_mclock_s *clock);
+
+void us_mclock_stream_init(us_mclock_stream_s *stream, const us_mclock_s *clock, uint hz);
+
+u32 us_mclock_ts_to_rtp(us_mclock_stream_s *stream, ldf ts);
+u32 us_mclock_pts_to_rtp(us_mclock_stream_s *stream, u64 pts, ldf ts);
+void us_mclock_count_sent(us_mclock_stream_s *stream, uz octets);
+
+uz us_mclock_make_sr(const us_mclock_stream_s *stream, u32 ssrc, u8 *data);
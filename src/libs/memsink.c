@@ -242,6 +242,12 @@ int us_memsink_client_get(us_memsink_s *sink, us_frame_s *frame, bool *key_reque
 	}
 
 	sink->last_readed_id = sink->mem->id;
+	if (sink->mem->used > sink->data_size) {
+		US_LOG_ERROR("%s-sink: Invalid frame size in shared memory: %zu > %zu",
+			sink->name, sink->mem->used, sink->data_size);
+		retval = -1;
+		goto done;
+	}
 	us_frame_set_data(frame, us_memsink_get_data(sink->mem), sink->mem->used);
 	US_FRAME_COPY_META(sink->mem, frame);
 	if (key_requested != NULL) { // We don't need it for non-H264 sinks
@@ -258,3 +264,73 @@ done:
 	}
 	return retval;
 }
+
+
+#ifdef FUZZ_MEMSINK
+// Клиент читает заголовок из разделяемой памяти, которую может записать
+// кто угодно с доступом к объекту. Первый байт входа: бит 0 - подставить
+// верные magic и version, бит 1 - новый id; затем заголовок и данные.
+//   clang -g -O1 -std=c17 -D_GNU_SOURCE -fsanitize=fuzzer,address,undefined -DUS_FUZZ_LIBFUZZER -DFUZZ_MEMSINK -o fuzz-memsink libs/memsink.c libs/memsinksh.c libs/frame.c libs/pixel.c libs/logging.c -lm -pthread -lrt
+//   gcc -g -O1 -std=c17 -D_GNU_SOURCE -fsanitize=address,undefined -DFUZZ_MEMSINK -o fuzz-memsink libs/memsink.c libs/memsinksh.c libs/frame.c libs/pixel.c libs/logging.c -lm -pthread -lrt
+
+#include <stddef.h>
+
+#include "fuzz.h"
+
+
+const us_fuzz_seed_s us_fuzz_seeds[] = {
+	US_FUZZ_SEED("\x00"),
+	US_FUZZ_SEED("\x03"),
+	US_FUZZ_SEED("\x03\xBE\xBA\xFE\xCA\xBE\xBA\xFE\xCA\x07\x00\x00\x00\x00\x00\x00\x00"
+		"\x01\x00\x00\x00\x00\x00\x00\x00\x10\x00\x00\x00\x00\x00\x00\x00"),
+	US_FUZZ_SEED("\x03\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+		"\x00\x00\x00\x00\x00\x00\x00\x00\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF"),
+	US_FUZZ_SEED("\x02\xBE\xBA\xFE\xCA\xBE\xBA\xFE\xCA\x06\x00\x00\x00"),
+};
+const uz us_fuzz_seeds_count = US_ARRAY_LEN(us_fuzz_seeds);
+
+void us_fuzz_one(const u8 *data, uz size) {
+	static us_memsink_s *server = NULL;
+	static us_memsink_s *client = NULL;
+	static us_frame_s *frame = NULL;
+	static u64 id = 0;
+	if (server == NULL) {
+		us_fuzz_silence_logging(); // Каждый мусорный заголовок - это US_LOG_ERROR()
+		char *obj;
+		US_ASPRINTF(obj, "/ustreamer-fuzz-%d.jpeg", getpid());
+		assert((server = us_memsink_init_opened("FUZZ", obj, true, 0600, false, 10, 1)) != NULL);
+		assert((client = us_memsink_init_opened("FUZZ", obj, false, 0600, false, 10, 1)) != NULL);
+		shm_unlink(obj); // Отображения остаются, а в /dev/shm ничего не забудем
+		frame = us_frame_init();
+	}
+	if (size < 1) {
+		return;
+	}
+
+	us_memsink_shared_s *const mem = server->mem;
+	memset(mem, 0, sizeof(*mem));
+	const uz head = US_MIN(size - 1, sizeof(*mem));
+	memcpy(mem, data + 1, head);
+	memcpy(us_memsink_get_data(mem), data + 1 + head, US_MIN(size - 1 - head, server->data_size));
+
+	if (data[0] & 0x01) {
+		mem->magic = US_MEMSINK_MAGIC;
+		mem->version = US_MEMSINK_VERSION;
+	}
+	if (data[0] & 0x02) {
+		mem->id = ++id;
+	}
+	// Булевы поля пишет только us_memsink_server_put(), мусор в них - не наш случай
+	mem->key_requested = !!((u8*)mem)[offsetof(us_memsink_shared_s, key_requested)];
+	mem->online = !!((u8*)mem)[offsetof(us_memsink_shared_s, online)];
+	mem->key = !!((u8*)mem)[offsetof(us_memsink_shared_s, key)];
+
+	bool key_requested;
+	const int retval = us_memsink_client_get(client, frame, &key_requested, false);
+	if (retval == 0) {
+		assert(frame->used <= client->data_size);
+		assert(frame->used == mem->used);
+	}
+}
+
+#endif
@@ -0,0 +1,478 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "memsync.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#include "types.h"
+#include "errors.h"
+#include "tools.h"
+#include "frame.h"
+#include "memsinksh.h"
+
+
+static int _sink_poll(us_memsync_s *sync, uint index);
+static void _sink_push(us_memsync_s *sync, uint index, const us_memsink_shared_s *mem);
+static void _sink_drop(us_memsync_s *sync, uint index, uint count);
+static bool _match(us_memsync_s *sync);
+static void _update_stats(us_memsync_s *sync);
+
+#define _TS(x_sink, x_index) ((x_sink)->queue[x_index]->grab_ts - (x_sink)->offset)
+
+
+us_memsync_s *us_memsync_init(
+	uint n_sinks, const char *const *objs, const ldf *offsets,
+	ldf tolerance, us_memsync_policy_e policy, uint depth) {
+
+	if (n_sinks == 0 || n_sinks > US_MEMSYNC_MAX_SINKS || depth == 0 || depth > US_MEMSYNC_MAX_DEPTH || tolerance < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	us_memsync_s *sync;
+	US_CALLOC(sync, 1);
+	sync->n_sinks = n_sinks;
+	sync->tolerance = tolerance;
+	sync->policy = policy;
+	sync->depth = (policy == US_MEMSYNC_POLICY_LATEST ? 1 : depth);
+	us_memsync_reset_stats(sync);
+
+	for (uint index = 0; index < n_sinks; ++index) {
+		us_memsync_sink_s *const sink = &sync->sinks[index];
+		sink->fd = -1;
+		for (uint qi = 0; qi < US_MEMSYNC_MAX_DEPTH; ++qi) {
+			sink->queue[qi] = us_frame_init();
+		}
+	}
+
+	for (uint index = 0; index < n_sinks; ++index) {
+		us_memsync_sink_s *const sink = &sync->sinks[index];
+		sink->obj = objs[index];
+		sink->offset = (offsets != NULL ? offsets[index] : 0);
+		if ((sink->data_size = us_memsink_calculate_size(sink->obj)) == 0) {
+			errno = EINVAL;
+			goto error;
+		}
+		if ((sink->fd = shm_open(sink->obj, O_RDWR, 0)) == -1) {
+			goto error;
+		}
+		if ((sink->mem = us_memsink_shared_map(sink->fd, sink->data_size)) == NULL) {
+			goto error;
+		}
+	}
+	return sync;
+
+error:
+	{
+		const int error = errno;
+		us_memsync_destroy(sync);
+		errno = error;
+	}
+	return NULL;
+}
+
+void us_memsync_destroy(us_memsync_s *sync) {
+	for (uint index = 0; index < sync->n_sinks; ++index) {
+		us_memsync_sink_s *const sink = &sync->sinks[index];
+		if (sink->mem != NULL) {
+			us_memsink_shared_unmap(sink->mem, sink->data_size);
+		}
+		US_CLOSE_FD(sink->fd);
+		for (uint qi = 0; qi < US_MEMSYNC_MAX_DEPTH; ++qi) {
+			US_DELETE(sink->queue[qi], us_frame_destroy);
+		}
+	}
+	free(sync);
+}
+
+int us_memsync_get(us_memsync_s *sync, us_frame_s **frames, ldf timeout) {
+	const ldf deadline_ts = us_get_now_monotonic() + timeout;
+	while (true) {
+		// The sinks have no notifications, so all of them are polled in one pass
+		// instead of blocking on each one in turn.
+		for (uint index = 0; index < sync->n_sinks; ++index) {
+			if (_sink_poll(sync, index) < 0) {
+				return -1;
+			}
+		}
+
+		if (_match(sync)) {
+			_update_stats(sync);
+			for (uint index = 0; index < sync->n_sinks; ++index) {
+				us_memsync_sink_s *const sink = &sync->sinks[index];
+				us_frame_s *const frame = frames[index];
+				frames[index] = sink->queue[0];
+				sink->queue[0] = frame;
+				_sink_drop(sync, index, 0); // Just shift the consumed one out
+			}
+			return 0;
+		}
+
+		if (us_get_now_monotonic() >= deadline_ts) {
+			return US_ERROR_NO_DATA;
+		}
+		if (usleep(1000) < 0) {
+			return -1;
+		}
+	}
+}
+
+void us_memsync_reset_stats(us_memsync_s *sync) {
+	memset(&sync->stats, 0, sizeof(sync->stats));
+	sync->stats.skew_min = -1;
+}
+
+const char *us_memsync_policy_to_string(us_memsync_policy_e policy) {
+	switch (policy) {
+		case US_MEMSYNC_POLICY_NEAREST: return "nearest";
+		case US_MEMSYNC_POLICY_LATEST: return "latest";
+	}
+	return "???";
+}
+
+int us_memsync_parse_policy(const char *str) {
+	if (!strcasecmp(str, "nearest")) {
+		return US_MEMSYNC_POLICY_NEAREST;
+	} else if (!strcasecmp(str, "latest")) {
+		return US_MEMSYNC_POLICY_LATEST;
+	}
+	return -1;
+}
+
+static int _sink_poll(us_memsync_s *sync, uint index) {
+	us_memsync_sink_s *const sink = &sync->sinks[index];
+
+	if (flock(sink->fd, LOCK_EX | LOCK_NB) < 0) {
+		return (errno == EWOULDBLOCK ? 0 : -1); // The producer is writing, try on the next pass
+	}
+
+	int retval = 0;
+	us_memsink_shared_s *const mem = sink->mem;
+	if (mem->magic != US_MEMSINK_MAGIC) {
+		goto done; // Not initialized yet
+	}
+	if (mem->version != US_MEMSINK_VERSION) {
+		errno = EPROTO;
+		retval = -1;
+		goto done;
+	}
+
+	// Let the sink know that the client is alive
+	mem->last_client_ts = us_get_now_monotonic();
+
+	if (mem->id == sink->last_id) {
+		goto done;
+	}
+	sink->last_id = mem->id;
+	if (mem->used > sink->data_size) {
+		errno = EMSGSIZE;
+		retval = -1;
+		goto done;
+	}
+	_sink_push(sync, index, mem);
+	retval = 1;
+
+done:
+	if (flock(sink->fd, LOCK_UN) < 0) {
+		retval = -1;
+	}
+	return retval;
+}
+
+static void _sink_push(us_memsync_s *sync, uint index, const us_memsink_shared_s *mem) {
+	us_memsync_sink_s *const sink = &sync->sinks[index];
+	++sync->stats.sinks[index].received;
+
+	if (mem->grab_ts <= 0 || !mem->online) {
+		return; // A blank or placeholder frame without the capture time can't be matched
+	}
+	if (sink->queued > 0 && mem->grab_ts <= sink->queue[sink->queued - 1]->grab_ts) {
+		// The producer was restarted: the old frames can't be compared with the new ones
+		++sync->stats.sinks[index].resyncs;
+		_sink_drop(sync, index, sink->queued);
+	}
+	if (sink->queued == sync->depth) {
+		_sink_drop(sync, index, 1);
+	}
+
+	us_frame_s *const frame = sink->queue[sink->queued];
+	us_frame_set_data(frame, us_memsink_get_data((us_memsink_shared_s*)mem), mem->used);
+	US_FRAME_COPY_META(mem, frame);
+	++sink->queued;
+}
+
+static void _sink_drop(us_memsync_s *sync, uint index, uint count) {
+	// Drops the count oldest frames. A zero count removes the head without
+	// accounting, it is used after the head was consumed by the match.
+	us_memsync_sink_s *const sink = &sync->sinks[index];
+	const bool consumed = (count == 0);
+	if (consumed) {
+		count = 1;
+	} else {
+		sync->stats.dropped += count;
+		sync->stats.sinks[index].dropped += count;
+	}
+	assert(count <= sink->queued);
+
+	us_frame_s *dropped[US_MEMSYNC_MAX_DEPTH];
+	memcpy(dropped, sink->queue, sizeof(us_frame_s*) * count);
+	memmove(sink->queue, sink->queue + count, sizeof(us_frame_s*) * (US_MEMSYNC_MAX_DEPTH - count));
+	memcpy(sink->queue + US_MEMSYNC_MAX_DEPTH - count, dropped, sizeof(us_frame_s*) * count);
+	sink->queued -= count;
+}
+
+static bool _match(us_memsync_s *sync) {
+	// Each queue is ordered, so a head older than the newest head minus
+	// the tolerance has no partners anymore: neither now nor in the future.
+	// Such heads are dropped until all of them fit into the window.
+	while (true) {
+		ldf pivot_ts = 0;
+		for (uint index = 0; index < sync->n_sinks; ++index) {
+			const us_memsync_sink_s *const sink = &sync->sinks[index];
+			if (sink->queued == 0) {
+				return false;
+			}
+			pivot_ts = (index == 0 ? _TS(sink, 0) : US_MAX(pivot_ts, _TS(sink, 0)));
+		}
+
+		bool fit = true;
+		for (uint index = 0; index < sync->n_sinks; ++index) {
+			us_memsync_sink_s *const sink = &sync->sinks[index];
+			uint count = 0;
+			while (count < sink->queued && _TS(sink, count) < pivot_ts - sync->tolerance) {
+				++count;
+			}
+			if (count > 0) {
+				_sink_drop(sync, index, count);
+				fit = false;
+			}
+		}
+		if (fit) {
+			return true;
+		}
+	}
+}
+
+static void _update_stats(us_memsync_s *sync) {
+	us_memsync_stats_s *const stats = &sync->stats;
+	const ldf now_ts = us_get_now_monotonic();
+
+	ldf min_ts = _TS(&sync->sinks[0], 0);
+	ldf max_ts = min_ts;
+	for (uint index = 1; index < sync->n_sinks; ++index) {
+		const us_memsync_sink_s *const sink = &sync->sinks[index];
+		const ldf ts = _TS(sink, 0);
+		min_ts = US_MIN(min_ts, ts);
+		max_ts = US_MAX(max_ts, ts);
+	}
+
+	++stats->matched;
+	const ldf skew = max_ts - min_ts;
+	stats->skew_last = skew;
+	stats->skew_min = (stats->skew_min < 0 ? skew : US_MIN(stats->skew_min, skew));
+	stats->skew_max = US_MAX(stats->skew_max, skew);
+	stats->skew_avg += (skew - stats->skew_avg) / stats->matched;
+	stats->latency_avg += ((now_ts - max_ts) - stats->latency_avg) / stats->matched;
+
+	const ldf first_ts = sync->sinks[0].queue[0]->grab_ts;
+	for (uint index = 0; index < sync->n_sinks; ++index) {
+		const ldf offset = sync->sinks[index].queue[0]->grab_ts - first_ts;
+		stats->sinks[index].offset_avg += (offset - stats->sinks[index].offset_avg) / stats->matched;
+	}
+}
+
+
+#ifdef TEST_MEMSYNC
+// Three synthetic producers with clock offsets, jitter and lost frames:
+// the offsets are measured with a wide tolerance first and then corrected.
+// The timestamps are synthetic, so the matching doesn't depend on the scheduling.
+// Each producer starts with a placeholder frame without the capture time.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_MEMSYNC -o memsync-test libs/memsync.c libs/memsinksh.c libs/frame.c libs/pixel.c -pthread -lm
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+
+#define _N_SINKS	3
+#define _PERIOD		((ldf)1 / 30)
+
+static const ldf _OFFSETS[_N_SINKS] = {0, 0.006, -0.004};
+static ldf _begin_ts; // The same phase for all producers
+static atomic_bool _stop;
+
+
+typedef struct {
+	uint	index;
+	char	obj[64];
+} _producer_s;
+
+static void *_producer_thread(void *v_producer) {
+	const _producer_s *const producer = v_producer;
+	const uz data_size = us_memsink_calculate_size(producer->obj);
+	const int fd = shm_open(producer->obj, O_RDWR, 0);
+	assert(fd >= 0);
+	us_memsink_shared_s *const mem = us_memsink_shared_map(fd, data_size);
+	assert(mem != NULL);
+
+	u32 rand_state = producer->index + 1;
+	ldf next_ts = _begin_ts;
+	for (u64 number = 1; !atomic_load(&_stop); ++number) {
+		rand_state = rand_state * 1103515245 + 12345;
+		const ldf jitter = (ldf)((int)((rand_state >> 16) % 3001) - 1500) / 1000000; // +/- 1.5ms
+		next_ts += _PERIOD;
+		while (us_get_now_monotonic() < next_ts) {
+			usleep(200);
+		}
+		if (producer->index == 2 && number % 10 == 0) {
+			continue; // Lost frame
+		}
+
+		assert(flock(fd, LOCK_EX) == 0);
+		mem->magic = US_MEMSINK_MAGIC;
+		mem->version = US_MEMSINK_VERSION;
+		mem->id = number;
+		mem->used = sizeof(number);
+		mem->width = 640;
+		mem->height = 480;
+		mem->online = (number > 1);
+		mem->grab_ts = (number > 1 ? next_ts + jitter + _OFFSETS[producer->index] : 0);
+		memcpy(us_memsink_get_data(mem), &number, sizeof(number));
+		assert(flock(fd, LOCK_UN) == 0);
+	}
+
+	us_memsink_shared_unmap(mem, data_size);
+	close(fd);
+	return NULL;
+}
+
+static int _run(const char *const *objs, const ldf *offsets, ldf tolerance, us_memsync_policy_e policy, us_memsync_stats_s *stats) {
+	us_memsync_s *const sync = us_memsync_init(_N_SINKS, objs, offsets, tolerance, policy, 4);
+	assert(sync != NULL);
+	us_frame_s *frames[_N_SINKS];
+	for (uint index = 0; index < _N_SINKS; ++index) {
+		frames[index] = us_frame_init();
+	}
+
+	int retval = 0;
+	for (uint count = 0; count < 90; ++count) {
+		if (us_memsync_get(sync, frames, 1) != 0) {
+			printf("  timeout\n");
+			retval = 1;
+			break;
+		}
+		u64 numbers[_N_SINKS];
+		for (uint index = 0; index < _N_SINKS; ++index) {
+			memcpy(&numbers[index], frames[index]->data, sizeof(u64));
+		}
+		if (sync->stats.skew_last > tolerance) {
+			printf("  out of tolerance: %.2Lf ms\n", sync->stats.skew_last * 1000);
+			retval = 1;
+		}
+	}
+	*stats = sync->stats;
+
+	for (uint index = 0; index < _N_SINKS; ++index) {
+		us_frame_destroy(frames[index]);
+	}
+	us_memsync_destroy(sync);
+	return retval;
+}
+
+static void _print_stats(const char *title, const us_memsync_stats_s *stats) {
+	printf("%s: matched=%llu dropped=%llu skew=%.2Lf/%.2Lf/%.2Lf ms latency=%.2Lf ms offsets=",
+		title, (ull)stats->matched, (ull)stats->dropped,
+		stats->skew_min * 1000, stats->skew_avg * 1000, stats->skew_max * 1000,
+		stats->latency_avg * 1000);
+	for (uint index = 0; index < _N_SINKS; ++index) {
+		printf("%+.2Lf(%llu) ", stats->sinks[index].offset_avg * 1000, (ull)stats->sinks[index].dropped);
+	}
+	putchar('\n');
+}
+
+int main(void) {
+	_producer_s producers[_N_SINKS];
+	pthread_t tids[_N_SINKS];
+	const char *objs[_N_SINKS];
+	_begin_ts = us_get_now_monotonic() + 0.1;
+	for (uint index = 0; index < _N_SINKS; ++index) {
+		_producer_s *const producer = &producers[index];
+		producer->index = index;
+		US_SNPRINTF(producer->obj, 63, "us-memsync-test-%u-%d.h264", index, getpid());
+		const int fd = shm_open(producer->obj, O_RDWR | O_CREAT | O_EXCL, 0600);
+		assert(fd >= 0);
+		assert(ftruncate(fd, sizeof(us_memsink_shared_s) + us_memsink_calculate_size(producer->obj)) == 0);
+		close(fd);
+		objs[index] = producer->obj;
+		assert(!pthread_create(&tids[index], NULL, _producer_thread, producer));
+	}
+
+	int retval = 0;
+	us_memsync_stats_s stats;
+
+	// Half of the period is the widest tolerance that can't pair the wrong frames
+	retval |= _run(objs, NULL, _PERIOD / 2, US_MEMSYNC_POLICY_NEAREST, &stats);
+	_print_stats("calibration", &stats);
+	if (stats.latency_avg < -0.1 || stats.latency_avg > 0.1) { // The offsets may put it ahead of now
+		printf("  the placeholder frames must not be matched\n");
+		retval = 1;
+	}
+	ldf offsets[_N_SINKS];
+	for (uint index = 0; index < _N_SINKS; ++index) {
+		offsets[index] = stats.sinks[index].offset_avg;
+		if (offsets[index] - _OFFSETS[index] > 0.001 || offsets[index] - _OFFSETS[index] < -0.001) {
+			printf("  wrong offset for sink %u\n", index);
+			retval = 1;
+		}
+	}
+
+	retval |= _run(objs, offsets, 0.004, US_MEMSYNC_POLICY_NEAREST, &stats);
+	_print_stats("nearest    ", &stats);
+	if (stats.sinks[0].dropped == 0 || stats.sinks[2].dropped > 0) {
+		printf("  the lost frames of sink 2 must be dropped from the others\n");
+		retval = 1;
+	}
+
+	retval |= _run(objs, offsets, 0.004, US_MEMSYNC_POLICY_LATEST, &stats);
+	_print_stats("latest     ", &stats);
+
+	atomic_store(&_stop, true);
+	for (uint index = 0; index < _N_SINKS; ++index) {
+		pthread_join(tids[index], NULL);
+		shm_unlink(producers[index].obj);
+	}
+	puts(retval == 0 ? "OK" : "FAILED");
+	return retval;
+}
+#endif
@@ -0,0 +1,99 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include "types.h"
+#include "frame.h"
+#include "memsinksh.h"
+
+
+#define US_MEMSYNC_MAX_SINKS	8
+#define US_MEMSYNC_MAX_DEPTH	32
+
+
+typedef enum {
+	US_MEMSYNC_POLICY_NEAREST = 0, // Buffer up to depth frames per sink and match the earliest possible tuple
+	US_MEMSYNC_POLICY_LATEST, // Match only the newest frames, drop everything older
+} us_memsync_policy_e;
+
+typedef struct {
+	u64		matched;
+	u64		dropped;
+
+	// Spread of the matched tuples: max(ts) - min(ts) after the offsets correction
+	ldf		skew_last;
+	ldf		skew_min;
+	ldf		skew_max;
+	ldf		skew_avg;
+
+	ldf		latency_avg; // From the newest corrected grab_ts to the delivery
+
+	struct {
+		u64	received;
+		u64	dropped;
+		u64	resyncs; // The sink was restarted or its clock went back
+		ldf	offset_avg; // Mean of (grab_ts - grab_ts of the first sink) in the matched tuples
+	} sinks[US_MEMSYNC_MAX_SINKS];
+} us_memsync_stats_s;
+
+typedef struct {
+	const char			*obj;
+	uz					data_size;
+	ldf					offset; // Subtracted from grab_ts before the matching
+
+	int					fd;
+	us_memsink_shared_s	*mem;
+	u64					last_id;
+
+	us_frame_s			*queue[US_MEMSYNC_MAX_DEPTH]; // Ordered by grab_ts
+	uint				queued;
+} us_memsync_sink_s;
+
+typedef struct {
+	uint				n_sinks;
+	us_memsync_sink_s	sinks[US_MEMSYNC_MAX_SINKS];
+
+	ldf					tolerance;
+	us_memsync_policy_e	policy;
+	uint				depth;
+
+	us_memsync_stats_s	stats;
+} us_memsync_s;
+
+
+// Returns NULL and sets errno on error. The offsets can be NULL.
+us_memsync_s *us_memsync_init(
+	uint n_sinks, const char *const *objs, const ldf *offsets,
+	ldf tolerance, us_memsync_policy_e policy, uint depth);
+
+void us_memsync_destroy(us_memsync_s *sync);
+
+// The frames is an array of n_sinks allocated frames, the matched ones are swapped into it.
+// Returns 0 on match, US_ERROR_NO_DATA on timeout and -1 with errno on error.
+int us_memsync_get(us_memsync_s *sync, us_frame_s **frames, ldf timeout);
+
+void us_memsync_reset_stats(us_memsync_s *sync);
+
+const char *us_memsync_policy_to_string(us_memsync_policy_e policy);
+int us_memsync_parse_policy(const char *str);
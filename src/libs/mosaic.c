@@ -0,0 +1,321 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "mosaic.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#ifdef __APPLE__
+#include "macos_v4l2_stub.h"
+#else
+#include <linux/videodev2.h>
+#endif
+
+#include "types.h"
+#include "tools.h"
+#include "logging.h"
+#include "errors.h"
+#include "frame.h"
+#include "memsink.h"
+#include "unjpeg.h"
+
+
+#define _OFFLINE_GREY	0x20
+
+
+static void _mosaic_layout(us_mosaic_s *mosaic);
+static bool _mosaic_update_tile(us_mosaic_s *mosaic, us_mosaic_tile_s *tile);
+static void _mosaic_fill_tile(us_mosaic_s *mosaic, const us_mosaic_tile_s *tile, u8 value);
+static int _mosaic_draw_tile(us_mosaic_s *mosaic, us_mosaic_tile_s *tile);
+static uint _mosaic_get_scale_denom(uint width, uint height, uint fit_width, uint fit_height);
+
+static inline void _yuv_to_rgb(u8 *dest, int y, int u, int v);
+
+
+us_mosaic_s *us_mosaic_init(void) {
+	us_mosaic_s *mosaic;
+	US_CALLOC(mosaic, 1);
+	mosaic->canvas = us_frame_init();
+	return mosaic;
+}
+
+void us_mosaic_destroy(us_mosaic_s *mosaic) {
+	us_mosaic_close(mosaic);
+	for (uint index = 0; index < mosaic->n_tiles; ++index) {
+		us_mosaic_tile_s *const tile = &mosaic->tiles[index];
+		us_frame_destroy(tile->decoded);
+		us_frame_destroy(tile->src);
+		free(tile->obj);
+	}
+	US_DELETE(mosaic->tiles, free);
+	us_frame_destroy(mosaic->canvas);
+	free(mosaic);
+}
+
+int us_mosaic_parse_sinks(us_mosaic_s *mosaic, const char *str) {
+	// Comma-separated list of the JPEG or RAW sinks, the tiles go row by row
+	if (mosaic->n_tiles > 0) {
+		return -1;
+	}
+
+	char *const copy = us_strdup(str);
+	char *save = NULL;
+	for (char *obj = strtok_r(copy, ",", &save); obj != NULL; obj = strtok_r(NULL, ",", &save)) {
+		if (mosaic->n_tiles >= US_MOSAIC_MAX_TILES) {
+			goto error;
+		}
+		US_REALLOC(mosaic->tiles, mosaic->n_tiles + 1);
+		us_mosaic_tile_s *const tile = &mosaic->tiles[mosaic->n_tiles];
+		US_MEMSET_ZERO(*tile);
+		tile->obj = us_strdup(obj);
+		tile->src = us_frame_init();
+		tile->decoded = us_frame_init();
+		++mosaic->n_tiles;
+	}
+	free(copy);
+	return (mosaic->n_tiles > 0 ? 0 : -1);
+
+error:
+	free(copy);
+	return -1;
+}
+
+void us_mosaic_open(us_mosaic_s *mosaic, uint width, uint height) {
+	us_frame_s *const canvas = mosaic->canvas;
+	canvas->width = width;
+	canvas->height = height;
+	canvas->format = V4L2_PIX_FMT_RGB24;
+	canvas->stride = width * 3;
+	canvas->online = true;
+	us_frame_realloc_data(canvas, (uz)canvas->stride * height);
+	canvas->used = (uz)canvas->stride * height;
+	memset(canvas->data, 0, canvas->used);
+
+	_mosaic_layout(mosaic);
+	mosaic->dirty = true;
+}
+
+void us_mosaic_close(us_mosaic_s *mosaic) {
+	for (uint index = 0; index < mosaic->n_tiles; ++index) {
+		us_mosaic_tile_s *const tile = &mosaic->tiles[index];
+		US_DELETE(tile->sink, us_memsink_destroy);
+		tile->next_open_ts = 0;
+		tile->drawn = false;
+	}
+}
+
+bool us_mosaic_update(us_mosaic_s *mosaic) {
+	bool changed = mosaic->dirty;
+	mosaic->dirty = false;
+	for (uint index = 0; index < mosaic->n_tiles; ++index) {
+		if (_mosaic_update_tile(mosaic, &mosaic->tiles[index])) {
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+static void _mosaic_layout(us_mosaic_s *mosaic) {
+	uint columns = mosaic->columns;
+	if (columns == 0) {
+		columns = ceilf(sqrtf(mosaic->n_tiles));
+	}
+	columns = US_MIN(columns, mosaic->n_tiles);
+	const uint rows = (mosaic->n_tiles + columns - 1) / columns;
+
+	const uint cell_width = mosaic->canvas->width / columns;
+	const uint cell_height = mosaic->canvas->height / rows;
+	for (uint index = 0; index < mosaic->n_tiles; ++index) {
+		us_mosaic_tile_s *const tile = &mosaic->tiles[index];
+		tile->x = (index % columns) * cell_width;
+		tile->y = (index / columns) * cell_height;
+		tile->width = cell_width;
+		tile->height = cell_height;
+		tile->drawn = false;
+	}
+}
+
+static bool _mosaic_update_tile(us_mosaic_s *mosaic, us_mosaic_tile_s *tile) {
+	const ldf now_ts = us_get_now_monotonic();
+
+	if (tile->sink == NULL) {
+		if (now_ts < tile->next_open_ts) {
+			return false;
+		}
+		tile->next_open_ts = now_ts + 5;
+		if ((tile->sink = us_memsink_init_opened("mosaic", tile->obj, false, 0, false, 0, 0)) == NULL) {
+			if (!tile->drawn) {
+				_mosaic_fill_tile(mosaic, tile, _OFFLINE_GREY);
+				tile->drawn = true;
+				return true;
+			}
+			return false;
+		}
+		tile->drawn = false;
+	}
+
+	// Неизмененные тайлы не декодируются заново, холст хранит последнюю картинку
+	switch (us_memsink_client_get(tile->sink, tile->src, NULL, false)) {
+		case 0: break;
+		case US_ERROR_NO_DATA:
+			if (!tile->drawn) {
+				_mosaic_fill_tile(mosaic, tile, _OFFLINE_GREY);
+				tile->drawn = true;
+				return true;
+			}
+			return false;
+		default:
+			US_DELETE(tile->sink, us_memsink_destroy);
+			tile->drawn = false;
+			return false;
+	}
+
+	if (_mosaic_draw_tile(mosaic, tile) < 0) {
+		return false;
+	}
+	tile->drawn = true;
+	++tile->updates;
+	return true;
+}
+
+static void _mosaic_fill_tile(us_mosaic_s *mosaic, const us_mosaic_tile_s *tile, u8 value) {
+	const us_frame_s *const canvas = mosaic->canvas;
+	for (uint y = 0; y < tile->height; ++y) {
+		memset(canvas->data + (uz)(tile->y + y) * canvas->stride + tile->x * 3, value, tile->width * 3);
+	}
+}
+
+static int _mosaic_draw_tile(us_mosaic_s *mosaic, us_mosaic_tile_s *tile) {
+	const us_frame_s *src = tile->src;
+	if (src->width == 0 || src->height == 0 || src->used == 0) {
+		return -1;
+	}
+
+	// Fit into the cell keeping the aspect ratio, the rest is black
+	uint fit_width = tile->width;
+	uint fit_height = (u64)src->height * tile->width / src->width;
+	if (fit_height > tile->height) {
+		fit_height = tile->height;
+		fit_width = (u64)src->width * tile->height / src->height;
+	}
+	if (fit_width == 0 || fit_height == 0) {
+		return -1;
+	}
+
+	if (us_is_jpeg(src->format)) {
+		const uint scale_denom = _mosaic_get_scale_denom(src->width, src->height, fit_width, fit_height);
+		if (us_unjpeg_scaled(src, tile->decoded, scale_denom) < 0) {
+			return -1;
+		}
+		src = tile->decoded;
+	}
+
+	uint bytes_per_pixel;
+	switch (src->format) {
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24: bytes_per_pixel = 3; break;
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY: bytes_per_pixel = 2; break;
+		case V4L2_PIX_FMT_GREY: bytes_per_pixel = 1; break;
+		default: {
+			char fourcc_str[8];
+			US_ONCE_FOR(tile->format_once, src->format, {
+				US_LOG_ERROR("MOSAIC: Unsupported format of the sink %s: %s",
+					tile->obj, us_fourcc_to_string(src->format, fourcc_str, 8));
+			});
+			return -1;
+		}
+	}
+	const uint stride = (src->stride > 0 ? src->stride : src->width * bytes_per_pixel);
+	if (src->used < (uz)stride * src->height) {
+		return -1;
+	}
+
+	_mosaic_fill_tile(mosaic, tile, 0);
+
+	const us_frame_s *const canvas = mosaic->canvas;
+	const uint off_x = tile->x + (tile->width - fit_width) / 2;
+	const uint off_y = tile->y + (tile->height - fit_height) / 2;
+	const u32 step_x = ((u64)src->width << 16) / fit_width; // Fixed point 16.16
+	const u32 step_y = ((u64)src->height << 16) / fit_height;
+
+	u32 src_y_fp = step_y / 2;
+	for (uint y = 0; y < fit_height; ++y, src_y_fp += step_y) {
+		const u8 *const src_row = src->data + (uz)(src_y_fp >> 16) * stride;
+		u8 *dest = canvas->data + (uz)(off_y + y) * canvas->stride + off_x * 3;
+		u32 src_x_fp = step_x / 2;
+		for (uint x = 0; x < fit_width; ++x, src_x_fp += step_x, dest += 3) {
+			const uint src_x = src_x_fp >> 16;
+			switch (src->format) {
+				case V4L2_PIX_FMT_RGB24:
+					memcpy(dest, src_row + src_x * 3, 3);
+					break;
+				case V4L2_PIX_FMT_BGR24: {
+					const u8 *const pixel = src_row + src_x * 3;
+					dest[0] = pixel[2];
+					dest[1] = pixel[1];
+					dest[2] = pixel[0];
+					break;
+				}
+				case V4L2_PIX_FMT_GREY:
+					memset(dest, src_row[src_x], 3);
+					break;
+				default: { // Packed YUV 4:2:2
+					const u8 *const macro = src_row + (src_x & ~1u) * 2;
+					const uint odd = src_x & 1;
+					switch (src->format) {
+						case V4L2_PIX_FMT_YUYV: _yuv_to_rgb(dest, macro[odd * 2], macro[1], macro[3]); break;
+						case V4L2_PIX_FMT_YVYU: _yuv_to_rgb(dest, macro[odd * 2], macro[3], macro[1]); break;
+						default: _yuv_to_rgb(dest, macro[odd * 2 + 1], macro[0], macro[2]); break; // UYVY
+					}
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+static uint _mosaic_get_scale_denom(uint width, uint height, uint fit_width, uint fit_height) {
+	// The largest denominator which still gives at least the tile size
+	uint denom = 8;
+	while (denom > 1 && (width / denom < fit_width || height / denom < fit_height)) {
+		denom /= 2;
+	}
+	return denom;
+}
+
+static inline void _yuv_to_rgb(u8 *dest, int y, int u, int v) {
+	// BT.601, limited range
+	const int c = (y - 16) * 298;
+	const int d = u - 128;
+	const int e = v - 128;
+#	define CLAMP(x_value) ((x_value) < 0 ? 0 : ((x_value) > 255 ? 255 : (x_value)))
+	dest[0] = CLAMP((c + 409 * e + 128) >> 8);
+	dest[1] = CLAMP((c - 100 * d - 208 * e + 128) >> 8);
+	dest[2] = CLAMP((c + 516 * d + 128) >> 8);
+#	undef CLAMP
+}
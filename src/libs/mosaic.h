@@ -0,0 +1,72 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include "types.h"
+#include "frame.h"
+#include "memsink.h"
+
+
+#define US_MOSAIC_MAX_TILES 64
+
+
+typedef struct {
+	char			*obj;
+	us_memsink_s	*sink;
+	ldf				next_open_ts;
+
+	us_frame_s		*src;
+	us_frame_s		*decoded; // JPEG decoded with the DCT scaling
+
+	// The tile cell on the canvas
+	uint			x;
+	uint			y;
+	uint			width;
+	uint			height;
+
+	bool			drawn;
+	int				format_once;
+	u64				updates;
+} us_mosaic_tile_s;
+
+typedef struct {
+	us_mosaic_tile_s	*tiles;
+	uint				n_tiles;
+	uint				columns; // 0 means auto
+
+	us_frame_s			*canvas; // RGB24
+	bool				dirty;
+} us_mosaic_s;
+
+
+us_mosaic_s *us_mosaic_init(void);
+void us_mosaic_destroy(us_mosaic_s *mosaic);
+
+int us_mosaic_parse_sinks(us_mosaic_s *mosaic, const char *str);
+
+void us_mosaic_open(us_mosaic_s *mosaic, uint width, uint height);
+void us_mosaic_close(us_mosaic_s *mosaic);
+
+// Returns true if the canvas was changed since the last call
+bool us_mosaic_update(us_mosaic_s *mosaic);
@@ -0,0 +1,59 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include "types.h"
+
+
+// Pixel kernels work on a single line (or a pair of lines), so the callers
+// keep dealing with the strides and paddings. Every kernel has a scalar
+// reference version, the vectorized ones must produce the identical output.
+typedef struct {
+	const char *name;
+
+	// YUYV, YVYU or UYVY to the interleaved 4:4:4 YCbCr (JCS_YCbCr)
+	void (*packed_yuv_to_yuv444)(const u8 *src, u8 *dest, uint width, uint format);
+
+	// YUV420 or YVU420 plane lines (u_src and v_src are already swapped
+	// by the caller for YVU420) to the interleaved 4:4:4 YCbCr.
+	// chroma_div is the horizontal subsampling of the chroma lines: 2 or 4.
+	void (*planar_yuv_to_yuv444)(const u8 *y_src, const u8 *u_src, const u8 *v_src, u8 *dest, uint width, uint chroma_div);
+
+	void (*rgb565_to_rgb24)(const u8 *src, u8 *dest, uint width);
+	void (*bgr24_to_rgb24)(const u8 *src, u8 *dest, uint width);
+
+	// 2x2 box filter with rounding, dest_width = src_width / 2
+	void (*downsample2_grey)(const u8 *src0, const u8 *src1, u8 *dest, uint dest_width);
+
+	// Fills count of 4-byte values (like YUYV macropixels), dest may be unaligned
+	void (*fill32)(u8 *dest, const u8 *pattern, uz count);
+} us_pixel_kernels_s;
+
+
+// Returns the best kernels for this CPU, the detection is performed once
+const us_pixel_kernels_s *us_pixel_get(void);
+
+// For the benchmarks and tests: NULL-terminated list of the kernels
+// supported by this CPU, the scalar reference is always the first
+const us_pixel_kernels_s *const *us_pixel_get_all(void);
@@ -0,0 +1,433 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "privacy.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#ifdef __APPLE__
+#include "macos_v4l2_stub.h"
+#else
+#include <linux/videodev2.h>
+#endif
+
+#include "types.h"
+#include "tools.h"
+#include "frame.h"
+#include "pixel.h"
+
+
+static int _parse_coord(const char *str, const char **end, us_privacy_coord_s *coord);
+static int _parse_rect(const char *str, us_privacy_shape_s *shape);
+static int _parse_polygon(const char *str, us_privacy_shape_s *shape);
+
+static void _rebuild_spans(us_privacy_s *priv, const us_frame_s *frame);
+static void _add_span(us_privacy_runtime_s *run, uint y, uint x0, uint x1);
+static int _span_cmp(const void *a_ptr, const void *b_ptr);
+static float _resolve(const us_privacy_coord_s *coord, uint size);
+static int _float_cmp(const void *a_ptr, const void *b_ptr);
+
+static void _fill_u8(u8 *row, uint x0, uint x1, u8 value);
+static void _fill_macropixels(u8 *row, uint x0, uint x1, const u8 *pattern);
+
+
+us_privacy_s *us_privacy_init(void) {
+	us_privacy_runtime_s *run;
+	US_CALLOC(run, 1);
+
+	us_privacy_s *priv;
+	US_CALLOC(priv, 1);
+	priv->run = run;
+	return priv;
+}
+
+void us_privacy_destroy(us_privacy_s *priv) {
+	US_DELETE(priv->run->spans, free);
+	free(priv->run);
+	US_DELETE(priv->shapes, free);
+	free(priv);
+}
+
+bool us_privacy_is_enabled(const us_privacy_s *priv) {
+	return (priv->n_shapes > 0);
+}
+
+int us_privacy_parse(us_privacy_s *priv, const char *str) {
+	// Shapes are separated by ';':
+	//   - WxH+X+Y is a rectangle, like in jpegtran -crop;
+	//   - X,Y/X,Y/X,Y[/...] is a polygon.
+	// Each number can be followed by '%' to be relative to the frame size.
+
+	char *const copy = us_strdup(str);
+	us_privacy_shape_s *shapes = NULL;
+	uint n_shapes = 0;
+
+	char *save = NULL;
+	for (char *item = strtok_r(copy, ";", &save); item != NULL; item = strtok_r(NULL, ";", &save)) {
+		while (*item == ' ') {
+			++item;
+		}
+		if (*item == '\0') {
+			goto error; // Empty shape
+		}
+		US_REALLOC(shapes, n_shapes + 1);
+		us_privacy_shape_s *const shape = &shapes[n_shapes];
+		US_MEMSET_ZERO(*shape);
+		if (strchr(item, 'x') != NULL) {
+			if (_parse_rect(item, shape) < 0) {
+				goto error;
+			}
+		} else {
+			if (_parse_polygon(item, shape) < 0) {
+				goto error;
+			}
+		}
+		++n_shapes;
+	}
+	if (n_shapes == 0) {
+		goto error;
+	}
+
+	free(copy);
+	US_DELETE(priv->shapes, free);
+	priv->shapes = shapes;
+	priv->n_shapes = n_shapes;
+	priv->run->width = 0; // Force rebuild
+	return 0;
+
+error:
+	free(copy);
+	US_DELETE(shapes, free);
+	return -1;
+}
+
+int us_privacy_apply(us_privacy_s *priv, us_frame_s *frame) {
+	us_privacy_runtime_s *const run = priv->run;
+
+	if (
+		run->width != frame->width
+		|| run->height != frame->height
+		|| run->format != frame->format
+		|| run->stride != frame->stride
+	) {
+		_rebuild_spans(priv, frame);
+	}
+	if (!run->supported) {
+		return -1;
+	}
+
+	const uint stride = frame->stride;
+	const uz y_size = (uz)stride * frame->height;
+	if (frame->used < y_size) {
+		return -1;
+	}
+
+	switch (frame->format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+			// Y=16 and U=V=128 is the video black
+			for (uint index = 0; index < run->n_spans; ++index) {
+				const us_privacy_span_s *const span = &run->spans[index];
+				_fill_macropixels(frame->data + (uz)span->y * stride, span->x0 / 2, span->x1 / 2, (const u8[4]){0x10, 0x80, 0x10, 0x80});
+			}
+			break;
+
+		case V4L2_PIX_FMT_UYVY:
+			for (uint index = 0; index < run->n_spans; ++index) {
+				const us_privacy_span_s *const span = &run->spans[index];
+				_fill_macropixels(frame->data + (uz)span->y * stride, span->x0 / 2, span->x1 / 2, (const u8[4]){0x80, 0x10, 0x80, 0x10});
+			}
+			break;
+
+		case V4L2_PIX_FMT_RGB565:
+			for (uint index = 0; index < run->n_spans; ++index) {
+				const us_privacy_span_s *const span = &run->spans[index];
+				_fill_u8(frame->data + (uz)span->y * stride, span->x0 * 2, span->x1 * 2, 0);
+			}
+			break;
+
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+			for (uint index = 0; index < run->n_spans; ++index) {
+				const us_privacy_span_s *const span = &run->spans[index];
+				_fill_u8(frame->data + (uz)span->y * stride, span->x0 * 3, span->x1 * 3, 0);
+			}
+			break;
+
+		case V4L2_PIX_FMT_GREY:
+			for (uint index = 0; index < run->n_spans; ++index) {
+				const us_privacy_span_s *const span = &run->spans[index];
+				_fill_u8(frame->data + (uz)span->y * stride, span->x0, span->x1, 16);
+			}
+			break;
+
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420: {
+			// Two chroma planes follow the luma, the same way as the CPU encoder reads them
+			const uz chroma_size = (frame->used - y_size) / 2;
+			const uint chroma_stride = stride / 2;
+			if (chroma_size < (uz)chroma_stride * (frame->height / 2)) {
+				return -1;
+			}
+			u8 *const u_plane = frame->data + y_size;
+			u8 *const v_plane = u_plane + chroma_size;
+			for (uint index = 0; index < run->n_spans; ++index) {
+				const us_privacy_span_s *const span = &run->spans[index];
+				_fill_u8(frame->data + (uz)span->y * stride, span->x0, span->x1, 16);
+				// Any chroma sample touching a masked pixel is greyed, so colors can't leak
+				const uz offset = (uz)(span->y / 2) * chroma_stride;
+				const uint x0 = span->x0 / 2;
+				const uint x1 = US_MIN((span->x1 + 1) / 2, chroma_stride);
+				_fill_u8(u_plane + offset, x0, x1, 128);
+				_fill_u8(v_plane + offset, x0, x1, 128);
+			}
+			break;
+		}
+
+		default: return -1;
+	}
+	return 0;
+}
+
+static int _parse_coord(const char *str, const char **end, us_privacy_coord_s *coord) {
+	char *num_end = NULL;
+	const float value = strtof(str, &num_end);
+	if (num_end == str || value < 0) {
+		return -1;
+	}
+	coord->value = value;
+	coord->percent = (*num_end == '%');
+	if (coord->percent) {
+		if (value > 100) {
+			return -1;
+		}
+		++num_end;
+	}
+	*end = num_end;
+	return 0;
+}
+
+static int _parse_rect(const char *str, us_privacy_shape_s *shape) {
+	us_privacy_coord_s w;
+	us_privacy_coord_s h;
+	us_privacy_coord_s x;
+	us_privacy_coord_s y;
+	const char *ptr = str;
+
+#	define PARSE(x_coord, x_sep) { \
+			if (_parse_coord(ptr, &ptr, &(x_coord)) < 0) { return -1; } \
+			if (*ptr != (x_sep)) { return -1; } \
+			if (*ptr != '\0') { ++ptr; } \
+		}
+	PARSE(w, 'x');
+	PARSE(h, '+');
+	PARSE(x, '+');
+	PARSE(y, '\0');
+#	undef PARSE
+
+	if (w.percent != x.percent || h.percent != y.percent) {
+		return -1; // Can't mix absolute and relative values on the one axis
+	}
+	if (w.value <= 0 || h.value <= 0) {
+		return -1;
+	}
+
+	const float x1 = x.value + w.value;
+	const float y1 = y.value + h.value;
+	const us_privacy_point_s points[4] = {
+		{x, y},
+		{{x1, x.percent}, y},
+		{{x1, x.percent}, {y1, y.percent}},
+		{x, {y1, y.percent}},
+	};
+	memcpy(shape->points, points, sizeof(points));
+	shape->n_points = 4;
+	return 0;
+}
+
+static int _parse_polygon(const char *str, us_privacy_shape_s *shape) {
+	const char *ptr = str;
+	while (true) {
+		if (shape->n_points >= US_PRIVACY_MAX_POINTS) {
+			return -1;
+		}
+		us_privacy_point_s *const point = &shape->points[shape->n_points];
+		if (_parse_coord(ptr, &ptr, &point->x) < 0 || *ptr != ',') {
+			return -1;
+		}
+		++ptr;
+		if (_parse_coord(ptr, &ptr, &point->y) < 0) {
+			return -1;
+		}
+		++shape->n_points;
+		if (*ptr == '\0') {
+			break;
+		} else if (*ptr != '/') {
+			return -1;
+		}
+		++ptr;
+	}
+	return (shape->n_points >= 3 ? 0 : -1);
+}
+
+static void _rebuild_spans(us_privacy_s *priv, const us_frame_s *frame) {
+	us_privacy_runtime_s *const run = priv->run;
+
+	run->width = frame->width;
+	run->height = frame->height;
+	run->format = frame->format;
+	run->stride = frame->stride;
+	run->n_spans = 0;
+
+	uint bytes_per_pixel = 0;
+	bool even_x = false;
+	switch (frame->format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY:
+			bytes_per_pixel = 2;
+			even_x = true; // Two pixels share the chroma
+			break;
+		case V4L2_PIX_FMT_RGB565: bytes_per_pixel = 2; break;
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24: bytes_per_pixel = 3; break;
+		case V4L2_PIX_FMT_GREY:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420: bytes_per_pixel = 1; break;
+		default: break;
+	}
+	run->supported = (
+		bytes_per_pixel > 0
+		&& frame->width > 0 && frame->height > 0
+		&& frame->stride >= frame->width * bytes_per_pixel
+	);
+	if (!run->supported) {
+		return;
+	}
+
+	float xs[US_PRIVACY_MAX_POINTS];
+	for (uint shape_index = 0; shape_index < priv->n_shapes; ++shape_index) {
+		const us_privacy_shape_s *const shape = &priv->shapes[shape_index];
+
+		float px[US_PRIVACY_MAX_POINTS];
+		float py[US_PRIVACY_MAX_POINTS];
+		float min_y = frame->height;
+		float max_y = 0;
+		for (uint index = 0; index < shape->n_points; ++index) {
+			px[index] = _resolve(&shape->points[index].x, frame->width);
+			py[index] = _resolve(&shape->points[index].y, frame->height);
+			min_y = US_MIN(min_y, py[index]);
+			max_y = US_MAX(max_y, py[index]);
+		}
+
+		// Even-odd scanline fill sampled at the pixel centers
+		const uint first_y = (min_y > 0.5 ? ceilf(min_y - 0.5) : 0);
+		const uint last_y = US_MIN((uint)ceilf(US_MAX(max_y - 0.5, 0)), frame->height);
+		for (uint y = first_y; y < last_y; ++y) {
+			const float center = y + 0.5;
+			uint n_xs = 0;
+			for (uint index = 0; index < shape->n_points; ++index) {
+				const uint next = (index + 1) % shape->n_points;
+				const float ya = py[index];
+				const float yb = py[next];
+				if ((ya <= center && center < yb) || (yb <= center && center < ya)) {
+					xs[n_xs] = px[index] + (center - ya) * (px[next] - px[index]) / (yb - ya);
+					++n_xs;
+				}
+			}
+			qsort(xs, n_xs, sizeof(float), _float_cmp);
+			for (uint index = 0; index + 1 < n_xs; index += 2) {
+				const float xa = US_MAX(ceilf(xs[index] - 0.5), 0);
+				const float xb = US_MIN(ceilf(xs[index + 1] - 0.5), frame->width);
+				if (xa < xb) {
+					uint x0 = xa;
+					uint x1 = xb;
+					if (even_x) {
+						x0 &= ~1u;
+						x1 = US_MIN((x1 + 1) & ~1u, frame->width & ~1u);
+					}
+					if (x0 < x1) {
+						_add_span(run, y, x0, x1);
+					}
+				}
+			}
+		}
+	}
+
+	if (run->n_spans > 0) {
+		// Merge overlapping spans of all shapes so that each byte is written once
+		qsort(run->spans, run->n_spans, sizeof(us_privacy_span_s), _span_cmp);
+		uint merged = 0;
+		for (uint index = 1; index < run->n_spans; ++index) {
+			us_privacy_span_s *const last = &run->spans[merged];
+			const us_privacy_span_s *const span = &run->spans[index];
+			if (span->y == last->y && span->x0 <= last->x1) {
+				last->x1 = US_MAX(last->x1, span->x1);
+			} else {
+				++merged;
+				run->spans[merged] = *span;
+			}
+		}
+		run->n_spans = merged + 1;
+	}
+}
+
+static void _add_span(us_privacy_runtime_s *run, uint y, uint x0, uint x1) {
+	if (run->n_spans >= run->spans_capacity) {
+		run->spans_capacity = US_MAX(run->spans_capacity * 2, 64u);
+		US_REALLOC(run->spans, run->spans_capacity);
+	}
+	run->spans[run->n_spans] = (us_privacy_span_s){.y = y, .x0 = x0, .x1 = x1};
+	++run->n_spans;
+}
+
+static int _span_cmp(const void *a_ptr, const void *b_ptr) {
+	const us_privacy_span_s *const a = a_ptr;
+	const us_privacy_span_s *const b = b_ptr;
+	if (a->y != b->y) {
+		return (a->y < b->y ? -1 : 1);
+	}
+	return (a->x0 < b->x0 ? -1 : (a->x0 > b->x0 ? 1 : 0));
+}
+
+static float _resolve(const us_privacy_coord_s *coord, uint size) {
+	return (coord->percent ? coord->value * size / 100 : coord->value);
+}
+
+static int _float_cmp(const void *a_ptr, const void *b_ptr) {
+	const float a = *(const float*)a_ptr;
+	const float b = *(const float*)b_ptr;
+	return (a < b ? -1 : (a > b ? 1 : 0));
+}
+
+static void _fill_u8(u8 *row, uint x0, uint x1, u8 value) {
+	memset(row + x0, value, x1 - x0);
+}
+
+static void _fill_macropixels(u8 *row, uint x0, uint x1, const u8 *pattern) {
+	// x0 and x1 are in 4-byte macropixels (two pixels with the shared chroma)
+	us_pixel_get()->fill32(row + x0 * 4, pattern, x1 - x0);
+}
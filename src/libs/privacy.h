@@ -0,0 +1,82 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include "types.h"
+#include "frame.h"
+
+
+#define US_PRIVACY_MAX_POINTS 32
+
+
+typedef struct {
+	float	value;
+	bool	percent;
+} us_privacy_coord_s;
+
+typedef struct {
+	us_privacy_coord_s	x;
+	us_privacy_coord_s	y;
+} us_privacy_point_s;
+
+typedef struct {
+	us_privacy_point_s	points[US_PRIVACY_MAX_POINTS];
+	uint				n_points;
+} us_privacy_shape_s;
+
+typedef struct {
+	uint	y;
+	uint	x0;
+	uint	x1; // Exclusive
+} us_privacy_span_s;
+
+typedef struct {
+	// Cached spans for the current frame geometry
+	uint				width;
+	uint				height;
+	uint				format;
+	uint				stride;
+	bool				supported;
+
+	us_privacy_span_s	*spans;
+	uint				n_spans;
+	uint				spans_capacity;
+} us_privacy_runtime_s;
+
+typedef struct {
+	us_privacy_shape_s		*shapes;
+	uint					n_shapes;
+
+	us_privacy_runtime_s	*run;
+} us_privacy_s;
+
+
+us_privacy_s *us_privacy_init(void);
+void us_privacy_destroy(us_privacy_s *priv);
+
+int us_privacy_parse(us_privacy_s *priv, const char *str);
+bool us_privacy_is_enabled(const us_privacy_s *priv);
+
+// Returns -1 if the frame format can't be masked
+int us_privacy_apply(us_privacy_s *priv, us_frame_s *frame);
@@ -0,0 +1,450 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "sched.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include <pthread.h>
+
+#include "types.h"
+#include "tools.h"
+#include "threading.h"
+
+
+static _Thread_local us_sched_worker_s *_tls_worker = NULL;
+
+
+static void *_worker_thread(void *v_wr);
+static bool _sched_take(us_sched_s *sched, us_sched_worker_s *wr, us_sched_task_s *task);
+
+static void _deque_push(us_sched_deque_s *dq, const us_sched_task_s *task);
+static bool _deque_pop_head(us_sched_deque_s *dq, us_sched_task_s *task);
+static bool _deque_pop_tail(us_sched_deque_s *dq, us_sched_task_s *task);
+
+
+us_sched_s *us_sched_init(const char *name, uint n_workers) {
+	assert(n_workers > 0);
+
+	us_sched_s *sched;
+	US_CALLOC(sched, 1);
+	sched->name = name;
+	sched->n_workers = n_workers;
+	atomic_init(&sched->next_worker, 0);
+	atomic_init(&sched->pending, 0);
+	atomic_init(&sched->running, 0);
+	US_MUTEX_INIT(sched->idle_mutex);
+	US_COND_INIT(sched->idle_cond);
+	US_COND_INIT(sched->done_cond);
+	atomic_init(&sched->stop, false);
+
+	US_CALLOC(sched->workers, n_workers);
+	for (uint index = 0; index < n_workers; ++index) {
+		us_sched_worker_s *const wr = &sched->workers[index];
+		wr->number = index;
+		wr->sched = sched;
+		US_MUTEX_INIT(wr->mutex);
+		atomic_init(&wr->executed, 0);
+		atomic_init(&wr->stolen, 0);
+	}
+	for (uint index = 0; index < n_workers; ++index) {
+		US_THREAD_CREATE(sched->workers[index].tid, _worker_thread, &sched->workers[index]);
+	}
+	return sched;
+}
+
+void us_sched_destroy(us_sched_s *sched) {
+	us_sched_wait_idle(sched);
+
+	US_MUTEX_LOCK(sched->idle_mutex);
+	atomic_store(&sched->stop, true);
+	US_COND_BROADCAST(sched->idle_cond);
+	US_MUTEX_UNLOCK(sched->idle_mutex);
+
+	for (uint index = 0; index < sched->n_workers; ++index) {
+		us_sched_worker_s *const wr = &sched->workers[index];
+		US_THREAD_JOIN(wr->tid);
+		for (uint prio = 0; prio < US_SCHED_N_PRIOS; ++prio) {
+			free(wr->deques[prio].items);
+		}
+		US_MUTEX_DESTROY(wr->mutex);
+	}
+	free(sched->workers);
+
+	US_COND_DESTROY(sched->done_cond);
+	US_COND_DESTROY(sched->idle_cond);
+	US_MUTEX_DESTROY(sched->idle_mutex);
+	free(sched);
+}
+
+void us_sched_submit(us_sched_s *sched, us_sched_prio_e prio, us_sched_task_f fn, void *arg) {
+	// Задачи, порожденные задачей, остаются на ядре своего воркера (данные кадра
+	// еще в кеше), остальные раскладываются по кругу. Свободные воркеры воруют.
+	us_sched_worker_s *wr = _tls_worker;
+	if (wr == NULL || wr->sched != sched) {
+		wr = &sched->workers[atomic_fetch_add(&sched->next_worker, 1) % sched->n_workers];
+	}
+
+	const us_sched_task_s task = {.fn = fn, .arg = arg};
+	atomic_fetch_add(&sched->pending, 1);
+	US_MUTEX_LOCK(wr->mutex);
+	_deque_push(&wr->deques[prio], &task);
+	US_MUTEX_UNLOCK(wr->mutex);
+
+	US_MUTEX_LOCK(sched->idle_mutex);
+	if (sched->n_sleeping > 0) {
+		US_COND_SIGNAL(sched->idle_cond);
+	}
+	US_MUTEX_UNLOCK(sched->idle_mutex);
+}
+
+void us_sched_wait_idle(us_sched_s *sched) {
+	US_MUTEX_LOCK(sched->idle_mutex);
+	while (atomic_load(&sched->pending) > 0 || atomic_load(&sched->running) > 0) {
+		assert(!pthread_cond_wait(&sched->done_cond, &sched->idle_mutex));
+	}
+	US_MUTEX_UNLOCK(sched->idle_mutex);
+}
+
+static void *_worker_thread(void *v_wr) {
+	us_sched_worker_s *const wr = v_wr;
+	us_sched_s *const sched = wr->sched;
+	US_THREAD_SETTLE("%s_%u", sched->name, wr->number);
+	_tls_worker = wr;
+
+	while (true) {
+		us_sched_task_s task;
+		if (_sched_take(sched, wr, &task)) {
+			task.fn(task.arg);
+			atomic_fetch_add(&wr->executed, 1);
+			if (atomic_fetch_sub(&sched->running, 1) == 1 && atomic_load(&sched->pending) == 0) {
+				US_MUTEX_LOCK(sched->idle_mutex);
+				US_COND_BROADCAST(sched->done_cond);
+				US_MUTEX_UNLOCK(sched->idle_mutex);
+			}
+			continue;
+		}
+
+		US_MUTEX_LOCK(sched->idle_mutex);
+		if (atomic_load(&sched->stop)) {
+			US_MUTEX_UNLOCK(sched->idle_mutex);
+			break;
+		}
+		if (atomic_load(&sched->pending) == 0) {
+			++sched->n_sleeping;
+			assert(!pthread_cond_wait(&sched->idle_cond, &sched->idle_mutex));
+			--sched->n_sleeping;
+		}
+		US_MUTEX_UNLOCK(sched->idle_mutex);
+	}
+	return NULL;
+}
+
+static bool _sched_take(us_sched_s *sched, us_sched_worker_s *wr, us_sched_task_s *task) {
+	// A higher priority task anywhere is more important than the own lower priority one
+	for (uint prio = 0; prio < US_SCHED_N_PRIOS; ++prio) {
+		for (uint offset = 0; offset < sched->n_workers; ++offset) {
+			us_sched_worker_s *const victim = &sched->workers[(wr->number + offset) % sched->n_workers];
+			US_MUTEX_LOCK(victim->mutex);
+			const bool taken = (victim == wr
+				? _deque_pop_head(&victim->deques[prio], task)
+				: _deque_pop_tail(&victim->deques[prio], task));
+			if (taken) {
+				// Still counted as pending or running, so wait_idle() can't miss it
+				atomic_fetch_add(&sched->running, 1);
+				atomic_fetch_sub(&sched->pending, 1);
+			}
+			US_MUTEX_UNLOCK(victim->mutex);
+			if (taken) {
+				if (victim != wr) {
+					atomic_fetch_add(&wr->stolen, 1);
+				}
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void _deque_push(us_sched_deque_s *dq, const us_sched_task_s *task) {
+	if (dq->size == dq->capacity) {
+		const uint capacity = US_MAX(dq->capacity * 2, 16u);
+		us_sched_task_s *items;
+		US_CALLOC(items, capacity);
+		for (uint index = 0; index < dq->size; ++index) {
+			items[index] = dq->items[(dq->head + index) % dq->capacity];
+		}
+		free(dq->items);
+		dq->items = items;
+		dq->capacity = capacity;
+		dq->head = 0;
+	}
+	dq->items[(dq->head + dq->size) % dq->capacity] = *task;
+	++dq->size;
+}
+
+static bool _deque_pop_head(us_sched_deque_s *dq, us_sched_task_s *task) {
+	if (dq->size == 0) {
+		return false;
+	}
+	*task = dq->items[dq->head];
+	dq->head = (dq->head + 1) % dq->capacity;
+	--dq->size;
+	return true;
+}
+
+static bool _deque_pop_tail(us_sched_deque_s *dq, us_sched_task_s *task) {
+	if (dq->size == 0) {
+		return false;
+	}
+	--dq->size;
+	*task = dq->items[(dq->head + dq->size) % dq->capacity];
+	return true;
+}
+
+
+#ifdef TEST_SCHED
+// Сравнение со старой схемой "поток на стадию": отдельный поток публикации RAW
+// и по потоку-релизеру на буфер, который опрашивает refs. Кодирование в обоих
+// режимах идет на выделенных потоках, как у JPEG-воркеров в стриме.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_SCHED -o sched-bench libs/sched.c libs/queue.c -pthread
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+
+#include "queue.h"
+
+
+#define _N_BUFS		8
+#define _N_FRAMES	600
+#define _ENCODE_US	1500
+#define _PUBLISH_US	100
+
+typedef struct {
+	uint		index;
+	u64			created_us;
+	atomic_int	refs;
+	atomic_bool	busy;
+} _frame_s;
+
+static _frame_s		_g_frames[_N_BUFS];
+static u64			_g_latencies[_N_FRAMES];
+static atomic_uint	_g_done;
+static us_sched_s	*_g_sched;
+
+static void _spin(u64 us) {
+	const u64 deadline = us_get_now_monotonic_u64() + us;
+	while (us_get_now_monotonic_u64() < deadline);
+}
+
+static void _frame_done(_frame_s *frame) {
+	const uint done = atomic_fetch_add(&_g_done, 1);
+	if (done < _N_FRAMES) {
+		_g_latencies[done] = us_get_now_monotonic_u64() - frame->created_us;
+	}
+	atomic_store(&frame->busy, false);
+}
+
+// Scheduler mode
+static void _task_release(void *v_frame) {
+	_frame_done(v_frame);
+}
+
+static void _task_decref(_frame_s *frame) {
+	if (atomic_fetch_sub(&frame->refs, 1) == 1) {
+		us_sched_submit(_g_sched, US_SCHED_PRIO_HIGH, _task_release, frame);
+	}
+}
+
+static void _task_publish(void *v_frame) {
+	_spin(_PUBLISH_US);
+	_task_decref(v_frame);
+}
+
+// The encoders are the same in the both modes
+static us_queue_s	*_g_encode_queue;
+static us_queue_s	*_g_publish_queue;
+static us_queue_s	*_g_release_queues[_N_BUFS];
+static atomic_bool	_g_threads_stop;
+
+static void *_thread_encode(void *v_use_sched) {
+	const bool use_sched = (v_use_sched != NULL);
+	while (!atomic_load(&_g_threads_stop)) {
+		_frame_s *frame;
+		if (!us_queue_get(_g_encode_queue, (void**)&frame, 0.1)) {
+			_spin(_ENCODE_US);
+			if (use_sched) {
+				_task_decref(frame);
+			} else {
+				atomic_fetch_sub(&frame->refs, 1);
+			}
+		}
+	}
+	return NULL;
+}
+
+static void *_thread_publish(void *arg) {
+	(void)arg;
+	while (!atomic_load(&_g_threads_stop)) {
+		_frame_s *frame;
+		if (!us_queue_get(_g_publish_queue, (void**)&frame, 0.1)) {
+			_spin(_PUBLISH_US);
+			atomic_fetch_sub(&frame->refs, 1);
+		}
+	}
+	return NULL;
+}
+
+static void *_thread_release(void *v_queue) {
+	while (!atomic_load(&_g_threads_stop)) {
+		_frame_s *frame;
+		if (!us_queue_get(v_queue, (void**)&frame, 0.1)) {
+			while (atomic_load(&frame->refs) > 0) {
+				usleep(10 * 1000); // The same polling as in the stream releasers
+			}
+			_frame_done(frame);
+		}
+	}
+	return NULL;
+}
+
+static int _cmp_u64(const void *a, const void *b) {
+	const u64 x = *(const u64*)a;
+	const u64 y = *(const u64*)b;
+	return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+static void _run(const char *name, bool use_sched, uint fps) {
+	const uint n_workers = us_get_cores_available();
+	atomic_store(&_g_done, 0);
+	for (uint index = 0; index < _N_BUFS; ++index) {
+		_g_frames[index].index = index;
+		atomic_init(&_g_frames[index].busy, false);
+	}
+
+	pthread_t tids[2 + _N_BUFS + 32];
+	uint n_tids = 0;
+	atomic_store(&_g_threads_stop, false);
+	_g_encode_queue = us_queue_init(_N_BUFS);
+	for (uint index = 0; index < n_workers; ++index) {
+		US_THREAD_CREATE(tids[n_tids++], _thread_encode, (use_sched ? (void*)1 : NULL));
+	}
+	if (use_sched) {
+		_g_sched = us_sched_init("bench", n_workers);
+	} else {
+		_g_publish_queue = us_queue_init(_N_BUFS);
+		US_THREAD_CREATE(tids[n_tids++], _thread_publish, NULL);
+		for (uint index = 0; index < _N_BUFS; ++index) {
+			_g_release_queues[index] = us_queue_init(1);
+			US_THREAD_CREATE(tids[n_tids++], _thread_release, _g_release_queues[index]);
+		}
+	}
+
+	struct rusage ru_begin;
+	getrusage(RUSAGE_SELF, &ru_begin);
+	const u64 begin_us = us_get_now_monotonic_u64();
+
+	uint produced = 0;
+	u64 next_us = begin_us;
+	while (produced < _N_FRAMES) {
+		if (fps > 0) {
+			const u64 now_us = us_get_now_monotonic_u64();
+			if (now_us < next_us) {
+				usleep(next_us - now_us);
+			}
+			next_us += 1000000 / fps;
+		}
+		_frame_s *frame = NULL;
+		while (frame == NULL) {
+			for (uint index = 0; index < _N_BUFS && frame == NULL; ++index) {
+				if (!atomic_load(&_g_frames[index].busy)) {
+					frame = &_g_frames[index];
+				}
+			}
+			if (frame == NULL) {
+				usleep(100); // Like a blocking DQBUF
+			}
+		}
+		atomic_store(&frame->busy, true);
+		frame->created_us = us_get_now_monotonic_u64();
+		if (use_sched) {
+			atomic_store(&frame->refs, 3); // Encode, publish and the producer itself
+			assert(!us_queue_put(_g_encode_queue, frame, 0));
+			us_sched_submit(_g_sched, US_SCHED_PRIO_NORMAL, _task_publish, frame);
+			_task_decref(frame);
+		} else {
+			atomic_store(&frame->refs, 2);
+			assert(!us_queue_put(_g_encode_queue, frame, 0));
+			assert(!us_queue_put(_g_publish_queue, frame, 0));
+			assert(!us_queue_put(_g_release_queues[frame->index], frame, 0));
+		}
+		++produced;
+	}
+	while (atomic_load(&_g_done) < _N_FRAMES) {
+		usleep(100);
+	}
+
+	const u64 elapsed_us = us_get_now_monotonic_u64() - begin_us;
+	struct rusage ru_end;
+	getrusage(RUSAGE_SELF, &ru_end);
+
+	atomic_store(&_g_threads_stop, true);
+	for (uint index = 0; index < n_tids; ++index) {
+		US_THREAD_JOIN(tids[index]);
+	}
+	us_queue_destroy(_g_encode_queue);
+	if (use_sched) {
+		US_DELETE(_g_sched, us_sched_destroy);
+	} else {
+		us_queue_destroy(_g_publish_queue);
+		for (uint index = 0; index < _N_BUFS; ++index) {
+			us_queue_destroy(_g_release_queues[index]);
+		}
+	}
+
+	qsort(_g_latencies, _N_FRAMES, sizeof(u64), _cmp_u64);
+	const long switches = (
+		(ru_end.ru_nvcsw - ru_begin.ru_nvcsw)
+		+ (ru_end.ru_nivcsw - ru_begin.ru_nivcsw)
+	);
+	printf("%-8s fps_limit=%-3u threads=%-2u  %7.1f frames/s  p50=%6.2f ms  p99=%6.2f ms  switches/frame=%5.1f\n",
+		name, fps, n_tids + (use_sched ? n_workers : 0),
+		(double)_N_FRAMES * 1000000 / elapsed_us,
+		(double)_g_latencies[_N_FRAMES / 2] / 1000,
+		(double)_g_latencies[_N_FRAMES * 99 / 100] / 1000,
+		(double)switches / _N_FRAMES);
+}
+
+int main(void) {
+	_run("threads", false, 0);
+	_run("sched", true, 0);
+	_run("threads", false, 30);
+	_run("sched", true, 30);
+	return 0;
+}
+#endif
@@ -0,0 +1,90 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include "types.h"
+
+
+typedef enum {
+	US_SCHED_PRIO_HIGH = 0,
+	US_SCHED_PRIO_NORMAL,
+	US_SCHED_PRIO_LOW,
+	US_SCHED_N_PRIOS,
+} us_sched_prio_e;
+
+typedef void (*us_sched_task_f)(void *arg);
+
+typedef struct {
+	us_sched_task_f	fn;
+	void			*arg;
+} us_sched_task_s;
+
+typedef struct {
+	us_sched_task_s	*items;
+	uint			capacity;
+	uint			head; // The oldest task, the owner takes it
+	uint			size; // Thieves take the newest one from the tail
+} us_sched_deque_s;
+
+typedef struct {
+	pthread_t			tid;
+	uint				number;
+	struct us_sched_sx	*sched;
+
+	pthread_mutex_t		mutex;
+	us_sched_deque_s	deques[US_SCHED_N_PRIOS];
+
+	atomic_ullong		executed;
+	atomic_ullong		stolen;
+} us_sched_worker_s;
+
+typedef struct us_sched_sx {
+	const char			*name;
+	uint				n_workers;
+	us_sched_worker_s	*workers;
+	atomic_uint			next_worker;
+
+	atomic_uint			pending; // Queued tasks
+	atomic_uint			running;
+
+	pthread_mutex_t		idle_mutex;
+	pthread_cond_t		idle_cond;
+	pthread_cond_t		done_cond;
+	uint				n_sleeping;
+
+	atomic_bool			stop;
+} us_sched_s;
+
+
+// For the short non-blocking tasks: a blocking one holds its worker,
+// and the tasks queued behind it wait until the others steal them.
+us_sched_s *us_sched_init(const char *name, uint n_workers);
+void us_sched_destroy(us_sched_s *sched);
+
+void us_sched_submit(us_sched_s *sched, us_sched_prio_e prio, us_sched_task_f fn, void *arg);
+void us_sched_wait_idle(us_sched_s *sched);
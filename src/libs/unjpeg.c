@@ -34,6 +34,7 @@
 #endif
 
 #include "types.h"
+#include "tools.h"
 #include "logging.h"
 #include "frame.h"
 
@@ -45,10 +46,22 @@ typedef struct {
 } _jpeg_error_manager_s;
 
 
+static int _unjpeg(const us_frame_s *src, us_frame_s *dest, bool decode, uint scale_denom);
 static void _jpeg_error_handler(j_common_ptr jpeg);
 
 
 int us_unjpeg(const us_frame_s *src, us_frame_s *dest, bool decode) {
+	return _unjpeg(src, dest, decode, 1);
+}
+
+int us_unjpeg_scaled(const us_frame_s *src, us_frame_s *dest, uint scale_denom) {
+	// The IDCT is performed directly at 1/2, 1/4 or 1/8 of the size,
+	// so it's much cheaper than the full decoding with a downscaling.
+	assert(scale_denom == 1 || scale_denom == 2 || scale_denom == 4 || scale_denom == 8);
+	return _unjpeg(src, dest, true, scale_denom);
+}
+
+static int _unjpeg(const us_frame_s *src, us_frame_s *dest, bool decode, uint scale_denom) {
 	assert(us_is_jpeg(src->format));
 
 	volatile int retval = 0;
@@ -69,6 +82,8 @@ int us_unjpeg(const us_frame_s *src, us_frame_s *dest, bool decode) {
 	jpeg_mem_src(&jpeg, src->data, src->used);
 	jpeg_read_header(&jpeg, TRUE);
 	jpeg.out_color_space = JCS_RGB;
+	jpeg.scale_num = 1;
+	jpeg.scale_denom = scale_denom;
 
 	jpeg_start_decompress(&jpeg);
 
@@ -80,14 +95,18 @@ int us_unjpeg(const us_frame_s *src, us_frame_s *dest, bool decode) {
 	dest->used = 0; // cppcheck-suppress redundantAssignment
 
 	if (decode) {
-		JSAMPARRAY scanlines;
-		scanlines = (*jpeg.mem->alloc_sarray)((j_common_ptr) &jpeg, JPOOL_IMAGE, dest->stride, 1);
-
-		us_frame_realloc_data(dest, ((dest->width * dest->height) << 1) * 2);
+		// The color conversion is done by libjpeg(-turbo) with its own SIMD,
+		// so the scanlines are decoded right into the frame without copying.
+		us_frame_realloc_data(dest, (uz)dest->stride * dest->height);
 		while (jpeg.output_scanline < jpeg.output_height) {
-			jpeg_read_scanlines(&jpeg, scanlines, 1);
-			us_frame_append_data(dest, scanlines[0], dest->stride);
+			JSAMPROW scanlines[4];
+			for (uint index = 0; index < 4; ++index) {
+				const uint y = US_MIN(jpeg.output_scanline + index, jpeg.output_height - 1);
+				scanlines[index] = dest->data + (uz)y * dest->stride;
+			}
+			jpeg_read_scanlines(&jpeg, scanlines, 4);
 		}
+		dest->used = (uz)dest->stride * dest->height;
 
 		jpeg_finish_decompress(&jpeg);
 	}
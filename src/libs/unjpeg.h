@@ -27,3 +27,4 @@
 
 
 int us_unjpeg(const us_frame_s *src, us_frame_s *dest, bool decode);
+int us_unjpeg_scaled(const us_frame_s *src, us_frame_s *dest, uint scale_denom);
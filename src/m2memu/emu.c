@@ -0,0 +1,970 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+// Userspace emulator of a V4L2 M2M encoder (like the bcm2835-codec)
+// to run the m2m.c paths without hardware:
+//   $ make WITH_M2M_EMU=1
+//   $ LD_PRELOAD=./ustreamer-m2m-emu.so ./ustreamer --encoder=m2m-image ...
+//
+// The devices are opened as eventfd (so poll() works as is), buffers
+// are allocated in a memfd and encoded by the CPU JPEG encoder.
+// H.264 is emulated by Annex B access units with JPEG payload: they are not
+// decodable, but their keyframes, sizes and timings are similar to real ones.
+//
+// Environment:
+//   US_M2M_EMU_DEVICES=/dev/video11,/dev/video31  -- Paths to emulate.
+//   US_M2M_EMU_LATENCY=<ms>, US_M2M_EMU_JITTER=<ms>  -- Extra encoding time.
+//   US_M2M_EMU_FAIL=<op>:<N>,...  -- Fail each Nth call with EIO. Operations:
+//       S_FMT, REQBUFS, QUERYBUF, QBUF, DQBUF, STREAMON, S_CTRL, S_PARM and
+//       "stall" (the frame is consumed without an output, like a hung encoder).
+//   US_M2M_EMU_GARBAGE=1  -- Emit a garbage buffer with zero timestamp first
+//       after each STREAMON, like the real encoder does sometimes.
+//   US_M2M_EMU_VERBOSE=1  -- Log each ioctl to stderr.
+//
+// The round trip statistics is printed on close.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+#include <dlfcn.h>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/array.h"
+#include "../libs/threading.h"
+#include "../libs/frame.h"
+#include "../ustreamer/encoders/cpu/encoder.h"
+
+
+#define _EXPORT __attribute__((visibility("default")))
+
+#define _MAX_BUFS			32
+#define _CAPTURE_OFFSET		((uz)1 << 30) // CAPTURE buffers in the memfd
+#define _DEFAULT_QUALITY	80
+
+
+typedef struct {
+	bool			queued; // Owned by the device
+	bool			done; // Ready to DQBUF
+	u64				seq;
+	u32				bytesused;
+	u32				flags;
+	struct timeval	timestamp;
+	int				dma_fd;
+	ldf				queued_ts;
+} _buf_s;
+
+typedef struct {
+	const char	*name;
+	uint		type;
+	uint		memory;
+	uint		width;
+	uint		height;
+	uint		format;
+	uint		stride;
+	uz			sizeimage;
+	bool		streaming;
+
+	_buf_s		bufs[_MAX_BUFS];
+	uint		n_bufs;
+	uz			offset;
+	uz			buf_size;
+	u8			*mem;
+} _queue_s;
+
+typedef struct _dev_sx {
+	int				fd;
+	int				mem_fd;
+	char			*path;
+	bool			nonblock;
+
+	_queue_s		in; // Raw frames: V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE
+	_queue_s		out; // Encoded: V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+	u64				seq;
+
+	int				bitrate;
+	int				gop;
+	int				quality;
+	bool			force_key;
+	uint			since_key;
+	bool			need_garbage;
+
+	us_frame_s		*src;
+	us_frame_s		*dest;
+
+	pthread_t		tid;
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	bool			stop;
+
+	uint			frames;
+	uint			keys;
+	uint			stalls;
+	uint			failures;
+	ldf				rt_sum;
+	ldf				rt_max;
+
+	struct _dev_sx	*next;
+} _dev_s;
+
+typedef struct {
+	const char	*op;
+	uint		every;
+	uint		count;
+} _fail_s;
+
+
+static pthread_once_t _g_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t _g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _dev_s *_g_devs = NULL;
+
+static char *_g_paths = NULL;
+static ldf _g_latency = 0;
+static ldf _g_jitter = 0;
+static bool _g_garbage = false;
+static bool _g_verbose = false;
+static _fail_s _g_fails[] = {
+	{"S_FMT", 0, 0}, {"REQBUFS", 0, 0}, {"QUERYBUF", 0, 0}, {"QBUF", 0, 0}, {"DQBUF", 0, 0},
+	{"STREAMON", 0, 0}, {"S_CTRL", 0, 0}, {"S_PARM", 0, 0}, {"stall", 0, 0},
+};
+
+
+static void _init(void);
+static bool _is_emulated(const char *path);
+static int _open_device(const char *path, int flags);
+static _dev_s *_find_device(int fd);
+static void _close_device(_dev_s *dev);
+
+static int _ioctl(_dev_s *dev, unsigned long request, void *arg);
+static _queue_s *_get_queue(_dev_s *dev, uint type);
+static void _set_format(_dev_s *dev, _queue_s *queue, struct v4l2_format *fmt);
+static int _request_buffers(_dev_s *dev, _queue_s *queue, struct v4l2_requestbuffers *req);
+static int _queue_buffer(_dev_s *dev, _queue_s *queue, struct v4l2_buffer *buf);
+static int _dequeue_buffer(_dev_s *dev, _queue_s *queue, struct v4l2_buffer *buf);
+static void _stream_off(_dev_s *dev, _queue_s *queue);
+
+static void *_worker_thread(void *v_dev);
+static void _encode(_dev_s *dev, const u8 *data, uz size, bool *key);
+static void _append_nal(us_frame_s *frame, u8 header, const u8 *data, uz size);
+static bool _fail(const char *op);
+
+static void _log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define _LOG_DEBUG(x_msg, ...) { if (_g_verbose) { _log(x_msg, ##__VA_ARGS__); } }
+
+#define _REAL(x_func) ({ \
+		static __typeof__(x_func) *m_real = NULL; \
+		if (m_real == NULL) { \
+			m_real = dlsym(RTLD_NEXT, #x_func); \
+			assert(m_real != NULL); \
+		} \
+		m_real; \
+	})
+
+
+_EXPORT int open(const char *path, int flags, ...) {
+	va_list args;
+	va_start(args, flags);
+	const mode_t mode = ((flags & (O_CREAT | O_TMPFILE)) ? va_arg(args, mode_t) : 0);
+	va_end(args);
+	if (_is_emulated(path)) {
+		return _open_device(path, flags);
+	}
+	return _REAL(open)(path, flags, mode);
+}
+
+_EXPORT int open64(const char *path, int flags, ...) {
+	va_list args;
+	va_start(args, flags);
+	const mode_t mode = ((flags & (O_CREAT | O_TMPFILE)) ? va_arg(args, mode_t) : 0);
+	va_end(args);
+	if (_is_emulated(path)) {
+		return _open_device(path, flags);
+	}
+	return _REAL(open64)(path, flags, mode);
+}
+
+_EXPORT int __open_2(const char *path, int flags) {
+	if (_is_emulated(path)) {
+		return _open_device(path, flags);
+	}
+	return _REAL(__open_2)(path, flags);
+}
+
+_EXPORT int __open64_2(const char *path, int flags) {
+	if (_is_emulated(path)) {
+		return _open_device(path, flags);
+	}
+	return _REAL(__open64_2)(path, flags);
+}
+
+_EXPORT int close(int fd) {
+	_dev_s *const dev = _find_device(fd);
+	if (dev != NULL) {
+		_close_device(dev);
+	}
+	return _REAL(close)(fd);
+}
+
+_EXPORT int ioctl(int fd, unsigned long request, ...) {
+	va_list args;
+	va_start(args, request);
+	void *const arg = va_arg(args, void*);
+	va_end(args);
+
+	_dev_s *const dev = _find_device(fd);
+	if (dev == NULL) {
+		return _REAL(ioctl)(fd, request, arg);
+	}
+	US_MUTEX_LOCK(dev->mutex);
+	const int retval = _ioctl(dev, request, arg);
+	US_MUTEX_UNLOCK(dev->mutex);
+	return retval;
+}
+
+_EXPORT void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+	_dev_s *const dev = _find_device(fd);
+	if (dev != NULL) {
+		fd = dev->mem_fd;
+	}
+	return _REAL(mmap)(addr, length, prot, flags, fd, offset);
+}
+
+_EXPORT void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset) {
+	_dev_s *const dev = _find_device(fd);
+	if (dev != NULL) {
+		fd = dev->mem_fd;
+	}
+	return _REAL(mmap64)(addr, length, prot, flags, fd, offset);
+}
+
+static void _init(void) {
+	const char *env;
+
+	_g_paths = us_strdup((env = getenv("US_M2M_EMU_DEVICES")) != NULL ? env : "/dev/video11,/dev/video31");
+	if ((env = getenv("US_M2M_EMU_LATENCY")) != NULL) {
+		_g_latency = strtold(env, NULL) / 1000;
+	}
+	if ((env = getenv("US_M2M_EMU_JITTER")) != NULL) {
+		_g_jitter = strtold(env, NULL) / 1000;
+	}
+	_g_garbage = ((env = getenv("US_M2M_EMU_GARBAGE")) != NULL && atoi(env) > 0);
+	_g_verbose = ((env = getenv("US_M2M_EMU_VERBOSE")) != NULL && atoi(env) > 0);
+
+	if ((env = getenv("US_M2M_EMU_FAIL")) != NULL) {
+		char *const fails = us_strdup(env);
+		char *saveptr = NULL;
+		for (char *item = strtok_r(fails, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+			char *const colon = strchr(item, ':');
+			bool found = false;
+			if (colon != NULL) {
+				*colon = '\0';
+				for (uz index = 0; index < US_ARRAY_LEN(_g_fails); ++index) {
+					if (!strcmp(_g_fails[index].op, item)) {
+						_g_fails[index].every = strtoul(colon + 1, NULL, 10);
+						found = true;
+					}
+				}
+			}
+			if (!found) {
+				_log("Invalid failure injection: %s", item);
+			}
+		}
+		free(fails);
+	}
+	srandom(getpid());
+}
+
+static bool _is_emulated(const char *path) {
+	pthread_once(&_g_once, _init);
+	if (path == NULL) {
+		return false;
+	}
+	const uz len = strlen(path);
+	for (const char *item = _g_paths; *item != '\0';) {
+		const char *const end = strchrnul(item, ',');
+		if ((uz)(end - item) == len && !strncmp(item, path, len)) {
+			return true;
+		}
+		item = (*end == ',' ? end + 1 : end);
+	}
+	return false;
+}
+
+static int _open_device(const char *path, int flags) {
+	_dev_s *dev;
+	US_CALLOC(dev, 1);
+	dev->fd = -1;
+	dev->mem_fd = -1;
+	dev->path = us_strdup(path);
+	dev->nonblock = (flags & O_NONBLOCK);
+	dev->in.name = "INPUT";
+	dev->in.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	dev->out.name = "OUTPUT";
+	dev->out.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	dev->out.offset = _CAPTURE_OFFSET;
+	dev->quality = _DEFAULT_QUALITY;
+	dev->src = us_frame_init();
+	dev->dest = us_frame_init();
+	US_MUTEX_INIT(dev->mutex);
+	US_COND_INIT(dev->cond);
+
+	{
+		struct v4l2_format fmt = {0};
+		fmt.fmt.pix_mp.width = 640;
+		fmt.fmt.pix_mp.height = 480;
+		fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_YUYV;
+		_set_format(dev, &dev->in, &fmt);
+		fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_H264;
+		_set_format(dev, &dev->out, &fmt);
+	}
+
+	if ((dev->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE)) < 0) {
+		goto error;
+	}
+	if ((dev->mem_fd = memfd_create("us-m2m-emu", MFD_CLOEXEC)) < 0) {
+		goto error;
+	}
+	US_THREAD_CREATE(dev->tid, _worker_thread, dev);
+
+	US_MUTEX_LOCK(_g_mutex);
+	dev->next = _g_devs;
+	_g_devs = dev;
+	US_MUTEX_UNLOCK(_g_mutex);
+
+	_LOG_DEBUG("%s: Opened as fd=%d", path, dev->fd);
+	return dev->fd;
+
+error:
+	{
+		const int error = errno;
+		if (dev->fd >= 0) {
+			_REAL(close)(dev->fd);
+		}
+		US_MUTEX_DESTROY(dev->mutex);
+		US_COND_DESTROY(dev->cond);
+		us_frame_destroy(dev->src);
+		us_frame_destroy(dev->dest);
+		free(dev->path);
+		free(dev);
+		errno = error;
+	}
+	return -1;
+}
+
+static _dev_s *_find_device(int fd) {
+	_dev_s *found = NULL;
+	if (fd >= 0) {
+		US_MUTEX_LOCK(_g_mutex);
+		for (_dev_s *dev = _g_devs; dev != NULL; dev = dev->next) {
+			if (dev->fd == fd) {
+				found = dev;
+				break;
+			}
+		}
+		US_MUTEX_UNLOCK(_g_mutex);
+	}
+	return found;
+}
+
+static void _close_device(_dev_s *dev) {
+	US_MUTEX_LOCK(_g_mutex);
+	for (_dev_s **ptr = &_g_devs; *ptr != NULL; ptr = &(*ptr)->next) {
+		if (*ptr == dev) {
+			*ptr = dev->next;
+			break;
+		}
+	}
+	US_MUTEX_UNLOCK(_g_mutex);
+
+	US_MUTEX_LOCK(dev->mutex);
+	dev->stop = true;
+	US_COND_BROADCAST(dev->cond);
+	US_MUTEX_UNLOCK(dev->mutex);
+	US_THREAD_JOIN(dev->tid);
+
+	_log("%s: Closed: frames=%u, keys=%u, stalls=%u, failures=%u, round_trip_avg=%.3Lf ms, round_trip_max=%.3Lf ms",
+		dev->path, dev->frames, dev->keys, dev->stalls, dev->failures,
+		(dev->frames > 0 ? dev->rt_sum * 1000 / dev->frames : 0), dev->rt_max * 1000);
+
+	_queue_s *const queues[] = {&dev->in, &dev->out};
+	for (uz index = 0; index < US_ARRAY_LEN(queues); ++index) {
+		if (queues[index]->mem != NULL) {
+			munmap(queues[index]->mem, queues[index]->n_bufs * queues[index]->buf_size);
+		}
+	}
+	_REAL(close)(dev->mem_fd);
+	US_MUTEX_DESTROY(dev->mutex);
+	US_COND_DESTROY(dev->cond);
+	us_frame_destroy(dev->src);
+	us_frame_destroy(dev->dest);
+	free(dev->path);
+	free(dev);
+}
+
+static int _ioctl(_dev_s *dev, unsigned long request, void *arg) {
+#	define FAIL(x_op) { \
+			if (_fail(x_op)) { \
+				_LOG_DEBUG("%s: Injected failure: %s", dev->path, x_op); \
+				++dev->failures; \
+				errno = EIO; \
+				return -1; \
+			} \
+		}
+#	define GET_QUEUE(x_type) ({ \
+			_queue_s *m_queue = _get_queue(dev, x_type); \
+			if (m_queue == NULL) { \
+				errno = EINVAL; \
+				return -1; \
+			} \
+			m_queue; \
+		})
+
+	// The kernel uses only the lower 32 bits, and us_xioctl() passes the request as int
+	request = (uint)request;
+
+	switch (request) {
+		case VIDIOC_QUERYCAP: {
+			struct v4l2_capability *const cap = arg;
+			US_MEMSET_ZERO(*cap);
+			US_SNPRINTF((char*)cap->driver, sizeof(cap->driver), "us-m2m-emu");
+			US_SNPRINTF((char*)cap->card, sizeof(cap->card), "uStreamer M2M emulator");
+			US_SNPRINTF((char*)cap->bus_info, sizeof(cap->bus_info), "platform:us-m2m-emu");
+			cap->device_caps = V4L2_CAP_VIDEO_M2M_MPLANE | V4L2_CAP_STREAMING;
+			cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+			return 0;
+		}
+
+		case VIDIOC_S_CTRL: {
+			FAIL("S_CTRL");
+			const struct v4l2_control *const ctl = arg;
+			_LOG_DEBUG("%s: S_CTRL id=0x%x value=%d", dev->path, ctl->id, ctl->value);
+			switch (ctl->id) {
+				case V4L2_CID_MPEG_VIDEO_BITRATE: dev->bitrate = ctl->value; break;
+				case V4L2_CID_MPEG_VIDEO_H264_I_PERIOD: dev->gop = ctl->value; break;
+				case V4L2_CID_JPEG_COMPRESSION_QUALITY: dev->quality = US_MAX(1, US_MIN(ctl->value, 100)); break;
+				case V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME: dev->force_key = true; break;
+				case V4L2_CID_MPEG_VIDEO_H264_PROFILE:
+				case V4L2_CID_MPEG_VIDEO_H264_LEVEL:
+				case V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER:
+				case V4L2_CID_MPEG_VIDEO_H264_MIN_QP:
+				case V4L2_CID_MPEG_VIDEO_H264_MAX_QP:
+					break;
+				default:
+					errno = EINVAL;
+					return -1;
+			}
+			return 0;
+		}
+
+		case VIDIOC_G_FMT:
+		case VIDIOC_S_FMT:
+		case VIDIOC_TRY_FMT: {
+			struct v4l2_format *const fmt = arg;
+			_queue_s *const queue = GET_QUEUE(fmt->type);
+			if (request == VIDIOC_G_FMT) {
+				struct v4l2_pix_format_mplane *const pix = &fmt->fmt.pix_mp;
+				US_MEMSET_ZERO(*pix);
+				pix->width = queue->width;
+				pix->height = queue->height;
+				pix->pixelformat = queue->format;
+				pix->field = V4L2_FIELD_NONE;
+				pix->num_planes = 1;
+				pix->plane_fmt[0].bytesperline = queue->stride;
+				pix->plane_fmt[0].sizeimage = queue->sizeimage;
+				return 0;
+			}
+			if (request == VIDIOC_S_FMT) {
+				FAIL("S_FMT");
+				if (queue->n_bufs > 0) {
+					errno = EBUSY;
+					return -1;
+				}
+			}
+			_LOG_DEBUG("%s: %s %s: %ux%u", dev->path, (request == VIDIOC_S_FMT ? "S_FMT" : "TRY_FMT"),
+				queue->name, fmt->fmt.pix_mp.width, fmt->fmt.pix_mp.height);
+			_set_format(dev, (request == VIDIOC_S_FMT ? queue : NULL), fmt);
+			return 0;
+		}
+
+		case VIDIOC_S_PARM: {
+			FAIL("S_PARM");
+			GET_QUEUE(((struct v4l2_streamparm*)arg)->type);
+			return 0;
+		}
+
+		case VIDIOC_REQBUFS: {
+			FAIL("REQBUFS");
+			struct v4l2_requestbuffers *const req = arg;
+			return _request_buffers(dev, GET_QUEUE(req->type), req);
+		}
+
+		case VIDIOC_QUERYBUF: {
+			FAIL("QUERYBUF");
+			struct v4l2_buffer *const buf = arg;
+			_queue_s *const queue = GET_QUEUE(buf->type);
+			if (buf->index >= queue->n_bufs || buf->length < 1 || buf->m.planes == NULL) {
+				errno = EINVAL;
+				return -1;
+			}
+			buf->memory = queue->memory;
+			buf->flags = (queue->bufs[buf->index].queued ? V4L2_BUF_FLAG_QUEUED : 0);
+			buf->m.planes[0].length = queue->sizeimage;
+			buf->m.planes[0].m.mem_offset = queue->offset + buf->index * queue->buf_size;
+			return 0;
+		}
+
+		case VIDIOC_QBUF: {
+			FAIL("QBUF");
+			struct v4l2_buffer *const buf = arg;
+			return _queue_buffer(dev, GET_QUEUE(buf->type), buf);
+		}
+
+		case VIDIOC_DQBUF: {
+			FAIL("DQBUF");
+			struct v4l2_buffer *const buf = arg;
+			return _dequeue_buffer(dev, GET_QUEUE(buf->type), buf);
+		}
+
+		case VIDIOC_STREAMON:
+		case VIDIOC_STREAMOFF: {
+			_queue_s *const queue = GET_QUEUE(*(const enum v4l2_buf_type*)arg);
+			if (request == VIDIOC_STREAMON) {
+				FAIL("STREAMON");
+				queue->streaming = true;
+				if (queue == &dev->out) {
+					dev->since_key = 0;
+					dev->need_garbage = _g_garbage;
+				}
+				US_COND_BROADCAST(dev->cond);
+			} else {
+				_stream_off(dev, queue);
+			}
+			_LOG_DEBUG("%s: %s %s", dev->path, (queue->streaming ? "STREAMON" : "STREAMOFF"), queue->name);
+			return 0;
+		}
+
+		default:
+			_LOG_DEBUG("%s: Unsupported ioctl 0x%lx", dev->path, request);
+			errno = ENOTTY;
+			return -1;
+	}
+
+#	undef GET_QUEUE
+#	undef FAIL
+}
+
+static _queue_s *_get_queue(_dev_s *dev, uint type) {
+	switch (type) {
+		case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE: return &dev->in;
+		case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE: return &dev->out;
+	}
+	return NULL;
+}
+
+static void _set_format(_dev_s *dev, _queue_s *queue, struct v4l2_format *fmt) {
+	// Like a real driver, adjust the format instead of failing
+
+	struct v4l2_pix_format_mplane *const pix = &fmt->fmt.pix_mp;
+	pix->width = US_MAX(32u, US_MIN(pix->width, 4096u)) & ~1u;
+	pix->height = US_MAX(32u, US_MIN(pix->height, 4096u)) & ~1u;
+	pix->field = V4L2_FIELD_NONE;
+	pix->num_planes = 1;
+
+	const bool raw = (queue != NULL ? queue == &dev->in : fmt->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE);
+	uint stride = 0;
+	uz sizeimage = pix->plane_fmt[0].sizeimage;
+	if (raw) {
+		switch (pix->pixelformat) {
+			case V4L2_PIX_FMT_YUYV:
+			case V4L2_PIX_FMT_YVYU:
+			case V4L2_PIX_FMT_UYVY:
+			case V4L2_PIX_FMT_RGB565: stride = pix->width * 2; break;
+			case V4L2_PIX_FMT_RGB24:
+			case V4L2_PIX_FMT_BGR24: stride = pix->width * 3; break;
+			case V4L2_PIX_FMT_GREY:
+			case V4L2_PIX_FMT_YUV420:
+			case V4L2_PIX_FMT_YVU420: stride = pix->width; break;
+			default:
+				pix->pixelformat = V4L2_PIX_FMT_YUYV;
+				stride = pix->width * 2;
+		}
+		sizeimage = stride * pix->height;
+		if (pix->pixelformat == V4L2_PIX_FMT_YUV420 || pix->pixelformat == V4L2_PIX_FMT_YVU420) {
+			sizeimage += sizeimage / 2;
+		}
+	} else {
+		switch (pix->pixelformat) {
+			case V4L2_PIX_FMT_H264:
+			case V4L2_PIX_FMT_MJPEG:
+			case V4L2_PIX_FMT_JPEG: break;
+			default: pix->pixelformat = V4L2_PIX_FMT_H264;
+		}
+		if (sizeimage == 0) {
+			sizeimage = US_MAX((uz)pix->width * pix->height * 3 / 2, (uz)65536);
+		}
+	}
+	pix->plane_fmt[0].bytesperline = stride;
+	pix->plane_fmt[0].sizeimage = sizeimage;
+
+	if (queue != NULL) {
+		queue->width = pix->width;
+		queue->height = pix->height;
+		queue->format = pix->pixelformat;
+		queue->stride = stride;
+		queue->sizeimage = sizeimage;
+		if (raw) {
+			// The encoded size follows the raw one if it wasn't set explicitly
+			dev->out.width = pix->width;
+			dev->out.height = pix->height;
+		}
+	}
+}
+
+static int _request_buffers(_dev_s *dev, _queue_s *queue, struct v4l2_requestbuffers *req) {
+	if (queue->streaming) {
+		errno = EBUSY;
+		return -1;
+	}
+	if (req->memory != V4L2_MEMORY_MMAP && !(req->memory == V4L2_MEMORY_DMABUF && queue == &dev->in)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (queue->mem != NULL) {
+		munmap(queue->mem, queue->n_bufs * queue->buf_size);
+		queue->mem = NULL;
+	}
+	queue->n_bufs = 0;
+	US_MEMSET_ZERO(queue->bufs);
+
+	_LOG_DEBUG("%s: REQBUFS %s: count=%u, dma=%d", dev->path, queue->name, req->count, (req->memory == V4L2_MEMORY_DMABUF));
+	if (req->count == 0) {
+		return 0;
+	}
+
+	req->count = US_MIN(req->count, (uint)_MAX_BUFS);
+	queue->memory = req->memory;
+	for (uint index = 0; index < req->count; ++index) {
+		queue->bufs[index].dma_fd = -1;
+	}
+
+	if (req->memory == V4L2_MEMORY_MMAP) {
+		const uz page_size = sysconf(_SC_PAGESIZE);
+		queue->buf_size = (queue->sizeimage + page_size - 1) / page_size * page_size;
+		const uz size = req->count * queue->buf_size;
+		if (
+			ftruncate(dev->mem_fd, _CAPTURE_OFFSET * 2) < 0
+			|| (queue->mem = _REAL(mmap)(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->mem_fd, queue->offset)) == MAP_FAILED
+		) {
+			queue->mem = NULL;
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	queue->n_bufs = req->count;
+	return 0;
+}
+
+static int _queue_buffer(_dev_s *dev, _queue_s *queue, struct v4l2_buffer *buf) {
+	if (buf->index >= queue->n_bufs || buf->memory != queue->memory || buf->length < 1 || buf->m.planes == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	_buf_s *const item = &queue->bufs[buf->index];
+	if (item->queued) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	item->queued = true;
+	item->done = false;
+	item->flags = 0;
+	item->seq = ++dev->seq;
+	if (queue == &dev->in) {
+		item->bytesused = US_MIN(buf->m.planes[0].bytesused, (u32)queue->sizeimage);
+		item->timestamp = buf->timestamp;
+		item->dma_fd = (queue->memory == V4L2_MEMORY_DMABUF ? buf->m.planes[0].m.fd : -1);
+		item->queued_ts = us_get_now_monotonic();
+	}
+	US_COND_BROADCAST(dev->cond);
+	return 0;
+}
+
+static int _dequeue_buffer(_dev_s *dev, _queue_s *queue, struct v4l2_buffer *buf) {
+	if (buf->memory != queue->memory || buf->length < 1 || buf->m.planes == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	_buf_s *found = NULL;
+	uint found_index = 0;
+	while (true) {
+		if (!queue->streaming && queue->n_bufs > 0 && queue == &dev->out) {
+			errno = EPIPE; // No more buffers will be produced
+			return -1;
+		}
+		for (uint index = 0; index < queue->n_bufs; ++index) {
+			_buf_s *const item = &queue->bufs[index];
+			if (item->queued && item->done && (found == NULL || item->seq < found->seq)) {
+				found = item;
+				found_index = index;
+			}
+		}
+		if (found != NULL) {
+			break;
+		}
+		if (dev->nonblock || dev->stop) {
+			errno = EAGAIN;
+			return -1;
+		}
+		assert(!pthread_cond_wait(&dev->cond, &dev->mutex));
+	}
+
+	found->queued = false;
+	found->done = false;
+	buf->index = found_index;
+	buf->flags = found->flags;
+	buf->timestamp = found->timestamp;
+	buf->m.planes[0].bytesused = found->bytesused;
+	buf->m.planes[0].length = queue->sizeimage;
+	if (queue->memory == V4L2_MEMORY_DMABUF) {
+		buf->m.planes[0].m.fd = found->dma_fd;
+	}
+
+	if (queue == &dev->out) {
+		eventfd_t value;
+		eventfd_read(dev->fd, &value);
+		if (found->timestamp.tv_sec != 0 || found->timestamp.tv_usec != 0) {
+			const ldf rt = us_get_now_monotonic() - found->queued_ts;
+			dev->rt_sum += rt;
+			dev->rt_max = US_MAX(dev->rt_max, rt);
+			++dev->frames;
+		}
+	}
+	return 0;
+}
+
+static void _stream_off(_dev_s *dev, _queue_s *queue) {
+	queue->streaming = false;
+	for (uint index = 0; index < queue->n_bufs; ++index) {
+		queue->bufs[index].queued = false;
+		queue->bufs[index].done = false;
+	}
+	if (queue == &dev->out) {
+		eventfd_t value;
+		while (eventfd_read(dev->fd, &value) == 0);
+	}
+	US_COND_BROADCAST(dev->cond);
+}
+
+static void *_worker_thread(void *v_dev) {
+	_dev_s *const dev = v_dev;
+
+	US_MUTEX_LOCK(dev->mutex);
+	while (!dev->stop) {
+		_buf_s *in_buf = NULL;
+		_buf_s *out_buf = NULL;
+		if (dev->in.streaming) {
+			for (uint index = 0; index < dev->in.n_bufs; ++index) {
+				_buf_s *const item = &dev->in.bufs[index];
+				if (item->queued && !item->done && (in_buf == NULL || item->seq < in_buf->seq)) {
+					in_buf = item;
+				}
+			}
+		}
+		if (in_buf != NULL && in_buf->bytesused == 0) {
+			// Initially queued empty buffers are just returned
+			in_buf->done = true;
+			US_COND_BROADCAST(dev->cond);
+			continue;
+		}
+		if (in_buf != NULL && dev->out.streaming) {
+			for (uint index = 0; index < dev->out.n_bufs; ++index) {
+				_buf_s *const item = &dev->out.bufs[index];
+				if (item->queued && !item->done && (out_buf == NULL || item->seq < out_buf->seq)) {
+					out_buf = item;
+				}
+			}
+		}
+		if (out_buf == NULL) {
+			assert(!pthread_cond_wait(&dev->cond, &dev->mutex));
+			continue;
+		}
+
+		if (dev->need_garbage) {
+			dev->need_garbage = false;
+			out_buf->bytesused = 16;
+			out_buf->flags = 0;
+			US_MEMSET_ZERO(out_buf->timestamp);
+			out_buf->done = true;
+			eventfd_write(dev->fd, 1);
+			US_COND_BROADCAST(dev->cond);
+			continue;
+		}
+
+		if (_fail("stall")) {
+			_LOG_DEBUG("%s: Injected stall", dev->path);
+			++dev->stalls;
+			in_buf->done = true;
+			US_COND_BROADCAST(dev->cond);
+			continue;
+		}
+
+		// Encoding is done without the lock, so the buffers can't be reallocated
+		// or dequeued by the application, but STREAMOFF can happen.
+		const u64 seq = in_buf->seq;
+		const uint in_index = in_buf - dev->in.bufs;
+		const u8 *data;
+		if (dev->in.memory == V4L2_MEMORY_DMABUF) {
+			data = _REAL(mmap)(NULL, in_buf->bytesused, PROT_READ, MAP_SHARED, in_buf->dma_fd, 0);
+		} else {
+			data = dev->in.mem + in_index * dev->in.buf_size;
+		}
+		const uz size = in_buf->bytesused;
+		bool key = (dev->force_key || dev->since_key == 0 || (dev->gop > 0 && dev->since_key >= (uint)dev->gop));
+		dev->force_key = false;
+
+		US_MUTEX_UNLOCK(dev->mutex);
+		const ldf deadline_ts = us_get_now_monotonic() + _g_latency + _g_jitter * (random() % 1001) / 1000;
+		if (data != MAP_FAILED) {
+			_encode(dev, data, size, &key);
+		}
+		const ldf now_ts = us_get_now_monotonic();
+		if (now_ts < deadline_ts) {
+			usleep((deadline_ts - now_ts) * 1000000);
+		}
+		US_MUTEX_LOCK(dev->mutex);
+
+		if (dev->in.memory == V4L2_MEMORY_DMABUF && data != MAP_FAILED) {
+			munmap((void*)data, size);
+		}
+		if (!in_buf->queued || in_buf->seq != seq || !out_buf->queued || !dev->out.streaming) {
+			continue; // Stopped while encoding
+		}
+
+		const uz used = US_MIN(dev->dest->used, dev->out.sizeimage);
+		memcpy(dev->out.mem + (out_buf - dev->out.bufs) * dev->out.buf_size, dev->dest->data, used);
+		out_buf->bytesused = used;
+		out_buf->flags = (key ? V4L2_BUF_FLAG_KEYFRAME : V4L2_BUF_FLAG_PFRAME);
+		if (used < dev->dest->used || data == MAP_FAILED) {
+			out_buf->flags |= V4L2_BUF_FLAG_ERROR;
+		}
+		out_buf->timestamp = in_buf->timestamp;
+		out_buf->queued_ts = in_buf->queued_ts;
+		out_buf->done = true;
+		in_buf->done = true;
+		dev->since_key = (key ? 1 : dev->since_key + 1);
+		dev->keys += key;
+		eventfd_write(dev->fd, 1);
+		US_COND_BROADCAST(dev->cond);
+	}
+	US_MUTEX_UNLOCK(dev->mutex);
+	return NULL;
+}
+
+static void _encode(_dev_s *dev, const u8 *data, uz size, bool *key) {
+	us_frame_s *const src = dev->src;
+	us_frame_set_data(src, data, size);
+	src->width = dev->in.width;
+	src->height = dev->in.height;
+	src->format = dev->in.format;
+	src->stride = dev->in.stride;
+
+	us_cpu_encoder_params_s params = {.quality = dev->quality};
+	if (dev->out.format != V4L2_PIX_FMT_H264) {
+		us_cpu_encoder_compress(src, dev->dest, &params, NULL);
+		*key = true;
+		return;
+	}
+
+	us_frame_s *const jpeg = us_frame_init();
+	if (!*key) {
+		params.quality /= 2;
+	}
+	us_cpu_encoder_compress(src, jpeg, &params, NULL);
+	dev->dest->used = 0;
+	if (*key) {
+		// Constrained Baseline, level 4.0; the contents don't matter
+		const u8 sps[] = {0x42, 0xC0, 0x28, 0x8D, 0x68, 0x05, 0x00, 0x5B, 0xA1, 0x00};
+		const u8 pps[] = {0xCE, 0x3C, 0x80};
+		_append_nal(dev->dest, 0x67, sps, sizeof(sps));
+		_append_nal(dev->dest, 0x68, pps, sizeof(pps));
+		_append_nal(dev->dest, 0x65, jpeg->data, jpeg->used);
+	} else {
+		_append_nal(dev->dest, 0x41, jpeg->data, jpeg->used);
+	}
+	us_frame_destroy(jpeg);
+}
+
+static void _append_nal(us_frame_s *frame, u8 header, const u8 *data, uz size) {
+	const u8 prefix[] = {0, 0, 0, 1, header};
+	us_frame_append_data(frame, prefix, sizeof(prefix));
+
+	// Emulation prevention to keep the payload inside of the NAL unit
+	us_frame_realloc_data(frame, frame->used + size + size / 2 + 1);
+	u8 *out = frame->data + frame->used;
+	uint zeros = 0;
+	for (uz index = 0; index < size; ++index) {
+		if (zeros >= 2 && data[index] <= 3) {
+			*out++ = 3;
+			zeros = 0;
+		}
+		*out++ = data[index];
+		zeros = (data[index] == 0 ? zeros + 1 : 0);
+	}
+	frame->used = out - frame->data;
+}
+
+static bool _fail(const char *op) {
+	for (uz index = 0; index < US_ARRAY_LEN(_g_fails); ++index) {
+		_fail_s *const fail = &_g_fails[index];
+		if (fail->every > 0 && !strcmp(fail->op, op)) {
+			US_MUTEX_LOCK(_g_mutex);
+			const bool failed = (++fail->count % fail->every == 0);
+			US_MUTEX_UNLOCK(_g_mutex);
+			return failed;
+		}
+	}
+	return false;
+}
+
+static void _log(const char *fmt, ...) {
+	char msg[1024];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+	fprintf(stderr, "-- M2M-EMU [%.03Lf]: %s\n", us_get_now_monotonic(), msg);
+}
@@ -0,0 +1,516 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+#include "burst.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include <pthread.h>
+#ifdef __linux__
+#	include <sys/resource.h>
+#endif
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/logging.h"
+#include "../libs/frame.h"
+#include "../libs/list.h"
+#include "../libs/threading.h"
+#include "../libs/jpegtran.h"
+
+#include "encoder.h"
+#include "encoders/cpu/encoder.h"
+#include "encoders/hw/encoder.h"
+
+
+static void _burst_take(us_burst_request_s *req, const us_frame_s *frame, u64 seq, bool pre);
+static void _burst_submit(us_burst_request_s *req);
+static void *_burst_encoder_thread(void *v_burst);
+static void _burst_encode(us_burst_shot_s *shot);
+static void _burst_request_unref(us_burst_request_s *req);
+
+
+us_burst_s *us_burst_init(us_encoder_s *enc) {
+	us_burst_runtime_s *run;
+	US_CALLOC(run, 1);
+	US_MUTEX_INIT(run->mutex);
+	US_COND_INIT(run->enc_cond);
+	atomic_init(&run->last_seq, 0);
+	atomic_init(&run->has_requests, false);
+
+	us_burst_s *burst;
+	US_CALLOC(burst, 1);
+	burst->enc = enc;
+	burst->run = run;
+	return burst;
+}
+
+void us_burst_destroy(us_burst_s *burst) {
+	us_burst_runtime_s *const run = burst->run;
+	assert(run->requests == NULL); // Released by the server
+	if (run->enc_started) {
+		US_MUTEX_LOCK(run->mutex);
+		run->enc_stop = true;
+		US_MUTEX_UNLOCK(run->mutex);
+		US_COND_SIGNAL(run->enc_cond);
+		US_THREAD_JOIN(run->enc_tid);
+	}
+	while (run->pending != NULL) {
+		us_burst_shot_s *const shot = run->pending;
+		run->pending = shot->next_pending;
+		_burst_request_unref(shot->req);
+	}
+	if (run->ring != NULL) {
+		for (uint index = 0; index < burst->pretrigger; ++index) {
+			US_DELETE(run->ring[index], us_frame_destroy);
+		}
+		free(run->ring);
+		free(run->ring_seqs);
+	}
+	US_COND_DESTROY(run->enc_cond);
+	US_MUTEX_DESTROY(run->mutex);
+	free(run);
+	free(burst);
+}
+
+bool us_burst_is_wanted(us_burst_s *burst) {
+	return (burst->max > 0 && (burst->pretrigger > 0 || atomic_load(&burst->run->has_requests)));
+}
+
+void us_burst_feed(us_burst_s *burst, const us_frame_s *frame) {
+	// Вызывается отдельным потоком стрима на каждый кадр, пока us_burst_is_wanted(),
+	// чтобы копирование не задерживало захват. Здесь только копирование,
+	// кодирование уходит в единственный поток с пониженным приоритетом.
+	us_burst_runtime_s *const run = burst->run;
+	const u64 seq = atomic_fetch_add(&run->last_seq, 1) + 1;
+
+	if (burst->pretrigger == 0 && !atomic_load(&run->has_requests)) {
+		return;
+	}
+
+	US_MUTEX_LOCK(run->mutex);
+
+	if (burst->pretrigger > 0) {
+		if (run->ring == NULL) {
+			US_CALLOC(run->ring, burst->pretrigger);
+			US_CALLOC(run->ring_seqs, burst->pretrigger);
+		}
+		if (run->ring[run->ring_head] == NULL) {
+			run->ring[run->ring_head] = us_frame_init();
+		}
+		us_frame_copy(frame, run->ring[run->ring_head]);
+		run->ring_seqs[run->ring_head] = seq;
+		run->ring_head = (run->ring_head + 1) % burst->pretrigger;
+		run->ring_filled = US_MIN(run->ring_filled + 1, burst->pretrigger);
+	}
+
+	US_LIST_ITERATE(run->requests, req, { // cppcheck-suppress constStatement
+		if (req->n_taken < req->n_shots) {
+			_burst_take(req, frame, seq, false);
+		}
+		_burst_submit(req);
+		if (req->n_taken == req->n_shots) {
+			US_LIST_REMOVE(run->requests, req);
+			req->waiting = false;
+		}
+	});
+	atomic_store(&run->has_requests, (run->requests != NULL));
+
+	US_MUTEX_UNLOCK(run->mutex);
+}
+
+us_burst_request_s *us_burst_request(us_burst_s *burst, uint count, uint pre) {
+	if (count == 0 || count > burst->max || pre > burst->pretrigger) {
+		return NULL;
+	}
+
+	us_burst_runtime_s *const run = burst->run;
+	US_MUTEX_LOCK(run->mutex);
+
+	pre = US_MIN(pre, run->ring_filled);
+
+	us_burst_request_s *req;
+	US_CALLOC(req, 1);
+	req->burst = burst;
+	req->n_shots = pre + count;
+	US_CALLOC(req->shots, req->n_shots);
+	atomic_init(&req->n_encoded, 0);
+	atomic_init(&req->progress_ts, us_get_now_monotonic());
+	atomic_init(&req->refs, 1);
+
+	// The oldest first. The pre-trigger shots are submitted with the first live frame.
+	for (uint index = 0; index < pre; ++index) {
+		const uint ri = (run->ring_head + burst->pretrigger - pre + index) % burst->pretrigger;
+		_burst_take(req, run->ring[ri], run->ring_seqs[ri], true);
+	}
+
+	req->waiting = true;
+	US_LIST_APPEND(run->requests, req);
+	atomic_store(&run->has_requests, true);
+
+	US_MUTEX_UNLOCK(run->mutex);
+	return req;
+}
+
+bool us_burst_request_is_done(const us_burst_request_s *req) {
+	return (atomic_load(&req->n_encoded) == req->n_shots);
+}
+
+void us_burst_request_release(us_burst_request_s *req) {
+	us_burst_runtime_s *const run = req->burst->run;
+	US_MUTEX_LOCK(run->mutex);
+	if (req->waiting) {
+		US_LIST_REMOVE(run->requests, req);
+		req->waiting = false;
+		atomic_store(&run->has_requests, (run->requests != NULL));
+	}
+	US_MUTEX_UNLOCK(run->mutex);
+	_burst_request_unref(req);
+}
+
+static void _burst_take(us_burst_request_s *req, const us_frame_s *frame, u64 seq, bool pre) {
+	us_burst_shot_s *const shot = &req->shots[req->n_taken];
+	shot->req = req;
+	shot->raw = us_frame_init();
+	shot->jpeg = us_frame_init();
+	us_frame_copy(frame, shot->raw);
+	shot->seq = seq;
+	shot->pre = pre;
+	atomic_init(&shot->encoded, false);
+	++req->n_taken;
+	atomic_store(&req->progress_ts, us_get_now_monotonic());
+}
+
+static void _burst_submit(us_burst_request_s *req) {
+	// Under the burst mutex
+	us_burst_runtime_s *const run = req->burst->run;
+	if (req->n_submitted == req->n_taken) {
+		return;
+	}
+	if (!run->enc_started) {
+		US_THREAD_CREATE(run->enc_tid, _burst_encoder_thread, req->burst);
+		run->enc_started = true;
+	}
+	for (; req->n_submitted < req->n_taken; ++req->n_submitted) {
+		us_burst_shot_s *const shot = &req->shots[req->n_submitted];
+		atomic_fetch_add(&req->refs, 1);
+		shot->next_pending = NULL;
+		if (run->pending == NULL) {
+			run->pending = shot;
+		} else {
+			run->pending_last->next_pending = shot;
+		}
+		run->pending_last = shot;
+	}
+	US_COND_SIGNAL(run->enc_cond);
+}
+
+static void *_burst_encoder_thread(void *v_burst) {
+	US_THREAD_SETTLE("us_burst");
+	us_burst_runtime_s *const run = ((us_burst_s*)v_burst)->run;
+
+#	ifdef __linux__
+	// Приоритет в Linux у каждого потока свой: кодирование серии получает
+	// только то, что осталось от живых энкодеров и релизов буферов.
+	if (setpriority(PRIO_PROCESS, 0, 10) < 0) {
+		US_LOG_PERROR("BURST: Can't lower the encoder priority");
+	}
+#	endif
+
+	while (true) {
+		US_MUTEX_LOCK(run->mutex);
+		US_COND_WAIT_FOR((run->pending != NULL || run->enc_stop), run->enc_cond, run->mutex);
+		if (run->enc_stop) {
+			US_MUTEX_UNLOCK(run->mutex);
+			break;
+		}
+		us_burst_shot_s *const shot = run->pending;
+		run->pending = shot->next_pending;
+		if (run->pending == NULL) {
+			run->pending_last = NULL;
+		}
+		US_MUTEX_UNLOCK(run->mutex);
+
+		_burst_encode(shot);
+	}
+	return NULL;
+}
+
+static void _burst_encode(us_burst_shot_s *shot) {
+	us_burst_request_s *const req = shot->req;
+	us_encoder_s *const enc = req->burst->enc;
+
+	// M2M-энкодеры заняты потоком, поэтому здесь только CPU или копия готового JPEG
+	if (us_is_jpeg(shot->raw->format)) {
+		us_hw_encoder_compress(shot->raw, shot->jpeg);
+	} else {
+		us_cpu_encoder_params_s params;
+		us_encoder_get_cpu_params(enc, &params);
+		us_cpu_encoder_compress(shot->raw, shot->jpeg, &params, NULL);
+	}
+
+	if (us_jpegtran_is_enabled(&enc->jpegtran)) {
+		us_frame_s *const tmp = us_frame_init();
+		if (us_jpegtran(&enc->jpegtran, shot->jpeg, tmp) == 0) {
+			us_frame_copy(tmp, shot->jpeg);
+		}
+		us_frame_destroy(tmp);
+	}
+
+	US_DELETE(shot->raw, us_frame_destroy);
+	atomic_store(&shot->encoded, true);
+	atomic_fetch_add(&req->n_encoded, 1);
+	atomic_store(&req->progress_ts, us_get_now_monotonic());
+	_burst_request_unref(req);
+}
+
+static void _burst_request_unref(us_burst_request_s *req) {
+	if (atomic_fetch_sub(&req->refs, 1) > 1) {
+		return;
+	}
+	for (uint index = 0; index < req->n_taken; ++index) {
+		US_DELETE(req->shots[index].raw, us_frame_destroy);
+		US_DELETE(req->shots[index].jpeg, us_frame_destroy);
+	}
+	free(req->shots);
+	free(req);
+}
+
+#ifdef TEST_BURST
+// Порядок кадров серии с предзаписью и время живого кодирования, пока серия
+// кодируется в фоне. Захват идет в 30 FPS, живой энкодер кодирует каждый кадр
+// в своем потоке, как JPEG-воркер, а копии для серии делает отдельный поток,
+// как в стриме. На захват остается только постановка в очередь.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_BURST -o burst-test ustreamer/burst.c ustreamer/encoder.c ustreamer/workers.c ustreamer/m2m.c ustreamer/encoders/cpu/encoder.c ustreamer/encoders/hw/encoder.c libs/frame.c libs/jpegtran.c libs/pixel.c libs/logging.c libs/queue.c -ljpeg -lm -pthread
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "../libs/queue.h"
+
+
+#define _WIDTH		1280
+#define _HEIGHT		720
+#define _N_BUFS		8
+#define _N_FRAMES	180
+#define _TRIGGER	60
+#define _COUNT		30
+#define _PRE		10
+
+static us_frame_s	*_g_bufs[_N_BUFS];
+static ldf			_g_encode_times[_N_FRAMES];
+static atomic_bool	_g_stop;
+
+static ldf _now(void) {
+	return (ldf)us_get_now_monotonic_u64() / 1000000; // us_get_now_monotonic() has 1ms resolution
+}
+
+static ldf _thread_cpu_now(void) {
+	// Without the time of the threads woken by the queue on the same core
+	struct timespec ts;
+	assert(!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts));
+	return us_timespec_to_ld(&ts);
+}
+
+static void *_live_thread(void *v_queue) {
+	us_frame_s *const dest = us_frame_init();
+	const us_cpu_encoder_params_s params = {.quality = 80};
+	while (!atomic_load(&_g_stop)) {
+		void *item;
+		if (!us_queue_get(v_queue, &item, 0.1)) {
+			const uint number = (uintptr_t)item;
+			const ldf begin_ts = _now();
+			us_cpu_encoder_compress(_g_bufs[number % _N_BUFS], dest, &params, NULL);
+			_g_encode_times[number] = _now() - begin_ts;
+		}
+	}
+	us_frame_destroy(dest);
+	return NULL;
+}
+
+static void *_copy_thread(void *v_queue) {
+	us_burst_s *burst = NULL;
+	while (!atomic_load(&_g_stop)) {
+		void *item;
+		if (!us_queue_get(v_queue, &item, 0.1)) {
+			if (burst == NULL) {
+				burst = item;
+			} else {
+				us_burst_feed(burst, _g_bufs[(uintptr_t)item % _N_BUFS]);
+			}
+		}
+	}
+	return NULL;
+}
+
+static ldf _avg_ms(uint begin, uint end) {
+	ldf sum = 0;
+	for (uint number = begin; number < end; ++number) {
+		sum += _g_encode_times[number];
+	}
+	return sum * 1000 / (end - begin);
+}
+
+int main(void) {
+	US_LOGGING_INIT;
+	int retval = 0;
+
+	for (uint index = 0; index < _N_BUFS; ++index) {
+		us_frame_s *const frame = us_frame_init();
+		us_frame_realloc_data(frame, _WIDTH * _HEIGHT * 2);
+		frame->width = _WIDTH;
+		frame->height = _HEIGHT;
+		frame->format = V4L2_PIX_FMT_YUYV;
+		frame->stride = _WIDTH * 2;
+		frame->used = _WIDTH * _HEIGHT * 2;
+		frame->online = true;
+		for (uz offset = 0; offset < frame->used; ++offset) {
+			frame->data[offset] = (offset & 1 ? 128 : (offset / 2 + index * 17) % 251);
+		}
+		_g_bufs[index] = frame;
+	}
+
+	us_encoder_s *const enc = us_encoder_init();
+	enc->run->cpu.quality = 80;
+	us_burst_s *const burst = us_burst_init(enc);
+	burst->max = _COUNT;
+	burst->pretrigger = _PRE;
+
+	atomic_init(&_g_stop, false);
+	us_queue_s *const live_queue = us_queue_init(_N_BUFS);
+	us_queue_s *const copy_queue = us_queue_init(_N_BUFS);
+	pthread_t live_tid;
+	pthread_t copy_tid;
+	US_THREAD_CREATE(live_tid, _live_thread, live_queue);
+	US_THREAD_CREATE(copy_tid, _copy_thread, copy_queue);
+	assert(!us_queue_put(copy_queue, burst, 0));
+
+	us_burst_request_s *req = NULL;
+	ldf capture_sum = 0;
+	ldf capture_max = 0;
+	ldf trigger_ts = 0;
+	ldf done_ts = 0;
+	uint done_number = _N_FRAMES;
+	const ldf begin_ts = _now();
+	for (uint number = 0; number < _N_FRAMES; ++number) {
+		const ldf next_ts = begin_ts + (ldf)number / 30;
+		const ldf now_ts = _now();
+		if (next_ts > now_ts) {
+			usleep((next_ts - now_ts) * 1000000);
+		}
+
+		if (number == _TRIGGER) {
+			req = us_burst_request(burst, _COUNT, _PRE);
+			assert(req != NULL);
+			trigger_ts = _now();
+		}
+		if (req != NULL && done_number == _N_FRAMES && us_burst_request_is_done(req)) {
+			done_number = number;
+			done_ts = _now();
+		}
+
+		// The work of the capture thread: the copies are made by another one
+		us_frame_s *const frame = _g_bufs[number % _N_BUFS];
+		frame->grab_ts = _now();
+		const ldf capture_ts = _thread_cpu_now();
+		assert(!us_queue_put(live_queue, (void*)(uintptr_t)number, 1));
+		if (us_burst_is_wanted(burst)) {
+			assert(!us_queue_put(copy_queue, (void*)(uintptr_t)number, 1));
+		}
+		const ldf capture_time = _thread_cpu_now() - capture_ts;
+		capture_sum += capture_time;
+		capture_max = US_MAX(capture_max, capture_time);
+	}
+	while (!us_burst_request_is_done(req)) {
+		usleep(10000);
+	}
+	if (done_number == _N_FRAMES) {
+		done_ts = _now();
+	}
+	usleep(100000);
+	atomic_store(&_g_stop, true);
+	US_THREAD_JOIN(live_tid);
+	US_THREAD_JOIN(copy_tid);
+
+	// The pre-trigger frames are the oldest, then the live ones without gaps
+	for (uint index = 0; index < req->n_shots; ++index) {
+		const us_burst_shot_s *const shot = &req->shots[index];
+		const us_burst_shot_s *const prev = (index > 0 ? &req->shots[index - 1] : NULL);
+		if (
+			shot->pre != (index < _PRE)
+			|| shot->jpeg->format != V4L2_PIX_FMT_JPEG || shot->jpeg->used == 0
+			|| (prev != NULL && (shot->seq != prev->seq + 1 || shot->jpeg->grab_ts <= prev->jpeg->grab_ts))
+		) {
+			printf("FAILED: shot %u: seq=%" PRIu64 ", pre=%d, used=%zu\n", index, shot->seq, shot->pre, shot->jpeg->used);
+			retval = -1;
+		}
+	}
+	if (req->shots[_PRE].seq != _TRIGGER + 1) {
+		printf("FAILED: the first live shot is %" PRIu64 " instead of %u\n", req->shots[_PRE].seq, _TRIGGER + 1);
+		retval = -1;
+	}
+
+	const ldf before_ms = _avg_ms(10, _TRIGGER);
+	const ldf during_ms = _avg_ms(_TRIGGER, US_MAX(done_number, (uint)_TRIGGER + 1));
+	printf("%ux%u, %u+%u shots, %u cores\n", _WIDTH, _HEIGHT, _PRE, _COUNT, us_get_cores_available());
+	printf("live encoding, ms: before=%.2Lf, during the burst=%.2Lf, after=%.2Lf\n",
+		before_ms, during_ms, (done_number + 10 < _N_FRAMES ? _avg_ms(done_number, _N_FRAMES) : 0));
+	us_frame_s *const copy = us_frame_init();
+	const ldf copy_begin_ts = _now();
+	for (uint index = 0; index < _N_BUFS; ++index) {
+		us_frame_copy(_g_bufs[index], copy);
+	}
+	const ldf copy_ms = (_now() - copy_begin_ts) * 1000 / _N_BUFS;
+	us_frame_destroy(copy);
+	printf("capture thread, CPU ms per frame: avg=%.3Lf, max=%.3Lf (a raw copy takes %.3Lf)\n",
+		capture_sum * 1000 / _N_FRAMES, capture_max * 1000, copy_ms);
+	printf("burst encoded in %.2Lf sec\n", done_ts - trigger_ts);
+	if (during_ms > before_ms * 1.5) {
+		printf("FAILED: the burst slows down the live encoding\n");
+		retval = -1;
+	}
+
+	us_burst_request_release(req);
+	us_queue_destroy(copy_queue);
+	us_queue_destroy(live_queue);
+	us_burst_destroy(burst);
+	us_encoder_destroy(enc);
+	for (uint index = 0; index < _N_BUFS; ++index) {
+		us_frame_destroy(_g_bufs[index]);
+	}
+	if (retval < 0) {
+		printf("===== TEST FAILED =====\n");
+	}
+	return retval;
+}
+
+#undef _PRE
+#undef _COUNT
+#undef _TRIGGER
+#undef _N_FRAMES
+#undef _N_BUFS
+#undef _HEIGHT
+#undef _WIDTH
+
+#endif
@@ -0,0 +1,101 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include "../libs/types.h"
+#include "../libs/frame.h"
+#include "../libs/list.h"
+
+#include "encoder.h"
+
+
+typedef struct us_burst_shot_sx {
+	struct us_burst_request_sx *req;
+
+	us_frame_s	*raw; // Freed after encoding
+	us_frame_s	*jpeg;
+	u64			seq;
+	bool		pre; // Taken from the pre-trigger ring
+	atomic_bool	encoded;
+
+	struct us_burst_shot_sx *next_pending;
+} us_burst_shot_s;
+
+typedef struct us_burst_request_sx {
+	struct us_burst_sx	*burst;
+
+	uint				n_shots;
+	us_burst_shot_s		*shots;
+	uint				n_taken; // Under the burst mutex
+	uint				n_submitted; // Ditto
+	atomic_uint			n_encoded;
+	atomic_ullong		progress_ts; // Seconds, the last taken or encoded shot
+
+	atomic_uint			refs; // The owner and the submitted encoding tasks
+	bool				waiting; // In the list of the requests waiting for the live frames
+
+	US_LIST_DECLARE;
+} us_burst_request_s;
+
+typedef struct {
+	pthread_mutex_t		mutex;
+	atomic_ullong		last_seq;
+
+	us_frame_s			**ring; // Pre-trigger copies of the raw frames
+	u64					*ring_seqs;
+	uint				ring_filled;
+	uint				ring_head;
+
+	us_burst_request_s	*requests;
+	atomic_bool			has_requests;
+
+	// The only encoding thread, so a burst takes one core at most
+	pthread_t			enc_tid;
+	bool				enc_started;
+	bool				enc_stop;
+	pthread_cond_t		enc_cond;
+	us_burst_shot_s		*pending;
+	us_burst_shot_s		*pending_last;
+} us_burst_runtime_s;
+
+typedef struct us_burst_sx {
+	uint			max; // Live frames per request, 0 means disabled
+	uint			pretrigger;
+	us_encoder_s	*enc;
+
+	us_burst_runtime_s *run;
+} us_burst_s;
+
+
+us_burst_s *us_burst_init(us_encoder_s *enc);
+void us_burst_destroy(us_burst_s *burst);
+
+bool us_burst_is_wanted(us_burst_s *burst);
+void us_burst_feed(us_burst_s *burst, const us_frame_s *frame);
+
+us_burst_request_s *us_burst_request(us_burst_s *burst, uint count, uint pre);
+bool us_burst_request_is_done(const us_burst_request_s *req);
+void us_burst_request_release(us_burst_request_s *req);
@@ -35,6 +35,7 @@
 #include "../libs/logging.h"
 #include "../libs/frame.h"
 #include "../libs/capture.h"
+#include "../libs/jpegtran.h"
 
 #include "workers.h"
 #include "m2m.h"
@@ -61,6 +62,7 @@ static const struct {
 static void *_worker_job_init(void *v_enc);
 static void _worker_job_destroy(void *v_job);
 static bool _worker_run_job(us_worker_s *wr);
+static uint _limit_quality(const us_encoder_runtime_s *run);
 
 
 us_encoder_s *us_encoder_init(void) {
@@ -127,7 +129,9 @@ void us_encoder_open(us_encoder_s *enc, us_capture_s *cap) {
 	if (type == US_ENCODER_TYPE_HW) {
 		if (us_is_jpeg(cr->format)) {
 			quality = cr->jpeg_quality;
-			n_workers = 1;
+			if (!us_jpegtran_is_enabled(&enc->jpegtran)) {
+				n_workers = 1; // Just copying
+			}
 		} else {
 			US_LOG_INFO("Switching to CPU encoder: the input format is not (M)JPEG ...");
 			type = US_ENCODER_TYPE_CPU;
@@ -151,6 +155,19 @@ void us_encoder_open(us_encoder_s *enc, us_capture_s *cap) {
 		}
 	}
 
+	if (type == US_ENCODER_TYPE_CPU && enc->huffman_interval > 0) {
+		US_LOG_INFO("Using optimized Huffman tables, refreshed every %u frames or on a scene change",
+			enc->huffman_interval);
+		run->huffman = us_cpu_encoder_huffman_init(enc->huffman_interval);
+	}
+
+	if (us_jpegtran_is_enabled(&enc->jpegtran)) {
+		const us_jpegtran_s *const tran = &enc->jpegtran;
+		US_LOG_INFO("Using lossless JPEG transformation: rotate=%u, flip_vertical=%d, flip_horizontal=%d, crop=%ux%u+%u+%u",
+			tran->rotate, tran->flip_vertical, tran->flip_horizontal,
+			tran->crop_width, tran->crop_height, tran->crop_left, tran->crop_top);
+	}
+
 	if (quality == 0) {
 		US_LOG_INFO("Using JPEG quality: encoder default");
 	} else {
@@ -159,9 +176,19 @@ void us_encoder_open(us_encoder_s *enc, us_capture_s *cap) {
 
 	US_MUTEX_LOCK(run->mutex);
 	run->type = type;
-	run->quality = quality;
+	run->quality_base = quality;
+	run->quality = _limit_quality(run);
+	run->cpu = enc->cpu; // Might have been changed at runtime
+	run->cpu.quality = run->quality;
+	const us_cpu_encoder_params_s cpu = run->cpu;
 	US_MUTEX_UNLOCK(run->mutex);
 
+	if (type == US_ENCODER_TYPE_CPU) {
+		US_LOG_INFO("Using CPU encoder params: subsampling=%s, grayscale=%d, dct=%s",
+			us_cpu_encoder_subsampling_to_string(cpu.subsampling), cpu.grayscale,
+			us_cpu_encoder_dct_to_string(cpu.dct));
+	}
+
 	const ldf desired_interval = (
 		cap->desired_fps > 0 && (cap->desired_fps < cap->run->hw_fps || cap->run->hw_fps == 0)
 		? (ldf)1 / cap->desired_fps
@@ -178,6 +205,7 @@ void us_encoder_open(us_encoder_s *enc, us_capture_s *cap) {
 void us_encoder_close(us_encoder_s *enc) {
 	assert(enc->run->pool != NULL);
 	US_DELETE(enc->run->pool, us_workers_pool_destroy);
+	US_DELETE(enc->run->huffman, us_cpu_encoder_huffman_destroy);
 }
 
 void us_encoder_get_runtime_params(us_encoder_s *enc, us_encoder_type_e *type, uint *quality) {
@@ -188,16 +216,61 @@ void us_encoder_get_runtime_params(us_encoder_s *enc, us_encoder_type_e *type, u
 	US_MUTEX_UNLOCK(run->mutex);
 }
 
+void us_encoder_get_cpu_params(us_encoder_s *enc, us_cpu_encoder_params_s *params) {
+	us_encoder_runtime_s *const run = enc->run;
+	US_MUTEX_LOCK(run->mutex);
+	*params = run->cpu;
+	US_MUTEX_UNLOCK(run->mutex);
+}
+
+void us_encoder_set_cpu_params(us_encoder_s *enc, const us_cpu_encoder_params_s *params) {
+	// Применяется со следующего фрейма и переживает переоткрытие устройства.
+	// Качество задается захватом и здесь не меняется.
+	us_encoder_runtime_s *const run = enc->run;
+	US_MUTEX_LOCK(run->mutex);
+	enc->cpu.subsampling = params->subsampling;
+	enc->cpu.grayscale = params->grayscale;
+	enc->cpu.dct = params->dct;
+	run->cpu.subsampling = params->subsampling;
+	run->cpu.grayscale = params->grayscale;
+	run->cpu.dct = params->dct;
+	US_MUTEX_UNLOCK(run->mutex);
+	US_LOG_INFO("Changing CPU encoder params: subsampling=%s, grayscale=%d, dct=%s",
+		us_cpu_encoder_subsampling_to_string(params->subsampling), params->grayscale,
+		us_cpu_encoder_dct_to_string(params->dct));
+}
+
+void us_encoder_set_quality_limit(us_encoder_s *enc, uint limit) {
+	// Переживает переоткрытие устройства, как и параметры CPU-энкодера
+	us_encoder_runtime_s *const run = enc->run;
+	US_MUTEX_LOCK(run->mutex);
+	run->quality_limit = limit;
+	if (run->type == US_ENCODER_TYPE_CPU) {
+		run->quality = _limit_quality(run);
+		run->cpu.quality = run->quality;
+	}
+	US_MUTEX_UNLOCK(run->mutex);
+}
+
+static uint _limit_quality(const us_encoder_runtime_s *run) {
+	if (run->type != US_ENCODER_TYPE_CPU || run->quality_limit == 0) {
+		return run->quality_base;
+	}
+	return (run->quality_base == 0 ? run->quality_limit : US_MIN(run->quality_base, run->quality_limit));
+}
+
 static void *_worker_job_init(void *v_enc) {
 	us_encoder_job_s *job;
 	US_CALLOC(job, 1);
 	job->enc = (us_encoder_s*)v_enc;
 	job->dest = us_frame_init();
+	job->tmp = us_frame_init();
 	return (void*)job;
 }
 
 static void _worker_job_destroy(void *v_job) {
 	us_encoder_job_s *job = v_job;
+	us_frame_destroy(job->tmp);
 	us_frame_destroy(job->dest);
 	free(job);
 }
@@ -211,7 +284,11 @@ static bool _worker_run_job(us_worker_s *wr) {
 	if (run->type == US_ENCODER_TYPE_CPU) {
 		US_LOG_VERBOSE("Compressing JPEG using CPU: worker=%s, buffer=%u",
 			wr->name, job->hw->buf.index);
-		us_cpu_encoder_compress(src, dest, run->quality);
+		us_cpu_encoder_params_s params;
+		US_MUTEX_LOCK(run->mutex);
+		params = run->cpu;
+		US_MUTEX_UNLOCK(run->mutex);
+		us_cpu_encoder_compress(src, dest, &params, run->huffman);
 
 	} else if (run->type == US_ENCODER_TYPE_HW) {
 		US_LOG_VERBOSE("Compressing JPEG using HW (just copying): worker=%s, buffer=%u",
@@ -229,6 +306,16 @@ static bool _worker_run_job(us_worker_s *wr) {
 		assert(0 && "Unknown encoder type");
 	}
 
+	if (us_jpegtran_is_enabled(&job->enc->jpegtran)) {
+		US_LOG_VERBOSE("Transforming JPEG: worker=%s, buffer=%u", wr->name, job->hw->buf.index);
+		if (us_jpegtran(&job->enc->jpegtran, job->dest, job->tmp) < 0) {
+			goto error;
+		}
+		us_frame_s *const tmp = job->dest;
+		job->dest = job->tmp;
+		job->tmp = tmp;
+	}
+
 	US_LOG_VERBOSE("Compressed new JPEG: size=%zu, time=%0.3Lf, worker=%s, buffer=%u",
 		job->dest->used,
 		job->dest->encode_end_ts - job->dest->encode_begin_ts,
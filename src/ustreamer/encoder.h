@@ -27,10 +27,13 @@
 #include "../libs/types.h"
 #include "../libs/frame.h"
 #include "../libs/capture.h"
+#include "../libs/jpegtran.h"
 
 #include "workers.h"
 #include "m2m.h"
 
+#include "encoders/cpu/encoder.h"
+
 
 #define ENCODER_TYPES_STR "CPU, HW, M2M-VIDEO, M2M-IMAGE"
 
@@ -45,11 +48,16 @@ typedef enum {
 typedef struct {
 	us_encoder_type_e	type;
 	uint				quality;
+	uint				quality_limit; // 0 means no limit, for the CPU encoder only
+	uint				quality_base;
+	us_cpu_encoder_params_s cpu;
 	pthread_mutex_t		mutex;
 
 	uint				n_m2ms;
 	us_m2m_encoder_s	**m2ms;
 
+	us_cpu_encoder_huffman_s *huffman;
+
 	us_workers_pool_s	*pool;
 } us_encoder_runtime_s;
 
@@ -57,6 +65,9 @@ typedef struct {
 	us_encoder_type_e	type;
 	uint				n_workers;
 	char				*m2m_path;
+	uint				huffman_interval;
+	us_cpu_encoder_params_s cpu; // The quality is taken from the capture
+	us_jpegtran_s		jpegtran;
 
 	us_encoder_runtime_s *run;
 } us_encoder_s;
@@ -65,6 +76,7 @@ typedef struct {
 	us_encoder_s		*enc;
 	us_capture_hwbuf_s	*hw;
 	us_frame_s			*dest;
+	us_frame_s			*tmp; // For the lossless transformation
 } us_encoder_job_s;
 
 
@@ -78,3 +90,6 @@ void us_encoder_open(us_encoder_s *enc, us_capture_s *cap);
 void us_encoder_close(us_encoder_s *enc);
 
 void us_encoder_get_runtime_params(us_encoder_s *enc, us_encoder_type_e *type, uint *quality);
+void us_encoder_get_cpu_params(us_encoder_s *enc, us_cpu_encoder_params_s *params);
+void us_encoder_set_cpu_params(us_encoder_s *enc, const us_cpu_encoder_params_s *params);
+void us_encoder_set_quality_limit(us_encoder_s *enc, uint limit);
@@ -27,6 +27,29 @@
 
 #include "encoder.h"
 
+#include <strings.h>
+
+#include "../../../libs/array.h"
+
+
+static const struct {
+	const char *name;
+	const us_cpu_encoder_subsampling_e subsampling; // cppcheck-suppress unusedStructMember
+} _SUBSAMPLINGS[] = {
+	{"444",	US_CPU_ENCODER_SUBSAMPLING_444},
+	{"422",	US_CPU_ENCODER_SUBSAMPLING_422},
+	{"420",	US_CPU_ENCODER_SUBSAMPLING_420},
+};
+
+static const struct {
+	const char *name;
+	const us_cpu_encoder_dct_e dct; // cppcheck-suppress unusedStructMember
+} _DCTS[] = {
+	{"ISLOW",	US_CPU_ENCODER_DCT_ISLOW},
+	{"IFAST",	US_CPU_ENCODER_DCT_IFAST},
+	{"FLOAT",	US_CPU_ENCODER_DCT_FLOAT},
+};
+
 
 typedef struct {
 	struct jpeg_destination_mgr mgr; // Default manager
@@ -51,8 +74,63 @@ static void _jpeg_init_destination(j_compress_ptr jpeg);
 static boolean _jpeg_empty_output_buffer(j_compress_ptr jpeg);
 static void _jpeg_term_destination(j_compress_ptr jpeg);
 
+static bool _huffman_begin(us_cpu_encoder_huffman_s *huff, j_compress_ptr jpeg, const us_cpu_encoder_params_s *params);
+static void _huffman_end(us_cpu_encoder_huffman_s *huff, j_compress_ptr jpeg, const us_cpu_encoder_params_s *params, bool optimized, uz size);
+static bool _huffman_is_same_params(const us_cpu_encoder_params_s *a, const us_cpu_encoder_params_s *b);
+static void _huffman_make_complete_table(const JHUFF_TBL *src, bool ac, us_cpu_encoder_huffman_table_s *dest);
+
+
+int us_cpu_encoder_parse_subsampling(const char *str) {
+	US_ARRAY_ITERATE(_SUBSAMPLINGS, 0, item, {
+		if (!strcasecmp(item->name, str)) {
+			return item->subsampling;
+		}
+	});
+	return -1;
+}
+
+const char *us_cpu_encoder_subsampling_to_string(us_cpu_encoder_subsampling_e subsampling) {
+	US_ARRAY_ITERATE(_SUBSAMPLINGS, 0, item, {
+		if (item->subsampling == subsampling) {
+			return item->name;
+		}
+	});
+	return _SUBSAMPLINGS[0].name;
+}
+
+int us_cpu_encoder_parse_dct(const char *str) {
+	US_ARRAY_ITERATE(_DCTS, 0, item, {
+		if (!strcasecmp(item->name, str)) {
+			return item->dct;
+		}
+	});
+	return -1;
+}
+
+const char *us_cpu_encoder_dct_to_string(us_cpu_encoder_dct_e dct) {
+	US_ARRAY_ITERATE(_DCTS, 0, item, {
+		if (item->dct == dct) {
+			return item->name;
+		}
+	});
+	return _DCTS[0].name;
+}
+
+us_cpu_encoder_huffman_s *us_cpu_encoder_huffman_init(uint interval) {
+	us_cpu_encoder_huffman_s *huff;
+	US_CALLOC(huff, 1);
+	huff->interval = interval;
+	US_MUTEX_INIT(huff->mutex);
+	return huff;
+}
+
+void us_cpu_encoder_huffman_destroy(us_cpu_encoder_huffman_s *huff) {
+	US_MUTEX_DESTROY(huff->mutex);
+	free(huff);
+}
 
-void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, uint quality) {
+
+void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, const us_cpu_encoder_params_s *params, us_cpu_encoder_huffman_s *huff) {
 	// This function based on compress_image_to_jpeg() from mjpg-streamer
 
 	us_frame_encoding_begin(src, dest, V4L2_PIX_FMT_JPEG);
@@ -91,7 +169,24 @@ void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, uint quali
 	}
 
 	jpeg_set_defaults(&jpeg);
-	jpeg_set_quality(&jpeg, quality, TRUE);
+	jpeg_set_quality(&jpeg, params->quality, TRUE);
+
+	if (params->grayscale) {
+		// Only the luma is encoded, any input colorspace is converted by libjpeg
+		jpeg_set_colorspace(&jpeg, JCS_GRAYSCALE);
+	} else if (jpeg.jpeg_color_space == JCS_YCbCr) {
+		// jpeg_set_defaults() gives 2x2 (4:2:0) for the luma and 1x1 for the chroma
+		jpeg.comp_info[0].h_samp_factor = (params->subsampling == US_CPU_ENCODER_SUBSAMPLING_444 ? 1 : 2);
+		jpeg.comp_info[0].v_samp_factor = (params->subsampling == US_CPU_ENCODER_SUBSAMPLING_420 ? 2 : 1);
+	}
+
+	switch (params->dct) {
+		case US_CPU_ENCODER_DCT_IFAST: jpeg.dct_method = JDCT_IFAST; break;
+		case US_CPU_ENCODER_DCT_FLOAT: jpeg.dct_method = JDCT_FLOAT; break;
+		default: jpeg.dct_method = JDCT_ISLOW; break;
+	}
+
+	const bool optimized = (huff != NULL && _huffman_begin(huff, &jpeg, params));
 
 	jpeg_start_compress(&jpeg, TRUE);
 
@@ -131,11 +226,219 @@ void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, uint quali
 	}
 
 	jpeg_finish_compress(&jpeg);
+	if (huff != NULL) {
+		_huffman_end(huff, &jpeg, params, optimized, dest->used);
+	}
 	jpeg_destroy_compress(&jpeg);
 
 	us_frame_encoding_end(dest);
 }
 
+static bool _huffman_begin(us_cpu_encoder_huffman_s *huff, j_compress_ptr jpeg, const us_cpu_encoder_params_s *params) {
+	// Optimized tables are computed on a sampled frame (twice the encoding cost)
+	// and reused for the following ones. Each frame still carries its own tables.
+
+	bool optimize = false;
+	bool reuse = false;
+	us_cpu_encoder_huffman_table_s dc[2];
+	us_cpu_encoder_huffman_table_s ac[2];
+
+	US_MUTEX_LOCK(huff->mutex);
+	if (!huff->ready || !_huffman_is_same_params(&huff->params, params) || huff->countdown == 0 || huff->scene_changed) {
+		if (!huff->refreshing) {
+			// Only one worker at a time, others are using the old or standard tables
+			huff->refreshing = true;
+			optimize = true;
+		}
+	}
+	if (!optimize && huff->ready && _huffman_is_same_params(&huff->params, params)) {
+		memcpy(dc, huff->dc, sizeof(dc));
+		memcpy(ac, huff->ac, sizeof(ac));
+		reuse = true;
+	}
+	if (huff->countdown > 0) {
+		--huff->countdown;
+	}
+	US_MUTEX_UNLOCK(huff->mutex);
+
+	if (optimize) {
+		jpeg->optimize_coding = TRUE;
+	} else if (reuse) {
+		for (uint index = 0; index < 2; ++index) {
+			JHUFF_TBL *const dc_table = jpeg->dc_huff_tbl_ptrs[index];
+			JHUFF_TBL *const ac_table = jpeg->ac_huff_tbl_ptrs[index];
+			assert(dc_table != NULL);
+			assert(ac_table != NULL);
+			memcpy(dc_table->bits, dc[index].bits, sizeof(dc_table->bits));
+			memcpy(dc_table->huffval, dc[index].vals, sizeof(dc_table->huffval));
+			memcpy(ac_table->bits, ac[index].bits, sizeof(ac_table->bits));
+			memcpy(ac_table->huffval, ac[index].vals, sizeof(ac_table->huffval));
+		}
+	}
+	return optimize;
+}
+
+static void _huffman_end(us_cpu_encoder_huffman_s *huff, j_compress_ptr jpeg, const us_cpu_encoder_params_s *params, bool optimized, uz size) {
+	if (optimized) {
+		// libjpeg has replaced the tables in use with the optimal ones.
+		// They have no codes for the symbols which didn't occur in this frame,
+		// so they are completed to make them usable for any other frame.
+		us_cpu_encoder_huffman_table_s dc[2];
+		us_cpu_encoder_huffman_table_s ac[2];
+		for (uint index = 0; index < 2; ++index) {
+			_huffman_make_complete_table(jpeg->dc_huff_tbl_ptrs[index], false, &dc[index]);
+			_huffman_make_complete_table(jpeg->ac_huff_tbl_ptrs[index], true, &ac[index]);
+		}
+
+		US_MUTEX_LOCK(huff->mutex);
+		memcpy(huff->dc, dc, sizeof(dc));
+		memcpy(huff->ac, ac, sizeof(ac));
+		huff->ready = true;
+		huff->refreshing = false;
+		huff->scene_changed = false;
+		huff->params = *params;
+		huff->countdown = huff->interval;
+		huff->ref_size = size;
+		US_MUTEX_UNLOCK(huff->mutex);
+
+	} else {
+		US_MUTEX_LOCK(huff->mutex);
+		// A big change of the frame size means a change of the scene
+		// and probably stale statistics of the symbols.
+		const uz delta = huff->ref_size / 4;
+		if (huff->ready && !huff->refreshing && (size > huff->ref_size + delta || size < huff->ref_size - delta)) {
+			huff->scene_changed = true;
+		}
+		US_MUTEX_UNLOCK(huff->mutex);
+	}
+}
+
+static bool _huffman_is_same_params(const us_cpu_encoder_params_s *a, const us_cpu_encoder_params_s *b) {
+	// The DCT method barely changes the coefficients, so the statistics stay valid
+	return (
+		a->quality == b->quality
+		&& a->grayscale == b->grayscale
+		&& (a->grayscale || a->subsampling == b->subsampling)
+	);
+}
+
+static void _huffman_make_complete_table(const JHUFF_TBL *src, bool ac, us_cpu_encoder_huffman_table_s *dest) {
+	// Code lengths of the optimal table are turned back into the weights,
+	// the missing symbols get the minimal weight, and the table is rebuilt
+	// with the procedure from the JPEG spec (Annex K.2), like libjpeg does.
+
+	long freq[257] = {0};
+	if (src != NULL) {
+		uint pos = 0;
+		for (uint len = 1; len <= 16; ++len) {
+			for (uint count = 0; count < src->bits[len]; ++count) {
+				freq[src->huffval[pos++]] = 1L << (24 - len);
+			}
+		}
+	}
+	if (ac) {
+		for (uint run = 0; run < 16; ++run) {
+			for (uint size = 1; size <= 10; ++size) {
+				const uint symbol = (run << 4) | size;
+				freq[symbol] = US_MAX(freq[symbol], 1L);
+			}
+		}
+		freq[0x00] = US_MAX(freq[0x00], 1L); // EOB
+		freq[0xF0] = US_MAX(freq[0xF0], 1L); // ZRL
+	} else {
+		for (uint symbol = 0; symbol <= 11; ++symbol) {
+			freq[symbol] = US_MAX(freq[symbol], 1L);
+		}
+	}
+	freq[256] = 1; // Reserved to avoid the all-ones codeword
+
+	int code_size[257] = {0};
+	int others[257];
+	for (uint index = 0; index < 257; ++index) {
+		others[index] = -1;
+	}
+
+	while (true) {
+		// Find two smallest nonzero frequencies, the largest index wins the ties
+		int c1 = -1;
+		int c2 = -1;
+		long v1 = 1000000000L;
+		long v2 = 1000000000L;
+		for (int index = 0; index <= 256; ++index) {
+			if (freq[index] > 0 && freq[index] <= v1) {
+				v1 = freq[index];
+				c1 = index;
+			}
+		}
+		for (int index = 0; index <= 256; ++index) {
+			if (freq[index] > 0 && freq[index] <= v2 && index != c1) {
+				v2 = freq[index];
+				c2 = index;
+			}
+		}
+		if (c2 < 0) {
+			break;
+		}
+
+		freq[c1] += freq[c2];
+		freq[c2] = 0;
+
+		++code_size[c1];
+		while (others[c1] >= 0) {
+			c1 = others[c1];
+			++code_size[c1];
+		}
+		others[c1] = c2;
+		++code_size[c2];
+		while (others[c2] >= 0) {
+			c2 = others[c2];
+			++code_size[c2];
+		}
+	}
+
+	uint bits[33] = {0};
+	for (uint index = 0; index <= 256; ++index) {
+		if (code_size[index] > 0) {
+			assert(code_size[index] <= 32);
+			++bits[code_size[index]];
+		}
+	}
+
+	// Limit the code lengths to 16 bits
+	for (uint len = 32; len > 16; --len) {
+		while (bits[len] > 0) {
+			uint shorter = len - 2;
+			while (bits[shorter] == 0) {
+				--shorter;
+			}
+			bits[len] -= 2;
+			++bits[len - 1];
+			bits[shorter + 1] += 2;
+			--bits[shorter];
+		}
+	}
+
+	// Remove the reserved code from the longest ones
+	uint longest = 16;
+	while (bits[longest] == 0) {
+		--longest;
+	}
+	--bits[longest];
+
+	US_MEMSET_ZERO(*dest);
+	for (uint len = 1; len <= 16; ++len) {
+		dest->bits[len] = bits[len];
+	}
+	uint pos = 0;
+	for (int len = 1; len <= 32; ++len) {
+		for (uint symbol = 0; symbol <= 255; ++symbol) {
+			if (code_size[symbol] == len) {
+				dest->vals[pos++] = symbol;
+			}
+		}
+	}
+}
+
 static void _jpeg_set_dest_frame(j_compress_ptr jpeg, us_frame_s *frame) {
 	if (jpeg->dest == NULL) {
 		assert((jpeg->dest = (struct jpeg_destination_mgr*)(*jpeg->mem->alloc_small)(
@@ -156,41 +459,13 @@ static void _jpeg_write_scanlines_yuv(struct jpeg_compress_struct *jpeg, const u
 	u8 *line_buf;
 	US_CALLOC(line_buf, frame->width * 3);
 
+	const us_pixel_kernels_s *const kernels = us_pixel_get();
 	const uint padding = us_frame_get_padding(frame);
 	const u8 *data = frame->data;
 
 	while (jpeg->next_scanline < frame->height) {
-		u8 *ptr = line_buf;
-
-		for (uint x = 0; x < frame->width; ++x) {
-			// See also: https://www.kernel.org/doc/html/v4.8/media/uapi/v4l/pixfmt-uyvy.html
-			const bool is_odd_pixel = x & 1;
-			u8 y, u, v;
-			if (frame->format == V4L2_PIX_FMT_YUYV) {
-				y = data[is_odd_pixel ? 2 : 0];
-				u = data[1];
-				v = data[3];
-			} else if (frame->format == V4L2_PIX_FMT_YVYU) {
-				y = data[is_odd_pixel ? 2 : 0];
-				u = data[3];
-				v = data[1];
-			} else if (frame->format == V4L2_PIX_FMT_UYVY) {
-				y = data[is_odd_pixel ? 3 : 1];
-				u = data[0];
-				v = data[2];
-			} else {
-				assert(0 && "Unsupported pixel format");
-				return; // Makes linter happy
-			}
-
-			ptr[0] = y;
-			ptr[1] = u;
-			ptr[2] = v;
-			ptr += 3;
-
-			data += (is_odd_pixel ? 4 : 0);
-		}
-		data += padding;
+		kernels->packed_yuv_to_yuv444(data, line_buf, frame->width, frame->format);
+		data += frame->width * 2 + padding;
 
 		JSAMPROW scanlines[1] = {line_buf};
 		jpeg_write_scanlines(jpeg, scanlines, 1);
@@ -203,54 +478,32 @@ static void _jpeg_write_scanlines_yuv_planar(struct jpeg_compress_struct *jpeg,
 	u8 *line_buf;
 	US_CALLOC(line_buf, frame->width * 3);
 
+	const us_pixel_kernels_s *const kernels = us_pixel_get();
 	const uint padding = us_frame_get_padding(frame);
 	const uint image_size = frame->width * frame->height;
 	const uint chroma_array_size = (frame->used - image_size) / 2;
 	const uint chroma_matrix_order = (image_size / chroma_array_size) == 16 ? 4 : 2;
+	const uint chroma_stride = (frame->width + padding) / chroma_matrix_order;
 	const u8 *data = frame->data;
 	const u8 *chroma1_data = frame->data + image_size;
 	const u8 *chroma2_data = frame->data + image_size + chroma_array_size;
+	if (frame->format == V4L2_PIX_FMT_YVU420) {
+		const u8 *const tmp = chroma1_data;
+		chroma1_data = chroma2_data;
+		chroma2_data = tmp;
+	}
 
 	//US_LOG_DEBUG("Planar data: Image Size %u, Chroma Array Size %u, Chroma Matrix Order %u",
 	//	image_size, chroma_array_size, chroma_matrix_order);
 
 	while (jpeg->next_scanline < frame->height) {
-		u8 *ptr = line_buf;
-
-		for (uint x = 0; x < frame->width; ++x) {
-			// See also: https://www.kernel.org/doc/html/v4.8/media/uapi/v4l/pixfmt-yuv420.html
-			u8 y = data[x];
-			u8 u;
-			u8 v;
-			uint chroma_position = x / chroma_matrix_order;
-
-			switch (frame->format) {
-				case V4L2_PIX_FMT_YUV420:
-					u = chroma1_data[chroma_position];
-					v = chroma2_data[chroma_position];
-					break;
-				case V4L2_PIX_FMT_YVU420:
-					u = chroma2_data[chroma_position];
-					v = chroma1_data[chroma_position];
-					break;
-				default:
-					assert(0 && "Unsupported pixel format");
-					return; // Makes linter happy
-			}
-
-			ptr[0] = y;
-			ptr[1] = u;
-			ptr[2] = v;
-			ptr += 3;
-		}
-
+		// See also: https://www.kernel.org/doc/html/v4.8/media/uapi/v4l/pixfmt-yuv420.html
+		const uint chroma_offset = (jpeg->next_scanline / chroma_matrix_order) * chroma_stride;
+		kernels->planar_yuv_to_yuv444(
+			data, chroma1_data + chroma_offset, chroma2_data + chroma_offset,
+			line_buf, frame->width, chroma_matrix_order);
 		data += frame->width + padding;
 
-		if (jpeg->next_scanline > 0 && jpeg->next_scanline % chroma_matrix_order == 0) {
-			chroma1_data += (frame->width + padding) / chroma_matrix_order;
-			chroma2_data += (frame->width + padding) / chroma_matrix_order;
-		}
-
 		JSAMPROW scanlines[1] = {line_buf};
 		jpeg_write_scanlines(jpeg, scanlines, 1);
 	}
@@ -259,50 +512,28 @@ static void _jpeg_write_scanlines_yuv_planar(struct jpeg_compress_struct *jpeg,
 }
 
 static void _jpeg_write_scanlines_grey(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	u8 *line_buf;
-	US_CALLOC(line_buf, frame->width);
-
 	const uint padding = us_frame_get_padding(frame);
-	const u8 *data = frame->data;
+	u8 *data = frame->data;
 
 	while (jpeg->next_scanline < frame->height) {
-		u8 *ptr = line_buf;
-
-		for (uint x = 0; x < frame->width; ++x) {
-			ptr[0] = data[x];
-			ptr += 1;
-		}
+		JSAMPROW scanlines[1] = {data};
+		jpeg_write_scanlines(jpeg, scanlines, 1);
 
 		data += frame->width + padding;
-
-		JSAMPROW scanlines[1] = {line_buf};
-		jpeg_write_scanlines(jpeg, scanlines, 1);
 	}
-
-	free(line_buf);
 }
 
 static void _jpeg_write_scanlines_rgb565(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
 	u8 *line_buf;
 	US_CALLOC(line_buf, frame->width * 3);
 
+	const us_pixel_kernels_s *const kernels = us_pixel_get();
 	const uint padding = us_frame_get_padding(frame);
 	const u8 *data = frame->data;
 
 	while (jpeg->next_scanline < frame->height) {
-		u8 *ptr = line_buf;
-
-		for (uint x = 0; x < frame->width; ++x) {
-			const uint two_byte = (data[1] << 8) + data[0];
-
-			ptr[0] = data[1] & 248; // Red
-			ptr[1] = (u8)((two_byte & 2016) >> 3); // Green
-			ptr[2] = (data[0] & 31) * 8; // Blue
-			ptr += 3;
-
-			data += 2;
-		}
-		data += padding;
+		kernels->rgb565_to_rgb24(data, line_buf, frame->width);
+		data += frame->width * 2 + padding;
 
 		JSAMPROW scanlines[1] = {line_buf};
 		jpeg_write_scanlines(jpeg, scanlines, 1);
@@ -328,20 +559,13 @@ static void _jpeg_write_scanlines_bgr24(struct jpeg_compress_struct *jpeg, const
 	u8 *line_buf;
 	US_CALLOC(line_buf, frame->width * 3);
 
+	const us_pixel_kernels_s *const kernels = us_pixel_get();
 	const uint padding = us_frame_get_padding(frame);
-	u8 *data = frame->data;
+	const u8 *data = frame->data;
 
 	while (jpeg->next_scanline < frame->height) {
-		u8 *ptr = line_buf;
-
-		// swap B and R values
-		for (uint x = 0; x < frame->width * 3; x += 3) {
-			ptr[0] = data[x + 2];
-			ptr[1] = data[x + 1];
-			ptr[2] = data[x];
-			ptr += 3;
-		}
-		
+		kernels->bgr24_to_rgb24(data, line_buf, frame->width); // swap B and R values
+
 		JSAMPROW scanlines[1] = {line_buf};
 		jpeg_write_scanlines(jpeg, scanlines, 1);
 
@@ -391,3 +615,203 @@ static void _jpeg_term_destination(j_compress_ptr jpeg) {
 }
 
 #undef JPEG_OUTPUT_BUFFER_SIZE
+
+
+#ifdef TEST_CPU_ENCODER
+// Время кодирования и размер JPEG для каждой настройки и качества
+// на синтетических 1080p YUYV-кадрах: рабочий стол с текстом, плавная
+// "фотография" и она же с шумом матрицы, как у вебкамеры в темноте.
+// Затем то же для таблиц Хаффмана: стандартные, оптимизация каждого кадра,
+// переиспользование раз оптимизированных на _ITERS кадров (время усреднено
+// вместе с оптимизацией) и чужие таблицы от другой сцены до ее детектирования.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_CPU_ENCODER -o cpu-encoder-bench ustreamer/encoders/cpu/encoder.c libs/frame.c libs/pixel.c -ljpeg -lm -pthread
+
+#define _WIDTH	1920
+#define _HEIGHT	1080
+#define _ITERS	20
+
+
+static u32 _rand(u32 *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static void _draw_desktop(u8 *rgb, u32 *rs) {
+	memset(rgb, 0xE8, _WIDTH * _HEIGHT * 3);
+	// Окна с заголовками и строками текста 6x10, часть строк цветные
+	for (uint win = 0; win < 4; ++win) {
+		const uint x0 = 40 + win * 460;
+		const uint y0 = 60 + win * 40;
+		for (uint y = y0; y < y0 + 700; ++y) {
+			for (uint x = x0; x < x0 + 440; ++x) {
+				u8 *const px = rgb + (y * _WIDTH + x) * 3;
+				const bool title = (y < y0 + 24);
+				px[0] = (title ? 0x30 : 0xFF);
+				px[1] = (title ? 0x60 : 0xFF);
+				px[2] = (title ? 0xA0 : 0xFF);
+			}
+		}
+		for (uint line = 0; line < 60; ++line) {
+			const u8 color[3] = {
+				(line % 7 == 3 ? 0xD0 : 0x10),
+				0x10,
+				(line % 11 == 5 ? 0xC0 : 0x10),
+			};
+			const uint ty = y0 + 34 + line * 11;
+			for (uint ch = 0; ch < 70; ++ch) {
+				if (_rand(rs) % 8 == 0) {
+					continue; // Space
+				}
+				const u32 glyph = _rand(rs);
+				for (uint bit = 0; bit < 30; ++bit) {
+					if (glyph & (1u << bit)) {
+						const uint gx = x0 + 8 + ch * 6 + bit % 5;
+						const uint gy = ty + (bit / 5) * 1 + (bit % 3);
+						u8 *const px = rgb + (gy * _WIDTH + gx) * 3;
+						memcpy(px, color, 3);
+					}
+				}
+			}
+		}
+	}
+}
+
+static void _draw_photo(u8 *rgb, u32 *rs, uint noise) {
+	for (uint y = 0; y < _HEIGHT; ++y) {
+		for (uint x = 0; x < _WIDTH; ++x) {
+			u8 *const px = rgb + (y * _WIDTH + x) * 3;
+			const double fx = (double)x / _WIDTH;
+			const double fy = (double)y / _HEIGHT;
+			const double base[3] = {
+				120 + 80 * sin(fx * 5 + fy * 3),
+				110 + 70 * cos(fx * 4 - fy * 6),
+				100 + 60 * sin(fx * fy * 12),
+			};
+			for (uint ch = 0; ch < 3; ++ch) {
+				const int n = (noise > 0 ? (int)(_rand(rs) % (noise * 2 + 1)) - (int)noise : 0);
+				px[ch] = US_MAX(0, US_MIN(255, (int)base[ch] + n));
+			}
+		}
+	}
+}
+
+static void _rgb_to_yuyv(const u8 *rgb, us_frame_s *frame) {
+	us_frame_realloc_data(frame, _WIDTH * _HEIGHT * 2);
+	frame->width = _WIDTH;
+	frame->height = _HEIGHT;
+	frame->format = V4L2_PIX_FMT_YUYV;
+	frame->stride = _WIDTH * 2;
+	frame->used = _WIDTH * _HEIGHT * 2;
+	for (uint index = 0; index < _WIDTH * _HEIGHT; index += 2) {
+		int y[2];
+		int u = 0;
+		int v = 0;
+		for (uint pair = 0; pair < 2; ++pair) {
+			const u8 *const px = rgb + (index + pair) * 3;
+			y[pair] = (77 * px[0] + 150 * px[1] + 29 * px[2]) >> 8;
+			u += ((-43 * px[0] - 85 * px[1] + 128 * px[2]) >> 8) + 128;
+			v += ((128 * px[0] - 107 * px[1] - 21 * px[2]) >> 8) + 128;
+		}
+		u8 *const out = frame->data + index * 2;
+		out[0] = y[0];
+		out[1] = u / 2;
+		out[2] = y[1];
+		out[3] = v / 2;
+	}
+}
+
+int main(void) {
+	static const struct {
+		const char *name;
+		us_cpu_encoder_params_s params;
+	} settings[] = {
+		{"420 ISLOW (default)",	{.subsampling = US_CPU_ENCODER_SUBSAMPLING_420}},
+		{"422 ISLOW",			{.subsampling = US_CPU_ENCODER_SUBSAMPLING_422}},
+		{"444 ISLOW",			{.subsampling = US_CPU_ENCODER_SUBSAMPLING_444}},
+		{"420 IFAST",			{.dct = US_CPU_ENCODER_DCT_IFAST}},
+		{"420 FLOAT",			{.dct = US_CPU_ENCODER_DCT_FLOAT}},
+		{"grayscale ISLOW",		{.grayscale = true}},
+		{"grayscale IFAST",		{.grayscale = true, .dct = US_CPU_ENCODER_DCT_IFAST}},
+	};
+	static const uint qualities[] = {50, 80, 95};
+	static const char *const frame_names[] = {"desktop", "photo", "noisy"};
+
+	u32 rs = 0x12345678;
+	u8 *rgb;
+	US_CALLOC(rgb, _WIDTH * _HEIGHT * 3);
+	us_frame_s *frames[3];
+	for (uint index = 0; index < 3; ++index) {
+		frames[index] = us_frame_init();
+		switch (index) {
+			case 0: _draw_desktop(rgb, &rs); break;
+			case 1: _draw_photo(rgb, &rs, 0); break;
+			default: _draw_photo(rgb, &rs, 24); break;
+		}
+		_rgb_to_yuyv(rgb, frames[index]);
+	}
+	free(rgb);
+
+	us_frame_s *const dest = us_frame_init();
+	printf("%ux%u YUYV, %u iterations, kernels=%s\n\n", _WIDTH, _HEIGHT, _ITERS, us_pixel_get()->name);
+	for (uint index = 0; index < 3; ++index) {
+		printf("%-8s %-20s", frame_names[index], "");
+		US_ARRAY_ITERATE(qualities, 0, quality, {
+			printf("  q=%-2u ms     KiB", *quality);
+		});
+		printf("\n");
+		US_ARRAY_ITERATE(settings, 0, setting, {
+			printf("%-8s %-20s", "", setting->name);
+			US_ARRAY_ITERATE(qualities, 0, quality, {
+				us_cpu_encoder_params_s params = setting->params;
+				params.quality = *quality;
+				const ldf begin_ts = us_get_now_monotonic();
+				for (uint iter = 0; iter < _ITERS; ++iter) {
+					us_cpu_encoder_compress(frames[index], dest, &params, NULL);
+				}
+				const ldf ms = (us_get_now_monotonic() - begin_ts) * 1000 / _ITERS;
+				printf("  %6.2Lf %7.1f", ms, (double)dest->used / 1024);
+			});
+			printf("\n");
+		});
+		printf("\n");
+	}
+
+	printf("Huffman tables, 420 ISLOW, q=80\n");
+	printf("%-8s  %-16s %-16s %-16s %-16s\n", "", "standard", "every frame", "reused", "other scene");
+	const us_cpu_encoder_params_s params = {.quality = 80};
+	for (uint index = 0; index < 3; ++index) {
+		printf("%-8s", frame_names[index]);
+		for (uint mode = 0; mode < 3; ++mode) {
+			// Интервал 0 - оптимизация на каждом кадре, _ITERS - только на первом
+			us_cpu_encoder_huffman_s *const huff = (mode == 0 ? NULL : us_cpu_encoder_huffman_init(mode == 1 ? 0 : _ITERS));
+			const ldf begin_ts = us_get_now_monotonic();
+			for (uint iter = 0; iter < _ITERS; ++iter) {
+				us_cpu_encoder_compress(frames[index], dest, &params, huff);
+			}
+			const ldf ms = (us_get_now_monotonic() - begin_ts) * 1000 / _ITERS;
+			printf("  %6.2Lf %7.1f", ms, (double)dest->used / 1024);
+			if (huff != NULL) {
+				us_cpu_encoder_huffman_destroy(huff);
+			}
+		}
+		us_cpu_encoder_huffman_s *const huff = us_cpu_encoder_huffman_init(_ITERS);
+		us_cpu_encoder_compress(frames[(index + 1) % 3], dest, &params, huff);
+		us_cpu_encoder_compress(frames[index], dest, &params, huff);
+		printf("  %6s %7.1f\n", "", (double)dest->used / 1024);
+		us_cpu_encoder_huffman_destroy(huff);
+	}
+
+	us_frame_destroy(dest);
+	for (uint index = 0; index < 3; ++index) {
+		us_frame_destroy(frames[index]);
+	}
+	return 0;
+}
+
+#undef _ITERS
+#undef _HEIGHT
+#undef _WIDTH
+
+#endif
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
 #include <jpeglib.h>
@@ -35,8 +36,63 @@
 #include <linux/videodev2.h>
 #endif
 
+#include <pthread.h>
+
 #include "../../../libs/tools.h"
+#include "../../../libs/threading.h"
 #include "../../../libs/frame.h"
+#include "../../../libs/pixel.h"
+
+
+#define US_CPU_ENCODER_SUBSAMPLINGS_STR "444, 422, 420"
+#define US_CPU_ENCODER_DCTS_STR "ISLOW, IFAST, FLOAT"
+
+
+typedef enum {
+	US_CPU_ENCODER_SUBSAMPLING_420 = 0,
+	US_CPU_ENCODER_SUBSAMPLING_422,
+	US_CPU_ENCODER_SUBSAMPLING_444,
+} us_cpu_encoder_subsampling_e;
+
+typedef enum {
+	US_CPU_ENCODER_DCT_ISLOW = 0,
+	US_CPU_ENCODER_DCT_IFAST,
+	US_CPU_ENCODER_DCT_FLOAT,
+} us_cpu_encoder_dct_e;
+
+typedef struct {
+	uint							quality;
+	us_cpu_encoder_subsampling_e	subsampling; // Ignored for grayscale
+	bool							grayscale;
+	us_cpu_encoder_dct_e			dct;
+} us_cpu_encoder_params_s;
+
+typedef struct {
+	u8	bits[17];
+	u8	vals[256];
+} us_cpu_encoder_huffman_table_s;
+
+typedef struct {
+	uint			interval;
+
+	pthread_mutex_t	mutex;
+	bool			ready;
+	bool			refreshing;
+	bool			scene_changed;
+	us_cpu_encoder_params_s params;
+	uint			countdown;
+	uz				ref_size;
+	us_cpu_encoder_huffman_table_s dc[2];
+	us_cpu_encoder_huffman_table_s ac[2];
+} us_cpu_encoder_huffman_s;
+
+
+int us_cpu_encoder_parse_subsampling(const char *str);
+const char *us_cpu_encoder_subsampling_to_string(us_cpu_encoder_subsampling_e subsampling);
+int us_cpu_encoder_parse_dct(const char *str);
+const char *us_cpu_encoder_dct_to_string(us_cpu_encoder_dct_e dct);
 
+us_cpu_encoder_huffman_s *us_cpu_encoder_huffman_init(uint interval);
+void us_cpu_encoder_huffman_destroy(us_cpu_encoder_huffman_s *huff);
 
-void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, uint quality);
+void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, const us_cpu_encoder_params_s *params, us_cpu_encoder_huffman_s *huff);
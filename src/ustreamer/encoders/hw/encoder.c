@@ -29,7 +29,7 @@
 
 
 void _copy_plus_huffman(const us_frame_s *src, us_frame_s *dest);
-static bool _is_huffman(const uint8_t *data);
+static bool _is_huffman(const uint8_t *data, size_t size);
 
 
 void us_hw_encoder_compress(const us_frame_s *src, us_frame_s *dest) {
@@ -40,14 +40,14 @@ void us_hw_encoder_compress(const us_frame_s *src, us_frame_s *dest) {
 void _copy_plus_huffman(const us_frame_s *src, us_frame_s *dest) {
 	us_frame_encoding_begin(src, dest, V4L2_PIX_FMT_JPEG);
 
-	if (!_is_huffman(src->data)) {
+	if (!_is_huffman(src->data, src->used)) {
 		const uint8_t *src_ptr = src->data;
 		const uint8_t *const src_end = src->data + src->used;
 
-		while ((((src_ptr[0] << 8) | src_ptr[1]) != 0xFFC0) && (src_ptr < src_end)) {
+		while ((src_ptr + 1 < src_end) && (((src_ptr[0] << 8) | src_ptr[1]) != 0xFFC0)) {
 			src_ptr += 1;
 		}
-		if (src_ptr >= src_end) {
+		if (src_ptr + 1 >= src_end) {
 			dest->used = 0; // Error
 			return;
 		}
@@ -65,10 +65,11 @@ void _copy_plus_huffman(const us_frame_s *src, us_frame_s *dest) {
 	us_frame_encoding_end(dest);
 }
 
-static bool _is_huffman(const uint8_t *data) {
+static bool _is_huffman(const uint8_t *data, size_t size) {
+	const uint8_t *const end = data + size;
 	unsigned count = 0;
 
-	while ((((uint16_t)data[0] << 8) | data[1]) != 0xFFDA) {
+	while ((data + 1 < end) && ((((uint16_t)data[0] << 8) | data[1]) != 0xFFDA)) {
 		if (count++ > 2048) {
 			return false;
 		}
@@ -79,3 +80,49 @@ static bool _is_huffman(const uint8_t *data) {
 	}
 	return false;
 }
+
+
+#ifdef FUZZ_HW_HUFFMAN
+// Вставка DHT в MJPEG от камер, которые его не шлют. Маркеры ищутся
+// в данных прямо с устройства, так что любое чтение за used - ошибка.
+//   clang -g -O1 -std=c17 -D_GNU_SOURCE -fsanitize=fuzzer,address,undefined -DUS_FUZZ_LIBFUZZER -DFUZZ_HW_HUFFMAN -o fuzz-hw-huffman ustreamer/encoders/hw/encoder.c libs/frame.c libs/pixel.c -lm -pthread
+//   gcc -g -O1 -std=c17 -D_GNU_SOURCE -fsanitize=address,undefined -DFUZZ_HW_HUFFMAN -o fuzz-hw-huffman ustreamer/encoders/hw/encoder.c libs/frame.c libs/pixel.c -lm -pthread
+
+#include "../../../libs/fuzz.h"
+
+
+const us_fuzz_seed_s us_fuzz_seeds[] = {
+	US_FUZZ_SEED("\xFF"),
+	US_FUZZ_SEED("\xFF\xD8\xFF\xC0\x00\x0B\x08\x00\x08\x00\x08\x01\x01\x11\x00\xFF\xDA\x00\x08\x01\x01\x00\x00\x3F\x00\xD2\xCF\x20\xFF\xD9"),
+	US_FUZZ_SEED("\xFF\xD8\xFF\xC4\x00\x14\x00\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+		"\xFF\xC0\x00\x0B\x08\x00\x08\x00\x08\x01\x01\x11\x00\xFF\xDA\x00\x08\x01\x01\x00\x00\x3F\x00\xFF\xD9"),
+	US_FUZZ_SEED("\xFF\xD8\xFF\xE0\x00\x10JFIF\x00\x01\x01\x00\x00\x01\x00\x01\x00\x00\xFF\xC0"),
+	US_FUZZ_SEED("\xFF\xD8\xFF\xE0\x00\x10JFIF\x00\x01\x01\x00\x00\x01\x00\x01\x00\x00\xFF"),
+};
+const uz us_fuzz_seeds_count = US_ARRAY_LEN(us_fuzz_seeds);
+
+void us_fuzz_one(const u8 *data, uz size) {
+	if (size == 0) {
+		return; // Пустые буферы отбрасывает захват
+	}
+
+	static us_frame_s *dest = NULL;
+	if (dest == NULL) {
+		dest = us_frame_init();
+	}
+	const us_frame_s src = {
+		.data = (u8*)data, // Только чтение
+		.used = size,
+		.format = V4L2_PIX_FMT_MJPEG,
+		.dma_fd = -1,
+	};
+
+	us_hw_encoder_compress(&src, dest);
+	assert(
+		dest->used == 0
+		|| dest->used == size
+		|| dest->used == size + sizeof(US_HUFFMAN_TABLE)
+	);
+}
+
+#endif
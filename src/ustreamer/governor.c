@@ -0,0 +1,499 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "governor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+
+#include <pthread.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/array.h"
+#include "../libs/threading.h"
+#include "../libs/logging.h"
+#include "../libs/capture.h"
+
+#include "encoder.h"
+
+
+// How far the temperature trend is extrapolated to step down before the throttling point
+#define _HORIZON		20
+#define _QUALITY_STEP	((uint)10)
+
+static const uint _FPS_PERCENTS[] = {75, 50, 33, 25};
+
+
+typedef struct {
+	uint	level;
+	float	fps;
+	float	temp_prev;
+	float	temp_slope;
+	ldf		prev_ts;
+	ldf		last_change_ts;
+	ldf		cool_since_ts;
+} _state_s;
+
+
+static void _governor_build_tiers(us_governor_s *gov, uint base_quality);
+static void _governor_step(us_governor_s *gov, us_encoder_s *enc, _state_s *st, ldf now_ts);
+static void _governor_apply(us_governor_s *gov, us_encoder_s *enc, uint level, bool changed, float fps);
+static float _read_temp(const char *sysfs);
+static u32 _read_throttled(const char *sysfs);
+static int _read_number(const char *path, int base, long long *value);
+
+
+#define _LOG_INFO(x_msg, ...)	US_LOG_INFO("GOVERNOR: " x_msg, ##__VA_ARGS__)
+#define _LOG_ERROR(x_msg, ...)	US_LOG_ERROR("GOVERNOR: " x_msg, ##__VA_ARGS__)
+
+
+us_governor_s *us_governor_init(void) {
+	us_governor_runtime_s *run;
+	US_CALLOC(run, 1);
+	atomic_init(&run->busy, 0);
+	atomic_init(&run->jobs, 0);
+	atomic_init(&run->dropped, 0);
+	atomic_init(&run->n_workers, 0);
+	atomic_init(&run->frames, 0);
+	atomic_init(&run->min_interval, 0);
+	atomic_init(&run->level, 0);
+	atomic_init(&run->restart_level, 0);
+	atomic_init(&run->stop, false);
+	run->stats.temp = -1;
+	US_MUTEX_INIT(run->mutex);
+
+	us_governor_s *gov;
+	US_CALLOC(gov, 1);
+	gov->sysfs = "/sys";
+	gov->temp_high = 75;
+	gov->temp_low = 65;
+	gov->load_high = 90;
+	gov->load_low = 60;
+	gov->quality_min = 50;
+	gov->fps_min = 10;
+	gov->down_delay = 10;
+	gov->up_delay = 30;
+	gov->run = run;
+	return gov;
+}
+
+void us_governor_destroy(us_governor_s *gov) {
+	US_MUTEX_DESTROY(gov->run->mutex);
+	free(gov->run);
+	free(gov);
+}
+
+int us_governor_parse_resolutions(us_governor_s *gov, const char *str) {
+	uint count = 0;
+	while (*str != '\0') {
+		if (count >= US_GOVERNOR_MAX_RESOLUTIONS) {
+			return -1;
+		}
+		uint width;
+		uint height;
+		int consumed = 0;
+		if (sscanf(str, "%ux%u%n", &width, &height, &consumed) != 2) {
+			return -1;
+		}
+		if (
+			width < US_VIDEO_MIN_WIDTH || width > US_VIDEO_MAX_WIDTH
+			|| height < US_VIDEO_MIN_HEIGHT || height > US_VIDEO_MAX_HEIGHT
+		) {
+			return -1;
+		}
+		gov->widths[count] = width;
+		gov->heights[count] = height;
+		++count;
+		str += consumed;
+		if (*str == ',') {
+			++str;
+		} else if (*str != '\0') {
+			return -1;
+		}
+	}
+	gov->n_resolutions = count;
+	return 0;
+}
+
+void us_governor_prepare(us_governor_s *gov, uint base_quality) {
+	us_governor_runtime_s *const run = gov->run;
+	_governor_build_tiers(gov, base_quality);
+	_LOG_INFO("Using %u levels, sysfs=%s, temp=%u..%u, load=%u..%u%%",
+		run->n_tiers, gov->sysfs, gov->temp_low, gov->temp_high, gov->load_low, gov->load_high);
+	if (_read_temp(gov->sysfs) < 0) {
+		_LOG_ERROR("Can't read any thermal zone, only the load will be taken into account");
+	}
+}
+
+void us_governor_loop(us_governor_s *gov, us_encoder_s *enc) {
+	us_governor_runtime_s *const run = gov->run;
+	_state_s st = {.temp_prev = -1, .prev_ts = us_get_now_monotonic()};
+	while (!atomic_load(&run->stop)) {
+		for (uint count = 0; count < 4 && !atomic_load(&run->stop); ++count) {
+			usleep(250 * 1000);
+		}
+		_governor_step(gov, enc, &st, us_get_now_monotonic());
+	}
+}
+
+void us_governor_loop_break(us_governor_s *gov) {
+	atomic_store(&gov->run->stop, true);
+}
+
+void us_governor_get_stats(us_governor_s *gov, us_governor_stats_s *stats) {
+	US_MUTEX_LOCK(gov->run->mutex);
+	*stats = gov->run->stats;
+	US_MUTEX_UNLOCK(gov->run->mutex);
+}
+
+void us_governor_apply_resolution(us_governor_s *gov, us_capture_s *cap) {
+	if (!gov->enabled || gov->n_resolutions == 0) {
+		return;
+	}
+	us_governor_runtime_s *const run = gov->run;
+	if (run->base_width == 0) {
+		run->base_width = cap->width;
+		run->base_height = cap->height;
+	}
+	const us_governor_tier_s *const tier = &run->tiers[atomic_load(&run->level)];
+	cap->width = (tier->width > 0 ? tier->width : run->base_width);
+	cap->height = (tier->height > 0 ? tier->height : run->base_height);
+}
+
+bool us_governor_take_restart(us_governor_s *gov) {
+	return (atomic_exchange(&gov->run->restart_level, 0) > 0);
+}
+
+static void _governor_build_tiers(us_governor_s *gov, uint base_quality) {
+	// The ladder from the least visible to the most visible step:
+	// the quality first, then the frame rate and then the resolution.
+	us_governor_runtime_s *const run = gov->run;
+	us_governor_tier_s tier = {.fps_percent = 100};
+
+#	define ADD_TIER { \
+			if (run->n_tiers < US_GOVERNOR_MAX_TIERS) { \
+				run->tiers[run->n_tiers++] = tier; \
+			} \
+		}
+
+	ADD_TIER;
+	uint quality = (base_quality > 0 ? base_quality : 100);
+	while (quality > gov->quality_min) {
+		quality = US_MAX(quality - US_MIN(quality, _QUALITY_STEP), gov->quality_min);
+		tier.quality = quality;
+		ADD_TIER;
+	}
+	for (uint index = 0; index < US_ARRAY_LEN(_FPS_PERCENTS); ++index) {
+		tier.fps_percent = _FPS_PERCENTS[index];
+		ADD_TIER;
+	}
+	for (uint index = 0; index < gov->n_resolutions; ++index) {
+		tier.width = gov->widths[index];
+		tier.height = gov->heights[index];
+		ADD_TIER;
+	}
+
+#	undef ADD_TIER
+}
+
+static void _governor_step(us_governor_s *gov, us_encoder_s *enc, _state_s *st, ldf now_ts) {
+	us_governor_runtime_s *const run = gov->run;
+
+	const ldf dt = now_ts - st->prev_ts;
+	st->prev_ts = now_ts;
+
+	const uint frames = atomic_exchange(&run->frames, 0);
+	const u64 busy = atomic_exchange(&run->busy, 0);
+	const uint jobs = atomic_exchange(&run->jobs, 0);
+	const uint dropped = atomic_exchange(&run->dropped, 0);
+	const uint n_workers = atomic_load(&run->n_workers);
+
+	// The captured FPS is not affected by our limit, it's the base for the FPS tiers
+	st->fps = (st->fps == 0 ? frames / dt : st->fps * 0.7 + (frames / dt) * 0.3);
+	const float load = (n_workers > 0 ? (ldf)busy / 1000000 / (n_workers * dt) : 0);
+	const float drops = (jobs > 0 ? (float)dropped / jobs : 0);
+
+	const float temp = _read_temp(gov->sysfs);
+	if (temp >= 0 && st->temp_prev >= 0) {
+		st->temp_slope = st->temp_slope * 0.8 + ((temp - st->temp_prev) / dt) * 0.2;
+	}
+	st->temp_prev = temp;
+	const float temp_predicted = (temp >= 0 ? temp + st->temp_slope * _HORIZON : -1);
+	const u32 throttled = _read_throttled(gov->sysfs);
+
+	// Step down ahead of the trip point while the temperature is rising,
+	// and don't wait for the next steps to take effect when it's already falling.
+	const bool hot = (
+		(temp >= 0 && temp_predicted >= gov->temp_high && (temp >= gov->temp_high || st->temp_slope > 0))
+		|| throttled != 0
+		|| load * 100 >= gov->load_high
+		|| (jobs >= 10 && drops >= 0.1)
+	);
+	const bool cool = (
+		!hot
+		&& (temp < 0 || temp <= gov->temp_low)
+		&& load * 100 <= gov->load_low
+		&& dropped == 0
+	);
+
+	const uint prev_level = st->level;
+	if (hot) {
+		st->cool_since_ts = 0;
+		if (st->level + 1 < run->n_tiers && now_ts - st->last_change_ts >= gov->down_delay) {
+			++st->level;
+		}
+	} else if (cool) {
+		if (st->cool_since_ts == 0) {
+			st->cool_since_ts = now_ts;
+		} else if (st->level > 0 && now_ts - st->cool_since_ts >= gov->up_delay) {
+			--st->level;
+			st->cool_since_ts = now_ts; // Each step up needs its own cool period
+		}
+	} else {
+		st->cool_since_ts = 0; // Between the thresholds: hold the level
+	}
+
+	const uint level = st->level;
+	const bool changed = (level != prev_level);
+	if (changed) {
+		st->last_change_ts = now_ts;
+		const us_governor_tier_s *const tier = &run->tiers[level];
+		_LOG_INFO("Level %u -> %u: quality=%u, fps=%u%%, resolution=%ux%u;"
+			" temp=%.1f, predicted=%.1f, throttled=0x%x, load=%.0f%%, drops=%.0f%%",
+			prev_level, level, tier->quality, tier->fps_percent, tier->width, tier->height,
+			temp, temp_predicted, throttled, load * 100, drops * 100);
+	}
+	_governor_apply(gov, enc, level, changed, st->fps);
+
+	US_MUTEX_LOCK(run->mutex);
+	us_governor_stats_s *const stats = &run->stats;
+	stats->level = level;
+	stats->n_levels = run->n_tiers;
+	stats->tier = run->tiers[level];
+	const u64 min_interval = atomic_load(&run->min_interval);
+	stats->fps_limit = (min_interval > 0 ? 1000000 / min_interval : 0);
+	stats->changes += changed;
+	stats->temp = temp;
+	stats->temp_slope = st->temp_slope;
+	stats->temp_predicted = temp_predicted;
+	stats->throttled = throttled;
+	stats->load = load;
+	stats->drops = drops;
+	stats->fps = st->fps;
+	stats->hot = hot;
+	stats->cool = cool;
+	US_MUTEX_UNLOCK(run->mutex);
+}
+
+static void _governor_apply(us_governor_s *gov, us_encoder_s *enc, uint level, bool changed, float fps) {
+	us_governor_runtime_s *const run = gov->run;
+	const us_governor_tier_s *const tier = &run->tiers[level];
+
+	if (changed) {
+		const us_governor_tier_s *const prev = &run->tiers[atomic_exchange(&run->level, level)];
+		us_encoder_set_quality_limit(enc, tier->quality);
+		if (prev->width != tier->width || prev->height != tier->height) {
+			atomic_store(&run->restart_level, level + 1);
+		}
+	}
+
+	// Recalculated every time because the captured FPS may change
+	u64 min_interval = 0;
+	if (tier->fps_percent < 100 && fps > 0) {
+		const uint limit = US_MAX(fps * tier->fps_percent / 100 + 0.5, gov->fps_min);
+		if (limit > 0 && limit < fps) {
+			min_interval = 1000000 / limit;
+		}
+	}
+	atomic_store(&run->min_interval, min_interval);
+}
+
+static float _read_temp(const char *sysfs) {
+	// The hottest one of all zones: the SoC usually has several sensors
+	char path[PATH_MAX];
+	US_SNPRINTF(path, PATH_MAX - 1, "%s/class/thermal", sysfs);
+	DIR *const dir = opendir(path);
+	if (dir == NULL) {
+		return -1;
+	}
+	float temp = -1;
+	const struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL) {
+		if (strncmp(ent->d_name, "thermal_zone", 12) != 0) {
+			continue;
+		}
+		US_SNPRINTF(path, PATH_MAX - 1, "%s/class/thermal/%s/temp", sysfs, ent->d_name);
+		long long value;
+		if (_read_number(path, 10, &value) == 0 && value > 0) {
+			temp = US_MAX(temp, (float)value / 1000); // Millidegrees
+		}
+	}
+	closedir(dir);
+	return temp;
+}
+
+static u32 _read_throttled(const char *sysfs) {
+	// Raspberry Pi: under-voltage, ARM frequency capped, throttled and soft temperature limit.
+	// The higher bits are the sticky "has occurred" ones, they are not interesting here.
+	char path[PATH_MAX];
+	US_SNPRINTF(path, PATH_MAX - 1, "%s/devices/platform/soc/soc:firmware/get_throttled", sysfs);
+	long long value;
+	if (_read_number(path, 16, &value) < 0) {
+		return 0;
+	}
+	return (u32)value & 0xF;
+}
+
+static int _read_number(const char *path, int base, long long *value) {
+	FILE *const fp = fopen(path, "r");
+	if (fp == NULL) {
+		return -1;
+	}
+	char line[64] = {0};
+	const bool ok = (fgets(line, 63, fp) != NULL);
+	fclose(fp);
+	if (!ok) {
+		return -1;
+	}
+	char *end = NULL;
+	*value = strtoll(line, &end, base);
+	return (end == line ? -1 : 0);
+}
+
+
+#ifdef TEST_GOVERNOR
+// Drives the levels by a fake sysfs through the hot, warm, cool and throttled
+// phases with the 1-second steps and checks the sequence of the levels.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_GOVERNOR -o governor-test ustreamer/governor.c ustreamer/encoder.c ustreamer/workers.c ustreamer/m2m.c ustreamer/encoders/cpu/encoder.c ustreamer/encoders/hw/encoder.c libs/frame.c libs/jpegtran.c libs/pixel.c libs/logging.c -ljpeg -lm -pthread
+
+#include <assert.h>
+
+#include <sys/stat.h>
+
+
+static void _write_file(const char *root, const char *name, const char *value) {
+	char path[PATH_MAX];
+	US_SNPRINTF(path, PATH_MAX - 1, "%s/%s", root, name);
+	FILE *const fp = fopen(path, "w");
+	assert(fp != NULL);
+	assert(fputs(value, fp) >= 0);
+	assert(!fclose(fp));
+}
+
+int main(void) {
+	US_LOGGING_INIT;
+
+	char root[] = "/tmp/.ustreamer-governor-test-XXXXXX";
+	assert(mkdtemp(root) != NULL);
+	char path[PATH_MAX];
+	const char *const dirs[] = {
+		"class", "class/thermal", "class/thermal/thermal_zone0",
+		"devices", "devices/platform", "devices/platform/soc", "devices/platform/soc/soc:firmware",
+	};
+	for (uint index = 0; index < US_ARRAY_LEN(dirs); ++index) {
+		US_SNPRINTF(path, PATH_MAX - 1, "%s/%s", root, dirs[index]);
+		assert(!mkdir(path, 0755));
+	}
+	const char *const temp_file = "class/thermal/thermal_zone0/temp";
+	const char *const throttled_file = "devices/platform/soc/soc:firmware/get_throttled";
+	_write_file(root, temp_file, "40000");
+
+	us_governor_s *const gov = us_governor_init();
+	us_encoder_s *const enc = us_encoder_init();
+	gov->enabled = true;
+	gov->sysfs = root;
+	gov->down_delay = 2;
+	gov->up_delay = 5;
+	assert(!us_governor_parse_resolutions(gov, "640x480"));
+	us_governor_prepare(gov, 80); // 0, 70, 60, 50, 75%, 50%, 33%, 25%, 640x480
+	assert(gov->run->n_tiers == 9);
+
+	const struct {
+		const char	*temp; // Millidegrees
+		const char	*throttled;
+		uint		seconds;
+	} phases[] = {
+		{"40000", "0x0", 10}, // Cool from the start: nothing to do
+		{"80000", "0x0", 20}, // Hot: all the way down by down_delay
+		{"70000", "0x0", 10}, // Between the thresholds: hold
+		{"50000", "0x0", 60}, // Cool: all the way up by up_delay
+		{"50000", "0x50005", 2}, // Under-voltage, the sticky bits are ignored
+	};
+	const uint expected[] = {1, 2, 3, 4, 5, 6, 7, 8, 7, 6, 5, 4, 3, 2, 1, 0, 1};
+
+	uint levels[64];
+	uint n_levels = 0;
+	uint last_level = 0;
+	bool restarted = false;
+	_state_s st = {.temp_prev = -1, .prev_ts = 1000};
+	ldf now_ts = 1000;
+	for (uint index = 0; index < US_ARRAY_LEN(phases); ++index) {
+		_write_file(root, temp_file, phases[index].temp);
+		_write_file(root, throttled_file, phases[index].throttled);
+		for (uint second = 0; second < phases[index].seconds; ++second) {
+			now_ts += 1;
+			atomic_store(&gov->run->frames, 30);
+			_governor_step(gov, enc, &st, now_ts);
+			if (st.level != last_level) {
+				assert(n_levels < US_ARRAY_LEN(levels));
+				levels[n_levels++] = st.level;
+				last_level = st.level;
+			}
+			restarted = (us_governor_take_restart(gov) || restarted);
+			if (index == 1 && second == phases[index].seconds - 1) {
+				// The bottom: the lowest quality, 25% of 30 fps but not below fps_min, and the resolution
+				assert(st.level == 8);
+				assert(enc->run->quality_limit == 50);
+				assert(atomic_load(&gov->run->min_interval) == 1000000 / gov->fps_min);
+				assert(restarted);
+			}
+		}
+	}
+
+	int retval = (n_levels != US_ARRAY_LEN(expected));
+	printf("Levels:");
+	for (uint index = 0; index < n_levels; ++index) {
+		printf(" %u", levels[index]);
+		if (index < US_ARRAY_LEN(expected) && levels[index] != expected[index]) {
+			retval = 1;
+		}
+	}
+	putchar('\n');
+	if (enc->run->quality_limit != 70 || atomic_load(&gov->run->min_interval) != 0) {
+		retval = 1; // The throttled step must be applied
+	}
+
+	US_SNPRINTF(path, PATH_MAX - 1, "rm -rf '%s'", root);
+	assert(!system(path));
+	us_encoder_destroy(enc);
+	us_governor_destroy(gov);
+	puts(retval == 0 ? "OK" : "FAILED");
+	return retval;
+}
+#endif
@@ -0,0 +1,137 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include "../libs/types.h"
+#include "../libs/capture.h"
+
+#include "encoder.h"
+
+
+#define US_GOVERNOR_MAX_RESOLUTIONS	4
+#define US_GOVERNOR_MAX_TIERS		32
+
+
+typedef struct {
+	uint	quality; // 0 means no limit
+	uint	fps_percent; // Of the captured FPS
+	uint	width; // 0 means the configured resolution
+	uint	height;
+} us_governor_tier_s;
+
+typedef struct {
+	uint				level;
+	uint				n_levels;
+	us_governor_tier_s	tier;
+	uint				fps_limit; // 0 means no limit
+	uint				changes;
+
+	float	temp; // Celsius, negative if unavailable
+	float	temp_slope; // Celsius per second
+	float	temp_predicted;
+	u32		throttled; // Raspberry Pi firmware flags, only the current ones
+	float	load; // Utilization of the JPEG workers, 0..1
+	float	drops; // Fraction of the encoded frames dropped as outdated
+	float	fps; // Captured
+	bool	hot;
+	bool	cool;
+} us_governor_stats_s;
+
+typedef struct {
+	atomic_ullong	busy; // Microseconds of the JPEG jobs
+	atomic_uint		jobs;
+	atomic_uint		dropped;
+	atomic_uint		n_workers;
+	atomic_uint		frames;
+
+	atomic_uint		level;
+	atomic_ullong	min_interval; // Microseconds between the frames to encode, 0 means no limit
+	atomic_uint		restart_level; // Pending resolution change, the level + 1
+	uint			base_width;
+	uint			base_height;
+
+	us_governor_tier_s	tiers[US_GOVERNOR_MAX_TIERS];
+	uint				n_tiers;
+
+	us_governor_stats_s	stats;
+	pthread_mutex_t		mutex; // For the stats
+
+	atomic_bool		stop;
+} us_governor_runtime_s;
+
+typedef struct {
+	bool		enabled;
+	const char	*sysfs; // The root, can be overridden for tests
+	uint		temp_high;
+	uint		temp_low;
+	uint		load_high; // Percents
+	uint		load_low;
+	uint		quality_min;
+	uint		fps_min;
+	uint		down_delay; // Seconds
+	uint		up_delay;
+
+	uint		n_resolutions;
+	uint		widths[US_GOVERNOR_MAX_RESOLUTIONS];
+	uint		heights[US_GOVERNOR_MAX_RESOLUTIONS];
+
+	us_governor_runtime_s	*run;
+} us_governor_s;
+
+
+us_governor_s *us_governor_init(void);
+void us_governor_destroy(us_governor_s *gov);
+
+int us_governor_parse_resolutions(us_governor_s *gov, const char *str);
+
+void us_governor_prepare(us_governor_s *gov, uint base_quality);
+void us_governor_loop(us_governor_s *gov, us_encoder_s *enc);
+void us_governor_loop_break(us_governor_s *gov);
+
+void us_governor_get_stats(us_governor_s *gov, us_governor_stats_s *stats);
+
+void us_governor_apply_resolution(us_governor_s *gov, us_capture_s *cap);
+bool us_governor_take_restart(us_governor_s *gov);
+
+
+static inline void us_governor_report_frame(us_governor_s *gov) {
+	atomic_fetch_add(&gov->run->frames, 1);
+}
+
+static inline void us_governor_report_job(us_governor_s *gov, ldf job_time, bool dropped, uint n_workers) {
+	atomic_fetch_add(&gov->run->busy, (u64)(job_time * 1000000));
+	atomic_fetch_add(&gov->run->jobs, 1);
+	if (dropped) {
+		atomic_fetch_add(&gov->run->dropped, 1);
+	}
+	atomic_store(&gov->run->n_workers, n_workers);
+}
+
+static inline ldf us_governor_get_min_interval(us_governor_s *gov) {
+	return (ldf)atomic_load(&gov->run->min_interval) / 1000000;
+}
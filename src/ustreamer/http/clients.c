@@ -0,0 +1,295 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "clients.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#ifdef TEST_HTTP_CLIENTS
+#	include <stdio.h>
+#	include <time.h>
+#endif
+
+#include "../../libs/types.h"
+#include "../../libs/tools.h"
+
+
+us_client_table_s *us_client_table_init(void) {
+	us_client_table_s *table;
+	US_CALLOC(table, 1);
+	return table;
+}
+
+void us_client_table_destroy(us_client_table_s *table) {
+	free(table->hot);
+	free(table);
+}
+
+bool us_client_table_add(
+	us_client_table_s *table, void *client, us_client_handle_s *handle,
+	struct bufferevent *buf_event, bool dual_final_frames) {
+
+	if (us_client_table_get(table, *handle) != NULL) {
+		return false;
+	}
+
+	if (table->count == table->capacity) {
+		table->capacity = US_MAX(table->capacity * 2, (uint)16);
+		assert((table->hot = realloc(table->hot, table->capacity * sizeof(us_client_hot_s))) != NULL);
+	}
+
+	++table->last_gen;
+	if (table->last_gen == 0) {
+		++table->last_gen; // Zero is never valid
+	}
+
+	const uint slot = table->count;
+	us_client_hot_s *const hot = &table->hot[slot];
+	US_MEMSET_ZERO(*hot);
+	hot->buf_event = buf_event;
+	hot->client = client;
+	hot->handle = handle;
+	hot->gen = table->last_gen;
+	hot->dual_final_frames = dual_final_frames;
+	hot->need_first_frame = true;
+	++table->count;
+
+	handle->slot = slot;
+	handle->gen = hot->gen;
+	return true;
+}
+
+us_client_hot_s *us_client_table_get(us_client_table_s *table, us_client_handle_s handle) {
+	if (handle.gen != 0 && handle.slot < table->count && table->hot[handle.slot].gen == handle.gen) {
+		return &table->hot[handle.slot];
+	}
+	return NULL;
+}
+
+static void _client_table_move_last(us_client_table_s *table, uint slot) {
+	--table->count;
+	if (slot < table->count) {
+		us_client_hot_s *const hot = &table->hot[slot];
+		*hot = table->hot[table->count];
+		hot->handle->slot = slot;
+	}
+}
+
+void us_client_table_remove(us_client_table_s *table, us_client_handle_s handle) {
+	us_client_hot_s *const hot = us_client_table_get(table, handle);
+	assert(hot != NULL);
+	if (table->walking) {
+		hot->buf_event = NULL;
+		hot->client = NULL;
+		hot->handle = NULL;
+		hot->gen = 0; // Invalidates the handle
+		++table->removed;
+	} else {
+		_client_table_move_last(table, handle.slot);
+	}
+}
+
+void us_client_table_begin_walk(us_client_table_s *table) {
+	assert(!table->walking);
+	table->walking = true;
+}
+
+void us_client_table_end_walk(us_client_table_s *table) {
+	assert(table->walking);
+	table->walking = false;
+	for (uint slot = table->count; table->removed > 0 && slot > 0; --slot) {
+		// Backwards, so the moved entry has been checked already
+		if (table->hot[slot - 1].client == NULL) {
+			_client_table_move_last(table, slot - 1);
+			--table->removed;
+		}
+	}
+	assert(table->removed == 0);
+}
+
+#ifdef TEST_HTTP_CLIENTS
+
+// Compares the fan-out walk over the table with the walk over a list
+// of separately allocated clients, as it was done before, and checks
+// the handles, the duplicates and the removals during the walk.
+//   $ cc -O2 -DTEST_HTTP_CLIENTS -I/usr/include ustreamer/http/clients.c -o /tmp/bench-clients
+
+typedef struct _node_s {
+	us_client_hot_s		hot;
+	us_client_handle_s	handle;
+	uint				visits;
+	u8					cold[1024]; // The rest of the client state
+	struct _node_s		*next;
+} _node_s;
+
+static ldf _now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ldf)ts.tv_sec + (ldf)ts.tv_nsec / 1000000000;
+}
+
+static int _check_handles(us_client_table_s *table) {
+	for (uint index = 0; index < table->count; ++index) {
+		_node_s *const node = table->hot[index].client;
+		if (node == NULL || us_client_table_get(table, node->handle) != &table->hot[index]) {
+			printf("FAILED: the handle of the slot %u is broken\n", index);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int _test_walk(us_client_table_s *table) {
+	// Removes the current client, the previous one and the last one
+	// on each 7th step, like the destroyed HTTP/2 session does.
+	// Every remaining client must be visited exactly once.
+	const uint count = table->count;
+	us_client_table_begin_walk(table);
+	for (uint index = 0; index < table->count; ++index) {
+		_node_s *const node = table->hot[index].client;
+		if (node == NULL) {
+			continue;
+		}
+		++node->visits;
+		if (index % 7 == 3) {
+			us_client_table_remove(table, node->handle);
+			node->visits = 0;
+			_node_s *const prev = table->hot[index - 1].client;
+			if (prev != NULL) {
+				us_client_table_remove(table, prev->handle);
+				prev->visits = 0;
+			}
+			_node_s *const last = table->hot[table->count - 1].client;
+			if (last != NULL) {
+				us_client_table_remove(table, last->handle);
+				last->visits = 0;
+			}
+		}
+	}
+	if (table->count != count) {
+		printf("FAILED: the table was changed during the walk\n");
+		return -1;
+	}
+	us_client_table_end_walk(table);
+
+	for (uint index = 0; index < table->count; ++index) {
+		_node_s *const node = table->hot[index].client;
+		if (node->visits != 1) {
+			printf("FAILED: the client was visited %u times\n", node->visits);
+			return -1;
+		}
+		node->visits = 0;
+	}
+	return _check_handles(table);
+}
+
+int main(void) {
+	int retval = 0;
+	const uint rounds = 2000;
+
+	printf("%8s %14s %14s\n", "clients", "list, ns/tick", "table, ns/tick");
+	for (uint n_clients = 1; n_clients <= 10000; n_clients *= 10) {
+		us_client_table_s *const table = us_client_table_init();
+		_node_s **const nodes = calloc(n_clients, sizeof(_node_s*));
+		_node_s *list = NULL;
+		void **garbage = calloc(n_clients, sizeof(void*));
+
+		for (uint index = 0; index < n_clients; ++index) {
+			_node_s *const node = calloc(1, sizeof(_node_s));
+			node->hot.dual_final_frames = (index & 1);
+			node->hot.need_first_frame = true;
+			node->next = list;
+			list = node;
+			nodes[index] = node;
+			garbage[index] = malloc(64 + (index * 37) % 512); // Other allocations of the server in between
+			assert(us_client_table_add(table, node, &node->handle, NULL, (index & 1)));
+		}
+
+		// Check the generation tags, the duplicates and the dense removal
+		if (us_client_table_add(table, nodes[n_clients - 1], &nodes[n_clients - 1]->handle, NULL, false)) {
+			printf("FAILED: the duplicate client was added\n");
+			retval = -1;
+		}
+		const us_client_handle_s first = nodes[0]->handle;
+		us_client_table_remove(table, first);
+		if (us_client_table_get(table, first) != NULL) {
+			printf("FAILED: the stale handle is still valid\n");
+			retval = -1;
+		}
+		if (table->count != n_clients - 1 || _check_handles(table) < 0) {
+			retval = -1;
+		}
+		assert(us_client_table_add(table, nodes[0], &nodes[0]->handle, NULL, false));
+		if (us_client_table_get(table, first) != NULL || _check_handles(table) < 0) {
+			printf("FAILED: the stale handle is valid after the re-adding\n");
+			retval = -1;
+		}
+
+		uint sent_list = 0;
+		uint sent_table = 0;
+
+		ldf begin_ts = _now();
+		for (uint round = 0; round < rounds; ++round) {
+			for (_node_s *node = list; node != NULL; node = node->next) {
+				sent_list += us_client_table_need_send(&node->hot, true, true, (round & 1));
+			}
+		}
+		const ldf list_time = _now() - begin_ts;
+
+		begin_ts = _now();
+		for (uint round = 0; round < rounds; ++round) {
+			for (uint index = 0; index < table->count; ++index) {
+				sent_table += us_client_table_need_send(&table->hot[index], true, true, (round & 1));
+			}
+		}
+		const ldf table_time = _now() - begin_ts;
+
+		printf("%8u %14.0Lf %14.0Lf\n", n_clients, list_time * 1000000000 / rounds, table_time * 1000000000 / rounds);
+		if (sent_list != sent_table) {
+			printf("FAILED: sent %u vs %u\n", sent_list, sent_table);
+			retval = -1;
+		}
+		if (_test_walk(table) < 0) {
+			retval = -1;
+		}
+
+		while (list != NULL) {
+			_node_s *const next = list->next;
+			free(list);
+			list = next;
+		}
+		for (uint index = 0; index < n_clients; ++index) {
+			free(garbage[index]);
+		}
+		free(garbage);
+		free(nodes);
+		us_client_table_destroy(table);
+	}
+
+	if (retval < 0) {
+		printf("===== TEST FAILED =====\n");
+	}
+	return retval;
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include <event2/bufferevent.h>
+
+#include "../../libs/types.h"
+
+
+typedef struct {
+	uint	slot;
+	u32		gen;
+} us_client_handle_s;
+
+// Hot per-client state of the MJPEG fan-out. It's stored contiguously,
+// so the walk on each refresher tick is linear and doesn't touch
+// the cold state (request, key, hostport, fpsi, etc.).
+typedef struct {
+	struct bufferevent	*buf_event;
+	void				*client; // Cold state, NULL if removed during the walk
+	us_client_handle_s	*handle; // Stored in the cold state, follows the moves
+	u32					gen;
+
+	bool				dual_final_frames;
+	bool				need_first_frame;
+	bool				updated_prev;
+} us_client_hot_s;
+
+typedef struct {
+	us_client_hot_s	*hot;
+	uint			count;
+	uint			capacity;
+	u32				last_gen;
+
+	bool			walking;
+	uint			removed;
+} us_client_table_s;
+
+
+us_client_table_s *us_client_table_init(void);
+void us_client_table_destroy(us_client_table_s *table);
+
+// Returns false if the handle already refers to a client in the table.
+bool us_client_table_add(
+	us_client_table_s *table, void *client, us_client_handle_s *handle,
+	struct bufferevent *buf_event, bool dual_final_frames);
+us_client_hot_s *us_client_table_get(us_client_table_s *table, us_client_handle_s handle);
+
+// The last entry is moved into the freed slot to keep the table dense,
+// and the handle of the moved client is updated.
+void us_client_table_remove(us_client_table_s *table, us_client_handle_s handle);
+
+// A send callback may destroy any client synchronously (HTTP/2 session),
+// so during the walk the removed entries are only cleared and skipped,
+// and the table is compacted after it. Otherwise the client moved
+// into the current or an already visited slot would be skipped.
+void us_client_table_begin_walk(us_client_table_s *table);
+void us_client_table_end_walk(us_client_table_s *table);
+
+static inline uint us_client_table_get_alive(const us_client_table_s *table) {
+	return table->count - table->removed;
+}
+
+
+static inline bool us_client_table_need_send(
+	us_client_hot_s *hot, bool drop_same_frames, bool stream_updated, bool frame_updated) {
+
+	// Фикс для бага WebKit. При включенной опции дропа одинаковых фреймов,
+	// WebKit отрисовывает последний фрейм в серии с некоторой задержкой,
+	// и нужно послать два фрейма, чтобы серия была вовремя завершена.
+	// Это похоже на баг Blink (см. _http_callback_stream_write() и advance_headers),
+	// но фикс для него не лечит проблему вебкита. Такие дела.
+
+	const bool dual_update = (
+		drop_same_frames
+		&& hot->dual_final_frames
+		&& stream_updated
+		&& hot->updated_prev
+		&& !frame_updated
+	);
+
+	if (dual_update || frame_updated || hot->need_first_frame) {
+		hot->need_first_frame = false;
+		hot->updated_prev = (frame_updated || hot->need_first_frame); // Игнорировать dual
+		return true;
+	} else if (stream_updated) { // Для dual
+		hot->updated_prev = false;
+	}
+	return false;
+}
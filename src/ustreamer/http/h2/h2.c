@@ -0,0 +1,623 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "h2.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include <sys/socket.h>
+#include <sys/queue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <event2/util.h>
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/listener.h>
+#include <event2/bufferevent.h>
+#include <event2/http.h>
+#include <event2/keyvalq_struct.h>
+
+#include <nghttp2/nghttp2.h>
+
+#include "../../../libs/types.h"
+#include "../../../libs/tools.h"
+#include "../../../libs/logging.h"
+#include "../../../libs/list.h"
+
+
+// Не даем nghttp2 складывать в сокет больше этого, остальное ждет в потоках,
+// чтобы медленное соединение пропускало фреймы вместо накопления очереди.
+#define _OUTPUT_WATERMARK (128 * 1024)
+
+
+static void _h2_accept_callback(
+	struct evconnlistener *listener, evutil_socket_t fd,
+	struct sockaddr *addr, int addr_len, void *v_h2);
+
+static void _h2_read_callback(struct bufferevent *bev, void *v_sess);
+static void _h2_write_callback(struct bufferevent *bev, void *v_sess);
+static void _h2_event_callback(struct bufferevent *bev, short what, void *v_sess);
+
+static sz _h2_send_callback(nghttp2_session *session, const u8 *data, uz length, int flags, void *v_sess);
+static int _h2_send_data_callback(
+	nghttp2_session *session, nghttp2_frame *frame, const u8 *frame_hd, uz length,
+	nghttp2_data_source *source, void *v_sess);
+static sz _h2_data_source_read_callback(
+	nghttp2_session *session, s32 stream_id, u8 *buf, uz length,
+	u32 *data_flags, nghttp2_data_source *source, void *v_sess);
+static int _h2_on_begin_headers_callback(nghttp2_session *session, const nghttp2_frame *frame, void *v_sess);
+static int _h2_on_header_callback(
+	nghttp2_session *session, const nghttp2_frame *frame,
+	const u8 *name, uz name_len, const u8 *value, uz value_len,
+	u8 flags, void *v_sess);
+static int _h2_on_frame_recv_callback(nghttp2_session *session, const nghttp2_frame *frame, void *v_sess);
+static int _h2_on_stream_close_callback(nghttp2_session *session, s32 stream_id, u32 error_code, void *v_sess);
+
+static void _h2_session_enter(us_h2_session_s *sess);
+static void _h2_session_leave(us_h2_session_s *sess);
+static void _h2_session_flush(us_h2_session_s *sess);
+static void _h2_session_destroy(us_h2_session_s *sess);
+
+static us_h2_stream_s *_h2_stream_init(us_h2_session_s *sess, s32 id);
+static void _h2_stream_destroy(us_h2_stream_s *stream);
+static void _h2_stream_submit_response(us_h2_stream_s *stream, int code, bool has_body);
+
+
+#define _LOG_ERROR(x_msg, ...)	US_LOG_ERROR("HTTP/2: " x_msg, ##__VA_ARGS__)
+#define _LOG_PERROR(x_msg, ...)	US_LOG_PERROR("HTTP/2: " x_msg, ##__VA_ARGS__)
+#define _LOG_INFO(x_msg, ...)		US_LOG_INFO("HTTP/2: " x_msg, ##__VA_ARGS__)
+#define _LOG_VERBOSE(x_msg, ...)	US_LOG_VERBOSE("HTTP/2: " x_msg, ##__VA_ARGS__)
+#define _LOG_DEBUG(x_msg, ...)	US_LOG_DEBUG("HTTP/2: " x_msg, ##__VA_ARGS__)
+
+
+us_h2_s *us_h2_init(struct event_base *base, us_h2_stream_f request_cb, void *request_arg) {
+	us_h2_s *h2;
+	US_CALLOC(h2, 1);
+	h2->base = base;
+	h2->request_cb = request_cb;
+	h2->request_arg = request_arg;
+	return h2;
+}
+
+void us_h2_destroy(us_h2_s *h2) {
+	US_DELETE(h2->listener, evconnlistener_free);
+	US_LIST_ITERATE(h2->sessions, sess, { // cppcheck-suppress constStatement
+		_h2_session_destroy(sess);
+	});
+	free(h2);
+}
+
+int us_h2_listen(us_h2_s *h2, const char *host, uint port) {
+	struct evutil_addrinfo hints = {0};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = EVUTIL_AI_PASSIVE | EVUTIL_AI_ADDRCONFIG;
+
+	char port_str[16];
+	US_SNPRINTF(port_str, 15, "%u", port);
+
+	struct evutil_addrinfo *ai = NULL;
+	const int err = evutil_getaddrinfo(host, port_str, &hints, &ai);
+	if (err != 0) {
+		_LOG_ERROR("Can't resolve [%s]:%u: %s", host, port, evutil_gai_strerror(err));
+		return -1;
+	}
+	h2->listener = evconnlistener_new_bind(
+		h2->base, _h2_accept_callback, (void*)h2,
+		LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1,
+		ai->ai_addr, ai->ai_addrlen);
+	evutil_freeaddrinfo(ai);
+	if (h2->listener == NULL) {
+		_LOG_PERROR("Can't bind HTTP/2 on [%s]:%u", host, port);
+		return -1;
+	}
+	return 0;
+}
+
+enum evhttp_cmd_type us_h2_stream_get_command(const us_h2_stream_s *stream) {
+	return stream->command;
+}
+
+const char *us_h2_stream_get_uri(const us_h2_stream_s *stream) {
+	return stream->uri;
+}
+
+struct evkeyvalq *us_h2_stream_get_input_headers(us_h2_stream_s *stream) {
+	return &stream->input_headers;
+}
+
+struct evkeyvalq *us_h2_stream_get_output_headers(us_h2_stream_s *stream) {
+	return &stream->output_headers;
+}
+
+char *us_h2_stream_get_hostport(us_h2_stream_s *stream) {
+	char *addr;
+	const char *const xff = evhttp_find_header(&stream->input_headers, "X-Forwarded-For");
+	if (xff != NULL) {
+		assert((addr = strndup(xff, 1024)) != NULL);
+		for (uint index = 0; addr[index]; ++index) {
+			if (addr[index] == ',') {
+				addr[index] = '\0';
+				break;
+			}
+		}
+	} else {
+		addr = us_strdup(stream->session->addr);
+	}
+
+	char *hostport;
+	US_ASPRINTF(hostport, "[%s]:%u", addr, stream->session->port);
+	free(addr);
+	return hostport;
+}
+
+void us_h2_stream_setcb(us_h2_stream_s *stream, us_h2_stream_f write_cb, us_h2_stream_f close_cb, void *arg) {
+	stream->write_cb = write_cb;
+	stream->close_cb = close_cb;
+	stream->cb_arg = arg;
+}
+
+void us_h2_stream_enable_write(us_h2_stream_s *stream) {
+	us_h2_session_s *const sess = stream->session;
+	stream->want_write = true;
+	_h2_session_enter(sess);
+	_h2_session_flush(sess);
+	_h2_session_leave(sess);
+}
+
+void us_h2_stream_send_reply(us_h2_stream_s *stream, int code, struct evbuffer *buf) {
+	us_h2_session_s *const sess = stream->session;
+	if (buf != NULL) {
+		assert(!evbuffer_add_buffer(stream->out, buf));
+	}
+	stream->finished = true;
+	_h2_session_enter(sess);
+	_h2_stream_submit_response(stream, code, (evbuffer_get_length(stream->out) > 0));
+	_h2_session_flush(sess);
+	_h2_session_leave(sess);
+}
+
+void us_h2_stream_send_reply_start(us_h2_stream_s *stream, int code) {
+	us_h2_session_s *const sess = stream->session;
+	_h2_session_enter(sess);
+	_h2_stream_submit_response(stream, code, true);
+	_h2_session_flush(sess);
+	_h2_session_leave(sess);
+}
+
+void us_h2_stream_send_reply_chunk(us_h2_stream_s *stream, struct evbuffer *buf) {
+	us_h2_session_s *const sess = stream->session;
+	assert(stream->replied);
+	assert(!evbuffer_add_buffer(stream->out, buf));
+	_h2_session_enter(sess);
+	if (stream->deferred) {
+		stream->deferred = false;
+		nghttp2_session_resume_data(sess->session, stream->id);
+	}
+	_h2_session_flush(sess);
+	_h2_session_leave(sess);
+}
+
+static void _h2_accept_callback(
+	struct evconnlistener *listener, evutil_socket_t fd,
+	struct sockaddr *addr, int addr_len, void *v_h2) {
+
+	(void)addr_len;
+	us_h2_s *const h2 = v_h2;
+
+	// HTTP/2 мультиплексирует мелкие фреймы в одном соединении, Нейгл тут только мешает
+	int on = 1;
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void*)&on, sizeof(on)) != 0) {
+		_LOG_PERROR("Can't set TCP_NODELAY");
+	}
+
+	us_h2_session_s *sess;
+	US_CALLOC(sess, 1);
+	sess->h2 = h2;
+
+	{
+		char addr_str[64] = "???";
+		if (addr->sa_family == AF_INET) {
+			const struct sockaddr_in *const sin = (const struct sockaddr_in*)addr;
+			evutil_inet_ntop(AF_INET, &sin->sin_addr, addr_str, sizeof(addr_str));
+			sess->port = ntohs(sin->sin_port);
+		} else if (addr->sa_family == AF_INET6) {
+			const struct sockaddr_in6 *const sin6 = (const struct sockaddr_in6*)addr;
+			evutil_inet_ntop(AF_INET6, &sin6->sin6_addr, addr_str, sizeof(addr_str));
+			sess->port = ntohs(sin6->sin6_port);
+		}
+		sess->addr = us_strdup(addr_str);
+	}
+
+	assert((sess->bev = bufferevent_socket_new(
+		evconnlistener_get_base(listener), fd, BEV_OPT_CLOSE_ON_FREE)) != NULL);
+
+	{
+		nghttp2_session_callbacks *callbacks;
+		assert(!nghttp2_session_callbacks_new(&callbacks));
+		nghttp2_session_callbacks_set_send_callback(callbacks, _h2_send_callback);
+		nghttp2_session_callbacks_set_send_data_callback(callbacks, _h2_send_data_callback);
+		nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, _h2_on_begin_headers_callback);
+		nghttp2_session_callbacks_set_on_header_callback(callbacks, _h2_on_header_callback);
+		nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, _h2_on_frame_recv_callback);
+		nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, _h2_on_stream_close_callback);
+		assert(!nghttp2_session_server_new(&sess->session, callbacks, sess));
+		nghttp2_session_callbacks_del(callbacks);
+	}
+
+	{
+		const nghttp2_settings_entry settings[] = {
+			{NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 100},
+		};
+		assert(!nghttp2_submit_settings(sess->session, NGHTTP2_FLAG_NONE, settings, 1));
+	}
+
+	US_LIST_APPEND(h2->sessions, sess);
+	_LOG_VERBOSE("NEW session: [%s]:%u", sess->addr, sess->port);
+
+	bufferevent_setcb(sess->bev, _h2_read_callback, _h2_write_callback, _h2_event_callback, (void*)sess);
+	bufferevent_enable(sess->bev, EV_READ | EV_WRITE);
+
+	_h2_session_enter(sess);
+	_h2_session_flush(sess);
+	_h2_session_leave(sess);
+}
+
+static void _h2_read_callback(struct bufferevent *bev, void *v_sess) {
+	us_h2_session_s *const sess = v_sess;
+	_h2_session_enter(sess);
+	if (!sess->closing) {
+		struct evbuffer *const in = bufferevent_get_input(bev);
+		const uz size = evbuffer_get_length(in);
+		// Из колбеков nghttp2 отправлять нельзя, все ответы уйдут во flush ниже
+		sess->flushing = true;
+		const sz recvd = nghttp2_session_mem_recv(sess->session, evbuffer_pullup(in, -1), size);
+		sess->flushing = false;
+		if (recvd < 0) {
+			_LOG_ERROR("Can't process [%s]:%u: %s", sess->addr, sess->port, nghttp2_strerror(recvd));
+			sess->closing = true;
+			sess->broken = true;
+		} else {
+			evbuffer_drain(in, recvd);
+			_h2_session_flush(sess);
+		}
+	}
+	_h2_session_leave(sess);
+}
+
+static void _h2_write_callback(struct bufferevent *bev, void *v_sess) {
+	(void)bev;
+	us_h2_session_s *const sess = v_sess;
+	_h2_session_enter(sess);
+	if (!sess->closing) {
+		_h2_session_flush(sess);
+	}
+	_h2_session_leave(sess);
+}
+
+static void _h2_event_callback(struct bufferevent *bev, short what, void *v_sess) {
+	(void)bev;
+	us_h2_session_s *const sess = v_sess;
+	if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR | BEV_EVENT_TIMEOUT)) {
+		_h2_session_enter(sess);
+		sess->closing = true;
+		sess->broken = true;
+		_h2_session_leave(sess);
+	}
+}
+
+static sz _h2_send_callback(nghttp2_session *session, const u8 *data, uz length, int flags, void *v_sess) {
+	(void)session;
+	(void)flags;
+	us_h2_session_s *const sess = v_sess;
+	struct evbuffer *const out = bufferevent_get_output(sess->bev);
+	if (evbuffer_get_length(out) >= _OUTPUT_WATERMARK) {
+		return NGHTTP2_ERR_WOULDBLOCK;
+	}
+	if (evbuffer_add(out, data, length) < 0) {
+		return NGHTTP2_ERR_CALLBACK_FAILURE;
+	}
+	return length;
+}
+
+static int _h2_send_data_callback(
+	nghttp2_session *session, nghttp2_frame *frame, const u8 *frame_hd, uz length,
+	nghttp2_data_source *source, void *v_sess) {
+
+	// DATA перекладывается из буфера потока в сокет без промежуточной копии в nghttp2
+	(void)session;
+	us_h2_session_s *const sess = v_sess;
+	us_h2_stream_s *const stream = source->ptr;
+	struct evbuffer *const out = bufferevent_get_output(sess->bev);
+
+	if (evbuffer_get_length(out) >= _OUTPUT_WATERMARK) {
+		return NGHTTP2_ERR_WOULDBLOCK;
+	}
+
+	assert(!evbuffer_add(out, frame_hd, 9));
+	const uz padlen = frame->data.padlen;
+	if (padlen > 0) {
+		const u8 padlen_byte = padlen - 1;
+		assert(!evbuffer_add(out, &padlen_byte, 1));
+	}
+	assert(evbuffer_remove_buffer(stream->out, out, length) == (int)length);
+	if (padlen > 1) {
+		u8 pad[256] = {0};
+		assert(!evbuffer_add(out, pad, padlen - 1));
+	}
+	return 0;
+}
+
+static sz _h2_data_source_read_callback(
+	nghttp2_session *session, s32 stream_id, u8 *buf, uz length,
+	u32 *data_flags, nghttp2_data_source *source, void *v_sess) {
+
+	(void)session;
+	(void)stream_id;
+	(void)buf;
+	(void)v_sess;
+	us_h2_stream_s *const stream = source->ptr;
+
+	const uz avail = evbuffer_get_length(stream->out);
+	if (avail == 0 && !stream->finished) {
+		// Данные будут позже, поток возобновится в us_h2_stream_send_reply_chunk()
+		stream->deferred = true;
+		return NGHTTP2_ERR_DEFERRED;
+	}
+
+	const uz size = US_MIN(avail, length);
+	*data_flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+	if (stream->finished && size == avail) {
+		*data_flags |= NGHTTP2_DATA_FLAG_EOF;
+	}
+	return size;
+}
+
+static int _h2_on_begin_headers_callback(nghttp2_session *session, const nghttp2_frame *frame, void *v_sess) {
+	if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+		us_h2_stream_s *const stream = _h2_stream_init(v_sess, frame->hd.stream_id);
+		nghttp2_session_set_stream_user_data(session, frame->hd.stream_id, stream);
+	}
+	return 0;
+}
+
+static int _h2_on_header_callback(
+	nghttp2_session *session, const nghttp2_frame *frame,
+	const u8 *name, uz name_len, const u8 *value, uz value_len,
+	u8 flags, void *v_sess) {
+
+	(void)flags;
+	(void)v_sess;
+
+	if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST) {
+		return 0;
+	}
+	us_h2_stream_s *const stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+	if (stream == NULL) {
+		return 0;
+	}
+
+	char *const key = strndup((const char*)name, name_len);
+	char *const str = strndup((const char*)value, value_len);
+	assert(key != NULL);
+	assert(str != NULL);
+
+	if (!strcmp(key, ":method")) {
+		if (!strcmp(str, "GET")) {
+			stream->command = EVHTTP_REQ_GET;
+		} else if (!strcmp(str, "HEAD")) {
+			stream->command = EVHTTP_REQ_HEAD;
+		} else if (!strcmp(str, "OPTIONS")) {
+			stream->command = EVHTTP_REQ_OPTIONS;
+		}
+	} else if (!strcmp(key, ":path")) {
+		US_DELETE(stream->uri, free);
+		stream->uri = us_strdup(str);
+	} else if (!strcmp(key, ":authority")) {
+		evhttp_add_header(&stream->input_headers, "Host", str);
+	} else if (key[0] != ':') {
+		evhttp_add_header(&stream->input_headers, key, str);
+	}
+
+	free(str);
+	free(key);
+	return 0;
+}
+
+static int _h2_on_frame_recv_callback(nghttp2_session *session, const nghttp2_frame *frame, void *v_sess) {
+	us_h2_session_s *const sess = v_sess;
+
+	if (
+		(frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA)
+		|| !(frame->hd.flags & NGHTTP2_FLAG_END_STREAM)
+	) {
+		return 0;
+	}
+	us_h2_stream_s *const stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+	if (stream == NULL || stream->requested) {
+		return 0;
+	}
+	stream->requested = true;
+
+	if (stream->uri == NULL) {
+		us_h2_stream_send_reply(stream, HTTP_BADREQUEST, NULL);
+	} else if ((int)stream->command == 0) {
+		us_h2_stream_send_reply(stream, HTTP_BADMETHOD, NULL);
+	} else {
+		sess->h2->request_cb(stream, sess->h2->request_arg);
+	}
+	return 0;
+}
+
+static int _h2_on_stream_close_callback(nghttp2_session *session, s32 stream_id, u32 error_code, void *v_sess) {
+	(void)error_code;
+	(void)v_sess;
+	us_h2_stream_s *const stream = nghttp2_session_get_stream_user_data(session, stream_id);
+	if (stream != NULL) {
+		nghttp2_session_set_stream_user_data(session, stream_id, NULL);
+		_h2_stream_destroy(stream);
+	}
+	return 0;
+}
+
+static void _h2_session_enter(us_h2_session_s *sess) {
+	++sess->depth;
+}
+
+static void _h2_session_leave(us_h2_session_s *sess) {
+	assert(sess->depth > 0);
+	--sess->depth;
+	if (sess->depth == 0 && sess->closing) {
+		// GOAWAY и хвосты ответов должны уйти в сокет перед закрытием
+		if (sess->broken || evbuffer_get_length(bufferevent_get_output(sess->bev)) == 0) {
+			_h2_session_destroy(sess);
+		} else {
+			bufferevent_disable(sess->bev, EV_READ);
+		}
+	}
+}
+
+static void _h2_session_flush(us_h2_session_s *sess) {
+	if (sess->flushing) {
+		sess->need_flush = true;
+		return;
+	}
+	sess->flushing = true;
+	do {
+		sess->need_flush = false;
+		const int err = nghttp2_session_send(sess->session);
+		if (err != 0) {
+			_LOG_ERROR("Can't send to [%s]:%u: %s", sess->addr, sess->port, nghttp2_strerror(err));
+			sess->closing = true;
+			sess->broken = true;
+			break;
+		}
+		US_LIST_ITERATE(sess->streams, stream, { // cppcheck-suppress constStatement
+			if (stream->want_write && evbuffer_get_length(stream->out) == 0) {
+				stream->want_write = false;
+				if (stream->write_cb != NULL) {
+					stream->write_cb(stream, stream->cb_arg);
+				}
+			}
+		});
+	} while (sess->need_flush);
+	sess->flushing = false;
+
+	if (!nghttp2_session_want_read(sess->session) && !nghttp2_session_want_write(sess->session)) {
+		sess->closing = true;
+	}
+}
+
+static void _h2_session_destroy(us_h2_session_s *sess) {
+	_LOG_VERBOSE("DEL session: [%s]:%u", sess->addr, sess->port);
+	US_LIST_ITERATE(sess->streams, stream, { // cppcheck-suppress constStatement
+		nghttp2_session_set_stream_user_data(sess->session, stream->id, NULL);
+		_h2_stream_destroy(stream);
+	});
+	nghttp2_session_del(sess->session);
+	bufferevent_free(sess->bev);
+	US_LIST_REMOVE(sess->h2->sessions, sess);
+	free(sess->addr);
+	free(sess);
+}
+
+static us_h2_stream_s *_h2_stream_init(us_h2_session_s *sess, s32 id) {
+	us_h2_stream_s *stream;
+	US_CALLOC(stream, 1);
+	stream->session = sess;
+	stream->id = id;
+	TAILQ_INIT(&stream->input_headers);
+	TAILQ_INIT(&stream->output_headers);
+	assert((stream->out = evbuffer_new()) != NULL);
+	US_LIST_APPEND(sess->streams, stream);
+	return stream;
+}
+
+static void _h2_stream_destroy(us_h2_stream_s *stream) {
+	if (stream->close_cb != NULL) {
+		stream->close_cb(stream, stream->cb_arg);
+	}
+	US_LIST_REMOVE(stream->session->streams, stream);
+	evhttp_clear_headers(&stream->input_headers);
+	evhttp_clear_headers(&stream->output_headers);
+	evbuffer_free(stream->out);
+	US_DELETE(stream->uri, free);
+	free(stream);
+}
+
+static void _h2_stream_submit_response(us_h2_stream_s *stream, int code, bool has_body) {
+	assert(!stream->replied);
+	stream->replied = true;
+
+	uint count = 1;
+	const struct evkeyval *header;
+	TAILQ_FOREACH(header, &stream->output_headers, next) {
+		++count;
+	}
+
+	nghttp2_nv *nva;
+	US_CALLOC(nva, count);
+
+	char status[8];
+	US_SNPRINTF(status, 7, "%d", code);
+	nva[0].name = (u8*)":status";
+	nva[0].namelen = 7;
+	nva[0].value = (u8*)status;
+	nva[0].valuelen = strlen(status);
+
+	// В HTTP/2 имена заголовков только в нижнем регистре
+	uint index = 1;
+	TAILQ_FOREACH(header, &stream->output_headers, next) {
+		char *const name = us_strdup(header->key);
+		for (char *ch = name; *ch != '\0'; ++ch) {
+			*ch = tolower(*ch);
+		}
+		nva[index].name = (u8*)name;
+		nva[index].namelen = strlen(name);
+		nva[index].value = (u8*)header->value;
+		nva[index].valuelen = strlen(header->value);
+		++index;
+	}
+
+	nghttp2_data_provider provider = {0};
+	provider.source.ptr = stream;
+	provider.read_callback = _h2_data_source_read_callback;
+
+	const int err = nghttp2_submit_response(
+		stream->session->session, stream->id,
+		nva, count, (has_body ? &provider : NULL));
+	if (err != 0) {
+		_LOG_ERROR("Can't submit response to [%s]:%u: %s",
+			stream->session->addr, stream->session->port, nghttp2_strerror(err));
+	}
+
+	for (index = 1; index < count; ++index) {
+		free(nva[index].name);
+	}
+	free(nva);
+}
@@ -0,0 +1,114 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/listener.h>
+#include <event2/bufferevent.h>
+#include <event2/http.h>
+#include <event2/keyvalq_struct.h>
+
+#include <nghttp2/nghttp2.h>
+
+#include "../../../libs/types.h"
+#include "../../../libs/list.h"
+
+
+typedef struct us_h2_stream_sx us_h2_stream_s;
+
+typedef void (*us_h2_stream_f)(us_h2_stream_s *stream, void *arg);
+
+typedef struct us_h2_session_sx {
+	struct us_h2_sx		*h2;
+	struct bufferevent	*bev;
+	nghttp2_session		*session;
+	char				*addr;
+	u16					port;
+
+	us_h2_stream_s		*streams;
+
+	uint	depth; // Nesting of the callbacks, the session is destroyed only at the top
+	bool	flushing;
+	bool	need_flush;
+	bool	closing;
+	bool	broken;
+
+	US_LIST_DECLARE;
+} us_h2_session_s;
+
+struct us_h2_stream_sx {
+	us_h2_session_s		*session;
+	s32					id;
+
+	enum evhttp_cmd_type	command;
+	char					*uri;
+	struct evkeyvalq		input_headers;
+	struct evkeyvalq		output_headers;
+
+	struct evbuffer		*out; // DATA which is not taken by nghttp2 yet
+	bool				requested;
+	bool				replied;
+	bool				finished;
+	bool				deferred;
+	bool				want_write;
+
+	us_h2_stream_f		write_cb;
+	us_h2_stream_f		close_cb;
+	void				*cb_arg;
+
+	US_LIST_DECLARE;
+};
+
+typedef struct us_h2_sx {
+	struct event_base		*base;
+	struct evconnlistener	*listener;
+
+	us_h2_stream_f	request_cb;
+	void			*request_arg;
+
+	us_h2_session_s	*sessions;
+} us_h2_s;
+
+
+us_h2_s *us_h2_init(struct event_base *base, us_h2_stream_f request_cb, void *request_arg);
+void us_h2_destroy(us_h2_s *h2);
+
+int us_h2_listen(us_h2_s *h2, const char *host, uint port);
+
+enum evhttp_cmd_type us_h2_stream_get_command(const us_h2_stream_s *stream);
+const char *us_h2_stream_get_uri(const us_h2_stream_s *stream);
+struct evkeyvalq *us_h2_stream_get_input_headers(us_h2_stream_s *stream);
+struct evkeyvalq *us_h2_stream_get_output_headers(us_h2_stream_s *stream);
+char *us_h2_stream_get_hostport(us_h2_stream_s *stream);
+
+// Like bufferevent: the write callback is called once, when the stream
+// has nothing to send after us_h2_stream_enable_write(). The close callback
+// is called when the stream is closed by the peer or with the whole session.
+void us_h2_stream_setcb(us_h2_stream_s *stream, us_h2_stream_f write_cb, us_h2_stream_f close_cb, void *arg);
+void us_h2_stream_enable_write(us_h2_stream_s *stream);
+
+void us_h2_stream_send_reply(us_h2_stream_s *stream, int code, struct evbuffer *buf);
+void us_h2_stream_send_reply_start(us_h2_stream_s *stream, int code);
+void us_h2_stream_send_reply_chunk(us_h2_stream_s *stream, struct evbuffer *buf);
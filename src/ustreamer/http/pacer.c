@@ -0,0 +1,272 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "pacer.h"
+
+#include <math.h>
+
+#include "../../libs/types.h"
+#include "../../libs/tools.h"
+#include "../../libs/frame.h"
+
+
+#define _CAPACITY		8
+#define _MAX_TRANSIT	((ldf)5) // The timestamps are not monotonic otherwise
+
+
+static void _update_jitter(ldf *jitter, ldf arrival_interval, ldf grab_interval);
+
+
+us_pacer_s *us_pacer_init(ldf max_delay) {
+	us_pacer_s *pacer;
+	US_CALLOC(pacer, 1);
+	pacer->max_delay = max_delay;
+	pacer->capacity = _CAPACITY;
+	US_CALLOC(pacer->frames, pacer->capacity);
+	US_CALLOC(pacer->release_ts, pacer->capacity);
+	for (uint index = 0; index < pacer->capacity; ++index) {
+		pacer->frames[index] = us_frame_init();
+	}
+	return pacer;
+}
+
+void us_pacer_destroy(us_pacer_s *pacer) {
+	for (uint index = 0; index < pacer->capacity; ++index) {
+		us_frame_destroy(pacer->frames[index]);
+	}
+	free(pacer->release_ts);
+	free(pacer->frames);
+	free(pacer);
+}
+
+void us_pacer_put(us_pacer_s *pacer, const us_frame_s *frame, ldf now_ts) {
+	us_pacer_stats_s *const stats = &pacer->stats;
+
+	if (pacer->prev_put_ts > 0) {
+		_update_jitter(&stats->jitter_in, now_ts - pacer->prev_put_ts, frame->grab_ts - pacer->prev_put_grab_ts);
+	}
+	pacer->prev_put_ts = now_ts;
+	pacer->prev_put_grab_ts = frame->grab_ts;
+
+	if (frame->grab_ts <= pacer->last_grab_ts) {
+		++stats->dropped; // Reordered by the workers, the newer one has been taken already
+		return;
+	}
+	pacer->last_grab_ts = frame->grab_ts;
+
+	ldf release_ts = now_ts;
+	const ldf transit = now_ts - frame->grab_ts;
+	if (transit >= 0 && transit < _MAX_TRANSIT) {
+		// The adaptive playout delay: the budget covers the most of the transit
+		// time variations. It grows fast to stop the stutter and shrinks slowly
+		// to not make it again on the next spike.
+		if (pacer->transit_avg == 0) {
+			pacer->transit_avg = transit;
+			stats->delay = US_MIN(transit, pacer->max_delay);
+		}
+		pacer->transit_avg += (transit - pacer->transit_avg) * 0.05;
+		pacer->transit_dev += (fabsl(transit - pacer->transit_avg) - pacer->transit_dev) * 0.05;
+		const ldf target = US_MIN(pacer->transit_avg + pacer->transit_dev * 4, pacer->max_delay);
+		stats->delay += (target - stats->delay) * (target > stats->delay ? 0.5 : 0.02);
+
+		release_ts = frame->grab_ts + stats->delay;
+		if (release_ts < now_ts) {
+			++stats->late;
+			release_ts = now_ts;
+		}
+	}
+	release_ts = US_MAX(release_ts, pacer->prev_release_ts);
+	pacer->prev_release_ts = release_ts;
+
+	if (pacer->count == pacer->capacity) {
+		pacer->head = (pacer->head + 1) % pacer->capacity;
+		--pacer->count;
+		++stats->dropped;
+	}
+	const uint tail = (pacer->head + pacer->count) % pacer->capacity;
+	us_frame_copy(frame, pacer->frames[tail]);
+	pacer->release_ts[tail] = release_ts;
+	++pacer->count;
+	stats->queued = pacer->count;
+}
+
+const us_frame_s *us_pacer_get(us_pacer_s *pacer, ldf now_ts) {
+	us_pacer_stats_s *const stats = &pacer->stats;
+
+	const us_frame_s *frame = NULL;
+	while (pacer->count > 0 && pacer->release_ts[pacer->head] <= now_ts) {
+		if (frame != NULL) {
+			++stats->dropped;
+		}
+		frame = pacer->frames[pacer->head];
+		pacer->head = (pacer->head + 1) % pacer->capacity;
+		--pacer->count;
+	}
+	stats->queued = pacer->count;
+
+	if (frame != NULL) {
+		if (pacer->prev_out_ts > 0) {
+			_update_jitter(&stats->jitter_out, now_ts - pacer->prev_out_ts, frame->grab_ts - pacer->prev_out_grab_ts);
+		}
+		pacer->prev_out_ts = now_ts;
+		pacer->prev_out_grab_ts = frame->grab_ts;
+	}
+	return frame;
+}
+
+void us_pacer_flush(us_pacer_s *pacer) {
+	pacer->stats.dropped += pacer->count;
+	pacer->head = 0;
+	pacer->count = 0;
+	pacer->stats.queued = 0;
+	// The next live frames may come from the restarted source
+	pacer->last_grab_ts = 0;
+	pacer->prev_release_ts = 0;
+	pacer->prev_put_ts = 0;
+	pacer->prev_out_ts = 0;
+}
+
+ldf us_pacer_get_next_ts(const us_pacer_s *pacer) {
+	return (pacer->count > 0 ? pacer->release_ts[pacer->head] : 0);
+}
+
+static void _update_jitter(ldf *jitter, ldf arrival_interval, ldf grab_interval) {
+	if (grab_interval < 1) { // Not a stall or slowdown
+		*jitter += (fabsl(arrival_interval - grab_interval) - *jitter) / 16;
+	}
+}
+
+
+#ifdef TEST_PACER
+// A 30 fps source with 20 ms + exp(8 ms) of the encoding and the delivery
+// to the server. The pacer is polled every millisecond like the event loop.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_PACER -o pacer-test ustreamer/http/pacer.c libs/frame.c libs/pixel.c libs/logging.c -pthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "../../libs/logging.h"
+
+
+#define _FPS		30
+#define _FRAMES		3000
+#define _TRANSIT	((ldf)0.020)
+#define _SPREAD		((ldf)0.008)
+
+
+static ldf _random_exp(u64 *state) {
+	*state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+	const ldf uniform = ((*state >> 11) + (ldf)0.5) / (ldf)(1ULL << 53);
+	return -logl(uniform) * _SPREAD;
+}
+
+static void _test_jitter(void) {
+	ldf *arrival_ts;
+	US_CALLOC(arrival_ts, _FRAMES);
+	u64 state = 1;
+	for (uint index = 0; index < _FRAMES; ++index) {
+		arrival_ts[index] = (ldf)index / _FPS + _TRANSIT + _random_exp(&state);
+	}
+
+	us_pacer_s *const pacer = us_pacer_init(0.1);
+	us_frame_s *const frame = us_frame_init();
+	uint released = 0;
+	for (uint step = 0; step < (_FRAMES / _FPS + 1) * 1000; ++step) {
+		const ldf now_ts = (ldf)step / 1000;
+		// The workers deliver the frames in the order of arrival
+		for (uint index = 0; index < _FRAMES; ++index) {
+			if (arrival_ts[index] <= now_ts && arrival_ts[index] > now_ts - (ldf)0.001) {
+				frame->grab_ts = (ldf)index / _FPS;
+				us_pacer_put(pacer, frame, now_ts);
+			}
+		}
+		if (us_pacer_get(pacer, now_ts) != NULL) {
+			++released;
+		}
+	}
+
+	const us_pacer_stats_s *const stats = &pacer->stats;
+	printf("jitter: in=%.2Lf ms, out=%.2Lf ms, delay=%.1Lf ms, released=%u, late=%ju, dropped=%ju\n",
+		stats->jitter_in * 1000, stats->jitter_out * 1000, stats->delay * 1000,
+		released, (uintmax_t)stats->late, (uintmax_t)stats->dropped);
+	assert(stats->jitter_in > (ldf)0.004);
+	assert(stats->jitter_out < stats->jitter_in / 4);
+	assert(stats->late < _FRAMES / 50);
+	assert(stats->dropped < _FRAMES / 50);
+	assert(released + stats->dropped == _FRAMES);
+	assert(stats->delay < _TRANSIT + _SPREAD * 6);
+
+	us_frame_destroy(frame);
+	us_pacer_destroy(pacer);
+	free(arrival_ts);
+}
+
+static void _test_order(void) {
+	us_pacer_s *const pacer = us_pacer_init(0.1);
+	us_frame_s *const frame = us_frame_init();
+
+	// The older frame from a slower worker after the newer one
+	frame->grab_ts = 10;
+	us_pacer_put(pacer, frame, 10.02);
+	frame->grab_ts = 9.9;
+	us_pacer_put(pacer, frame, 10.03);
+	assert(pacer->stats.dropped == 1);
+	assert(pacer->stats.queued == 1);
+
+	// Nobody takes the frames, the oldest one goes out of the ring
+	for (uint index = 1; index <= _CAPACITY; ++index) {
+		frame->grab_ts = 10 + (ldf)index / _FPS;
+		us_pacer_put(pacer, frame, frame->grab_ts + 0.02);
+	}
+	assert(pacer->stats.dropped == 2);
+	assert(pacer->stats.queued == _CAPACITY);
+	const us_frame_s *const next = us_pacer_get(pacer, 100);
+	assert(next != NULL && next->grab_ts == 10 + (ldf)_CAPACITY / _FPS);
+	assert(pacer->stats.dropped == 2 + _CAPACITY - 1);
+	assert(us_pacer_get_next_ts(pacer) == 0);
+
+	// The restarted source begins from the older timestamps
+	frame->grab_ts = 20;
+	us_pacer_put(pacer, frame, 20.02);
+	us_pacer_flush(pacer);
+	assert(pacer->stats.dropped == 2 + _CAPACITY);
+	assert(pacer->stats.queued == 0);
+	frame->grab_ts = 1;
+	us_pacer_put(pacer, frame, 30);
+	assert(pacer->stats.queued == 1);
+	assert(us_pacer_get(pacer, 30) != NULL);
+
+	us_frame_destroy(frame);
+	us_pacer_destroy(pacer);
+	puts("order: OK");
+}
+
+int main(void) {
+	US_LOGGING_INIT;
+	_test_jitter();
+	_test_order();
+	puts("OK");
+	return 0;
+}
+#endif
@@ -0,0 +1,74 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include "../../libs/types.h"
+#include "../../libs/frame.h"
+
+
+typedef struct {
+	ldf		delay; // Current latency budget after grab_ts
+	ldf		jitter_in; // RFC 3550 interarrival jitter of the incoming frames
+	ldf		jitter_out; // The same for the released ones
+	uint	queued;
+	u64		late; // Arrived after the budget, released immediately
+	u64		dropped; // Overflow or reordered
+} us_pacer_stats_s;
+
+typedef struct {
+	ldf		max_delay;
+
+	us_frame_s	**frames;
+	ldf			*release_ts;
+	uint		capacity;
+	uint		head;
+	uint		count;
+
+	ldf		transit_avg;
+	ldf		transit_dev;
+	ldf		prev_put_ts;
+	ldf		prev_put_grab_ts;
+	ldf		last_grab_ts; // Of the newest accepted frame
+	ldf		prev_release_ts;
+	ldf		prev_out_ts;
+	ldf		prev_out_grab_ts;
+
+	us_pacer_stats_s stats;
+} us_pacer_s;
+
+
+us_pacer_s *us_pacer_init(ldf max_delay);
+void us_pacer_destroy(us_pacer_s *pacer);
+
+void us_pacer_put(us_pacer_s *pacer, const us_frame_s *frame, ldf now_ts);
+
+// Returns the latest due frame or NULL, the older due frames are skipped.
+// The frame is valid until the next put().
+const us_frame_s *us_pacer_get(us_pacer_s *pacer, ldf now_ts);
+
+// Drops the queued frames, for a frame which must go out right now
+void us_pacer_flush(us_pacer_s *pacer);
+
+// The release time of the next frame or 0 if the queue is empty
+ldf us_pacer_get_next_ts(const us_pacer_s *pacer);
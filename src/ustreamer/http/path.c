@@ -182,3 +182,43 @@ int main(void) {
 }
 
 #endif
+
+
+#ifdef FUZZ_HTTP_PATH
+// Путь из запроса приходит прямо от клиента и идет в open() статики,
+// поэтому кроме памяти проверяем, что из корня выйти нельзя.
+//   clang -g -O1 -std=c17 -D_GNU_SOURCE -fsanitize=fuzzer,address,undefined -DUS_FUZZ_LIBFUZZER -DFUZZ_HTTP_PATH -o fuzz-http-path ustreamer/http/path.c -lm
+//   gcc -g -O1 -std=c17 -D_GNU_SOURCE -fsanitize=address,undefined -DFUZZ_HTTP_PATH -o fuzz-http-path ustreamer/http/path.c -lm
+
+#include "../../libs/fuzz.h"
+
+
+const us_fuzz_seed_s us_fuzz_seeds[] = {
+	US_FUZZ_SEED(""),
+	US_FUZZ_SEED("/"),
+	US_FUZZ_SEED("/index.html"),
+	US_FUZZ_SEED("abc/./xyz/.."),
+	US_FUZZ_SEED("   /foo/bar/../../../etc/passwd"),
+	US_FUZZ_SEED(".././xyz/.."),
+	US_FUZZ_SEED("..../...//.//x/"),
+};
+const uz us_fuzz_seeds_count = US_ARRAY_LEN(us_fuzz_seeds);
+
+void us_fuzz_one(const u8 *data, uz size) {
+	char *str;
+	US_CALLOC(str, size + 1);
+	memcpy(str, data, size);
+
+	char *const simplified = us_simplify_request_path(str);
+	assert(strlen(simplified) <= strlen(str));
+	for (const char *ptr = simplified; *ptr != '\0';) {
+		const char *const slash = strchrnul(ptr, '/');
+		assert(!(slash - ptr == 2 && ptr[0] == '.' && ptr[1] == '.'));
+		ptr = (*slash == '/' ? slash + 1 : slash);
+	}
+
+	free(simplified);
+	free(str);
+}
+
+#endif
@@ -31,11 +31,14 @@
 #include <inttypes.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
 #include <assert.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/queue.h>
 #include <netinet/tcp.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
@@ -59,22 +62,32 @@
 #include "../../libs/frame.h"
 #include "../../libs/base64.h"
 #include "../../libs/list.h"
+#include "../../libs/jpegtran.h"
 #include "../data/index_html.h"
 #include "../data/favicon_ico.h"
 #include "../encoder.h"
+#include "../burst.h"
 #include "../stream.h"
 #ifdef WITH_GPIO
 #	include "../gpio/gpio.h"
 #endif
 
 #include "tools.h"
+#include "tcp.h"
+#include "pacer.h"
 #include "mime.h"
 #include "static.h"
 #ifdef WITH_SYSTEMD
 #	include "systemd/systemd.h"
 #endif
+#ifdef WITH_HTTP2
+#	include "h2/h2.h"
+#endif
 
 
+static int _http_check_request(
+	us_server_s *server, enum evhttp_cmd_type cmd,
+	struct evkeyvalq *input_headers, struct evkeyvalq *output_headers);
 static int _http_preprocess_request(struct evhttp_request *request, us_server_s *server);
 
 static int _http_check_run_compat_action(struct evhttp_request *request, void *v_server);
@@ -83,15 +96,43 @@ static void _http_callback_root(struct evhttp_request *request, void *v_server);
 static void _http_callback_favicon(struct evhttp_request *request, void *v_server);
 static void _http_callback_static(struct evhttp_request *request, void *v_server);
 static void _http_callback_state(struct evhttp_request *request, void *v_server);
+static void _http_callback_encoder(struct evhttp_request *request, void *v_server);
 static void _http_callback_snapshot(struct evhttp_request *request, void *v_server);
+static void _http_callback_burst(struct evhttp_request *request, void *v_server);
 
 static void _http_callback_stream(struct evhttp_request *request, void *v_server);
 static void _http_callback_stream_write(struct bufferevent *buf_event, void *v_ctx);
 static void _http_callback_stream_error(struct bufferevent *buf_event, short what, void *v_ctx);
 
+#ifdef WITH_HTTP2
+static void _h2_callback_request(us_h2_stream_s *h2_stream, void *v_server);
+static void _h2_callback_stream_write(us_h2_stream_s *h2_stream, void *v_client);
+static void _h2_callback_stream_close(us_h2_stream_s *h2_stream, void *v_client);
+static void _h2_callback_snapshot_close(us_h2_stream_s *h2_stream, void *v_client);
+static void _h2_callback_burst_close(us_h2_stream_s *h2_stream, void *v_client);
+#endif
+
+static void _http_make_state(us_server_s *server, struct evbuffer *buf);
+static void _http_make_encoder_params(us_server_s *server, struct evbuffer *buf);
+static int _http_make_encoder(us_server_s *server, const char *uri, struct evbuffer *buf);
+static us_snapshot_client_s *_http_add_snapshot_client(us_server_s *server, const us_jpegtran_s *crop);
+static void _http_reply_snapshot(us_snapshot_client_s *client, int code, struct evbuffer *buf);
+static int _http_parse_uint(const char *str, uint *value);
+static us_burst_client_s *_http_add_burst_client(us_server_s *server, const char *uri, int *code);
+static void _http_reply_burst(us_burst_client_s *client, int code, struct evbuffer *buf);
+static us_stream_client_s *_http_make_stream_client(us_server_s *server, const char *uri);
+static void _http_add_stream_client(us_server_s *server, us_stream_client_s *client, struct bufferevent *buf_event);
+static void _http_del_stream_client(us_stream_client_s *client, const char *reason);
+static void _http_add_stream_headers(us_stream_client_s *client, struct evkeyvalq *headers);
+static void _http_make_stream_part(us_stream_client_s *client, struct evbuffer *buf);
+
 static void _http_refresher(int fd, short event, void *v_server);
+static void _http_pacer_timer(int fd, short event, void *v_server);
+static void _http_schedule_pacer(us_server_s *server);
 static void _http_send_stream(us_server_s *server, bool stream_updated, bool frame_updated);
 static void _http_send_snapshot(us_server_s *server);
+static void _http_send_burst(us_server_s *server);
+static void _http_tune_stream_clients(us_server_s *server);
 
 static bool _expose_frame(us_server_s *server, const us_frame_s *frame);
 
@@ -106,8 +147,15 @@ static bool _expose_frame(us_server_s *server, const us_frame_s *frame);
 #define _A_EVBUFFER_ADD(x_buf, x_data, x_size)		assert(!evbuffer_add(x_buf, x_data, x_size))
 #define _A_EVBUFFER_ADD_PRINTF(x_buf, x_fmt, ...)	assert(evbuffer_add_printf(x_buf, x_fmt, ##__VA_ARGS__) >= 0)
 
+#define _A_EVKEYVALQ_ADD(x_headers, x_key, x_value)	assert(!evhttp_add_header(x_headers, x_key, x_value))
+
 #define _A_ADD_HEADER(x_request, x_key, x_value) \
-		assert(!evhttp_add_header(evhttp_request_get_output_headers(x_request), x_key, x_value))
+		_A_EVKEYVALQ_ADD(evhttp_request_get_output_headers(x_request), x_key, x_value)
+
+// Multipart-стрим одинаковый для HTTP/1 и HTTP/2, меняется только транспорт
+#define _BOUNDARY "boundarydonotcross"
+#define _ADD_ADVANCE_HEADERS(x_buf) \
+		_A_EVBUFFER_ADD_PRINTF(x_buf, "Content-Type: image/jpeg" RN "X-Timestamp: %.06Lf" RN RN, us_get_now_real())
 
 
 us_server_s *us_server_init(us_stream_s *stream) {
@@ -120,6 +168,7 @@ us_server_s *us_server_init(us_stream_s *stream) {
 	US_CALLOC(run, 1);
 	run->ext_fd = -1;
 	run->exposed = exposed;
+	run->stream_clients = us_client_table_init();
 
 	us_server_s *server;
 	US_CALLOC(server, 1);
@@ -149,6 +198,16 @@ void us_server_destroy(us_server_s *server) {
 		event_del(run->refresher);
 		event_free(run->refresher);
 	}
+	if (run->pacer_timer != NULL) {
+		event_del(run->pacer_timer);
+		event_free(run->pacer_timer);
+	}
+	US_DELETE(run->pacer, us_pacer_destroy);
+
+#	ifdef WITH_HTTP2
+	// Закрытие потоков удаляет их клиентов из общих списков
+	US_DELETE(run->h2, us_h2_destroy);
+#	endif
 
 	evhttp_free(run->http);
 	US_CLOSE_FD(run->ext_fd);
@@ -162,12 +221,19 @@ void us_server_destroy(us_server_s *server) {
 		free(client);
 	});
 
-	US_LIST_ITERATE(run->stream_clients, client, { // cppcheck-suppress constStatement
+	US_LIST_ITERATE(run->burst_clients, client, { // cppcheck-suppress constStatement
+		us_burst_request_release(client->burst_req);
+		free(client);
+	});
+
+	for (uint index = 0; index < run->stream_clients->count; ++index) {
+		us_stream_client_s *const client = run->stream_clients->hot[index].client;
 		us_fpsi_destroy(client->fpsi);
 		free(client->key);
 		free(client->hostport);
 		free(client);
-	});
+	}
+	us_client_table_destroy(run->stream_clients);
 
 	US_DELETE(run->auth_token, free);
 
@@ -192,7 +258,9 @@ int us_server_listen(us_server_s *server) {
 			assert(!evhttp_set_cb(run->http, "/favicon.ico", _http_callback_favicon, (void*)server));
 		}
 		assert(!evhttp_set_cb(run->http, "/state", _http_callback_state, (void*)server));
+		assert(!evhttp_set_cb(run->http, "/encoder", _http_callback_encoder, (void*)server));
 		assert(!evhttp_set_cb(run->http, "/snapshot", _http_callback_snapshot, (void*)server));
+		assert(!evhttp_set_cb(run->http, "/burst", _http_callback_burst, (void*)server));
 		assert(!evhttp_set_cb(run->http, "/stream", _http_callback_stream, (void*)server));
 	}
 
@@ -209,6 +277,12 @@ int us_server_listen(us_server_s *server) {
 		assert(!event_add(run->refresher, &interval));
 	}
 
+	if (server->stream_pacing > 0) {
+		_LOG_INFO("Using stream pacing with max delay %ums", server->stream_pacing);
+		run->pacer = us_pacer_init((ldf)server->stream_pacing / 1000);
+		assert((run->pacer_timer = evtimer_new(run->base, _http_pacer_timer, server)) != NULL);
+	}
+
 	evhttp_set_timeout(run->http, server->timeout);
 
 	if (server->user[0] != '\0') {
@@ -255,6 +329,17 @@ int us_server_listen(us_server_s *server) {
 		_LOG_INFO("Listening HTTP on [%s]:%u", server->host, server->port);
 	}
 
+#	ifdef WITH_HTTP2
+	if (server->h2_port > 0) {
+		_LOG_DEBUG("Binding HTTP/2 to [%s]:%u ...", server->host, server->h2_port);
+		run->h2 = us_h2_init(run->base, _h2_callback_request, (void*)server);
+		if (us_h2_listen(run->h2, server->host, server->h2_port) < 0) {
+			return -1;
+		}
+		_LOG_INFO("Listening HTTP/2 (h2c) on [%s]:%u", server->host, server->h2_port);
+	}
+#	endif
+
 	return 0;
 }
 
@@ -268,41 +353,54 @@ void us_server_loop_break(us_server_s *server) {
 	event_base_loopbreak(server->run->base);
 }
 
-static int _http_preprocess_request(struct evhttp_request *request, us_server_s *server) {
+static int _http_check_request(
+	us_server_s *server, enum evhttp_cmd_type cmd,
+	struct evkeyvalq *input_headers, struct evkeyvalq *output_headers) {
+
+	// Returns 0 if the request should be handled or a status for an empty reply
 	const us_server_runtime_s *const run = server->run;
 
 	atomic_store(&server->stream->run->http->last_request_ts, us_get_now_monotonic());
 
 	if (server->allow_origin[0] != '\0') {
-		const char *const cors_headers = us_evhttp_get_header(request, "Access-Control-Request-Headers");
-		const char *const cors_method = us_evhttp_get_header(request, "Access-Control-Request-Method");
+		const char *const cors_headers = evhttp_find_header(input_headers, "Access-Control-Request-Headers");
+		const char *const cors_method = evhttp_find_header(input_headers, "Access-Control-Request-Method");
 
-		_A_ADD_HEADER(request, "Access-Control-Allow-Origin", server->allow_origin);
-		_A_ADD_HEADER(request, "Access-Control-Allow-Credentials", "true");
+		_A_EVKEYVALQ_ADD(output_headers, "Access-Control-Allow-Origin", server->allow_origin);
+		_A_EVKEYVALQ_ADD(output_headers, "Access-Control-Allow-Credentials", "true");
 		if (cors_headers != NULL) {
-			_A_ADD_HEADER(request, "Access-Control-Allow-Headers", cors_headers);
+			_A_EVKEYVALQ_ADD(output_headers, "Access-Control-Allow-Headers", cors_headers);
 		}
 		if (cors_method != NULL) {
-			_A_ADD_HEADER(request, "Access-Control-Allow-Methods", cors_method);
+			_A_EVKEYVALQ_ADD(output_headers, "Access-Control-Allow-Methods", cors_method);
 		}
 	}
 
-	if (evhttp_request_get_command(request) == EVHTTP_REQ_OPTIONS) {
-		evhttp_send_reply(request, HTTP_OK, "OK", NULL);
-		return -1;
+	if (cmd == EVHTTP_REQ_OPTIONS) {
+		return HTTP_OK;
 	}
 
 	if (run->auth_token != NULL) {
-		const char *const token = us_evhttp_get_header(request, "Authorization");
+		const char *const token = evhttp_find_header(input_headers, "Authorization");
 		if (token == NULL || strcmp(token, run->auth_token) != 0) {
-			_A_ADD_HEADER(request, "WWW-Authenticate", "Basic realm=\"Restricted area\"");
-			evhttp_send_reply(request, 401, "Unauthorized", NULL);
-			return -1;
+			_A_EVKEYVALQ_ADD(output_headers, "WWW-Authenticate", "Basic realm=\"Restricted area\"");
+			return 401;
 		}
 	}
 
-	if (evhttp_request_get_command(request) == EVHTTP_REQ_HEAD) {
-		evhttp_send_reply(request, HTTP_OK, "OK", NULL);
+	if (cmd == EVHTTP_REQ_HEAD) {
+		return HTTP_OK;
+	}
+	return 0;
+}
+
+static int _http_preprocess_request(struct evhttp_request *request, us_server_s *server) {
+	const int code = _http_check_request(
+		server, evhttp_request_get_command(request),
+		evhttp_request_get_input_headers(request),
+		evhttp_request_get_output_headers(request));
+	if (code > 0) {
+		evhttp_send_reply(request, code, (code == 401 ? "Unauthorized" : "OK"), NULL);
 		return -1;
 	}
 	return 0;
@@ -446,27 +544,31 @@ cleanup:
 
 static void _http_callback_state(struct evhttp_request *request, void *v_server) {
 	us_server_s *const server = v_server;
-	us_server_runtime_s *const run = server->run;
-	us_server_exposed_s *const ex = run->exposed;
-	us_stream_s *const stream = server->stream;
 
 	PREPROCESS_REQUEST;
 
-	us_encoder_type_e enc_type;
-	uint enc_quality;
-	us_encoder_get_runtime_params(stream->enc, &enc_type, &enc_quality);
-
 	struct evbuffer *buf;
 	_A_EVBUFFER_NEW(buf);
+	_http_make_state(server, buf);
+
+	_A_ADD_HEADER(request, "Content-Type", "application/json");
+	evhttp_send_reply(request, HTTP_OK, "OK", buf);
+	evbuffer_free(buf);
+}
+
+static void _http_make_state(us_server_s *server, struct evbuffer *buf) {
+	us_server_runtime_s *const run = server->run;
+	us_server_exposed_s *const ex = run->exposed;
+	us_stream_s *const stream = server->stream;
 
 	_A_EVBUFFER_ADD_PRINTF(buf,
 		"{\"ok\": true, \"result\": {"
 		" \"instance_id\": \"%s\","
-		" \"encoder\": {\"type\": \"%s\", \"quality\": %u},",
-		server->instance_id,
-		us_encoder_type_to_string(enc_type),
-		enc_quality
+		" \"encoder\": ",
+		server->instance_id
 	);
+	_http_make_encoder_params(server, buf);
+	_A_EVBUFFER_ADD_PRINTF(buf, ",");
 
 #	ifdef WITH_V4P
 	if (stream->drm != NULL) {
@@ -510,6 +612,76 @@ static void _http_callback_state(struct evhttp_request *request, void *v_server)
 		_A_EVBUFFER_ADD_PRINTF(buf, "},");
 	}
 
+	{
+		us_watchdog_s *const wd = stream->run->watchdog;
+		_A_EVBUFFER_ADD_PRINTF(buf,
+			" \"watchdog\": {\"stale\": %.3Lf, \"stages\": {",
+			(ldf)atomic_load(&wd->stale_total) / 1000);
+		for (uint stage = 0; stage < US_WATCHDOG_N_STAGES; ++stage) {
+			const us_watchdog_stage_s *const st = &wd->stages[stage];
+			_A_EVBUFFER_ADD_PRINTF(buf,
+				"\"%s\": {\"timeout\": %u, \"stalled\": %s, \"stalled_for\": %.3Lf, \"stalls\": %u}%s",
+				us_watchdog_stage_to_string(stage),
+				st->timeout,
+				us_bool_to_string(atomic_load(&st->stalled)),
+				(ldf)atomic_load(&st->stalled_for) / 1000,
+				atomic_load(&st->stalls),
+				(stage + 1 < US_WATCHDOG_N_STAGES ? ", " : "")
+			);
+		}
+		_A_EVBUFFER_ADD_PRINTF(buf, "}},");
+	}
+
+	{
+		const us_stream_ttff_s *const ttff = &stream->run->http->ttff;
+		_A_EVBUFFER_ADD_PRINTF(buf,
+			" \"ttff\": {\"sessions\": %u, \"ready\": %s, \"total\": %.3Lf, \"phases\": {"
+			"\"waiting\": %.3Lf, \"open\": %.3Lf, \"streamon\": %.3Lf, \"warmup\": %.3Lf, \"encode\": %.3Lf}},",
+			atomic_load(&ttff->sessions),
+			us_bool_to_string(atomic_load(&ttff->total) > 0),
+			(ldf)atomic_load(&ttff->total) / 1000000,
+			(ldf)atomic_load(&ttff->waiting) / 1000000,
+			(ldf)atomic_load(&ttff->open) / 1000000,
+			(ldf)atomic_load(&ttff->streamon) / 1000000,
+			(ldf)atomic_load(&ttff->warmup) / 1000000,
+			(ldf)atomic_load(&ttff->encode) / 1000000
+		);
+	}
+
+	if (stream->run->health->interval > 0) {
+		us_health_stats_s hs;
+		us_health_get_stats(stream->run->health, &hs);
+		_A_EVBUFFER_ADD_PRINTF(buf,
+			" \"health\": {\"state\": \"%s\", \"interval\": %u, \"samples\": %u,"
+			" \"mean\": %.2f, \"stddev\": %.2f, \"diff\": %.2f, \"sharpness\": %.2f, \"noise\": %.2f,"
+			" \"frozen_for\": %.3Lf, \"hist\": [",
+			us_health_state_to_string(hs.state),
+			stream->run->health->interval,
+			hs.samples,
+			hs.mean, hs.stddev, hs.diff, hs.sharpness, hs.noise,
+			(hs.frozen_since_ts > 0 ? hs.ts - hs.frozen_since_ts : 0)
+		);
+		for (uint index = 0; index < US_HEALTH_HIST_BINS; ++index) {
+			_A_EVBUFFER_ADD_PRINTF(buf, "%.4f%s", hs.hist[index], (index + 1 < US_HEALTH_HIST_BINS ? ", " : ""));
+		}
+		_A_EVBUFFER_ADD_PRINTF(buf, "]},");
+	}
+
+	if (stream->run->governor->enabled) {
+		us_governor_stats_s gs;
+		us_governor_get_stats(stream->run->governor, &gs);
+		_A_EVBUFFER_ADD_PRINTF(buf,
+			" \"governor\": {\"level\": %u, \"levels\": %u, \"changes\": %u, \"hot\": %s, \"cool\": %s,"
+			" \"limits\": {\"quality\": %u, \"fps\": %u, \"fps_percent\": %u, \"width\": %u, \"height\": %u},"
+			" \"temp\": %.1f, \"temp_slope\": %.3f, \"temp_predicted\": %.1f, \"throttled\": %u,"
+			" \"load\": %.3f, \"drops\": %.3f, \"fps\": %.1f},",
+			gs.level, gs.n_levels, gs.changes, us_bool_to_string(gs.hot), us_bool_to_string(gs.cool),
+			gs.tier.quality, gs.fps_limit, gs.tier.fps_percent, gs.tier.width, gs.tier.height,
+			gs.temp, gs.temp_slope, gs.temp_predicted, gs.throttled,
+			gs.load, gs.drops, gs.fps
+		);
+	}
+
 	us_fpsi_meta_s captured_meta;
 	const uint captured_fps = us_fpsi_get(stream->run->http->captured_fpsi, &captured_meta);
 	_A_EVBUFFER_ADD_PRINTF(buf,
@@ -518,48 +690,228 @@ static void _http_callback_state(struct evhttp_request *request, void *v_server)
 		" \"stream\": {\"queued_fps\": %u, \"clients\": %u, \"clients_stat\": {",
 		(server->fake_width ? server->fake_width : captured_meta.width),
 		(server->fake_height ? server->fake_height : captured_meta.height),
-		us_bool_to_string(captured_meta.online),
+		us_bool_to_string(captured_meta.online && !us_watchdog_is_stalled(stream->run->watchdog, US_WATCHDOG_CAPTURE)),
 		stream->cap->desired_fps,
 		captured_fps,
 		us_fpsi_get(ex->queued_fpsi, NULL),
-		run->stream_clients_count
+		run->stream_clients->count
 	);
 
-	US_LIST_ITERATE(run->stream_clients, client, { // cppcheck-suppress constStatement
+	for (uint index = 0; index < run->stream_clients->count; ++index) {
+		const us_client_hot_s *const hot = &run->stream_clients->hot[index];
+		const us_stream_client_s *const client = hot->client;
 		_A_EVBUFFER_ADD_PRINTF(buf,
 			"\"%" PRIx64 "\": {\"fps\": %u, \"extra_headers\": %s, \"advance_headers\": %s,"
-			" \"dual_final_frames\": %s, \"zero_data\": %s, \"key\": \"%s\"}%s",
+			" \"dual_final_frames\": %s, \"zero_data\": %s, \"key\": \"%s\", \"tcp\": ",
 			client->id,
 			us_fpsi_get(client->fpsi, NULL),
 			us_bool_to_string(client->extra_headers),
 			us_bool_to_string(client->advance_headers),
 			us_bool_to_string(client->dual_final_frames),
 			us_bool_to_string(client->zero_data),
-			(client->key != NULL ? client->key : "0"),
-			(client->next ? ", " : "")
+			(client->key != NULL ? client->key : "0")
 		);
-	});
+		if (client->fd >= 0) {
+			us_tcp_queues_s queues;
+			us_tcp_get_queues(client->fd, &queues);
+			_A_EVBUFFER_ADD_PRINTF(buf,
+				"{\"queued\": %d, \"unsent\": %d, \"sndbuf\": %d, \"userspace\": %zu}",
+				queues.queued, queues.unsent, queues.sndbuf,
+				(hot->buf_event != NULL ? evbuffer_get_length(bufferevent_get_output(hot->buf_event)) : 0)
+			);
+		} else {
+			_A_EVBUFFER_ADD_PRINTF(buf, "null");
+		}
+		_A_EVBUFFER_ADD_PRINTF(buf, "}%s", (index + 1 < run->stream_clients->count ? ", " : ""));
+	}
 
-	_A_EVBUFFER_ADD_PRINTF(buf, "}}}}");
+	_A_EVBUFFER_ADD_PRINTF(buf, "}, \"pacing\": ");
+	if (run->pacer != NULL) {
+		const us_pacer_stats_s *const ps = &run->pacer->stats;
+		_A_EVBUFFER_ADD_PRINTF(buf,
+			"{\"delay\": %.3Lf, \"jitter_in\": %.3Lf, \"jitter_out\": %.3Lf,"
+			" \"queued\": %u, \"late\": %" PRIu64 ", \"dropped\": %" PRIu64 "}",
+			ps->delay, ps->jitter_in, ps->jitter_out,
+			ps->queued, ps->late, ps->dropped
+		);
+	} else {
+		_A_EVBUFFER_ADD_PRINTF(buf, "null");
+	}
+	_A_EVBUFFER_ADD_PRINTF(buf, "}}}");
+}
 
-	_A_ADD_HEADER(request, "Content-Type", "application/json");
-	evhttp_send_reply(request, HTTP_OK, "OK", buf);
+static void _http_callback_encoder(struct evhttp_request *request, void *v_server) {
+	us_server_s *const server = v_server;
+
+	PREPROCESS_REQUEST;
+
+	struct evbuffer *buf;
+	_A_EVBUFFER_NEW(buf);
+	const int code = _http_make_encoder(server, evhttp_request_get_uri(request), buf);
+	if (code == HTTP_OK) {
+		_A_ADD_HEADER(request, "Content-Type", "application/json");
+		evhttp_send_reply(request, HTTP_OK, "OK", buf);
+	} else {
+		evhttp_send_error(request, code, NULL);
+	}
 	evbuffer_free(buf);
 }
 
+static void _http_make_encoder_params(us_server_s *server, struct evbuffer *buf) {
+	us_encoder_type_e type;
+	uint quality;
+	us_encoder_get_runtime_params(server->stream->enc, &type, &quality);
+	us_cpu_encoder_params_s cpu;
+	us_encoder_get_cpu_params(server->stream->enc, &cpu);
+
+	_A_EVBUFFER_ADD_PRINTF(buf,
+		"{\"type\": \"%s\", \"quality\": %u,"
+		" \"subsampling\": \"%s\", \"grayscale\": %s, \"dct\": \"%s\"}",
+		us_encoder_type_to_string(type),
+		quality,
+		us_cpu_encoder_subsampling_to_string(cpu.subsampling),
+		us_bool_to_string(cpu.grayscale),
+		us_cpu_encoder_dct_to_string(cpu.dct)
+	);
+}
+
+static int _http_make_encoder(us_server_s *server, const char *uri, struct evbuffer *buf) {
+	// Без параметров просто отдаем текущие настройки, с параметрами - меняем их,
+	// если это разрешено. Возвращает HTTP-код ответа.
+	us_cpu_encoder_params_s cpu;
+	us_encoder_get_cpu_params(server->stream->enc, &cpu);
+
+	struct evkeyvalq params;
+	evhttp_parse_query(uri, &params);
+	int code = HTTP_OK;
+	bool changed = false;
+
+	const char *value;
+	if ((value = evhttp_find_header(&params, "subsampling")) != NULL) {
+		const int subsampling = us_cpu_encoder_parse_subsampling(value);
+		if (subsampling < 0) {
+			code = HTTP_BADREQUEST;
+			goto done;
+		}
+		cpu.subsampling = subsampling;
+		changed = true;
+	}
+	if (evhttp_find_header(&params, "grayscale") != NULL) {
+		cpu.grayscale = us_evkeyvalq_get_true(&params, "grayscale");
+		changed = true;
+	}
+	if ((value = evhttp_find_header(&params, "dct")) != NULL) {
+		const int dct = us_cpu_encoder_parse_dct(value);
+		if (dct < 0) {
+			code = HTTP_BADREQUEST;
+			goto done;
+		}
+		cpu.dct = dct;
+		changed = true;
+	}
+
+	if (changed) {
+		if (!server->encoder_control) {
+			code = 403;
+			goto done;
+		}
+		us_encoder_set_cpu_params(server->stream->enc, &cpu);
+	}
+
+	_A_EVBUFFER_ADD_PRINTF(buf, "{\"ok\": true, \"result\": ");
+	_http_make_encoder_params(server, buf);
+	_A_EVBUFFER_ADD_PRINTF(buf, "}");
+
+done:
+	evhttp_clear_headers(&params);
+	return code;
+}
+
 static void _http_callback_snapshot(struct evhttp_request *request, void *v_server) {
 	us_server_s *const server = v_server;
 
 	PREPROCESS_REQUEST;
 
+	us_jpegtran_s crop = {0};
+	if (us_evhttp_parse_crop(evhttp_request_get_uri(request), &crop) < 0) {
+		evhttp_send_error(request, HTTP_BADREQUEST, NULL);
+		return;
+	}
+
+	us_snapshot_client_s *const client = _http_add_snapshot_client(server, &crop);
+	client->request = request;
+}
+
+static us_snapshot_client_s *_http_add_snapshot_client(us_server_s *server, const us_jpegtran_s *crop) {
 	us_snapshot_client_s *client;
 	US_CALLOC(client, 1);
 	client->server = server;
-	client->request = request;
 	client->request_ts = us_get_now_monotonic();
+	client->crop = *crop;
 
 	atomic_fetch_add(&server->stream->run->http->snapshot_requested, 1);
 	US_LIST_APPEND(server->run->snapshot_clients, client);
+	return client;
+}
+
+static void _http_callback_burst(struct evhttp_request *request, void *v_server) {
+	us_server_s *const server = v_server;
+
+	PREPROCESS_REQUEST;
+
+	int code;
+	us_burst_client_s *const client = _http_add_burst_client(server, evhttp_request_get_uri(request), &code);
+	if (client == NULL) {
+		evhttp_send_error(request, code, NULL);
+		return;
+	}
+	client->request = request;
+}
+
+static int _http_parse_uint(const char *str, uint *value) {
+	char *end = NULL;
+	errno = 0;
+	const unsigned long parsed = strtoul(str, &end, 10);
+	if (errno != 0 || end == str || *end != '\0' || str[0] == '-' || parsed > UINT_MAX) {
+		return -1;
+	}
+	*value = parsed;
+	return 0;
+}
+
+static us_burst_client_s *_http_add_burst_client(us_server_s *server, const char *uri, int *code) {
+	// /burst?count=N&pre=M: the next N captured frames and up to M previous ones
+	us_burst_s *const burst = server->stream->run->burst;
+	if (burst->max == 0) {
+		*code = 403;
+		return NULL;
+	}
+
+	struct evkeyvalq params;
+	evhttp_parse_query(uri, &params);
+	uint count = 1;
+	uint pre = 0;
+	const char *value;
+	us_burst_request_s *req = NULL;
+	if (
+		((value = evhttp_find_header(&params, "count")) == NULL || _http_parse_uint(value, &count) == 0)
+		&& ((value = evhttp_find_header(&params, "pre")) == NULL || _http_parse_uint(value, &pre) == 0)
+	) {
+		req = us_burst_request(burst, count, pre);
+	}
+	evhttp_clear_headers(&params);
+
+	if (req == NULL) {
+		*code = HTTP_BADREQUEST;
+		return NULL;
+	}
+
+	us_burst_client_s *client;
+	US_CALLOC(client, 1);
+	client->server = server;
+	client->burst_req = req;
+	US_LIST_APPEND(server->run->burst_clients, client);
+	return client;
 }
 
 static void _http_callback_stream(struct evhttp_request *request, void *v_server) {
@@ -570,60 +922,33 @@ static void _http_callback_stream(struct evhttp_request *request, void *v_server
 	// https://github.com/libevent/libevent/blob/29cc8386a2f7911eaa9336692a2c5544d8b4734f/http.c#L1458
 
 	us_server_s *const server = v_server;
-	us_server_runtime_s *const run = server->run;
 
 	PREPROCESS_REQUEST;
 
 	struct evhttp_connection *const conn = evhttp_request_get_connection(request);
 	if (conn != NULL) {
-		us_stream_client_s *client;
-		US_CALLOC(client, 1);
-		client->server = server;
+		us_stream_client_s *const client = _http_make_stream_client(server, evhttp_request_get_uri(request));
 		client->request = request;
-		client->need_initial = true;
-		client->need_first_frame = true;
-
-		struct evkeyvalq params;
-		evhttp_parse_query(evhttp_request_get_uri(request), &params);
-#		define PARSE_PARAM(x_type, x_name) client->x_name = us_evkeyvalq_get_##x_type(&params, #x_name)
-		PARSE_PARAM(string, key);
-		PARSE_PARAM(true, extra_headers);
-		PARSE_PARAM(true, advance_headers);
-		PARSE_PARAM(true, dual_final_frames);
-		PARSE_PARAM(true, zero_data);
-#		undef PARSE_PARAM
-		evhttp_clear_headers(&params);
-
 		client->hostport = us_evhttp_get_hostport(request);
-		client->id = us_get_now_id();
-
-		{
-			char *name;
-			US_ASPRINTF(name, "MJPEG-CLIENT-%" PRIx64, client->id);
-			client->fpsi = us_fpsi_init(name, false);
-			free(name);
-		}
-
-		US_LIST_APPEND_C(run->stream_clients, client, run->stream_clients_count);
-
-		if (run->stream_clients_count == 1) {
-			atomic_store(&server->stream->run->http->has_clients, true);
-#			ifdef WITH_GPIO
-			us_gpio_set_has_http_clients(true);
-#			endif
-		}
-
-		_LOG_INFO("NEW client (now=%u): %s, id=%" PRIx64,
-			run->stream_clients_count, client->hostport, client->id);
 
 		struct bufferevent *const buf_event = evhttp_connection_get_bufferevent(conn);
-		if (server->tcp_nodelay && run->ext_fd >= 0) {
-			_LOG_DEBUG("Setting up TCP_NODELAY to the client %s ...", client->hostport);
-			const evutil_socket_t fd = bufferevent_getfd(buf_event);
-			assert(fd >= 0);
-			int on = 1;
-			if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void*)&on, sizeof(on)) != 0) {
-				_LOG_PERROR("Can't set TCP_NODELAY to the client %s", client->hostport);
+		_http_add_stream_client(server, client, buf_event);
+
+		const evutil_socket_t fd = bufferevent_getfd(buf_event);
+		assert(fd >= 0);
+		if (us_tcp_is_inet(fd)) {
+			client->fd = fd;
+			if (server->tcp_nodelay) {
+				_LOG_DEBUG("Setting up TCP_NODELAY to the client %s ...", client->hostport);
+				if (us_tcp_set_nodelay(fd) < 0) {
+					_LOG_PERROR("Can't set TCP_NODELAY to the client %s", client->hostport);
+				}
+			}
+			if (server->tcp_notsent_lowat > 0) {
+				_LOG_DEBUG("Setting up TCP_NOTSENT_LOWAT=%u to the client %s ...", server->tcp_notsent_lowat, client->hostport);
+				if (us_tcp_set_notsent_lowat(fd, server->tcp_notsent_lowat) < 0) {
+					_LOG_PERROR("Can't set TCP_NOTSENT_LOWAT to the client %s", client->hostport);
+				}
 			}
 		}
 		bufferevent_setcb(buf_event, NULL, NULL, _http_callback_stream_error, (void*)client);
@@ -635,10 +960,75 @@ static void _http_callback_stream(struct evhttp_request *request, void *v_server
 
 #undef PREPROCESS_REQUEST
 
+static us_stream_client_s *_http_make_stream_client(us_server_s *server, const char *uri) {
+	us_stream_client_s *client;
+	US_CALLOC(client, 1);
+	client->server = server;
+	client->need_initial = true;
+	client->fd = -1;
+
+	struct evkeyvalq params;
+	evhttp_parse_query(uri, &params);
+#	define PARSE_PARAM(x_type, x_name) client->x_name = us_evkeyvalq_get_##x_type(&params, #x_name)
+	PARSE_PARAM(string, key);
+	PARSE_PARAM(true, extra_headers);
+	PARSE_PARAM(true, advance_headers);
+	PARSE_PARAM(true, dual_final_frames);
+	PARSE_PARAM(true, zero_data);
+#	undef PARSE_PARAM
+	evhttp_clear_headers(&params);
+
+	client->id = us_get_now_id();
+
+	{
+		char *name;
+		US_ASPRINTF(name, "MJPEG-CLIENT-%" PRIx64, client->id);
+		client->fpsi = us_fpsi_init(name, false);
+		free(name);
+	}
+	return client;
+}
+
+static void _http_add_stream_client(us_server_s *server, us_stream_client_s *client, struct bufferevent *buf_event) {
+	us_server_runtime_s *const run = server->run;
+
+	assert(us_client_table_add(run->stream_clients, client, &client->handle, buf_event, client->dual_final_frames));
+
+	if (us_client_table_get_alive(run->stream_clients) == 1) {
+		atomic_store(&server->stream->run->http->has_clients, true);
+#		ifdef WITH_GPIO
+		us_gpio_set_has_http_clients(true);
+#		endif
+	}
+
+	_LOG_INFO("NEW client (now=%u): %s, id=%" PRIx64,
+		us_client_table_get_alive(run->stream_clients), client->hostport, client->id);
+}
+
+static void _http_del_stream_client(us_stream_client_s *client, const char *reason) {
+	us_server_s *const server = client->server;
+	us_server_runtime_s *const run = server->run;
+
+	us_client_table_remove(run->stream_clients, client->handle);
+
+	if (us_client_table_get_alive(run->stream_clients) == 0) {
+		atomic_store(&server->stream->run->http->has_clients, false);
+#		ifdef WITH_GPIO
+		us_gpio_set_has_http_clients(false);
+#		endif
+	}
+
+	_LOG_INFO("DEL client (now=%u): %s, id=%" PRIx64 ", %s",
+		us_client_table_get_alive(run->stream_clients), client->hostport, client->id, reason);
+
+	us_fpsi_destroy(client->fpsi);
+	free(client->key);
+	free(client->hostport);
+	free(client);
+}
+
 static void _http_callback_stream_write(struct bufferevent *buf_event, void *v_client) {
 	us_stream_client_s *const client = v_client;
-	us_server_s *const server = client->server;
-	us_server_exposed_s *const ex = server->run->exposed;
 
 	us_fpsi_update(client->fpsi, true, NULL);
 
@@ -664,54 +1054,71 @@ static void _http_callback_stream_write(struct bufferevent *buf_event, void *v_c
 	// Кроме того, advance_headers форсит отключение заголовков X-UStreamer-*
 	// по тем же причинам, по которым у нас нет Content-Length.
 
-#	define BOUNDARY "boundarydonotcross"
-
-#	define ADD_ADVANCE_HEADERS \
-		_A_EVBUFFER_ADD_PRINTF(buf, \
-			"Content-Type: image/jpeg" RN "X-Timestamp: %.06Lf" RN RN, us_get_now_real())
-
 	if (client->need_initial) {
-		_A_EVBUFFER_ADD_PRINTF(buf, "HTTP/1.0 200 OK" RN);
-		
-		if (client->server->allow_origin[0] != '\0') {
-			const char *const cors_headers = us_evhttp_get_header(client->request, "Access-Control-Request-Headers");
-			const char *const cors_method = us_evhttp_get_header(client->request, "Access-Control-Request-Method");
+		// CORS уже лежат в выходных заголовках после _http_preprocess_request()
+		struct evkeyvalq *const headers = evhttp_request_get_output_headers(client->request);
+		_http_add_stream_headers(client, headers);
 
-			_A_EVBUFFER_ADD_PRINTF(buf,
-				"Access-Control-Allow-Origin: %s" RN
-				"Access-Control-Allow-Credentials: true" RN,
-				client->server->allow_origin				
-			);
-			if (cors_headers != NULL) {
-				_A_EVBUFFER_ADD_PRINTF(buf, "Access-Control-Allow-Headers: %s" RN, cors_headers);
-			}
-			if (cors_method != NULL) {
-				_A_EVBUFFER_ADD_PRINTF(buf, "Access-Control-Allow-Methods: %s" RN, cors_method);
-			}
+		_A_EVBUFFER_ADD_PRINTF(buf, "HTTP/1.0 200 OK" RN);
+		const struct evkeyval *header;
+		TAILQ_FOREACH(header, headers, next) {
+			_A_EVBUFFER_ADD_PRINTF(buf, "%s: %s" RN, header->key, header->value);
 		}
-
-		_A_EVBUFFER_ADD_PRINTF(buf,
-			"Cache-Control: no-store, no-cache, must-revalidate, proxy-revalidate, pre-check=0, post-check=0, max-age=0" RN
-			"Pragma: no-cache" RN
-			"Expires: Mon, 3 Jan 2000 12:34:56 GMT" RN
-			"Set-Cookie: stream_client%s%s=%s/%" PRIx64 "; path=/; max-age=30" RN
-			"Content-Type: multipart/x-mixed-replace;boundary=" BOUNDARY RN
-			RN
-			"--" BOUNDARY RN,
-			(server->instance_id[0] == '\0' ? "" : "_"),
-			server->instance_id,
-			(client->key != NULL ? client->key : "0"),
-			client->id
-		);
+		_A_EVBUFFER_ADD_PRINTF(buf, RN "--" _BOUNDARY RN);
 
 		if (client->advance_headers) {
-			ADD_ADVANCE_HEADERS;
+			_ADD_ADVANCE_HEADERS(buf);
 		}
 
 		assert(!bufferevent_write_buffer(buf_event, buf));
 		client->need_initial = false;
 	}
 
+	_http_make_stream_part(client, buf);
+
+	assert(!bufferevent_write_buffer(buf_event, buf));
+	evbuffer_free(buf);
+
+	bufferevent_setcb(buf_event, NULL, NULL, _http_callback_stream_error, (void*)client);
+	bufferevent_enable(buf_event, EV_READ);
+}
+
+static void _http_callback_stream_error(struct bufferevent *buf_event, short what, void *v_client) {
+	(void)buf_event;
+
+	us_stream_client_s *const client = v_client;
+	struct evhttp_connection *conn = evhttp_request_get_connection(client->request);
+
+	char *const reason = us_bufferevent_format_reason(what);
+	_http_del_stream_client(client, reason);
+	free(reason);
+
+	US_DELETE(conn, evhttp_connection_free);
+}
+
+static void _http_add_stream_headers(us_stream_client_s *client, struct evkeyvalq *headers) {
+	const us_server_s *const server = client->server;
+
+	_A_EVKEYVALQ_ADD(headers, "Cache-Control", "no-store, no-cache, must-revalidate, proxy-revalidate, pre-check=0, post-check=0, max-age=0");
+	_A_EVKEYVALQ_ADD(headers, "Pragma", "no-cache");
+	_A_EVKEYVALQ_ADD(headers, "Expires", "Mon, 3 Jan 2000 12:34:56 GMT");
+
+	char *cookie;
+	US_ASPRINTF(cookie, "stream_client%s%s=%s/%" PRIx64 "; path=/; max-age=30",
+		(server->instance_id[0] == '\0' ? "" : "_"),
+		server->instance_id,
+		(client->key != NULL ? client->key : "0"),
+		client->id
+	);
+	_A_EVKEYVALQ_ADD(headers, "Set-Cookie", cookie);
+	free(cookie);
+
+	_A_EVKEYVALQ_ADD(headers, "Content-Type", "multipart/x-mixed-replace;boundary=" _BOUNDARY);
+}
+
+static void _http_make_stream_part(us_stream_client_s *client, struct evbuffer *buf) {
+	us_server_exposed_s *const ex = client->server->run->exposed;
+
 	if (!client->advance_headers) {
 		_A_EVBUFFER_ADD_PRINTF(buf,
 			"Content-Type: image/jpeg" RN
@@ -759,53 +1166,142 @@ static void _http_callback_stream_write(struct bufferevent *buf_event, void *v_c
 	if (!client->zero_data) {
 		_A_EVBUFFER_ADD(buf, (void*)ex->frame->data, ex->frame->used);
 	}
-	_A_EVBUFFER_ADD_PRINTF(buf, RN "--" BOUNDARY RN);
+	_A_EVBUFFER_ADD_PRINTF(buf, RN "--" _BOUNDARY RN);
 
 	if (client->advance_headers) {
-		ADD_ADVANCE_HEADERS;
+		_ADD_ADVANCE_HEADERS(buf);
 	}
+}
 
-	assert(!bufferevent_write_buffer(buf_event, buf));
-	evbuffer_free(buf);
+#ifdef WITH_HTTP2
+static void _h2_callback_request(us_h2_stream_s *h2_stream, void *v_server) {
+	us_server_s *const server = v_server;
 
-	bufferevent_setcb(buf_event, NULL, NULL, _http_callback_stream_error, (void*)client);
-	bufferevent_enable(buf_event, EV_READ);
+	const int code = _http_check_request(
+		server, us_h2_stream_get_command(h2_stream),
+		us_h2_stream_get_input_headers(h2_stream),
+		us_h2_stream_get_output_headers(h2_stream));
+	if (code > 0) {
+		us_h2_stream_send_reply(h2_stream, code, NULL);
+		return;
+	}
 
-#	undef ADD_ADVANCE_HEADERS
-#	undef BOUNDARY
-}
+	const char *const uri = us_h2_stream_get_uri(h2_stream);
+	struct evhttp_uri *parsed = evhttp_uri_parse(uri);
+	const char *const path = (parsed != NULL ? evhttp_uri_get_path(parsed) : NULL);
+	struct evkeyvalq *const headers = us_h2_stream_get_output_headers(h2_stream);
+	struct evbuffer *buf;
+	_A_EVBUFFER_NEW(buf);
 
-static void _http_callback_stream_error(struct bufferevent *buf_event, short what, void *v_client) {
-	(void)buf_event;
-	(void)what;
+	if (path == NULL) {
+		us_h2_stream_send_reply(h2_stream, HTTP_BADREQUEST, NULL);
+
+	} else if (!strcmp(path, "/state")) {
+		_http_make_state(server, buf);
+		_A_EVKEYVALQ_ADD(headers, "Content-Type", "application/json");
+		us_h2_stream_send_reply(h2_stream, HTTP_OK, buf);
+
+	} else if (!strcmp(path, "/encoder")) {
+		const int enc_code = _http_make_encoder(server, uri, buf);
+		if (enc_code == HTTP_OK) {
+			_A_EVKEYVALQ_ADD(headers, "Content-Type", "application/json");
+			us_h2_stream_send_reply(h2_stream, HTTP_OK, buf);
+		} else {
+			us_h2_stream_send_reply(h2_stream, enc_code, NULL);
+		}
+
+	} else if (!strcmp(path, "/snapshot")) {
+		us_jpegtran_s crop = {0};
+		if (us_evhttp_parse_crop(uri, &crop) < 0) {
+			us_h2_stream_send_reply(h2_stream, HTTP_BADREQUEST, NULL);
+		} else {
+			us_snapshot_client_s *const client = _http_add_snapshot_client(server, &crop);
+			client->h2_stream = h2_stream;
+			us_h2_stream_setcb(h2_stream, NULL, _h2_callback_snapshot_close, client);
+		}
+
+	} else if (!strcmp(path, "/burst")) {
+		int burst_code;
+		us_burst_client_s *const client = _http_add_burst_client(server, uri, &burst_code);
+		if (client == NULL) {
+			us_h2_stream_send_reply(h2_stream, burst_code, NULL);
+		} else {
+			client->h2_stream = h2_stream;
+			us_h2_stream_setcb(h2_stream, NULL, _h2_callback_burst_close, client);
+		}
+
+	} else if (!strcmp(path, "/stream")) {
+		us_stream_client_s *const client = _http_make_stream_client(server, uri);
+		client->h2_stream = h2_stream;
+		client->hostport = us_h2_stream_get_hostport(h2_stream);
+		_http_add_stream_client(server, client, NULL);
+		us_h2_stream_setcb(h2_stream, NULL, _h2_callback_stream_close, client);
+
+	} else if (server->static_path[0] == '\0' && !strcmp(path, "/")) {
+		_A_EVBUFFER_ADD_PRINTF(buf, "%s", US_HTML_INDEX_PAGE);
+		_A_EVKEYVALQ_ADD(headers, "Content-Type", "text/html");
+		us_h2_stream_send_reply(h2_stream, HTTP_OK, buf);
+
+	} else if (server->static_path[0] == '\0' && !strcmp(path, "/favicon.ico")) {
+		_A_EVBUFFER_ADD(buf, (const void*)US_FAVICON_ICO_DATA, US_FAVICON_ICO_DATA_SIZE);
+		_A_EVKEYVALQ_ADD(headers, "Content-Type", "image/x-icon");
+		us_h2_stream_send_reply(h2_stream, HTTP_OK, buf);
+
+	} else {
+		us_h2_stream_send_reply(h2_stream, HTTP_NOTFOUND, NULL);
+	}
+
+	evbuffer_free(buf);
+	US_DELETE(parsed, evhttp_uri_free);
+}
 
+static void _h2_callback_stream_write(us_h2_stream_s *h2_stream, void *v_client) {
 	us_stream_client_s *const client = v_client;
-	us_server_s *const server = client->server;
-	us_server_runtime_s *const run = server->run;
 
-	US_LIST_REMOVE_C(run->stream_clients, client, run->stream_clients_count);
+	us_fpsi_update(client->fpsi, true, NULL);
 
-	if (run->stream_clients_count == 0) {
-		atomic_store(&server->stream->run->http->has_clients, false);
-#		ifdef WITH_GPIO
-		us_gpio_set_has_http_clients(false);
-#		endif
+	struct evbuffer *buf;
+	_A_EVBUFFER_NEW(buf);
+
+	if (client->need_initial) {
+		_http_add_stream_headers(client, us_h2_stream_get_output_headers(h2_stream));
+		us_h2_stream_send_reply_start(h2_stream, HTTP_OK);
+		_A_EVBUFFER_ADD_PRINTF(buf, "--" _BOUNDARY RN);
+		if (client->advance_headers) {
+			_ADD_ADVANCE_HEADERS(buf);
+		}
+		client->need_initial = false;
 	}
 
-	char *const reason = us_bufferevent_format_reason(what);
-	_LOG_INFO("DEL client (now=%u): %s, id=%" PRIx64 ", %s",
-		run->stream_clients_count, client->hostport, client->id, reason);
-	free(reason);
+	// Каждая часть уходит DATA-фреймами в рамках окна потока. Пока часть
+	// не отправлена целиком, колбек не вызывается, и медленный поток пропускает
+	// фреймы, не мешая остальным потокам этого соединения.
+	_http_make_stream_part(client, buf);
+	us_h2_stream_send_reply_chunk(h2_stream, buf);
+	evbuffer_free(buf);
+}
 
-	struct evhttp_connection *conn = evhttp_request_get_connection(client->request);
-	US_DELETE(conn, evhttp_connection_free);
+static void _h2_callback_stream_close(us_h2_stream_s *h2_stream, void *v_client) {
+	(void)h2_stream;
+	_http_del_stream_client(v_client, "HTTP/2 stream closed");
+}
 
-	us_fpsi_destroy(client->fpsi);
-	free(client->key);
-	free(client->hostport);
+static void _h2_callback_snapshot_close(us_h2_stream_s *h2_stream, void *v_client) {
+	(void)h2_stream;
+	us_snapshot_client_s *const client = v_client;
+	US_LIST_REMOVE(client->server->run->snapshot_clients, client);
 	free(client);
 }
 
+static void _h2_callback_burst_close(us_h2_stream_s *h2_stream, void *v_client) {
+	(void)h2_stream;
+	us_burst_client_s *const client = v_client;
+	US_LIST_REMOVE(client->server->run->burst_clients, client);
+	us_burst_request_release(client->burst_req);
+	free(client);
+}
+#endif
+
 static void _http_send_stream(us_server_s *server, bool stream_updated, bool frame_updated) {
 	us_server_runtime_s *const run = server->run;
 	us_server_exposed_s *const ex = run->exposed;
@@ -813,37 +1309,36 @@ static void _http_send_stream(us_server_s *server, bool stream_updated, bool fra
 	bool queued = false;
 	bool has_clients = true;
 
-	US_LIST_ITERATE(run->stream_clients, client, { // cppcheck-suppress constStatement
-		struct evhttp_connection *const conn = evhttp_request_get_connection(client->request);
-		if (conn != NULL) {
-			// Фикс для бага WebKit. При включенной опции дропа одинаковых фреймов,
-			// WebKit отрисовывает последний фрейм в серии с некоторой задержкой,
-			// и нужно послать два фрейма, чтобы серия была вовремя завершена.
-			// Это похоже на баг Blink (см. _http_callback_stream_write() и advance_headers),
-			// но фикс для него не лечит проблему вебкита. Такие дела.
-
-			const bool dual_update = (
-				server->drop_same_frames
-				&& client->dual_final_frames
-				&& stream_updated
-				&& client->updated_prev
-				&& !frame_updated
-			);
-
-			if (dual_update || frame_updated || client->need_first_frame) {
-				struct bufferevent *const buf_event = evhttp_connection_get_bufferevent(conn);
-				bufferevent_setcb(buf_event, NULL, _http_callback_stream_write, _http_callback_stream_error, (void*)client);
-				bufferevent_enable(buf_event, EV_READ|EV_WRITE);
-
-				client->need_first_frame = false;
-				client->updated_prev = (frame_updated || client->need_first_frame); // Игнорировать dual
+	// Линейный проход по горячей части клиентов, без хождения по указателям.
+	// Сессия HTTP/2 может закрыться прямо в us_h2_stream_enable_write()
+	// вместе со всеми своими клиентами, поэтому удаления откладываются до конца прохода.
+	us_client_table_begin_walk(run->stream_clients);
+	for (uint index = 0; index < run->stream_clients->count; ++index) {
+		us_client_hot_s *const hot = &run->stream_clients->hot[index];
+		if (hot->client == NULL) {
+			continue; // Удален во время прохода
+		}
+		if (us_client_table_need_send(hot, server->drop_same_frames, stream_updated, frame_updated)) {
+			us_stream_client_s *const client = hot->client;
+			if (hot->buf_event != NULL) {
+				// Холодное состояние трогаем только для отправки, где оно все равно нужно
+				// в _http_callback_stream_write(). Запрос может быть уже отвязан от соединения.
+				if (evhttp_request_get_connection(client->request) != NULL) {
+					bufferevent_setcb(hot->buf_event, NULL, _http_callback_stream_write, _http_callback_stream_error, client);
+					bufferevent_enable(hot->buf_event, EV_READ|EV_WRITE);
+					queued = true;
+				}
+#			ifdef WITH_HTTP2
+			} else {
+				us_h2_stream_setcb(client->h2_stream, _h2_callback_stream_write, _h2_callback_stream_close, client);
+				us_h2_stream_enable_write(client->h2_stream);
 				queued = true;
-			} else if (stream_updated) { // Для dual
-				client->updated_prev = false;
+#			endif
 			}
-			has_clients = true;
 		}
-	});
+		has_clients = true;
+	}
+	us_client_table_end_walk(run->stream_clients);
 
 	if (queued) {
 		us_fpsi_update(ex->queued_fpsi, true, NULL);
@@ -855,29 +1350,39 @@ static void _http_send_stream(us_server_s *server, bool stream_updated, bool fra
 static void _http_send_snapshot(us_server_s *server) {
 	us_server_exposed_s *const ex = server->run->exposed;
 	us_blank_s *blank = NULL;
+	us_frame_s *cropped = NULL;
 
 #	define ADD_TIME_HEADER(x_key, x_value) { \
 			US_SNPRINTF(header_buf, 255, "%.06Lf", x_value); \
-			_A_ADD_HEADER(request, x_key, header_buf); \
+			_A_EVKEYVALQ_ADD(headers, x_key, header_buf); \
 		}
 
 #	define ADD_UNSIGNED_HEADER(x_key, x_value) { \
 			US_SNPRINTF(header_buf, 255, "%u", x_value); \
-			_A_ADD_HEADER(request, x_key, header_buf); \
+			_A_EVKEYVALQ_ADD(headers, x_key, header_buf); \
 		}
 
 	us_fpsi_meta_s captured_meta;
 	us_fpsi_get(server->stream->run->http->captured_fpsi, &captured_meta);
 
 	US_LIST_ITERATE(server->run->snapshot_clients, client, { // cppcheck-suppress constStatement
-		struct evhttp_request *request = client->request;
+		struct evkeyvalq *headers = NULL;
+		if (client->request != NULL) {
+			headers = evhttp_request_get_output_headers(client->request);
+		}
+#		ifdef WITH_HTTP2
+		if (client->h2_stream != NULL) {
+			headers = us_h2_stream_get_output_headers(client->h2_stream);
+		}
+#		endif
 
 		const bool has_fresh_snapshot = (atomic_load(&server->stream->run->http->snapshot_requested) == 0);
 		const bool timed_out = (client->request_ts + US_MAX((uint)1, server->stream->error_delay * 3) < us_get_now_monotonic());
 
-		if (has_fresh_snapshot || timed_out) {
+		// There is nothing to wait for while the capture is offline
+		if (has_fresh_snapshot || timed_out || !ex->frame->online) {
 			us_frame_s *frame = ex->frame;
-			if (!captured_meta.online) {
+			if (!ex->frame->online && !atomic_load(&server->stream->run->http->last_frame_exposed)) {
 				if (blank == NULL) {
 					blank = us_blank_init();
 					us_blank_draw(blank, "< NO LIVE VIDEO >", captured_meta.width, captured_meta.height);
@@ -885,30 +1390,45 @@ static void _http_send_snapshot(us_server_s *server) {
 				frame = blank->jpeg;
 			}
 
-			struct evbuffer *buf;
-			_A_EVBUFFER_NEW(buf);
-			_A_EVBUFFER_ADD(buf, (const void*)frame->data, frame->used);
+			if (us_jpegtran_is_enabled(&client->crop)) {
+				if (cropped == NULL) {
+					cropped = us_frame_init();
+				}
+				if (us_jpegtran(&client->crop, frame, cropped) < 0) {
+					frame = NULL;
+				} else {
+					frame = cropped;
+				}
+			}
 
-			_A_ADD_HEADER(request, "Cache-Control", "no-store, no-cache, must-revalidate, proxy-revalidate, pre-check=0, post-check=0, max-age=0");
-			_A_ADD_HEADER(request, "Pragma", "no-cache");
-			_A_ADD_HEADER(request, "Expires", "Mon, 3 Jan 2000 12:34:56 GMT");
+			if (frame == NULL) {
+				_http_reply_snapshot(client, HTTP_BADREQUEST, NULL);
+			} else {
+				struct evbuffer *buf;
+				_A_EVBUFFER_NEW(buf);
+				_A_EVBUFFER_ADD(buf, (const void*)frame->data, frame->used);
 
-			char header_buf[256];
+				_A_EVKEYVALQ_ADD(headers, "Cache-Control", "no-store, no-cache, must-revalidate, proxy-revalidate, pre-check=0, post-check=0, max-age=0");
+				_A_EVKEYVALQ_ADD(headers, "Pragma", "no-cache");
+				_A_EVKEYVALQ_ADD(headers, "Expires", "Mon, 3 Jan 2000 12:34:56 GMT");
 
-			ADD_TIME_HEADER("X-Timestamp", us_get_now_real());
+				char header_buf[256];
 
-			_A_ADD_HEADER(request, "X-UStreamer-Online",			us_bool_to_string(frame->online));
-			ADD_UNSIGNED_HEADER("X-UStreamer-Width",				frame->width);
-			ADD_UNSIGNED_HEADER("X-UStreamer-Height",				frame->height);
-			ADD_TIME_HEADER("X-UStreamer-Grab-Timestamp",			frame->grab_ts);
-			ADD_TIME_HEADER("X-UStreamer-Encode-Begin-Timestamp",	frame->encode_begin_ts);
-			ADD_TIME_HEADER("X-UStreamer-Encode-End-Timestamp",		frame->encode_end_ts);
-			ADD_TIME_HEADER("X-UStreamer-Send-Timestamp",			us_get_now_monotonic());
+				ADD_TIME_HEADER("X-Timestamp", us_get_now_real());
 
-			_A_ADD_HEADER(request, "Content-Type", "image/jpeg");
+				_A_EVKEYVALQ_ADD(headers, "X-UStreamer-Online",		us_bool_to_string(frame->online));
+				ADD_UNSIGNED_HEADER("X-UStreamer-Width",				frame->width);
+				ADD_UNSIGNED_HEADER("X-UStreamer-Height",				frame->height);
+				ADD_TIME_HEADER("X-UStreamer-Grab-Timestamp",			frame->grab_ts);
+				ADD_TIME_HEADER("X-UStreamer-Encode-Begin-Timestamp",	frame->encode_begin_ts);
+				ADD_TIME_HEADER("X-UStreamer-Encode-End-Timestamp",		frame->encode_end_ts);
+				ADD_TIME_HEADER("X-UStreamer-Send-Timestamp",			us_get_now_monotonic());
 
-			evhttp_send_reply(request, HTTP_OK, "OK", buf);
-			evbuffer_free(buf);
+				_A_EVKEYVALQ_ADD(headers, "Content-Type", "image/jpeg");
+
+				_http_reply_snapshot(client, HTTP_OK, buf);
+				evbuffer_free(buf);
+			}
 
 			US_LIST_REMOVE(server->run->snapshot_clients, client);
 			free(client);
@@ -918,9 +1438,114 @@ static void _http_send_snapshot(us_server_s *server) {
 #	undef ADD_UNSUGNED_HEADER
 #	undef ADD_TIME_HEADER
 
+	US_DELETE(cropped, us_frame_destroy);
 	US_DELETE(blank, us_blank_destroy);
 }
 
+static void _http_reply_snapshot(us_snapshot_client_s *client, int code, struct evbuffer *buf) {
+#	ifdef WITH_HTTP2
+	if (client->h2_stream != NULL) {
+		us_h2_stream_setcb(client->h2_stream, NULL, NULL, NULL); // The client is freed right after
+		us_h2_stream_send_reply(client->h2_stream, code, buf);
+		return;
+	}
+#	endif
+	if (code == HTTP_OK) {
+		evhttp_send_reply(client->request, HTTP_OK, "OK", buf);
+	} else {
+		evhttp_send_error(client->request, code, NULL);
+	}
+}
+
+static void _http_send_burst(us_server_s *server) {
+	US_LIST_ITERATE(server->run->burst_clients, client, { // cppcheck-suppress constStatement
+		const us_burst_request_s *const req = client->burst_req;
+
+		// Отдаем то, что успели снять и закодировать, если захват встал
+		const ldf progress_ts = atomic_load(&req->progress_ts);
+		const bool timed_out = (progress_ts + US_MAX((uint)1, server->stream->error_delay * 3) < us_get_now_monotonic());
+		if (us_burst_request_is_done(req) || timed_out) {
+			struct evbuffer *buf;
+			_A_EVBUFFER_NEW(buf);
+			uint n_frames = 0;
+			for (uint index = 0; index < req->n_shots; ++index) {
+				const us_burst_shot_s *const shot = &req->shots[index];
+				if (!atomic_load(&shot->encoded)) { // The capture thread may be still taking the shots
+					continue;
+				}
+				const us_frame_s *const frame = shot->jpeg;
+				_A_EVBUFFER_ADD_PRINTF(buf,
+					"--" _BOUNDARY RN
+					"Content-Type: image/jpeg" RN
+					"Content-Length: %zu" RN
+					"X-UStreamer-Sequence: %llu" RN
+					"X-UStreamer-Pretrigger: %s" RN
+					"X-UStreamer-Width: %u" RN
+					"X-UStreamer-Height: %u" RN
+					"X-UStreamer-Grab-Timestamp: %.06Lf" RN
+					"X-UStreamer-Encode-Begin-Timestamp: %.06Lf" RN
+					"X-UStreamer-Encode-End-Timestamp: %.06Lf" RN
+					RN,
+					frame->used,
+					(ull)shot->seq,
+					us_bool_to_string(shot->pre),
+					frame->width,
+					frame->height,
+					frame->grab_ts,
+					frame->encode_begin_ts,
+					frame->encode_end_ts
+				);
+				_A_EVBUFFER_ADD(buf, (const void*)frame->data, frame->used);
+				_A_EVBUFFER_ADD_PRINTF(buf, RN);
+				++n_frames;
+			}
+			_A_EVBUFFER_ADD_PRINTF(buf, "--" _BOUNDARY "--" RN);
+
+			if (n_frames == 0) {
+				_http_reply_burst(client, HTTP_SERVUNAVAIL, NULL);
+			} else {
+				struct evkeyvalq *headers = NULL;
+				if (client->request != NULL) {
+					headers = evhttp_request_get_output_headers(client->request);
+				}
+#			ifdef WITH_HTTP2
+				if (client->h2_stream != NULL) {
+					headers = us_h2_stream_get_output_headers(client->h2_stream);
+				}
+#			endif
+				char header_buf[256];
+				US_SNPRINTF(header_buf, 255, "%u", req->n_shots);
+				_A_EVKEYVALQ_ADD(headers, "X-UStreamer-Burst-Requested", header_buf);
+				US_SNPRINTF(header_buf, 255, "%u", n_frames);
+				_A_EVKEYVALQ_ADD(headers, "X-UStreamer-Burst-Frames", header_buf);
+				_A_EVKEYVALQ_ADD(headers, "Cache-Control", "no-store, no-cache, must-revalidate, proxy-revalidate, pre-check=0, post-check=0, max-age=0");
+				_A_EVKEYVALQ_ADD(headers, "Content-Type", "multipart/mixed;boundary=" _BOUNDARY);
+				_http_reply_burst(client, HTTP_OK, buf);
+			}
+			evbuffer_free(buf);
+
+			US_LIST_REMOVE(server->run->burst_clients, client);
+			us_burst_request_release(client->burst_req);
+			free(client);
+		}
+	});
+}
+
+static void _http_reply_burst(us_burst_client_s *client, int code, struct evbuffer *buf) {
+#	ifdef WITH_HTTP2
+	if (client->h2_stream != NULL) {
+		us_h2_stream_setcb(client->h2_stream, NULL, NULL, NULL); // The client is freed right after
+		us_h2_stream_send_reply(client->h2_stream, code, buf);
+		return;
+	}
+#	endif
+	if (code == HTTP_OK) {
+		evhttp_send_reply(client->request, HTTP_OK, "OK", buf);
+	} else {
+		evhttp_send_error(client->request, code, NULL);
+	}
+}
+
 static void _http_refresher(int fd, short what, void *v_server) {
 	(void)fd;
 	(void)what;
@@ -929,14 +1554,27 @@ static void _http_refresher(int fd, short what, void *v_server) {
 	us_server_exposed_s *ex = server->run->exposed;
 	us_ring_s *const ring = server->stream->run->http->jpeg_ring;
 
+	us_watchdog_begin(server->stream->run->watchdog, US_WATCHDOG_HTTP, 0); // Heartbeat
+
 	bool stream_updated = false;
 	bool frame_updated = false;
 
 	const int ri = us_ring_consumer_acquire(ring, 0);
 	if (ri >= 0) {
 		const us_frame_s *const frame = ring->items[ri];
-		frame_updated = _expose_frame(server, frame);
-		stream_updated = true;
+		if (server->run->pacer != NULL && frame->used > 0 && frame->online) {
+			// The frame will be exposed by the pacer timer
+			us_pacer_put(server->run->pacer, frame, us_get_now_monotonic());
+			_http_schedule_pacer(server);
+		} else {
+			if (server->run->pacer != NULL) {
+				// The blank and the saved frame have no fresh grab_ts to pace,
+				// and the live frames before them must not override them.
+				us_pacer_flush(server->run->pacer);
+			}
+			frame_updated = _expose_frame(server, frame);
+			stream_updated = true;
+		}
 		us_ring_consumer_release(ring, ri);
 	} else if (ex->expose_end_ts + 1 < us_get_now_monotonic()) {
 		_LOG_DEBUG("Repeating exposed ...");
@@ -949,6 +1587,95 @@ static void _http_refresher(int fd, short what, void *v_server) {
 
 	_http_send_stream(server, stream_updated, frame_updated);
 	_http_send_snapshot(server);
+	_http_send_burst(server);
+
+	if (
+		(server->tcp_sndbuf_frames > 0 || server->tcp_pacing > 0)
+		&& server->run->tcp_tune_next_ts <= us_get_now_monotonic()
+	) {
+		_http_tune_stream_clients(server);
+		server->run->tcp_tune_next_ts = us_get_now_monotonic() + 1;
+	}
+}
+
+static void _http_tune_stream_clients(us_server_s *server) {
+	us_server_runtime_s *const run = server->run;
+	const ldf frame_size = run->exposed->frame_size_avg;
+	if (frame_size <= 0) {
+		return;
+	}
+
+	// Менять буферы на каждый чих смысла нет, только при заметном
+	// изменении размера фрейма или частоты кадров.
+#	define NEED_UPDATE(x_old, x_new) ( \
+		(x_old) == 0 \
+		|| (ldf)(x_new) > (ldf)(x_old) * 1.25 \
+		|| (ldf)(x_new) < (ldf)(x_old) * 0.75 \
+	)
+
+	uint sndbuf = 0;
+	if (server->tcp_sndbuf_frames > 0) {
+		sndbuf = US_MAX((uint)(frame_size * server->tcp_sndbuf_frames), (uint)16384);
+	}
+	u64 pacing = 0;
+	if (server->tcp_pacing > 0) {
+		const uint fps = us_fpsi_get(run->exposed->queued_fpsi, NULL);
+		if (fps > 0) { // Don't throttle the clients until the rate is known
+			pacing = (u64)(frame_size * fps * server->tcp_pacing / 100);
+		}
+	}
+
+	for (uint index = 0; index < run->stream_clients->count; ++index) {
+		us_stream_client_s *const client = run->stream_clients->hot[index].client;
+		if (client->fd < 0) {
+			// No TCP queue to tune: unix socket or HTTP/2
+		} else {
+			if (sndbuf > 0 && NEED_UPDATE(client->sndbuf, sndbuf)) {
+				_LOG_VERBOSE("Setting SO_SNDBUF=%u to the client %s ...", sndbuf, client->hostport);
+				if (us_tcp_set_sndbuf(client->fd, sndbuf) < 0) {
+					_LOG_PERROR("Can't set SO_SNDBUF to the client %s", client->hostport);
+				}
+				client->sndbuf = sndbuf; // Don't retry on each tick on error
+			}
+			if (pacing > 0 && NEED_UPDATE(client->pacing, pacing)) {
+				_LOG_VERBOSE("Setting SO_MAX_PACING_RATE=%" PRIu64 " to the client %s ...", pacing, client->hostport);
+				if (us_tcp_set_pacing(client->fd, pacing) < 0) {
+					_LOG_PERROR("Can't set SO_MAX_PACING_RATE to the client %s", client->hostport);
+				}
+				client->pacing = pacing;
+			}
+		}
+	}
+
+#	undef NEED_UPDATE
+}
+
+static void _http_pacer_timer(int fd, short what, void *v_server) {
+	(void)fd;
+	(void)what;
+
+	us_server_s *const server = v_server;
+
+	const us_frame_s *const frame = us_pacer_get(server->run->pacer, us_get_now_monotonic());
+	if (frame != NULL) {
+		const bool frame_updated = _expose_frame(server, frame);
+		_http_send_stream(server, true, frame_updated);
+		_http_send_snapshot(server);
+	}
+	_http_schedule_pacer(server);
+}
+
+static void _http_schedule_pacer(us_server_s *server) {
+	us_server_runtime_s *const run = server->run;
+	const ldf next_ts = us_pacer_get_next_ts(run->pacer);
+	if (next_ts > 0) {
+		const ldf delay = US_MAX(next_ts - us_get_now_monotonic(), (ldf)0);
+		struct timeval interval = {
+			.tv_sec = delay,
+			.tv_usec = (delay - (long)delay) * 1000000,
+		};
+		assert(!event_add(run->pacer_timer, &interval)); // Reschedules the pending one
+	}
 }
 
 static bool _expose_frame(us_server_s *server, const us_frame_s *frame) {
@@ -983,6 +1710,11 @@ static bool _expose_frame(us_server_s *server, const us_frame_s *frame) {
 		ex->frame->online = frame->online;
 	} else {
 		us_frame_copy(frame, ex->frame);
+		ex->frame_size_avg = (
+			ex->frame_size_avg > 0
+			? ex->frame_size_avg * 0.9 + (ldf)ex->frame->used * 0.1
+			: (ldf)ex->frame->used
+		);
 	}
 
 	ex->dropped = 0;
@@ -32,13 +32,24 @@
 #include "../../libs/frame.h"
 #include "../../libs/list.h"
 #include "../../libs/fpsi.h"
+#include "../../libs/jpegtran.h"
 #include "../encoder.h"
+#include "../burst.h"
 #include "../stream.h"
 
+#include "clients.h"
+#include "pacer.h"
+#ifdef WITH_HTTP2
+#	include "h2/h2.h"
+#endif
+
 
 typedef struct {
 	struct us_server_sx		*server;
 	struct evhttp_request	*request;
+#	ifdef WITH_HTTP2
+	us_h2_stream_s			*h2_stream; // Instead of the request
+#	endif
 
 	char	*key;
 	bool	extra_headers;
@@ -49,22 +60,39 @@ typedef struct {
 	char	*hostport;
 	u64		id;
 	bool	need_initial;
-	bool	need_first_frame;
-	bool	updated_prev;
 
 	us_fpsi_s *fpsi;
 
-	US_LIST_DECLARE;
+	int		fd; // TCP socket for the kernel queue tuning, -1 otherwise
+	uint	sndbuf;
+	u64		pacing;
+
+	us_client_handle_s handle; // Hot state in the server's clients table
 } us_stream_client_s;
 
 typedef struct {
 	struct us_server_sx		*server;
 	struct evhttp_request	*request;
+#	ifdef WITH_HTTP2
+	us_h2_stream_s			*h2_stream; // Instead of the request
+#	endif
 	ldf						request_ts;
+	us_jpegtran_s			crop;
 
 	US_LIST_DECLARE;
 } us_snapshot_client_s;
 
+typedef struct {
+	struct us_server_sx		*server;
+	struct evhttp_request	*request;
+#	ifdef WITH_HTTP2
+	us_h2_stream_s			*h2_stream; // Instead of the request
+#	endif
+	us_burst_request_s		*burst_req;
+
+	US_LIST_DECLARE;
+} us_burst_client_s;
+
 typedef struct {
 	us_frame_s	*frame;
 	us_fpsi_s	*queued_fpsi;
@@ -72,22 +100,30 @@ typedef struct {
 	ldf			expose_begin_ts;
 	ldf			expose_cmp_ts;
 	ldf			expose_end_ts;
+	ldf			frame_size_avg; // For the TCP tuning
 } us_server_exposed_s;
 
 typedef struct {
 	struct event_base	*base;
 	struct evhttp		*http;
 	evutil_socket_t		ext_fd; // Unix or socket activation
+#	ifdef WITH_HTTP2
+	us_h2_s				*h2;
+#	endif
 
 	char				*auth_token;
 
 	struct event		*refresher;
 	us_server_exposed_s	*exposed;
+	ldf					tcp_tune_next_ts;
+
+	us_pacer_s			*pacer;
+	struct event		*pacer_timer;
 
-	us_stream_client_s	*stream_clients;
-	uint				stream_clients_count;
+	us_client_table_s	*stream_clients;
 
 	us_snapshot_client_s *snapshot_clients;
+	us_burst_client_s	*burst_clients;
 } us_server_runtime_s;
 
 typedef struct us_server_sx {
@@ -104,7 +140,14 @@ typedef struct us_server_sx {
 	bool	systemd;
 #	endif
 
+#	ifdef WITH_HTTP2
+	uint	h2_port;
+#	endif
+
 	bool	tcp_nodelay;
+	uint	tcp_notsent_lowat;
+	uint	tcp_sndbuf_frames;
+	uint	tcp_pacing;
 	uint	timeout;
 
 	char	*user;
@@ -112,8 +155,10 @@ typedef struct us_server_sx {
 	char	*static_path;
 	char	*allow_origin;
 	char	*instance_id;
+	bool	encoder_control;
 
 	uint	drop_same_frames;
+	uint	stream_pacing; // Max delay in ms
 	uint	fake_width;
 	uint	fake_height;
 
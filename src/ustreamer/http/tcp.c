@@ -0,0 +1,251 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "tcp.h"
+
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef __linux__
+#	include <linux/sockios.h>
+#endif
+
+#include "../../libs/types.h"
+#include "../../libs/tools.h"
+
+
+bool us_tcp_is_inet(int fd) {
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	if (getsockname(fd, (struct sockaddr*)&addr, &len) < 0) {
+		return false;
+	}
+	return (addr.ss_family == AF_INET || addr.ss_family == AF_INET6);
+}
+
+int us_tcp_set_nodelay(int fd) {
+	const int on = 1;
+	return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+int us_tcp_set_notsent_lowat(int fd, uint lowat) {
+	// The socket is writable only while the unsent data is below the mark,
+	// so the frames wait in the userspace and can be skipped there instead
+	// of piling up in the kernel buffer which autotuning makes huge.
+#	ifdef TCP_NOTSENT_LOWAT
+	return setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+#	else
+	(void)fd;
+	(void)lowat;
+	errno = ENOTSUP;
+	return -1;
+#	endif
+}
+
+int us_tcp_set_sndbuf(int fd, uint size) {
+	// Linux doubles the value for the bookkeeping overhead and disables autotuning
+	const int value = US_MIN(size, (uint)INT_MAX);
+	return setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &value, sizeof(value));
+}
+
+int us_tcp_set_pacing(int fd, u64 rate) {
+#	ifdef SO_MAX_PACING_RATE
+	// The u32 form is accepted by all kernels, ~0U means no limit
+	const u32 value = (rate >= (u64)UINT32_MAX ? UINT32_MAX - 1 : rate);
+	return setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &value, sizeof(value));
+#	else
+	(void)fd;
+	(void)rate;
+	errno = ENOTSUP;
+	return -1;
+#	endif
+}
+
+void us_tcp_get_queues(int fd, us_tcp_queues_s *queues) {
+	queues->queued = -1;
+	queues->unsent = -1;
+	queues->sndbuf = -1;
+#	ifdef SIOCOUTQ
+	int queued;
+	if (ioctl(fd, SIOCOUTQ, &queued) == 0) {
+		queues->queued = queued;
+	}
+#	endif
+#	ifdef SIOCOUTQNSD
+	int unsent;
+	if (ioctl(fd, SIOCOUTQNSD, &unsent) == 0) {
+		queues->unsent = unsent;
+	}
+#	endif
+	int sndbuf;
+	socklen_t len = sizeof(sndbuf);
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == 0) {
+		queues->sndbuf = sndbuf;
+	}
+}
+
+
+#ifdef TEST_TCP
+// A 30 fps stream of 64 KiB frames to a reader which takes ~1 MiB/s over loopback.
+// Like the server, the sender starts a new frame only when the previous one
+// is fully written, and skips the frames meanwhile.
+//   gcc -O2 -std=c17 -D_GNU_SOURCE -DTEST_TCP -o tcp-test ustreamer/http/tcp.c -pthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <assert.h>
+
+#include <pthread.h>
+#include <arpa/inet.h>
+
+
+#define _FRAME_SIZE	(64 * 1024)
+#define _DURATION	6
+
+
+typedef struct {
+	int	fd;
+	ldf	max_latency; // For the last second
+	uint	frames;
+} _reader_s;
+
+static void *_reader_thread(void *v_reader) {
+	_reader_s *const reader = v_reader;
+	u8 *const frame = malloc(_FRAME_SIZE);
+	uz got = 0;
+	const ldf end_ts = us_get_now_monotonic() + _DURATION;
+	while (us_get_now_monotonic() < end_ts) {
+		const sz readed = read(reader->fd, frame + got, US_MIN((uz)8192, _FRAME_SIZE - got));
+		if (readed <= 0) {
+			break;
+		}
+		got += readed;
+		if (got == _FRAME_SIZE) {
+			ldf sent_ts;
+			memcpy(&sent_ts, frame, sizeof(sent_ts));
+			const ldf now_ts = us_get_now_monotonic();
+			if (now_ts > end_ts - 1) {
+				reader->max_latency = US_MAX(reader->max_latency, now_ts - sent_ts);
+			}
+			++reader->frames;
+			got = 0;
+		}
+		usleep(readed * 1000000 / (1024 * 1024)); // The slow network
+	}
+	free(frame);
+	close(reader->fd);
+	return NULL;
+}
+
+static ldf _run(uint lowat, uint *sent, uint *received) {
+	const int listener = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+	socklen_t len = sizeof(addr);
+	assert(!bind(listener, (struct sockaddr*)&addr, sizeof(addr)));
+	assert(!listen(listener, 1));
+	assert(!getsockname(listener, (struct sockaddr*)&addr, &len));
+
+	_reader_s reader = {.fd = socket(AF_INET, SOCK_STREAM, 0)};
+	// A small receive window instead of a long link, otherwise
+	// the loopback receiver would buffer everything itself.
+	const int rcvbuf = 32 * 1024;
+	assert(!setsockopt(reader.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)));
+	assert(!connect(reader.fd, (struct sockaddr*)&addr, sizeof(addr)));
+	const int fd = accept(listener, NULL, NULL);
+	assert(fd >= 0);
+	close(listener);
+	assert(us_tcp_is_inet(fd));
+	assert(!us_tcp_set_nodelay(fd));
+	if (lowat > 0) {
+		assert(!us_tcp_set_notsent_lowat(fd, lowat));
+	}
+	assert(!fcntl(fd, F_SETFL, O_NONBLOCK));
+
+	pthread_t tid;
+	assert(!pthread_create(&tid, NULL, _reader_thread, &reader));
+
+	u8 *const frame = calloc(1, _FRAME_SIZE);
+	uz left = 0;
+	ldf next_ts = us_get_now_monotonic();
+	*sent = 0;
+	while (true) {
+		const ldf now_ts = us_get_now_monotonic();
+		if (now_ts >= next_ts) {
+			next_ts += (ldf)1 / 30;
+			if (left == 0) { // Otherwise the frame is skipped
+				memcpy(frame, &now_ts, sizeof(now_ts));
+				left = _FRAME_SIZE;
+				++*sent;
+			}
+		}
+		if (left > 0) {
+			struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+			if (poll(&pfd, 1, 1) > 0) {
+				const sz written = write(fd, frame + _FRAME_SIZE - left, left);
+				if (written < 0) {
+					break; // The reader is done
+				}
+				left -= written;
+			}
+		} else {
+			usleep(1000);
+		}
+	}
+	pthread_join(tid, NULL);
+
+	us_tcp_queues_s queues;
+	us_tcp_get_queues(fd, &queues);
+	printf("  kernel: queued=%d, unsent=%d, sndbuf=%d\n", queues.queued, queues.unsent, queues.sndbuf);
+	close(fd);
+	free(frame);
+	*received = reader.frames;
+	return reader.max_latency;
+}
+
+int main(void) {
+	signal(SIGPIPE, SIG_IGN);
+	uint sent;
+	uint received;
+
+	const ldf latency_default = _run(0, &sent, &received);
+	printf("default:          latency=%.3Lf sec, sent=%u, received=%u\n", latency_default, sent, received);
+	const ldf latency_lowat = _run(16 * 1024, &sent, &received);
+	printf("notsent_lowat=16K: latency=%.3Lf sec, sent=%u, received=%u\n", latency_lowat, sent, received);
+
+	const bool ok = (latency_lowat < 0.3 && latency_lowat * 3 < latency_default);
+	puts(ok ? "OK" : "FAILED");
+	return !ok;
+}
+#endif
@@ -0,0 +1,44 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include "../../libs/types.h"
+
+
+typedef struct {
+	int	queued; // Sent but not acknowledged plus not sent yet, -1 if unavailable
+	int	unsent;
+	int	sndbuf;
+} us_tcp_queues_s;
+
+
+bool us_tcp_is_inet(int fd);
+
+// Return -1 and set errno, ENOTSUP if the option is not supported by the platform
+int us_tcp_set_nodelay(int fd);
+int us_tcp_set_notsent_lowat(int fd, uint lowat);
+int us_tcp_set_sndbuf(int fd, uint size);
+int us_tcp_set_pacing(int fd, u64 rate); // Bytes per second
+
+void us_tcp_get_queues(int fd, us_tcp_queues_s *queues);
@@ -39,6 +39,7 @@
 #include "../../libs/types.h"
 #include "../../libs/tools.h"
 #include "../../libs/logging.h"
+#include "../../libs/jpegtran.h"
 
 
 evutil_socket_t us_evhttp_bind_unix(struct evhttp *http, const char *path, bool rm, mode_t mode) {
@@ -140,6 +141,26 @@ char *us_evkeyvalq_get_string(struct evkeyvalq *params, const char *key) {
 	return NULL;
 }
 
+int us_evhttp_parse_crop(const char *uri, us_jpegtran_s *crop) {
+	struct evkeyvalq params;
+	evhttp_parse_query(uri, &params);
+	const char *const value = evhttp_find_header(&params, "crop");
+	int parsed = 0;
+	if (value != NULL) {
+		// WxH+X+Y, the query decoder turns "+" into spaces
+		char *const geometry = us_strdup(value);
+		for (char *ch = geometry; *ch != '\0'; ++ch) {
+			if (*ch == ' ') {
+				*ch = '+';
+			}
+		}
+		parsed = us_jpegtran_parse_crop(crop, geometry);
+		free(geometry);
+	}
+	evhttp_clear_headers(&params);
+	return parsed;
+}
+
 char *us_bufferevent_format_reason(short what) {
 	char *reason;
 	US_CALLOC(reason, 2048);
@@ -172,3 +193,56 @@ char *us_bufferevent_format_reason(short what) {
 	strcat(reason, ")");
 	return reason;
 }
+
+
+#ifdef FUZZ_HTTP_QUERY
+// Разбор query так же, как это делает server.c: action от совместимости
+// с MJPG-Streamer, параметры стрим-клиента и crop для /snapshot тем же
+// us_evhttp_parse_crop(), что и у сервера.
+//   clang -g -O1 -std=c17 -D_GNU_SOURCE -fsanitize=fuzzer,address,undefined -DUS_FUZZ_LIBFUZZER -DFUZZ_HTTP_QUERY -o fuzz-http-query ustreamer/http/tools.c libs/jpegtran.c libs/frame.c libs/pixel.c libs/logging.c -levent -ljpeg -lm -pthread
+//   gcc -g -O1 -std=c17 -D_GNU_SOURCE -fsanitize=address,undefined -DFUZZ_HTTP_QUERY -o fuzz-http-query ustreamer/http/tools.c libs/jpegtran.c libs/frame.c libs/pixel.c libs/logging.c -levent -ljpeg -lm -pthread
+
+#include "../../libs/capture.h"
+#include "../../libs/fuzz.h"
+
+
+const us_fuzz_seed_s us_fuzz_seeds[] = {
+	US_FUZZ_SEED("/stream"),
+	US_FUZZ_SEED("/?action=snapshot"),
+	US_FUZZ_SEED("/stream?key=abc&extra_headers=1&advance_headers=yes&dual_final_frames=true&zero_data=0"),
+	US_FUZZ_SEED("/snapshot?crop=640x480"),
+	US_FUZZ_SEED("/snapshot?crop=640x480+32+16"),
+	US_FUZZ_SEED("/snapshot?crop=640x480%2B32%2B16&key=%00%ff"),
+	US_FUZZ_SEED("/snapshot?crop=4294967295x1+0+0#frag"),
+};
+const uz us_fuzz_seeds_count = US_ARRAY_LEN(us_fuzz_seeds);
+
+void us_fuzz_one(const u8 *data, uz size) {
+	char *uri;
+	US_CALLOC(uri, size + 1);
+	memcpy(uri, data, size);
+
+	struct evkeyvalq params;
+	if (evhttp_parse_query(uri, &params) == 0) {
+		const char *const action = evhttp_find_header(&params, "action");
+		if (action != NULL) {
+			assert(strlen(action) <= size);
+		}
+
+		free(us_evkeyvalq_get_string(&params, "key"));
+		us_evkeyvalq_get_true(&params, "extra_headers");
+		us_evkeyvalq_get_true(&params, "advance_headers");
+		us_evkeyvalq_get_true(&params, "dual_final_frames");
+		us_evkeyvalq_get_true(&params, "zero_data");
+	}
+	evhttp_clear_headers(&params);
+
+	us_jpegtran_s crop = {0};
+	if (us_evhttp_parse_crop(uri, &crop) == 0 && crop.crop_width > 0) {
+		assert(crop.crop_width <= US_VIDEO_MAX_WIDTH && crop.crop_height > 0 && crop.crop_height <= US_VIDEO_MAX_HEIGHT);
+		assert(crop.crop_left < US_VIDEO_MAX_WIDTH && crop.crop_top < US_VIDEO_MAX_HEIGHT);
+	}
+	free(uri);
+}
+
+#endif
@@ -28,6 +28,7 @@
 #include <event2/keyvalq_struct.h>
 
 #include "../../libs/types.h"
+#include "../../libs/jpegtran.h"
 
 
 evutil_socket_t us_evhttp_bind_unix(struct evhttp *http, const char *path, bool rm, mode_t mode);
@@ -38,4 +39,7 @@ char *us_evhttp_get_hostport(struct evhttp_request *request);
 bool us_evkeyvalq_get_true(struct evkeyvalq *params, const char *key);
 char *us_evkeyvalq_get_string(struct evkeyvalq *params, const char *key);
 
+// The crop=WxH+X+Y parameter of the URI, the crop is unchanged without it
+int us_evhttp_parse_crop(const char *uri, us_jpegtran_s *crop);
+
 char *us_bufferevent_format_reason(short what);
@@ -31,6 +31,9 @@
 #include <assert.h>
 
 #include <sys/mman.h>
+#ifdef TEST_M2M
+#	include <stdio.h>
+#endif
 
 #ifdef __APPLE__
 #include "../libs/macos_v4l2_stub.h"
@@ -569,3 +572,69 @@ error: // Mostly for _E_XIOCTL
 }
 
 #undef _E_XIOCTL
+
+#ifdef TEST_M2M
+
+// Measures the synchronous per-frame round trip of the encoder,
+// with a resolution change in the middle. Without hardware, use the emulator:
+//   $ cc -O2 -DTEST_M2M -D_GNU_SOURCE ustreamer/m2m.c libs/frame.c libs/pixel.c libs/logging.c -lm -pthread -o /tmp/test-m2m
+//   $ LD_PRELOAD=./ustreamer-m2m-emu.so /tmp/test-m2m [h264|mjpeg|jpeg] [frames]
+
+int main(int argc, char **argv) {
+	US_LOGGING_INIT;
+	us_g_log_level = US_LOG_LEVEL_VERBOSE;
+
+	const char *const type = (argc > 1 ? argv[1] : "h264");
+	const uint n_frames = (argc > 2 ? (uint)atoi(argv[2]) : 300);
+
+	us_m2m_encoder_s *enc;
+	if (!strcmp(type, "h264")) {
+		enc = us_m2m_h264_encoder_init("TEST-H264", NULL, 5000, 30);
+	} else if (!strcmp(type, "mjpeg")) {
+		enc = us_m2m_mjpeg_encoder_init("TEST-MJPEG", NULL, 80);
+	} else {
+		enc = us_m2m_jpeg_encoder_init("TEST-JPEG", NULL, 80);
+	}
+
+	us_frame_s *const src = us_frame_init();
+	us_frame_s *const dest = us_frame_init();
+	uint errors = 0;
+	uint keys = 0;
+	ldf sum = 0;
+	ldf max = 0;
+
+	for (uint number = 0; number < n_frames; ++number) {
+		src->width = (number < n_frames / 2 ? 640 : 1280);
+		src->height = (number < n_frames / 2 ? 480 : 720);
+		src->format = V4L2_PIX_FMT_YUYV;
+		src->stride = src->width * 2;
+		src->online = true;
+		us_frame_realloc_data(src, src->stride * src->height);
+		src->used = src->stride * src->height;
+		for (uz index = 0; index < src->used; ++index) {
+			src->data[index] = (index + number * 4) & 0xFF;
+		}
+
+		const ldf begin_ts = us_get_now_monotonic();
+		if (us_m2m_encoder_compress(enc, src, dest, (number % 100 == 99)) < 0) {
+			++errors;
+			continue;
+		}
+		const ldf spent = us_get_now_monotonic() - begin_ts;
+		sum += spent;
+		max = US_MAX(max, spent);
+		keys += dest->key;
+	}
+
+	const uint ok = n_frames - errors;
+	printf("frames=%u, errors=%u, keys=%u, round_trip_avg=%.3Lf ms, round_trip_max=%.3Lf ms\n",
+		ok, errors, keys, (ok > 0 ? sum * 1000 / ok : 0), max * 1000);
+
+	us_frame_destroy(dest);
+	us_frame_destroy(src);
+	us_m2m_encoder_destroy(enc);
+	US_LOGGING_DESTROY;
+	return (ok > 0 ? 0 : -1);
+}
+
+#endif
@@ -34,6 +34,8 @@
 #include "options.h"
 #include "encoder.h"
 #include "stream.h"
+#include "watchdog.h"
+#include "governor.h"
 #include "http/server.h"
 #ifdef WITH_GPIO
 #	include "gpio/gpio.h"
@@ -60,6 +62,22 @@ static void *_stream_loop_thread(void *arg) {
 	return NULL;
 }
 
+static void *_watchdog_loop_thread(void *arg) {
+	(void)arg;
+	US_THREAD_SETTLE("watchdog");
+	_block_thread_signals();
+	us_watchdog_loop(_g_stream->run->watchdog);
+	return NULL;
+}
+
+static void *_governor_loop_thread(void *arg) {
+	(void)arg;
+	US_THREAD_SETTLE("governor");
+	_block_thread_signals();
+	us_governor_loop(_g_stream->run->governor, _g_stream->enc);
+	return NULL;
+}
+
 static void *_server_loop_thread(void *arg) {
 	(void)arg;
 	US_THREAD_SETTLE("http");
@@ -74,6 +92,8 @@ static void _signal_handler(int signum) {
 	free(name);
 	us_stream_loop_break(_g_stream);
 	us_server_loop_break(_g_server);
+	us_watchdog_loop_break(_g_stream->run->watchdog);
+	us_governor_loop_break(_g_stream->run->governor);
 }
 
 int main(int argc, char *argv[]) {
@@ -104,10 +124,25 @@ int main(int argc, char *argv[]) {
 
 			pthread_t stream_loop_tid;
 			pthread_t server_loop_tid;
+			pthread_t watchdog_loop_tid;
+			pthread_t governor_loop_tid;
+			const bool governor = _g_stream->run->governor->enabled;
+			if (governor) {
+				// The stream thread reads the tiers on the capture opening
+				us_governor_prepare(_g_stream->run->governor, cap->jpeg_quality);
+			}
 			US_THREAD_CREATE(stream_loop_tid, _stream_loop_thread, NULL);
 			US_THREAD_CREATE(server_loop_tid, _server_loop_thread, NULL);
+			US_THREAD_CREATE(watchdog_loop_tid, _watchdog_loop_thread, NULL);
+			if (governor) {
+				US_THREAD_CREATE(governor_loop_tid, _governor_loop_thread, NULL);
+			}
 			US_THREAD_JOIN(server_loop_tid);
 			US_THREAD_JOIN(stream_loop_tid);
+			US_THREAD_JOIN(watchdog_loop_tid);
+			if (governor) {
+				US_THREAD_JOIN(governor_loop_tid);
+			}
 		}
 
 #		ifdef WITH_GPIO
@@ -62,8 +62,22 @@ enum _US_OPT_VALUES {
 
 	_O_DEVICE_TIMEOUT = 10000,
 	_O_DEVICE_ERROR_DELAY,
+	_O_LAST_FRAME,
+	_O_MOSAIC,
+	_O_MOSAIC_COLUMNS,
 	_O_FORMAT_SWAP_RGB,
 	_O_M2M_DEVICE,
+	_O_HUFFMAN_INTERVAL,
+	_O_JPEG_SUBSAMPLING,
+	_O_JPEG_GRAYSCALE,
+	_O_JPEG_DCT,
+	_O_JPEG_ROTATE,
+	_O_JPEG_FLIP_VERTICAL,
+	_O_JPEG_FLIP_HORIZONTAL,
+	_O_JPEG_CROP,
+	_O_PRIVACY_MASK,
+	_O_HEALTH_INTERVAL,
+	_O_HEALTH_OFFLINE,
 
 	_O_IMAGE_DEFAULT,
 	_O_BRIGHTNESS,
@@ -85,8 +99,18 @@ enum _US_OPT_VALUES {
 	_O_STATIC,
 	_O_ALLOW_ORIGIN,
 	_O_INSTANCE_ID,
+	_O_ENCODER_CONTROL,
+	_O_BURST_MAX,
+	_O_BURST_PRETRIGGER,
 	_O_TCP_NODELAY,
+	_O_TCP_NOTSENT_LOWAT,
+	_O_TCP_SNDBUF_FRAMES,
+	_O_TCP_PACING,
+	_O_STREAM_PACING,
 	_O_SERVER_TIMEOUT,
+#	ifdef WITH_HTTP2
+	_O_H2_PORT,
+#	endif
 
 #	define ADD_SINK(x_prefix) \
 		_O_##x_prefix, \
@@ -118,6 +142,19 @@ enum _US_OPT_VALUES {
 	_O_EXIT_ON_PARENT_DEATH,
 #	endif
 	_O_EXIT_ON_NO_CLIENTS,
+	_O_WATCHDOG_TIMEOUT,
+	_O_WATCHDOG_RESTART,
+	_O_GOVERNOR,
+	_O_GOVERNOR_SYSFS,
+	_O_GOVERNOR_TEMP_HIGH,
+	_O_GOVERNOR_TEMP_LOW,
+	_O_GOVERNOR_LOAD_HIGH,
+	_O_GOVERNOR_LOAD_LOW,
+	_O_GOVERNOR_QUALITY_MIN,
+	_O_GOVERNOR_FPS_MIN,
+	_O_GOVERNOR_RESOLUTIONS,
+	_O_GOVERNOR_DOWN_DELAY,
+	_O_GOVERNOR_UP_DELAY,
 #	ifdef WITH_SETPROCTITLE
 	_O_PROCESS_NAME_PREFIX,
 #	endif
@@ -156,7 +193,21 @@ static const struct option _LONG_OPTS[] = {
 	{"slowdown",				no_argument,		NULL,	_O_SLOWDOWN},
 	{"device-timeout",			required_argument,	NULL,	_O_DEVICE_TIMEOUT},
 	{"device-error-delay",		required_argument,	NULL,	_O_DEVICE_ERROR_DELAY},
+	{"last-frame",				required_argument,	NULL,	_O_LAST_FRAME},
+	{"mosaic",					required_argument,	NULL,	_O_MOSAIC},
+	{"mosaic-columns",			required_argument,	NULL,	_O_MOSAIC_COLUMNS},
 	{"m2m-device",				required_argument,	NULL,	_O_M2M_DEVICE},
+	{"huffman-interval",		required_argument,	NULL,	_O_HUFFMAN_INTERVAL},
+	{"jpeg-subsampling",		required_argument,	NULL,	_O_JPEG_SUBSAMPLING},
+	{"jpeg-grayscale",			no_argument,		NULL,	_O_JPEG_GRAYSCALE},
+	{"jpeg-dct",				required_argument,	NULL,	_O_JPEG_DCT},
+	{"jpeg-rotate",				required_argument,	NULL,	_O_JPEG_ROTATE},
+	{"jpeg-flip-vertical",		no_argument,		NULL,	_O_JPEG_FLIP_VERTICAL},
+	{"jpeg-flip-horizontal",	no_argument,		NULL,	_O_JPEG_FLIP_HORIZONTAL},
+	{"jpeg-crop",				required_argument,	NULL,	_O_JPEG_CROP},
+	{"privacy-mask",			required_argument,	NULL,	_O_PRIVACY_MASK},
+	{"health-interval",			required_argument,	NULL,	_O_HEALTH_INTERVAL},
+	{"health-offline",			no_argument,		NULL,	_O_HEALTH_OFFLINE},
 
 	{"image-default",			no_argument,		NULL,	_O_IMAGE_DEFAULT},
 	{"brightness",				required_argument,	NULL,	_O_BRIGHTNESS},
@@ -185,11 +236,21 @@ static const struct option _LONG_OPTS[] = {
 	{"passwd",					required_argument,	NULL,	_O_PASSWD},
 	{"static",					required_argument,	NULL,	_O_STATIC},
 	{"drop-same-frames",		required_argument,	NULL,	_O_DROP_SAME_FRAMES},
+	{"stream-pacing",			required_argument,	NULL,	_O_STREAM_PACING},
 	{"allow-origin",			required_argument,	NULL,	_O_ALLOW_ORIGIN},
 	{"instance-id",				required_argument,	NULL,	_O_INSTANCE_ID},
+	{"encoder-control",			no_argument,		NULL,	_O_ENCODER_CONTROL},
+	{"burst-max",				required_argument,	NULL,	_O_BURST_MAX},
+	{"burst-pretrigger",		required_argument,	NULL,	_O_BURST_PRETRIGGER},
 	{"fake-resolution",			required_argument,	NULL,	_O_FAKE_RESOLUTION},
 	{"tcp-nodelay",				no_argument,		NULL,	_O_TCP_NODELAY},
+	{"tcp-notsent-lowat",		required_argument,	NULL,	_O_TCP_NOTSENT_LOWAT},
+	{"tcp-sndbuf-frames",		required_argument,	NULL,	_O_TCP_SNDBUF_FRAMES},
+	{"tcp-pacing",				required_argument,	NULL,	_O_TCP_PACING},
 	{"server-timeout",			required_argument,	NULL,	_O_SERVER_TIMEOUT},
+#	ifdef WITH_HTTP2
+	{"h2-port",					required_argument,	NULL,	_O_H2_PORT},
+#	endif
 
 #	define ADD_SINK(x_opt, x_prefix) \
 		{x_opt "-sink",				required_argument,	NULL,	_O_##x_prefix}, \
@@ -228,6 +289,19 @@ static const struct option _LONG_OPTS[] = {
 	{"exit-on-parent-death",	no_argument,		NULL,	_O_EXIT_ON_PARENT_DEATH},
 #	endif
 	{"exit-on-no-clients",		required_argument,	NULL,	_O_EXIT_ON_NO_CLIENTS},
+	{"watchdog-timeout",		required_argument,	NULL,	_O_WATCHDOG_TIMEOUT},
+	{"watchdog-restart",		no_argument,		NULL,	_O_WATCHDOG_RESTART},
+	{"governor",				no_argument,		NULL,	_O_GOVERNOR},
+	{"governor-sysfs",			required_argument,	NULL,	_O_GOVERNOR_SYSFS},
+	{"governor-temp-high",		required_argument,	NULL,	_O_GOVERNOR_TEMP_HIGH},
+	{"governor-temp-low",		required_argument,	NULL,	_O_GOVERNOR_TEMP_LOW},
+	{"governor-load-high",		required_argument,	NULL,	_O_GOVERNOR_LOAD_HIGH},
+	{"governor-load-low",		required_argument,	NULL,	_O_GOVERNOR_LOAD_LOW},
+	{"governor-quality-min",	required_argument,	NULL,	_O_GOVERNOR_QUALITY_MIN},
+	{"governor-fps-min",		required_argument,	NULL,	_O_GOVERNOR_FPS_MIN},
+	{"governor-resolutions",	required_argument,	NULL,	_O_GOVERNOR_RESOLUTIONS},
+	{"governor-down-delay",		required_argument,	NULL,	_O_GOVERNOR_DOWN_DELAY},
+	{"governor-up-delay",		required_argument,	NULL,	_O_GOVERNOR_UP_DELAY},
 #	ifdef WITH_SETPROCTITLE
 	{"process-name-prefix",		required_argument,	NULL,	_O_PROCESS_NAME_PREFIX},
 #	endif
@@ -272,6 +346,7 @@ void us_options_destroy(us_options_s *options) {
 	US_DELETE(options->jpeg_sink, us_memsink_destroy);
 	US_DELETE(options->raw_sink, us_memsink_destroy);
 	US_DELETE(options->h264_sink, us_memsink_destroy);
+	US_DELETE(options->mosaic, us_mosaic_destroy);
 #	ifdef WITH_V4P
 	US_DELETE(options->drm, us_drm_destroy);
 #	endif
@@ -365,6 +440,8 @@ int options_parse(us_options_s *options, us_capture_s *cap, us_encoder_s *enc, u
 	ADD_SINK(h264_sink);
 #	undef ADD_SINK
 
+	uint mosaic_columns = 0;
+
 #	ifdef WITH_SETPROCTITLE
 	const char *process_name_prefix = NULL;
 #	endif
@@ -399,7 +476,40 @@ int options_parse(us_options_s *options, us_capture_s *cap, us_encoder_s *enc, u
 			case _O_SLOWDOWN:			OPT_SET(stream->slowdown, true);
 			case _O_DEVICE_TIMEOUT:		OPT_NUMBER("--device-timeout", cap->timeout, 1, 60, 0);
 			case _O_DEVICE_ERROR_DELAY:	OPT_NUMBER("--device-error-delay", stream->error_delay, 1, 60, 0);
+			case _O_LAST_FRAME:			OPT_SET(stream->last_frame_path, optarg);
+			case _O_MOSAIC:
+				if (options->mosaic == NULL) {
+					options->mosaic = us_mosaic_init();
+				}
+				if (us_mosaic_parse_sinks(options->mosaic, optarg) < 0) {
+					printf("Invalid mosaic sinks: %s; expected up to %u comma-separated sink names\n", optarg, US_MOSAIC_MAX_TILES);
+					return -1;
+				}
+				cap->mosaic = options->mosaic;
+				break;
+			case _O_MOSAIC_COLUMNS:		OPT_NUMBER("--mosaic-columns", mosaic_columns, 0, US_MOSAIC_MAX_TILES, 0);
 			case _O_M2M_DEVICE:			OPT_SET(enc->m2m_path, optarg);
+			case _O_HUFFMAN_INTERVAL:	OPT_NUMBER("--huffman-interval", enc->huffman_interval, 0, 10000, 0);
+			case _O_JPEG_SUBSAMPLING:	OPT_PARSE_ENUM("JPEG subsampling", enc->cpu.subsampling, us_cpu_encoder_parse_subsampling, US_CPU_ENCODER_SUBSAMPLINGS_STR);
+			case _O_JPEG_GRAYSCALE:		OPT_SET(enc->cpu.grayscale, true);
+			case _O_JPEG_DCT:			OPT_PARSE_ENUM("JPEG DCT method", enc->cpu.dct, us_cpu_encoder_parse_dct, US_CPU_ENCODER_DCTS_STR);
+			case _O_JPEG_ROTATE:		OPT_PARSE_ENUM("JPEG rotation", enc->jpegtran.rotate, us_jpegtran_parse_rotate, "0, 90, 180, 270");
+			case _O_JPEG_FLIP_VERTICAL:		OPT_SET(enc->jpegtran.flip_vertical, true);
+			case _O_JPEG_FLIP_HORIZONTAL:	OPT_SET(enc->jpegtran.flip_horizontal, true);
+			case _O_JPEG_CROP:
+				if (us_jpegtran_parse_crop(&enc->jpegtran, optarg) < 0) {
+					printf("Invalid JPEG crop geometry: %s; expected WxH or WxH+X+Y\n", optarg);
+					return -1;
+				}
+				break;
+			case _O_PRIVACY_MASK:
+				if (us_privacy_parse(stream->run->privacy, optarg) < 0) {
+					printf("Invalid privacy mask: %s; expected WxH+X+Y or X,Y/X,Y/X,Y shapes separated by ';'\n", optarg);
+					return -1;
+				}
+				break;
+			case _O_HEALTH_INTERVAL:	OPT_NUMBER("--health-interval", stream->run->health->interval, 0, 1000, 0);
+			case _O_HEALTH_OFFLINE:		OPT_SET(stream->health_offline, true);
 
 			case _O_IMAGE_DEFAULT:
 				OPT_CTL_DEFAULT_NOBREAK(brightness);
@@ -442,6 +552,7 @@ int options_parse(us_options_s *options, us_capture_s *cap, us_encoder_s *enc, u
 			case _O_PASSWD:				OPT_SET(server->passwd, optarg);
 			case _O_STATIC:				OPT_SET(server->static_path, optarg);
 			case _O_DROP_SAME_FRAMES:	OPT_NUMBER("--drop-same-frames", server->drop_same_frames, 0, US_VIDEO_MAX_FPS, 0);
+			case _O_STREAM_PACING:		OPT_NUMBER("--stream-pacing", server->stream_pacing, 0, 1000, 0);
 			case _O_FAKE_RESOLUTION:	OPT_RESOLUTION("--fake-resolution", server->fake_width, server->fake_height, false);
 			case _O_ALLOW_ORIGIN:		OPT_SET(server->allow_origin, optarg);
 			case _O_INSTANCE_ID:
@@ -451,8 +562,17 @@ int options_parse(us_options_s *options, us_capture_s *cap, us_encoder_s *enc, u
 				}
 				server->instance_id = optarg;
 				break;
+			case _O_ENCODER_CONTROL:	OPT_SET(server->encoder_control, true);
+			case _O_BURST_MAX:			OPT_NUMBER("--burst-max", stream->run->burst->max, 0, 1000, 0);
+			case _O_BURST_PRETRIGGER:	OPT_NUMBER("--burst-pretrigger", stream->run->burst->pretrigger, 0, 100, 0);
 			case _O_TCP_NODELAY:		OPT_SET(server->tcp_nodelay, true);
+			case _O_TCP_NOTSENT_LOWAT:	OPT_NUMBER("--tcp-notsent-lowat", server->tcp_notsent_lowat, 0, 16 * 1024 * 1024, 0);
+			case _O_TCP_SNDBUF_FRAMES:	OPT_NUMBER("--tcp-sndbuf-frames", server->tcp_sndbuf_frames, 0, 32, 0);
+			case _O_TCP_PACING:			OPT_NUMBER("--tcp-pacing", server->tcp_pacing, 0, 1000, 0);
 			case _O_SERVER_TIMEOUT:		OPT_NUMBER("--server-timeout", server->timeout, 1, 60, 0);
+#			ifdef WITH_HTTP2
+			case _O_H2_PORT:			OPT_NUMBER("--h2-port", server->h2_port, 1, 65535, 0);
+#			endif
 
 #			define ADD_SINK(x_opt, x_lp, x_up) \
 				case _O_##x_up:					OPT_SET(x_lp##_name, optarg); \
@@ -491,6 +611,30 @@ int options_parse(us_options_s *options, us_capture_s *cap, us_encoder_s *enc, u
 				break;
 #			endif
 			case _O_EXIT_ON_NO_CLIENTS:		OPT_NUMBER("--exit-on-no-clients", stream->exit_on_no_clients, 0, 86400, 0);
+			case _O_WATCHDOG_TIMEOUT:
+				if (us_watchdog_parse_timeouts(stream->run->watchdog, optarg) < 0) {
+					printf("Invalid watchdog timeouts: %s; expected N or stage=N,... in seconds\n", optarg);
+					return -1;
+				}
+				break;
+			case _O_WATCHDOG_RESTART:		OPT_SET(stream->run->watchdog->restart, true);
+			case _O_GOVERNOR:				OPT_SET(stream->run->governor->enabled, true);
+			case _O_GOVERNOR_SYSFS:			OPT_SET(stream->run->governor->sysfs, optarg);
+			case _O_GOVERNOR_TEMP_HIGH:		OPT_NUMBER("--governor-temp-high", stream->run->governor->temp_high, 1, 150, 0);
+			case _O_GOVERNOR_TEMP_LOW:		OPT_NUMBER("--governor-temp-low", stream->run->governor->temp_low, 1, 150, 0);
+			case _O_GOVERNOR_LOAD_HIGH:		OPT_NUMBER("--governor-load-high", stream->run->governor->load_high, 1, 100, 0);
+			case _O_GOVERNOR_LOAD_LOW:		OPT_NUMBER("--governor-load-low", stream->run->governor->load_low, 0, 100, 0);
+			case _O_GOVERNOR_QUALITY_MIN:	OPT_NUMBER("--governor-quality-min", stream->run->governor->quality_min, 1, 100, 0);
+			case _O_GOVERNOR_FPS_MIN:		OPT_NUMBER("--governor-fps-min", stream->run->governor->fps_min, 1, US_VIDEO_MAX_FPS, 0);
+			case _O_GOVERNOR_RESOLUTIONS:
+				if (us_governor_parse_resolutions(stream->run->governor, optarg) < 0) {
+					printf("Invalid governor resolutions: %s; expected WxH,... up to %u items\n",
+						optarg, US_GOVERNOR_MAX_RESOLUTIONS);
+					return -1;
+				}
+				break;
+			case _O_GOVERNOR_DOWN_DELAY:	OPT_NUMBER("--governor-down-delay", stream->run->governor->down_delay, 1, 3600, 0);
+			case _O_GOVERNOR_UP_DELAY:		OPT_NUMBER("--governor-up-delay", stream->run->governor->up_delay, 1, 3600, 0);
 #			ifdef WITH_SETPROCTITLE
 			case _O_PROCESS_NAME_PREFIX:	OPT_SET(process_name_prefix, optarg);
 #			endif
@@ -533,6 +677,10 @@ int options_parse(us_options_s *options, us_capture_s *cap, us_encoder_s *enc, u
 	ADD_SINK("H264", h264_sink);
 #	undef ADD_SINK
 
+	if (options->mosaic != NULL) {
+		options->mosaic->columns = mosaic_columns;
+	}
+
 #	ifdef WITH_SETPROCTITLE
 	if (process_name_prefix != NULL) {
 		us_process_set_name_prefix(options->argc, options->argv, process_name_prefix);
@@ -599,6 +747,12 @@ static void _features(void) {
 	puts("- WITH_V4P");
 #	endif
 
+#	ifdef MK_WITH_ACAP
+	puts("+ WITH_ACAP");
+#	else
+	puts("- WITH_ACAP");
+#	endif
+
 #	ifdef MK_WITH_GPIO
 	puts("+ WITH_GPIO");
 #	else
@@ -611,6 +765,12 @@ static void _features(void) {
 	puts("- WITH_SYSTEMD");
 #	endif
 
+#	ifdef MK_WITH_HTTP2
+	puts("+ WITH_HTTP2");
+#	else
+	puts("- WITH_HTTP2");
+#	endif
+
 #	ifdef MK_WITH_PTHREAD_NP
 	puts("+ WITH_PTHREAD_NP");
 #	else
@@ -682,8 +842,44 @@ static void _help(FILE *fp, const us_capture_s *cap, const us_encoder_s *enc, co
 	SAY("                                           are connected. Useful to reduce CPU consumption. Default: disabled.\n");
 	SAY("    --device-timeout <sec>  ────────────── Timeout for device querying. Default: %u.\n", cap->timeout);
 	SAY("    --device-error-delay <sec>  ────────── Delay before trying to connect to the device again");
-	SAY("                                           after an error (timeout for example). Default: %u.\n", stream->error_delay);
+	SAY("                                           after an error (timeout for example). The first retries");
+	SAY("                                           are quicker, starting from 0.1 sec. Default: %u.\n", stream->error_delay);
+	SAY("    --last-frame <path>  ───────────────── Save the last live JPEG to this file on exit and serve it");
+	SAY("                                           as an offline frame after the start until the capture is ready.");
+	SAY("                                           Default: disabled.\n");
+	SAY("    --mosaic <sink1,sink2,...>  ────────── Compose the JPEG or RAW sinks into one grid frame of --resolution");
+	SAY("                                           instead of capturing the device. The JPEG tiles are decoded");
+	SAY("                                           with the DCT scaling, the unchanged ones are not decoded again.");
+	SAY("                                           The rate is --desired-fps or 10 by default. Default: disabled.\n");
+	SAY("    --mosaic-columns <N>  ──────────────── Number of the mosaic columns. Default: auto.\n");
 	SAY("    --m2m-device </dev/path>  ──────────── Path to V4L2 M2M encoder device. Default: auto select.\n");
+	SAY("    --huffman-interval <N>  ────────────── Compute optimized Huffman tables on a frame and reuse them");
+	SAY("                                           for the next N frames or until a scene change. It reduces");
+	SAY("                                           the JPEG size at almost no CPU cost. CPU encoder only.");
+	SAY("                                           Default: %u (standard tables).\n", enc->huffman_interval);
+	SAY("    --jpeg-subsampling <444|422|420>  ──── Chroma subsampling of the CPU encoder. 4:4:4 keeps the colored");
+	SAY("                                           text sharp at a bigger size. Default: 420.\n");
+	SAY("    --jpeg-grayscale  ──────────────────── Encode only the luma by the CPU encoder. Default: disabled.\n");
+	SAY("    --jpeg-dct <ISLOW|IFAST|FLOAT>  ────── DCT method of the CPU encoder. IFAST is faster and slightly");
+	SAY("                                           less accurate. Default: ISLOW.\n");
+	SAY("    --jpeg-rotate <0|90|180|270>  ──────── Rotate the encoded JPEG losslessly in the DCT domain.");
+	SAY("                                           Useful if the camera ignores --rotate. Default: 0.\n");
+	SAY("    --jpeg-flip-vertical  ──────────────── Flip the encoded JPEG vertically (before rotation). Default: disabled.\n");
+	SAY("    --jpeg-flip-horizontal  ────────────── Flip the encoded JPEG horizontally (before rotation). Default: disabled.\n");
+	SAY("    --jpeg-crop <WxH[+X+Y]>  ───────────── Crop the encoded JPEG losslessly, in the output coordinates.");
+	SAY("                                           The offset is aligned down to 8 or 16 pixels. Default: disabled.\n");
+	SAY("    --privacy-mask <shapes>  ───────────── Black out the areas of the raw frame before any encoding and sinks.");
+	SAY("                                           Shapes are separated by ';': WxH+X+Y for a rectangle");
+	SAY("                                           or X,Y/X,Y/X,Y[/...] for a polygon, each number can be in %%.");
+	SAY("                                           The frames from MJPEG/JPEG sources are dropped. Default: disabled.\n");
+	SAY("    --health-interval <N>  ─────────────── Check every Nth raw frame for the black, frozen, noisy or blurry");
+	SAY("                                           picture using the sampled luma. The state and the statistics");
+	SAY("                                           are shown in /state, changes are logged. MJPEG/JPEG frames");
+	SAY("                                           are decoded at 1/8 scale for it, about 1%% of a core at 1080p");
+	SAY("                                           and 30 fps with N=10, and their noise is reported as unknown.");
+	SAY("                                           Default: %u (disabled).\n", stream->run->health->interval);
+	SAY("    --health-offline  ──────────────────── Mark the unhealthy frames as offline, including the GPIO");
+	SAY("                                           stream-online signal. Default: disabled.\n");
 	SAY("Image control options:");
 	SAY("══════════════════════");
 	SAY("    --image-default  ────────────────────── Reset all image settings below to default. Default: no change.\n");
@@ -710,6 +906,11 @@ static void _help(FILE *fp, const us_capture_s *cap, const us_encoder_s *enc, co
 	SAY("    -M|--unix-mode <mode>  ────── Set UNIX socket file permissions (like 777). Default: disabled.\n");
 #	ifdef WITH_SYSTEMD
 	SAY("    -S|--systemd  ─────────────── Bind to systemd socket for socket activation.\n");
+#	endif
+#	ifdef WITH_HTTP2
+	SAY("    --h2-port <N>  ────────────── Also serve HTTP/2 with prior knowledge (h2c) on this TCP port.");
+	SAY("                                  Streams, snapshots and /state share one connection,");
+	SAY("                                  static files are not served. Default: disabled.\n");
 #	endif
 	SAY("    --user <name>  ────────────── HTTP basic auth user. Default: disabled.\n");
 	SAY("    --passwd <str>  ───────────── HTTP basic auth passwd. Default: empty.\n");
@@ -719,12 +920,36 @@ static void _help(FILE *fp, const us_capture_s *cap, const us_encoder_s *enc, co
 	SAY("                                  It can significantly reduce the outgoing traffic, but will increase");
 	SAY("                                  the CPU loading. Don't use this option with analog signal sources");
 	SAY("                                  or webcams, it's useless. Default: disabled.\n");
+	SAY("    --stream-pacing <ms>  ─────── Release the frames to the /stream clients by the smoothed schedule");
+	SAY("                                  of the capture timestamps instead of the encoding completion order.");
+	SAY("                                  The latency budget adapts to the jitter up to the specified value.");
+	SAY("                                  Default: disabled.\n");
 	SAY("    -R|--fake-resolution <WxH>  ─ Override image resolution for the /state. Default: disabled.\n");
 	SAY("    --tcp-nodelay  ────────────── Set TCP_NODELAY flag to the client /stream socket. Only for TCP socket.");
 	SAY("                                  Default: disabled.\n");
+	SAY("    --tcp-notsent-lowat <bytes>  ─ Set TCP_NOTSENT_LOWAT to the client /stream socket, so the kernel");
+	SAY("                                  keeps only this amount of unsent data and slow clients get the fresh");
+	SAY("                                  frames instead of the stale queue. Only for TCP socket. Default: disabled.\n");
+	SAY("    --tcp-sndbuf-frames <N>  ──── Size SO_SNDBUF of the client /stream socket to fit N average frames.");
+	SAY("                                  It's retuned when the frame size changes. Only for TCP socket.");
+	SAY("                                  Default: disabled.\n");
+	SAY("    --tcp-pacing <%%>  ─────────── Limit the sending rate of the client /stream socket by SO_MAX_PACING_RATE");
+	SAY("                                  to the specified percentage of the stream bitrate (avg frame size");
+	SAY("                                  multiplied by queued fps). Needs the fq qdisc or TCP internal pacing.");
+	SAY("                                  Only for TCP socket. Default: disabled.\n");
 	SAY("    --allow-origin <str>  ─────── Set Access-Control-Allow-Origin header. Default: disabled.\n");
 	SAY("    --instance-id <str>  ──────── A short string identifier to be displayed in the /state handle.");
 	SAY("                                  It must satisfy regexp ^[a-zA-Z0-9\\./+_-]*$. Default: an empty string.\n");
+	SAY("    --encoder-control  ────────── Allow changing the CPU encoder subsampling, grayscale and DCT method");
+	SAY("                                  at runtime via /encoder?subsampling=...&grayscale=...&dct=...");
+	SAY("                                  Default: disabled, /encoder is read-only.\n");
+	SAY("    --burst-max <N>  ──────────── Allow /burst?count=N&pre=M to get up to N next captured frames");
+	SAY("                                  as multipart/mixed JPEGs with their sequence numbers and timestamps.");
+	SAY("                                  They are encoded by the CPU in one background thread with a lower");
+	SAY("                                  priority. Default: 0 (disabled).\n");
+	SAY("    --burst-pretrigger <M>  ───── Keep the copies of the last M raw frames for the pre-trigger");
+	SAY("                                  part of /burst. It costs a copy per frame in a separate thread.");
+	SAY("                                  Default: 0 (disabled).\n");
 	SAY("    --server-timeout <sec>  ───── Timeout for client connections. Default: %u.\n", server->timeout);
 #	define ADD_SINK(x_name, x_opt) \
 		SAY(x_name " sink options:"); \
@@ -767,6 +992,28 @@ static void _help(FILE *fp, const us_capture_s *cap, const us_encoder_s *enc, co
 #	endif
 	SAY("    --exit-on-no-clients <sec> ──── Exit the program if there have been no stream or sink clients");
 	SAY("                                    or any HTTP requests in the last N seconds. Default: 0 (disabled)\n");
+	SAY("    --watchdog-timeout <N|stage=N,...>  Report a stage as stalled if it's busy for more than N seconds.");
+	SAY("                                    Stages: capture, releasers, jpeg, h264, sinks, http; 0 to disable.");
+	SAY("                                    The stalls are shown in /state, systemd WATCHDOG=1 pings are sent");
+	SAY("                                    only while nothing is stalled (WITH_SYSTEMD). Default: 10.\n");
+	SAY("    --watchdog-restart  ─────────── Restart the capture session with its workers on a stall. Default: disabled.\n");
+	SAY("    --governor  ─────────────────── Step the JPEG quality, then the frame rate and then the resolution down");
+	SAY("                                    and back up by the SoC temperature trend, the throttling flags");
+	SAY("                                    and the load of the JPEG workers. The state is shown in /state.");
+	SAY("                                    Default: disabled.\n");
+	SAY("    --governor-sysfs <path>  ────── The sysfs root for the thermal zones and the Raspberry Pi");
+	SAY("                                    firmware throttling flags. Default: %s.\n", stream->run->governor->sysfs);
+	SAY("    --governor-temp-high <C>  ───── Step down when the temperature predicted for 20 seconds");
+	SAY("                                    reaches it. Default: %u.\n", stream->run->governor->temp_high);
+	SAY("    --governor-temp-low <C>  ────── Allow to step up below it. Default: %u.\n", stream->run->governor->temp_low);
+	SAY("    --governor-load-high <%%>  ───── Step down when the JPEG workers are busier. Default: %u.\n", stream->run->governor->load_high);
+	SAY("    --governor-load-low <%%>  ────── Allow to step up below it. Default: %u.\n", stream->run->governor->load_low);
+	SAY("    --governor-quality-min <N>  ─── The lowest JPEG quality for the CPU encoder. Default: %u.\n", stream->run->governor->quality_min);
+	SAY("    --governor-fps-min <N>  ─────── The lowest frame rate. Default: %u.\n", stream->run->governor->fps_min);
+	SAY("    --governor-resolutions <WxH,...>  The capture resolutions for the last steps, from the largest;");
+	SAY("                                    each change restarts the capture session. Default: disabled.\n");
+	SAY("    --governor-down-delay <sec>  ── The minimal interval between the steps down. Default: %u.\n", stream->run->governor->down_delay);
+	SAY("    --governor-up-delay <sec>  ──── How long the conditions must be good for each step up. Default: %u.\n", stream->run->governor->up_delay);
 #	ifdef WITH_SETPROCTITLE
 	SAY("    --process-name-prefix <str>  ── Set process name prefix which will be displayed in the process list");
 	SAY("                                    like '<str>: ustreamer --blah-blah-blah'. Default: disabled.\n");
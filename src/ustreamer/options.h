@@ -40,6 +40,9 @@
 #include "../libs/memsink.h"
 #include "../libs/options.h"
 #include "../libs/capture.h"
+#include "../libs/jpegtran.h"
+#include "../libs/privacy.h"
+#include "../libs/mosaic.h"
 #ifdef WITH_V4P
 #	include "../libs/drm/drm.h"
 #endif
@@ -59,6 +62,7 @@ typedef struct {
 	us_memsink_s	*jpeg_sink;
 	us_memsink_s	*raw_sink;
 	us_memsink_s	*h264_sink;
+	us_mosaic_s		*mosaic;
 #	ifdef WITH_V4P
 	us_drm_s		*drm;
 #	endif
@@ -26,10 +26,17 @@
 #include <stdatomic.h>
 #include <limits.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <assert.h>
 
+#include <sys/stat.h>
+
 #include <pthread.h>
+#ifndef __APPLE__
+#	include <sys/ioctl.h>
+#	include <linux/dma-buf.h>
+#endif
 
 #include "../libs/types.h"
 #include "../libs/errors.h"
@@ -43,6 +50,9 @@
 #include "../libs/capture.h"
 #include "../libs/unjpeg.h"
 #include "../libs/fpsi.h"
+#include "../libs/privacy.h"
+#include "../libs/health.h"
+#include "../libs/sched.h"
 #ifdef WITH_V4P
 #	include "../libs/drm/drm.h"
 #endif
@@ -51,18 +61,20 @@
 #include "encoder.h"
 #include "workers.h"
 #include "m2m.h"
+#include "watchdog.h"
 #ifdef WITH_GPIO
 #	include "gpio/gpio.h"
 #endif
 
 
-typedef struct {
-	pthread_t		tid;
-	us_capture_s	*cap;
-	us_queue_s		*queue;
-	pthread_mutex_t	*mutex;
-	atomic_bool		*stop;
-} _releaser_context_s;
+struct us_stream_releaser_sx {
+	// Один на буфер, живет одну сессию захвата и передается в задачи планировщика
+	us_stream_s			*stream;
+	us_capture_hwbuf_s	*hw;
+	pthread_mutex_t		*mutex;
+	atomic_bool			*stop;
+	u64					raw_id;
+};
 
 typedef struct {
 	pthread_t	tid;
@@ -72,20 +84,32 @@ typedef struct {
 } _worker_context_s;
 
 
-static void *_releaser_thread(void *v_ctx);
+static void _release_task(void *v_rel);
+static void _raw_task(void *v_rel);
 static void *_jpeg_thread(void *v_ctx);
-static void *_raw_thread(void *v_ctx);
 static void *_h264_thread(void *v_ctx);
+static void *_burst_thread(void *v_ctx);
 #ifdef WITH_V4P
 static void *_drm_thread(void *v_ctx);
 #endif
 
-static us_capture_hwbuf_s *_get_latest_hw(us_queue_s *queue);
+static void _stream_hwbuf_decref(us_stream_s *stream, us_capture_hwbuf_s *hw);
+static us_capture_hwbuf_s *_get_latest_hw(us_stream_s *stream, us_queue_s *queue);
 
 static bool _stream_has_jpeg_clients_cached(us_stream_s *stream);
 static bool _stream_has_any_clients_cached(us_stream_s *stream);
 static int _stream_init_loop(us_stream_s *stream);
+static int _stream_renegotiate(us_stream_s *stream, pthread_mutex_t *release_mutex, atomic_bool *threads_stop);
+static int _stream_apply_privacy(us_stream_s *stream, us_capture_hwbuf_s *hw);
+static void _stream_check_health(us_stream_s *stream, us_capture_hwbuf_s *hw);
 static void _stream_update_captured_fpsi(us_stream_s *stream, const us_frame_s *frame, bool bump);
+static void _stream_ttff_begin(us_stream_s *stream);
+static void _stream_ttff_opened(us_stream_s *stream, ldf open_begin_ts);
+static void _stream_ttff_grabbed(us_stream_s *stream);
+static void _stream_ttff_exposed(us_stream_s *stream);
+static void _stream_expose_initial(us_stream_s *stream);
+static int _stream_load_last_frame(us_stream_s *stream);
+static void _stream_save_last_frame(us_stream_s *stream);
 #ifdef WITH_V4P
 static void _stream_drm_ensure_no_signal(us_stream_s *stream);
 #endif
@@ -113,6 +137,14 @@ us_stream_s *us_stream_init(us_capture_s *cap, us_encoder_s *enc) {
 	atomic_init(&run->stop, false);
 	run->blank = us_blank_init();
 	run->http = http;
+	run->privacy = us_privacy_init();
+	run->burst = us_burst_init(enc);
+	run->health = us_health_init();
+	run->health_state = US_HEALTH_UNKNOWN;
+	run->watchdog = us_watchdog_init();
+	run->governor = us_governor_init();
+	run->last_jpeg = us_frame_init();
+	US_MUTEX_INIT(run->last_jpeg_mutex);
 
 	us_stream_s *stream;
 	US_CALLOC(stream, 1);
@@ -141,6 +173,13 @@ void us_stream_destroy(us_stream_s *stream) {
 #	ifdef WITH_V4P
 	us_fpsi_destroy(stream->run->http->drm_fpsi);
 #	endif
+	us_governor_destroy(stream->run->governor);
+	us_watchdog_destroy(stream->run->watchdog);
+	us_health_destroy(stream->run->health);
+	us_burst_destroy(stream->run->burst);
+	us_privacy_destroy(stream->run->privacy);
+	US_MUTEX_DESTROY(stream->run->last_jpeg_mutex);
+	us_frame_destroy(stream->run->last_jpeg);
 	us_blank_destroy(stream->run->blank);
 	free(stream->run->http);
 	free(stream->run);
@@ -150,6 +189,7 @@ void us_stream_destroy(us_stream_s *stream) {
 void us_stream_loop(us_stream_s *stream) {
 	us_stream_runtime_s *const run = stream->run;
 	us_capture_s *const cap = stream->cap;
+	us_watchdog_s *const wd = run->watchdog;
 
 	atomic_store(&run->http->last_request_ts, us_get_now_monotonic());
 
@@ -158,6 +198,12 @@ void us_stream_loop(us_stream_s *stream) {
 		run->h264_tmp_src = us_frame_init();
 		run->h264_dest = us_frame_init();
 	}
+	// Only the buffer releasing and the RAW publishing are the scheduler tasks.
+	// The JPEG, H.264 and DRM encoders keep their own threads since they block
+	// in the device waits, so the capture-to-encode path is the same as before.
+	run->sched = us_sched_init("str_sched", us_get_cores_available());
+
+	_stream_expose_initial(stream);
 
 	while (!_stream_init_loop(stream)) {
 		atomic_bool threads_stop;
@@ -165,16 +211,14 @@ void us_stream_loop(us_stream_s *stream) {
 
 		pthread_mutex_t release_mutex;
 		US_MUTEX_INIT(release_mutex);
-		const uint n_releasers = cap->run->n_bufs;
-		_releaser_context_s *releasers;
-		US_CALLOC(releasers, n_releasers);
-		for (uint index = 0; index < n_releasers; ++index) {
-			_releaser_context_s *ctx = &releasers[index];
-			ctx->cap = cap;
-			ctx->queue = us_queue_init(1);
-			ctx->mutex = &release_mutex;
-			ctx->stop = &threads_stop;
-			US_THREAD_CREATE(ctx->tid, _releaser_thread, ctx);
+		cap->release_mutex = &release_mutex;
+		US_CALLOC(run->releasers, cap->run->n_bufs);
+		for (uint index = 0; index < cap->run->n_bufs; ++index) {
+			us_stream_releaser_s *const rel = &run->releasers[index];
+			rel->stream = stream;
+			rel->hw = &cap->run->bufs[index];
+			rel->mutex = &release_mutex;
+			rel->stop = &threads_stop;
 		}
 
 #		define CREATE_WORKER(x_cond, x_ctx, x_thread, x_capacity) \
@@ -187,8 +231,8 @@ void us_stream_loop(us_stream_s *stream) {
 				US_THREAD_CREATE(x_ctx->tid, (x_thread), x_ctx); \
 			}
 		CREATE_WORKER(true, jpeg_ctx, _jpeg_thread, cap->run->n_bufs);
-		CREATE_WORKER((stream->raw_sink != NULL), raw_ctx, _raw_thread, 2);
 		CREATE_WORKER((stream->h264_sink != NULL), h264_ctx, _h264_thread, cap->run->n_bufs);
+		CREATE_WORKER((run->burst->max > 0), burst_ctx, _burst_thread, cap->run->n_bufs);
 #		ifdef WITH_V4P
 		CREATE_WORKER((stream->drm != NULL), drm_ctx, _drm_thread, cap->run->n_bufs); // cppcheck-suppress assertWithSideEffect
 #		endif
@@ -211,8 +255,19 @@ void us_stream_loop(us_stream_s *stream) {
 		while (!atomic_load(&run->stop) && !atomic_load(&threads_stop)) {
 			us_capture_hwbuf_s *hw;
 			loop_count++;
-			
+
+			if (us_watchdog_take_restart(wd)) {
+				US_LOG_ERROR("Restarting the capture session by the watchdog ...");
+				goto close;
+			}
+			if (us_governor_take_restart(run->governor)) {
+				US_LOG_INFO("Restarting the capture session by the governor to change the resolution ...");
+				goto close;
+			}
+
+			us_watchdog_begin(wd, US_WATCHDOG_CAPTURE, 0);
 			int grab_result = us_capture_hwbuf_grab(cap, &hw);
+			us_watchdog_end(wd, US_WATCHDOG_CAPTURE, 0);
 			
 			// Debug logging every second
 			uint64_t now = us_get_now_monotonic();
@@ -237,15 +292,36 @@ void us_stream_loop(us_stream_s *stream) {
 					// Add small delay to prevent busy-wait when no frame available
 					usleep(1000); // 1ms sleep to reduce CPU usage
 					continue; // Broken frame
+				case US_ERROR_SOURCE_CHANGED:
+					if (_stream_renegotiate(stream, &release_mutex, &threads_stop) < 0) {
+						error_count++;
+						goto close; // Full restart
+					}
+					continue;
 				default: 
 					error_count++;
 					goto close; // Any error
 			}
 
+			_stream_ttff_grabbed(stream);
+
+			// Буфер освобождается задачей, когда отпущена последняя ссылка,
+			// поэтому главный цикл держит свою, пока раздает кадр потребителям.
+			us_watchdog_begin(wd, US_WATCHDOG_RELEASERS, hw->buf.index);
+			us_capture_hwbuf_incref(hw);
+
+			if (_stream_apply_privacy(stream, hw) < 0) {
+				// Never pass an unmasked frame to the encoders and sinks
+				_stream_hwbuf_decref(stream, hw);
+				continue;
+			}
+
+			_stream_check_health(stream, hw);
 			_stream_update_captured_fpsi(stream, &hw->raw, true);
+			us_governor_report_frame(run->governor);
 
 #			ifdef WITH_GPIO
-			us_gpio_set_stream_online(true);
+			us_gpio_set_stream_online(hw->raw.online);
 #			endif
 
 #			define QUEUE_HW(x_ctx) if (x_ctx != NULL) { \
@@ -253,13 +329,21 @@ void us_stream_loop(us_stream_s *stream) {
 					us_queue_put(x_ctx->queue, hw, 0); \
 				}
 			QUEUE_HW(jpeg_ctx);
-			QUEUE_HW(raw_ctx);
 			QUEUE_HW(h264_ctx);
+			if (us_burst_is_wanted(run->burst)) {
+				QUEUE_HW(burst_ctx);
+			}
 #			ifdef WITH_V4P
 			QUEUE_HW(drm_ctx);
 #			endif
 #			undef QUEUE_HW
-			us_queue_put(releasers[hw->buf.index].queue, hw, 0); // Plan to release
+			if (stream->raw_sink != NULL) {
+				us_stream_releaser_s *const rel = &run->releasers[hw->buf.index];
+				rel->raw_id = atomic_fetch_add(&run->raw_last_id, 1) + 1;
+				us_capture_hwbuf_incref(hw);
+				us_sched_submit(run->sched, US_SCHED_PRIO_NORMAL, _raw_task, rel);
+			}
+			_stream_hwbuf_decref(stream, hw); // Plan to release
 
 			// Мы не обновляем здесь состояние синков, потому что это происходит внутри обслуживающих их потоков
 			_stream_check_suicide(stream);
@@ -283,28 +367,30 @@ void us_stream_loop(us_stream_s *stream) {
 #		ifdef WITH_V4P
 		DELETE_WORKER(drm_ctx);
 #		endif
+		DELETE_WORKER(burst_ctx);
 		DELETE_WORKER(h264_ctx);
-		DELETE_WORKER(raw_ctx);
 		DELETE_WORKER(jpeg_ctx);
 #		undef DELETE_WORKER
 
-		for (uint index = 0; index < n_releasers; ++index) {
-			US_THREAD_JOIN(releasers[index].tid);
-			us_queue_destroy(releasers[index].queue);
-		}
-		free(releasers);
+		us_sched_wait_idle(run->sched);
+		US_DELETE(run->releasers, free);
+		cap->release_mutex = NULL;
 		US_MUTEX_DESTROY(release_mutex);
 
 		atomic_store(&threads_stop, false);
 
 		us_encoder_close(stream->enc);
 		us_capture_close(cap);
+		us_watchdog_reset_session(wd);
 
 		if (!atomic_load(&run->stop)) {
 			US_SEP_INFO('=');
 		}
 	}
 
+	_stream_save_last_frame(stream);
+
+	US_DELETE(run->sched, us_sched_destroy);
 	US_DELETE(run->h264_enc, us_m2m_encoder_destroy);
 	US_DELETE(run->h264_tmp_src, us_frame_destroy);
 	US_DELETE(run->h264_dest, us_frame_destroy);
@@ -314,34 +400,36 @@ void us_stream_loop_break(us_stream_s *stream) {
 	atomic_store(&stream->run->stop, true);
 }
 
-static void *_releaser_thread(void *v_ctx) {
-	US_THREAD_SETTLE("str_rel")
-	_releaser_context_s *ctx = v_ctx;
-
-	while (!atomic_load(ctx->stop)) {
-		us_capture_hwbuf_s *hw;
-		if (us_queue_get(ctx->queue, (void**)&hw, 0.1) < 0) {
-			continue;
-		}
-
-		while (atomic_load(&hw->refs) > 0) {
-			if (atomic_load(ctx->stop)) {
-				goto done;
-			}
-			usleep(10 * 1000); // Increased to 10ms for lower CPU usage
-		}
+static void _release_task(void *v_rel) {
+	us_stream_releaser_s *const rel = v_rel;
+	if (atomic_load(rel->stop)) {
+		return; // The buffers will be unmapped anyway
+	}
 
-		US_MUTEX_LOCK(*ctx->mutex);
-		const int released = us_capture_hwbuf_release(ctx->cap, hw);
-		US_MUTEX_UNLOCK(*ctx->mutex);
-		if (released < 0) {
-			goto done;
-		}
+	US_MUTEX_LOCK(*rel->mutex);
+	const int released = us_capture_hwbuf_release(rel->stream->cap, rel->hw);
+	US_MUTEX_UNLOCK(*rel->mutex);
+	if (released < 0) {
+		atomic_store(rel->stop, true); // Stop all other guys on error
+		return;
 	}
+	us_watchdog_end(rel->stream->run->watchdog, US_WATCHDOG_RELEASERS, rel->hw->buf.index);
+}
 
-done:
-	atomic_store(ctx->stop, true); // Stop all other guys on error
-	return NULL;
+static void _raw_task(void *v_rel) {
+	us_stream_releaser_s *const rel = v_rel;
+	us_stream_s *const stream = rel->stream;
+
+	if (rel->raw_id != atomic_load(&stream->run->raw_last_id)) {
+		US_LOG_VERBOSE("RAW: Passed publishing of the outdated frame");
+	} else if (us_memsink_server_check(stream->raw_sink, NULL)) {
+		us_watchdog_begin(stream->run->watchdog, US_WATCHDOG_SINKS, 0);
+		us_memsink_server_put(stream->raw_sink, &rel->hw->raw, false);
+		us_watchdog_end(stream->run->watchdog, US_WATCHDOG_SINKS, 0);
+	} else {
+		US_LOG_VERBOSE("RAW: Passed publishing because nobody is watching");
+	}
+	_stream_hwbuf_decref(stream, rel->hw);
 }
 
 static void *_jpeg_thread(void *v_ctx) {
@@ -357,8 +445,11 @@ static void *_jpeg_thread(void *v_ctx) {
 		us_encoder_job_s *const job = wr->job;
 
 		if (job->hw != NULL) {
-			us_capture_hwbuf_decref(job->hw);
+			us_watchdog_end(stream->run->watchdog, US_WATCHDOG_JPEG, wr->number);
+			_stream_hwbuf_decref(stream, job->hw);
 			job->hw = NULL;
+			us_governor_report_job(stream->run->governor, wr->last_job_time,
+				(!wr->job_failed && !wr->job_timely), stream->enc->run->pool->n_workers);
 			if (wr->job_failed) {
 				// pass
 			} else if (wr->job_timely) {
@@ -373,15 +464,20 @@ static void *_jpeg_thread(void *v_ctx) {
 			}
 		}
 
-		us_capture_hwbuf_s *hw = _get_latest_hw(ctx->queue);
+		us_capture_hwbuf_s *hw = _get_latest_hw(stream, ctx->queue);
 		if (hw == NULL) {
 			continue;
 		}
 
-		const bool update_required = (stream->jpeg_sink != NULL && us_memsink_server_check(stream->jpeg_sink, NULL));
+		// The first frame of the session is always encoded, so the clients coming later
+		// and the persisted last frame have the live picture without waiting.
+		const bool update_required = (
+			(stream->jpeg_sink != NULL && us_memsink_server_check(stream->jpeg_sink, NULL))
+			|| atomic_load(&stream->run->ttff_exposing)
+		);
 		if (!update_required && !_stream_has_jpeg_clients_cached(stream)) {
 			US_LOG_VERBOSE("JPEG: Passed encoding because nobody is watching");
-			us_capture_hwbuf_decref(hw);
+			_stream_hwbuf_decref(stream, hw);
 			continue;
 		}
 
@@ -390,42 +486,25 @@ static void *_jpeg_thread(void *v_ctx) {
 			fluency_passed += 1;
 			US_LOG_VERBOSE("JPEG: Passed %u frames for fluency: now=%.03Lf, grab_after=%.03Lf",
 				fluency_passed, now_ts, grab_after_ts);
-			us_capture_hwbuf_decref(hw);
+			_stream_hwbuf_decref(stream, hw);
 			continue;
 		}
 		fluency_passed = 0;
 
-		const ldf fluency_delay = us_workers_pool_get_fluency_delay(stream->enc->run->pool, wr);
+		const ldf fluency_delay = US_MAX(
+			us_workers_pool_get_fluency_delay(stream->enc->run->pool, wr),
+			us_governor_get_min_interval(stream->run->governor));
 		grab_after_ts = now_ts + fluency_delay;
 		US_LOG_VERBOSE("JPEG: Fluency: delay=%.03Lf, grab_after=%.03Lf", fluency_delay, grab_after_ts);
 
 		job->hw = hw;
+		us_watchdog_begin(stream->run->watchdog, US_WATCHDOG_JPEG, wr->number);
 		us_workers_pool_assign(stream->enc->run->pool, wr);
 		US_LOG_DEBUG("JPEG: Assigned new frame in buffer=%d to worker=%s", hw->buf.index, wr->name);
 	}
 	return NULL;
 }
 
-static void *_raw_thread(void *v_ctx) {
-	US_THREAD_SETTLE("str_raw");
-	_worker_context_s *ctx = v_ctx;
-
-	while (!atomic_load(ctx->stop)) {
-		us_capture_hwbuf_s *hw = _get_latest_hw(ctx->queue);
-		if (hw == NULL) {
-			continue;
-		}
-
-		if (us_memsink_server_check(ctx->stream->raw_sink, NULL)) {
-			us_memsink_server_put(ctx->stream->raw_sink, &hw->raw, false);
-		} else {
-			US_LOG_VERBOSE("RAW: Passed publishing because nobody is watching");
-		}
-		us_capture_hwbuf_decref(hw);
-	}
-	return NULL;
-}
-
 static void *_h264_thread(void *v_ctx) {
 	US_THREAD_SETTLE("str_h264");
 	_worker_context_s *ctx = v_ctx;
@@ -433,7 +512,7 @@ static void *_h264_thread(void *v_ctx) {
 
 	ldf grab_after_ts = 0;
 	while (!atomic_load(ctx->stop)) {
-		us_capture_hwbuf_s *hw = _get_latest_hw(ctx->queue);
+		us_capture_hwbuf_s *hw = _get_latest_hw(stream, ctx->queue);
 		if (hw == NULL) {
 			continue;
 		}
@@ -447,7 +526,9 @@ static void *_h264_thread(void *v_ctx) {
 			goto decref;
 		}
 
+		us_watchdog_begin(stream->run->watchdog, US_WATCHDOG_H264, 0);
 		_stream_encode_expose_h264(ctx->stream, &hw->raw, false);
+		us_watchdog_end(stream->run->watchdog, US_WATCHDOG_H264, 0);
 
 		// M2M-енкодер увеличивает задержку на 100 милисекунд при 1080p, если скормить ему больше 30 FPS.
 		// Поэтому у нас есть два режима: 60 FPS для маленьких видео и 30 для 1920x1080(1200).
@@ -460,7 +541,24 @@ static void *_h264_thread(void *v_ctx) {
 		}
 
 	decref:
-		us_capture_hwbuf_decref(hw);
+		_stream_hwbuf_decref(stream, hw);
+	}
+	return NULL;
+}
+
+static void *_burst_thread(void *v_ctx) {
+	US_THREAD_SETTLE("str_burst");
+	_worker_context_s *ctx = v_ctx;
+	us_stream_s *stream = ctx->stream;
+
+	while (!atomic_load(ctx->stop)) {
+		us_capture_hwbuf_s *hw;
+		if (us_queue_get(ctx->queue, (void**)&hw, 0.1) < 0) {
+			continue;
+		}
+		// Каждый кадр, а не только самый свежий, как у энкодеров
+		us_burst_feed(stream->run->burst, &hw->raw);
+		_stream_hwbuf_decref(stream, hw);
 	}
 	return NULL;
 }
@@ -480,9 +578,9 @@ static void *_drm_thread(void *v_ctx) {
 #		define SLOWDOWN { \
 				const ldf m_next_ts = us_get_now_monotonic() + 1; \
 				while (!atomic_load(ctx->stop) && us_get_now_monotonic() < m_next_ts) { \
-					us_capture_hwbuf_s *m_pass_hw = _get_latest_hw(ctx->queue); \
+					us_capture_hwbuf_s *m_pass_hw = _get_latest_hw(stream, ctx->queue); \
 					if (m_pass_hw != NULL) { \
-						us_capture_hwbuf_decref(m_pass_hw); \
+						_stream_hwbuf_decref(stream, m_pass_hw); \
 					} \
 				} \
 			}
@@ -491,9 +589,12 @@ static void *_drm_thread(void *v_ctx) {
 
 		while (!atomic_load(ctx->stop)) {
 			CHECK(us_drm_wait_for_vsync(stream->drm));
-			US_DELETE(prev_hw, us_capture_hwbuf_decref);
+			if (prev_hw != NULL) {
+				_stream_hwbuf_decref(stream, prev_hw);
+				prev_hw = NULL;
+			}
 
-			us_capture_hwbuf_s *hw = _get_latest_hw(ctx->queue);
+			us_capture_hwbuf_s *hw = _get_latest_hw(stream, ctx->queue);
 			if (hw == NULL) {
 				continue;
 			}
@@ -507,7 +608,7 @@ static void *_drm_thread(void *v_ctx) {
 			}
 
 			CHECK(us_drm_expose_stub(stream->drm, stream->drm->run->opened, ctx->stream->cap));
-			us_capture_hwbuf_decref(hw);
+			_stream_hwbuf_decref(stream, hw);
 
 			us_fpsi_meta_s meta = {.online = false};
 			us_fpsi_update(stream->run->http->drm_fpsi, true, &meta);
@@ -517,7 +618,10 @@ static void *_drm_thread(void *v_ctx) {
 
 	close:
 		us_drm_close(stream->drm);
-		US_DELETE(prev_hw, us_capture_hwbuf_decref);
+		if (prev_hw != NULL) {
+			_stream_hwbuf_decref(stream, prev_hw);
+			prev_hw = NULL;
+		}
 		us_fpsi_meta_s meta = {.online = false};
 		us_fpsi_update(stream->run->http->drm_fpsi, false, &meta);
 		SLOWDOWN;
@@ -529,13 +633,19 @@ static void *_drm_thread(void *v_ctx) {
 }
 #endif
 
-static us_capture_hwbuf_s *_get_latest_hw(us_queue_s *queue) {
+static void _stream_hwbuf_decref(us_stream_s *stream, us_capture_hwbuf_s *hw) {
+	if (atomic_fetch_sub(&hw->refs, 1) == 1) {
+		us_sched_submit(stream->run->sched, US_SCHED_PRIO_HIGH, _release_task, &stream->run->releasers[hw->buf.index]);
+	}
+}
+
+static us_capture_hwbuf_s *_get_latest_hw(us_stream_s *stream, us_queue_s *queue) {
 	us_capture_hwbuf_s *hw;
 	if (us_queue_get(queue, (void**)&hw, 0.1) < 0) {
 		return NULL;
 	}
 	while (!us_queue_is_empty(queue)) { // Берем только самый свежий кадр
-		us_capture_hwbuf_decref(hw);
+		_stream_hwbuf_decref(stream, hw);
 		assert(!us_queue_get(queue, (void**)&hw, 0));
 	}
 	return hw;
@@ -564,7 +674,10 @@ static bool _stream_has_any_clients_cached(us_stream_s *stream) {
 static int _stream_init_loop(us_stream_s *stream) {
 	us_stream_runtime_s *const run = stream->run;
 
+	_stream_ttff_begin(stream);
+
 	int once = 0;
+	uint attempt = 0;
 	while (!atomic_load(&stream->run->stop)) {
 		const char *blank_reason = "< NO LIVE VIDEO >";
 
@@ -590,7 +703,12 @@ static int _stream_init_loop(us_stream_s *stream) {
 			|| stream->drm != NULL
 #			endif
 		);
-		switch (us_capture_open(stream->cap)) {
+		us_governor_apply_resolution(run->governor, stream->cap);
+		const ldf open_begin_ts = us_get_now_monotonic();
+		us_watchdog_begin(run->watchdog, US_WATCHDOG_CAPTURE, 0);
+		const int opened = us_capture_open(stream->cap);
+		us_watchdog_end(run->watchdog, US_WATCHDOG_CAPTURE, 0);
+		switch (opened) {
 			case 0: break;
 			case US_ERROR_NO_DEVICE:
 				blank_reason = (
@@ -638,6 +756,7 @@ static int _stream_init_loop(us_stream_s *stream) {
 				goto verbose_error;
 		}
 		us_encoder_open(stream->enc, stream->cap);
+		_stream_ttff_opened(stream, open_begin_ts);
 		return 0;
 
 	silent_error:
@@ -649,11 +768,20 @@ static int _stream_init_loop(us_stream_s *stream) {
 		goto offline_and_retry;
 
 	offline_and_retry:
-		for (uint count = 0; count < stream->error_delay * 10; ++count) {
+		// Первые повторы быстрее: устройство часто появляется сразу после старта,
+		// например когда udev еще не успел его создать или источник просыпается.
+		++attempt;
+		const uint delay = US_MIN(stream->error_delay * 10, (uint)1 << US_MIN(attempt - 1, (uint)10));
+		for (uint count = 0; count < delay; ++count) {
 			if (atomic_load(&run->stop)) {
 				break;
 			}
-			if (count % 10 == 0) {
+			if (count % 10 == 0 && atomic_load(&run->http->last_frame_exposed)) {
+				// Сохраненный кадр держим до первого живого, вместо blank
+				_stream_update_captured_fpsi(stream, run->last_jpeg, false);
+				_stream_expose_jpeg(stream, run->last_jpeg);
+				_stream_encode_expose_h264(stream, run->last_jpeg, true);
+			} else if (count % 10 == 0) {
 				// Каждую секунду повторяем blank
 				uint width = stream->cap->run->width;
 				uint height = stream->cap->run->height;
@@ -678,6 +806,93 @@ static int _stream_init_loop(us_stream_s *stream) {
 	return -1;
 }
 
+static int _stream_renegotiate(us_stream_s *stream, pthread_mutex_t *release_mutex, atomic_bool *threads_stop) {
+	// Ждем, пока воркеры и релизеры вернут все буферы устройству, и меняем разрешение
+	// без полного перезапуска: потоки, энкодер, синки и клиенты остаются как есть.
+
+	us_capture_s *const cap = stream->cap;
+	const ldf deadline_ts = us_get_now_monotonic() + cap->timeout;
+
+	while (true) {
+		if (atomic_load(&stream->run->stop) || atomic_load(threads_stop)) {
+			return -1;
+		}
+
+		US_MUTEX_LOCK(*release_mutex);
+		bool grabbed = false;
+		for (uint index = 0; index < cap->run->n_bufs; ++index) {
+			grabbed = (grabbed || cap->run->bufs[index].grabbed);
+		}
+		if (!grabbed) {
+			const int retval = us_capture_renegotiate(cap);
+			US_MUTEX_UNLOCK(*release_mutex);
+			return retval;
+		}
+		US_MUTEX_UNLOCK(*release_mutex);
+
+		if (us_get_now_monotonic() > deadline_ts) {
+			US_LOG_ERROR("Can't renegotiate the capture: HW buffers are still in use");
+			return -1;
+		}
+		usleep(1000);
+	}
+}
+
+static int _stream_apply_privacy(us_stream_s *stream, us_capture_hwbuf_s *hw) {
+	// Маски накладываются один раз на сырой кадр до любого энкодера и синка
+	us_privacy_s *const priv = stream->run->privacy;
+	if (!us_privacy_is_enabled(priv)) {
+		return 0;
+	}
+
+	us_frame_s *const frame = &hw->raw;
+#	ifndef __APPLE__
+	if (frame->dma_fd >= 0) {
+		struct dma_buf_sync sync = {.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW};
+		ioctl(frame->dma_fd, DMA_BUF_IOCTL_SYNC, &sync);
+	}
+#	endif
+	const int retval = us_privacy_apply(priv, frame);
+#	ifndef __APPLE__
+	if (frame->dma_fd >= 0) {
+		struct dma_buf_sync sync = {.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW};
+		ioctl(frame->dma_fd, DMA_BUF_IOCTL_SYNC, &sync);
+	}
+#	endif
+
+	if (retval < 0) {
+		US_ONCE_FOR(stream->run->privacy_once, frame->format, {
+			char fourcc_str[8];
+			US_LOG_ERROR("Can't apply the privacy mask to %s frames, dropping them",
+				us_fourcc_to_string(frame->format, fourcc_str, 8));
+		});
+	}
+	return retval;
+}
+
+static void _stream_check_health(us_stream_s *stream, us_capture_hwbuf_s *hw) {
+	us_stream_runtime_s *const run = stream->run;
+	if (run->health->interval == 0) {
+		return;
+	}
+	const us_health_state_e state = us_health_process(run->health, &hw->raw);
+	if (state != run->health_state) {
+		if (state == US_HEALTH_OK) {
+			US_LOG_INFO("Image health: %s -> ok", us_health_state_to_string(run->health_state));
+		} else if (state == US_HEALTH_UNKNOWN) {
+			char fourcc_str[8];
+			US_LOG_INFO("Image health: can't check %s frames", us_fourcc_to_string(hw->raw.format, fourcc_str, 8));
+		} else {
+			US_LOG_ERROR("Image health: %s -> %s", us_health_state_to_string(run->health_state), us_health_state_to_string(state));
+		}
+		run->health_state = state;
+	}
+	if (stream->health_offline && state != US_HEALTH_OK && state != US_HEALTH_UNKNOWN) {
+		// Живые, но бесполезные кадры отдаются как оффлайн
+		hw->raw.online = false;
+	}
+}
+
 static void _stream_update_captured_fpsi(us_stream_s *stream, const us_frame_s *frame, bool bump) {
 	us_stream_runtime_s *const run = stream->run;
 
@@ -691,6 +906,181 @@ static void _stream_update_captured_fpsi(us_stream_s *stream, const us_frame_s *
 	}
 }
 
+static void _stream_ttff_begin(us_stream_s *stream) {
+	us_stream_runtime_s *const run = stream->run;
+	us_stream_ttff_s *const ttff = &run->http->ttff;
+	atomic_store(&run->ttff_exposing, false);
+	run->ttff_begin_ts = us_get_now_monotonic();
+	run->ttff_open_end_ts = 0;
+	run->ttff_grab_ts = 0;
+	atomic_store(&ttff->waiting, 0);
+	atomic_store(&ttff->open, 0);
+	atomic_store(&ttff->streamon, 0);
+	atomic_store(&ttff->warmup, 0);
+	atomic_store(&ttff->encode, 0);
+	atomic_store(&ttff->total, 0);
+}
+
+#define _US(x_sec) ((u64)((x_sec) * 1000000))
+
+static void _stream_ttff_opened(us_stream_s *stream, ldf open_begin_ts) {
+	us_stream_runtime_s *const run = stream->run;
+	us_stream_ttff_s *const ttff = &run->http->ttff;
+	const us_capture_runtime_s *const cap_run = stream->cap->run;
+
+	run->ttff_open_end_ts = us_get_now_monotonic();
+	ldf streamon = 0;
+	if (cap_run->streamon_begin_ts >= open_begin_ts) { // Not for the mosaic and macOS
+		streamon = cap_run->streamon_end_ts - cap_run->streamon_begin_ts;
+	}
+	atomic_store(&ttff->waiting, _US(open_begin_ts - run->ttff_begin_ts));
+	atomic_store(&ttff->open, _US(run->ttff_open_end_ts - open_begin_ts - streamon));
+	atomic_store(&ttff->streamon, _US(streamon));
+}
+
+static void _stream_ttff_grabbed(us_stream_s *stream) {
+	us_stream_runtime_s *const run = stream->run;
+	if (run->ttff_grab_ts == 0) {
+		run->ttff_grab_ts = us_get_now_monotonic();
+		atomic_store(&run->http->ttff.warmup, _US(run->ttff_grab_ts - run->ttff_open_end_ts));
+		atomic_store(&run->ttff_exposing, true);
+	}
+}
+
+static void _stream_ttff_exposed(us_stream_s *stream) {
+	// Вызывается из воркеров JPEG и H264, засчитывается тот, кто успел первым
+	us_stream_runtime_s *const run = stream->run;
+	if (!atomic_exchange(&run->ttff_exposing, false)) {
+		return;
+	}
+	us_stream_ttff_s *const ttff = &run->http->ttff;
+	const ldf now_ts = us_get_now_monotonic();
+	atomic_store(&ttff->encode, _US(now_ts - run->ttff_grab_ts));
+	atomic_store(&ttff->total, _US(now_ts - run->ttff_begin_ts));
+	atomic_fetch_add(&ttff->sessions, 1);
+	US_LOG_INFO("Time to first frame: %.3Lf sec (waiting=%.3Lf, open=%.3Lf, streamon=%.3Lf, warmup=%.3Lf, encode=%.3Lf)",
+		(ldf)atomic_load(&ttff->total) / 1000000,
+		(ldf)atomic_load(&ttff->waiting) / 1000000,
+		(ldf)atomic_load(&ttff->open) / 1000000,
+		(ldf)atomic_load(&ttff->streamon) / 1000000,
+		(ldf)atomic_load(&ttff->warmup) / 1000000,
+		(ldf)atomic_load(&ttff->encode) / 1000000);
+}
+
+#undef _US
+
+static void _stream_expose_initial(us_stream_s *stream) {
+	// Клиенты и синки получают кадр сразу, не дожидаясь первой попытки открыть устройство,
+	// которая может занять несколько секунд. Если есть сохраненный кадр, отдаем его как offline.
+	us_stream_runtime_s *const run = stream->run;
+	if (stream->last_frame_path != NULL && !_stream_load_last_frame(stream)) {
+		_stream_update_captured_fpsi(stream, run->last_jpeg, false);
+		atomic_store(&run->http->last_frame_exposed, true);
+		_stream_expose_jpeg(stream, run->last_jpeg);
+		_stream_encode_expose_h264(stream, run->last_jpeg, true);
+	} else {
+		_stream_expose_jpeg(stream, run->blank->jpeg);
+		_stream_expose_raw(stream, run->blank->raw);
+		_stream_encode_expose_h264(stream, run->blank->raw, true);
+	}
+}
+
+static int _stream_load_last_frame(us_stream_s *stream) {
+	us_frame_s *const frame = stream->run->last_jpeg;
+	us_frame_s *tmp = NULL;
+	int fd = -1;
+	int retval = -1;
+
+	if ((fd = open(stream->last_frame_path, O_RDONLY)) < 0) {
+		if (errno != ENOENT) {
+			US_LOG_PERROR("Can't open the last frame %s", stream->last_frame_path);
+		}
+		goto done;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size <= 0 || st.st_size > 32 * 1024 * 1024) {
+		US_LOG_ERROR("Invalid last frame %s", stream->last_frame_path);
+		goto done;
+	}
+	us_frame_realloc_data(frame, st.st_size);
+	for (frame->used = 0; frame->used < (uz)st.st_size;) {
+		const sz got = read(fd, frame->data + frame->used, st.st_size - frame->used);
+		if (got <= 0) {
+			US_LOG_PERROR("Can't read the last frame %s", stream->last_frame_path);
+			goto done;
+		}
+		frame->used += got;
+	}
+
+	frame->format = V4L2_PIX_FMT_JPEG;
+	tmp = us_frame_init();
+	if (us_unjpeg(frame, tmp, false) < 0) { // Only the header for the geometry
+		goto done;
+	}
+	frame->width = tmp->width;
+	frame->height = tmp->height;
+	frame->stride = 0;
+	frame->online = false;
+	frame->key = false;
+	frame->gop = 0;
+	frame->grab_ts = us_get_now_monotonic();
+	frame->encode_begin_ts = frame->grab_ts;
+	frame->encode_end_ts = frame->grab_ts;
+	US_LOG_INFO("Using the last frame %ux%u from %s until the capture is ready",
+		frame->width, frame->height, stream->last_frame_path);
+	retval = 0;
+
+done:
+	US_DELETE(tmp, us_frame_destroy);
+	US_CLOSE_FD(fd);
+	if (retval < 0) {
+		frame->used = 0;
+	}
+	return retval;
+}
+
+static void _stream_save_last_frame(us_stream_s *stream) {
+	// Пишем во временный файл и переименовываем, чтобы не оставить обрезанный JPEG
+	us_stream_runtime_s *const run = stream->run;
+	if (stream->last_frame_path == NULL) {
+		return;
+	}
+
+	char *tmp_path = NULL;
+	int fd = -1;
+
+	US_MUTEX_LOCK(run->last_jpeg_mutex);
+	if (!run->last_jpeg->online || run->last_jpeg->used == 0) {
+		goto done; // Nothing live during this run, keep the previous one
+	}
+	US_ASPRINTF(tmp_path, "%s.tmp", stream->last_frame_path);
+	if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		US_LOG_PERROR("Can't create the last frame %s", tmp_path);
+		goto done;
+	}
+	for (uz written = 0; written < run->last_jpeg->used;) {
+		const sz wrote = write(fd, run->last_jpeg->data + written, run->last_jpeg->used - written);
+		if (wrote < 0) {
+			US_LOG_PERROR("Can't write the last frame %s", tmp_path);
+			goto done;
+		}
+		written += wrote;
+	}
+	if (fsync(fd) < 0 || rename(tmp_path, stream->last_frame_path) < 0) {
+		US_LOG_PERROR("Can't save the last frame %s", stream->last_frame_path);
+		goto done;
+	}
+	US_LOG_INFO("The last frame is saved to %s", stream->last_frame_path);
+
+done:
+	US_CLOSE_FD(fd);
+	if (tmp_path != NULL) {
+		unlink(tmp_path); // No-op after the successful rename()
+		free(tmp_path);
+	}
+	US_MUTEX_UNLOCK(run->last_jpeg_mutex);
+}
+
 #ifdef WITH_V4P
 static void _stream_drm_ensure_no_signal(us_stream_s *stream) {
 	if (stream->drm == NULL) {
@@ -718,10 +1108,22 @@ close:
 
 static void _stream_expose_jpeg(us_stream_s *stream, const us_frame_s *frame) {
 	us_stream_runtime_s *const run = stream->run;
+	if (frame != run->last_jpeg) {
+		atomic_store(&run->http->last_frame_exposed, false);
+	}
+	if (frame->online) {
+		_stream_ttff_exposed(stream);
+		if (stream->last_frame_path != NULL) {
+			US_MUTEX_LOCK(run->last_jpeg_mutex);
+			us_frame_copy(frame, run->last_jpeg);
+			US_MUTEX_UNLOCK(run->last_jpeg_mutex);
+		}
+	}
+	us_watchdog_begin(run->watchdog, US_WATCHDOG_SINKS, 1);
 	int ri;
 	while ((ri = us_ring_producer_acquire(run->http->jpeg_ring, 0)) < 0) {
 		if (atomic_load(&run->stop)) {
-			return;
+			goto done;
 		}
 	}
 	us_frame_s *const dest = run->http->jpeg_ring->items[ri];
@@ -730,6 +1132,8 @@ static void _stream_expose_jpeg(us_stream_s *stream, const us_frame_s *frame) {
 	if (stream->jpeg_sink != NULL) {
 		us_memsink_server_put(stream->jpeg_sink, dest, NULL);
 	}
+done:
+	us_watchdog_end(run->watchdog, US_WATCHDOG_SINKS, 1);
 }
 
 static void _stream_expose_raw(us_stream_s *stream, const us_frame_s *frame) {
@@ -758,6 +1162,9 @@ static void _stream_encode_expose_h264(us_stream_s *stream, const us_frame_s *fr
 	}
 	if (!us_m2m_encoder_compress(run->h264_enc, frame, run->h264_dest, force_key)) {
 		meta.online = !us_memsink_server_put(stream->h264_sink, run->h264_dest, &run->h264_key_requested);
+		if (meta.online && frame->online) {
+			_stream_ttff_exposed(stream);
+		}
 	}
 
 done:
@@ -33,15 +33,33 @@
 #include "../libs/memsink.h"
 #include "../libs/capture.h"
 #include "../libs/fpsi.h"
+#include "../libs/privacy.h"
+#include "../libs/health.h"
+#include "../libs/sched.h"
 #ifdef WITH_V4P
 #	include "../libs/drm/drm.h"
 #endif
 
 #include "blank.h"
+#include "burst.h"
 #include "encoder.h"
+#include "governor.h"
 #include "m2m.h"
+#include "watchdog.h"
 
 
+typedef struct {
+	// Time to the first frame of the last capture session, in microseconds.
+	// The phases are zero until passed, total is set when the first frame is exposed.
+	atomic_uint		sessions;
+	atomic_ullong	waiting; // Failed attempts to open the device and error delays
+	atomic_ullong	open;
+	atomic_ullong	streamon;
+	atomic_ullong	warmup; // From STREAMON to the first grabbed buffer
+	atomic_ullong	encode; // From the first buffer to the first exposed frame
+	atomic_ullong	total;
+} us_stream_ttff_s;
+
 typedef struct {
 #	ifdef WITH_V4P
 	atomic_bool		drm_live;
@@ -56,20 +74,44 @@ typedef struct {
 	atomic_uint		snapshot_requested;
 	atomic_ullong	last_request_ts; // Seconds
 	us_fpsi_s		*captured_fpsi;
+
+	us_stream_ttff_s	ttff;
+	atomic_bool			last_frame_exposed; // The persisted frame from the previous run
 } us_stream_http_s;
 
+typedef struct us_stream_releaser_sx us_stream_releaser_s;
+
 typedef struct {
 	us_stream_http_s	*http;
 
+	us_sched_s				*sched;
+	us_stream_releaser_s	*releasers; // For the current capture session, per buffer
+	atomic_ullong			raw_last_id;
+
 	us_m2m_encoder_s	*h264_enc;
 	us_frame_s			*h264_tmp_src;
 	us_frame_s			*h264_dest;
 	bool				h264_key_requested;
 
 	us_blank_s			*blank;
+	us_privacy_s		*privacy;
+	int					privacy_once;
+	us_burst_s			*burst;
+	us_health_s			*health;
+	us_health_state_e	health_state;
+	us_watchdog_s		*watchdog;
+	us_governor_s		*governor;
 
 	us_fpsi_meta_s		notify_meta;
 
+	ldf					ttff_begin_ts;
+	ldf					ttff_open_end_ts;
+	ldf					ttff_grab_ts;
+	atomic_bool			ttff_exposing;
+
+	us_frame_s			*last_jpeg;
+	pthread_mutex_t		last_jpeg_mutex;
+
 	atomic_bool			stop;
 } us_stream_runtime_s;
 
@@ -81,6 +123,8 @@ typedef struct {
 	bool			slowdown;
 	uint			error_delay;
 	uint			exit_on_no_clients;
+	bool			health_offline;
+	char			*last_frame_path;
 
 	us_memsink_s	*jpeg_sink;
 	us_memsink_s	*raw_sink;
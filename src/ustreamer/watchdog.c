@@ -0,0 +1,232 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "watchdog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef WITH_SYSTEMD
+#	include <systemd/sd-daemon.h>
+#endif
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+#include "../libs/array.h"
+#include "../libs/logging.h"
+
+
+static const char *const _STAGES[] = {
+	[US_WATCHDOG_CAPTURE]	= "capture",
+	[US_WATCHDOG_RELEASERS]	= "releasers",
+	[US_WATCHDOG_JPEG]		= "jpeg",
+	[US_WATCHDOG_H264]		= "h264",
+	[US_WATCHDOG_SINKS]		= "sinks",
+	[US_WATCHDOG_HTTP]		= "http",
+};
+
+
+static u64 _watchdog_check_stage(us_watchdog_s *wd, us_watchdog_stage_e stage, u64 now_ms);
+
+
+#define _LOG_ERROR(x_msg, ...)	US_LOG_ERROR("WATCHDOG: " x_msg, ##__VA_ARGS__)
+#define _LOG_INFO(x_msg, ...)	US_LOG_INFO("WATCHDOG: " x_msg, ##__VA_ARGS__)
+
+
+us_watchdog_s *us_watchdog_init(void) {
+	us_watchdog_s *wd;
+	US_CALLOC(wd, 1);
+	for (uint stage = 0; stage < US_WATCHDOG_N_STAGES; ++stage) {
+		us_watchdog_stage_s *const st = &wd->stages[stage];
+		for (uint slot = 0; slot < US_WATCHDOG_MAX_SLOTS; ++slot) {
+			atomic_init(&st->busy_since[slot], 0);
+		}
+		st->timeout = 10;
+		atomic_init(&st->stalled, false);
+		atomic_init(&st->stalls, 0);
+		atomic_init(&st->stalled_for, 0);
+	}
+	atomic_init(&wd->restart_requested, false);
+	atomic_init(&wd->stale_total, 0);
+	atomic_init(&wd->stop, false);
+	return wd;
+}
+
+void us_watchdog_destroy(us_watchdog_s *wd) {
+	free(wd);
+}
+
+int us_watchdog_parse_timeouts(us_watchdog_s *wd, const char *str) {
+	// "N" for all stages or "stage=N,stage=N,..."
+	uint timeouts[US_WATCHDOG_N_STAGES];
+	for (uint stage = 0; stage < US_WATCHDOG_N_STAGES; ++stage) {
+		timeouts[stage] = wd->stages[stage].timeout;
+	}
+
+	char *const copy = us_strdup(str);
+	char *save = NULL;
+	for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+		char *value = strchr(item, '=');
+		int stage = -1;
+		if (value != NULL) {
+			*value = '\0';
+			++value;
+			for (uint index = 0; index < US_ARRAY_LEN(_STAGES); ++index) {
+				if (!strcasecmp(_STAGES[index], item)) {
+					stage = index;
+				}
+			}
+			if (stage < 0) {
+				goto error;
+			}
+		} else {
+			value = item;
+		}
+
+		errno = 0;
+		char *end = NULL;
+		const long timeout = strtol(value, &end, 10);
+		if (errno || *end != '\0' || end == value || timeout < 0 || timeout > 3600) {
+			goto error;
+		}
+		for (uint index = 0; index < US_WATCHDOG_N_STAGES; ++index) {
+			if (stage < 0 || (uint)stage == index) {
+				timeouts[index] = timeout;
+			}
+		}
+	}
+
+	for (uint stage = 0; stage < US_WATCHDOG_N_STAGES; ++stage) {
+		wd->stages[stage].timeout = timeouts[stage];
+	}
+	free(copy);
+	return 0;
+
+error:
+	free(copy);
+	return -1;
+}
+
+const char *us_watchdog_stage_to_string(us_watchdog_stage_e stage) {
+	return _STAGES[stage];
+}
+
+void us_watchdog_loop(us_watchdog_s *wd) {
+	ldf sd_interval = 0;
+#	ifdef WITH_SYSTEMD
+	u64 sd_usec = 0;
+	if (sd_watchdog_enabled(0, &sd_usec) > 0 && sd_usec > 0) {
+		sd_interval = (ldf)sd_usec / 1000000 / 2;
+		_LOG_INFO("Using systemd watchdog with interval=%.3Lf", sd_interval);
+	}
+	ldf sd_next_ts = 0;
+#	endif
+
+	u64 prev_ms = us_get_now_monotonic_u64() / 1000;
+	while (!atomic_load(&wd->stop)) {
+		const u64 now_ms = us_get_now_monotonic_u64() / 1000;
+
+		u64 stalled_for = 0;
+		for (uint stage = 0; stage < US_WATCHDOG_N_STAGES; ++stage) {
+			stalled_for = US_MAX(stalled_for, _watchdog_check_stage(wd, stage, now_ms));
+		}
+		if (stalled_for > 0) {
+			atomic_fetch_add(&wd->stale_total, now_ms - prev_ms);
+		}
+		prev_ms = now_ms;
+
+#		ifdef WITH_SYSTEMD
+		// Пока какая-то стадия зависла, systemd не получит пинг и перезапустит сервис,
+		// если перезапуск сессии не помог (поток застрял в ioctl и не может завершиться).
+		if (sd_interval > 0 && stalled_for == 0 && us_get_now_monotonic() >= sd_next_ts) {
+			sd_notify(0, "WATCHDOG=1");
+			sd_next_ts = us_get_now_monotonic() + sd_interval;
+		}
+#		endif
+
+		usleep((sd_interval > 0 ? US_MIN(sd_interval / 2, 0.25) : 0.25) * 1000000);
+	}
+}
+
+void us_watchdog_loop_break(us_watchdog_s *wd) {
+	atomic_store(&wd->stop, true);
+}
+
+void us_watchdog_reset_session(us_watchdog_s *wd) {
+	// Everything except HTTP is restarted with the capture session
+	for (uint stage = 0; stage < US_WATCHDOG_N_STAGES; ++stage) {
+		if (stage != US_WATCHDOG_HTTP) {
+			for (uint slot = 0; slot < US_WATCHDOG_MAX_SLOTS; ++slot) {
+				atomic_store(&wd->stages[stage].busy_since[slot], 0);
+			}
+		}
+	}
+	atomic_store(&wd->restart_requested, false);
+}
+
+bool us_watchdog_take_restart(us_watchdog_s *wd) {
+	return atomic_exchange(&wd->restart_requested, false);
+}
+
+bool us_watchdog_is_stalled(us_watchdog_s *wd, us_watchdog_stage_e stage) {
+	return atomic_load(&wd->stages[stage].stalled);
+}
+
+static u64 _watchdog_check_stage(us_watchdog_s *wd, us_watchdog_stage_e stage, u64 now_ms) {
+	us_watchdog_stage_s *const st = &wd->stages[stage];
+	if (st->timeout == 0) {
+		return 0;
+	}
+
+	u64 busy_for = 0;
+	uint slot_found = 0;
+	for (uint slot = 0; slot < US_WATCHDOG_MAX_SLOTS; ++slot) {
+		const u64 since = atomic_load(&st->busy_since[slot]);
+		if (since > 0 && now_ms > since && now_ms - since > busy_for) {
+			busy_for = now_ms - since;
+			slot_found = slot;
+		}
+	}
+
+	const bool stalled = (busy_for > (u64)st->timeout * 1000);
+	const bool was_stalled = atomic_load(&st->stalled);
+	atomic_store(&st->stalled_for, (stalled ? busy_for : 0));
+	atomic_store(&st->stalled, stalled);
+
+	if (stalled && !was_stalled) {
+		atomic_fetch_add(&st->stalls, 1);
+		_LOG_ERROR("Stage %s is stalled: slot=%u, busy_for=%.3Lf, timeout=%u",
+			_STAGES[stage], slot_found, (ldf)busy_for / 1000, st->timeout);
+		if (wd->restart && stage != US_WATCHDOG_HTTP) {
+			_LOG_ERROR("Requesting the capture session restart ...");
+			atomic_store(&wd->restart_requested, true);
+		}
+	} else if (!stalled && was_stalled) {
+		_LOG_INFO("Stage %s is alive again", _STAGES[stage]);
+	}
+	return (stalled ? busy_for : 0);
+}
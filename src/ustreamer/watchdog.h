@@ -0,0 +1,89 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2024  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include "../libs/types.h"
+#include "../libs/tools.h"
+
+
+#define US_WATCHDOG_MAX_SLOTS	32
+
+typedef enum {
+	US_WATCHDOG_CAPTURE = 0,
+	US_WATCHDOG_RELEASERS,
+	US_WATCHDOG_JPEG,
+	US_WATCHDOG_H264,
+	US_WATCHDOG_SINKS,
+	US_WATCHDOG_HTTP,
+	US_WATCHDOG_N_STAGES,
+} us_watchdog_stage_e;
+
+typedef struct {
+	// Монотонное время начала работы в миллисекундах для каждого слота (воркера,
+	// буфера и т.п.), 0 - слот простаивает. Писатели - потоки пайплайна, читатель - вотчдог.
+	atomic_ullong	busy_since[US_WATCHDOG_MAX_SLOTS];
+
+	uint			timeout; // Seconds, 0 to disable the stage
+
+	// Only for the watchdog thread and the results
+	atomic_bool		stalled;
+	atomic_uint		stalls;
+	atomic_ullong	stalled_for; // Milliseconds
+} us_watchdog_stage_s;
+
+typedef struct {
+	us_watchdog_stage_s	stages[US_WATCHDOG_N_STAGES];
+
+	bool				restart;
+	atomic_bool			restart_requested;
+	atomic_ullong		stale_total; // Milliseconds with any stage stalled
+
+	atomic_bool			stop;
+} us_watchdog_s;
+
+
+us_watchdog_s *us_watchdog_init(void);
+void us_watchdog_destroy(us_watchdog_s *wd);
+
+int us_watchdog_parse_timeouts(us_watchdog_s *wd, const char *str);
+const char *us_watchdog_stage_to_string(us_watchdog_stage_e stage);
+
+void us_watchdog_loop(us_watchdog_s *wd);
+void us_watchdog_loop_break(us_watchdog_s *wd);
+
+void us_watchdog_reset_session(us_watchdog_s *wd);
+bool us_watchdog_take_restart(us_watchdog_s *wd);
+bool us_watchdog_is_stalled(us_watchdog_s *wd, us_watchdog_stage_e stage);
+
+
+static inline void us_watchdog_begin(us_watchdog_s *wd, us_watchdog_stage_e stage, uint slot) {
+	// Works also as a heartbeat for the stages which are always busy (HTTP)
+	atomic_store(&wd->stages[stage].busy_since[slot % US_WATCHDOG_MAX_SLOTS], us_get_now_monotonic_u64() / 1000);
+}
+
+static inline void us_watchdog_end(us_watchdog_s *wd, us_watchdog_stage_e stage, uint slot) {
+	atomic_store(&wd->stages[stage].busy_since[slot % US_WATCHDOG_MAX_SLOTS], 0);
+}